@@ -0,0 +1,168 @@
+/* Benchmark of the batch geometry kernels (util library), on every instruction set available.
+ *
+ * Each kernel runs single-threaded over the same random data with each instruction set, and the
+ * best of several runs is reported in millions of elements per second, along with the speedup
+ * over the scalar code.
+ *
+ * Usage:
+ *   bench_batch [--size N] [--quick]
+ *
+ * --size sets the number of points and triangles (default 10M). --quick does a tiny run, for
+ * smoke testing.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/batch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+using obvi::affine3f;
+using obvi::bboxf;
+using obvi::mat3f;
+using obvi::simd_isa;
+using obvi::vec3f;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    struct options {
+        size_t size    = 10000000;
+        int    repeats = 5;
+    };
+
+    bool parse_args(int argc, char *argv[], options& opts) {
+        for(int i=1; i<argc; ++i) {
+            if(std::strcmp(argv[i], "--quick") == 0) {
+                opts.size    = 10000;
+                opts.repeats = 1;
+            } else if(std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+                opts.size = std::strtoull(argv[++i], nullptr, 10);
+            } else {
+                return false;
+            }
+        }
+        return opts.size > 0;
+    }
+
+    // Best time of several runs, in seconds.
+    double best_time(int repeats, const std::function<void()>& func) {
+        double best = 0;
+        for(int r=0; r<repeats; ++r) {
+            clock_type::time_point start = clock_type::now();
+            func();
+            double sec = std::chrono::duration<double>(clock_type::now() - start).count();
+            best = (r == 0 || sec < best)? sec : best;
+        }
+        return best;
+    }
+
+    struct kernel_test {
+        const char           *name;
+        std::function<void()> run;
+        double                scalar_sec = 0;
+    };
+}
+
+
+int main(int argc, char *argv[]) {
+    options opts;
+    if(!parse_args(argc, argv, opts)) {
+        std::fprintf(stderr, "usage: %s [--size N] [--quick]\n", argv[0]);
+        return 2;
+    }
+    const size_t n = opts.size;
+
+    // Random points in [0,100)^3, and triangles made of nearby points (like a mesh that was run
+    // through optimize_vertex_fetch()).
+    std::mt19937                          gen(1);
+    std::uniform_real_distribution<float> coord(0.0f, 100.0f);
+    std::vector<float> x(n), y(n), z(n);
+    std::vector<vec3f> positions(n);
+    for(size_t i=0; i<n; ++i) {
+        x[i] = coord(gen);
+        y[i] = coord(gen);
+        z[i] = coord(gen);
+        positions[i] = vec3f(x[i], y[i], z[i]);
+    }
+    std::uniform_int_distribution<uint32_t> near(0, 63);
+    std::vector<uint32_t> indices(3 * n);
+    for(size_t i=0; i<indices.size(); ++i) {
+        indices[i] = uint32_t(std::min<size_t>(i / 3 + near(gen), n - 1));
+    }
+
+    std::vector<float>    out_x(n), out_y(n), out_z(n);
+    std::vector<bboxf>    boxes(n);
+    std::vector<uint32_t> codes30(n);
+    std::vector<uint64_t> codes63(n);
+    const affine3f tf(mat3f::zrot(0.5f) * mat3f::xrot(0.25f), vec3f(1.0f, 2.0f, 3.0f), 1.5f);
+    const vec3f    offset(0.0f, 0.0f, 0.0f);
+    const vec3f    scale30(10.23f, 10.23f, 10.23f);
+    const vec3f    scale63(20971.5f, 20971.5f, 20971.5f);
+
+    kernel_test tests[] = {
+        {"transform_points", [&] {
+            obvi::transform_points(tf, x.data(), y.data(), z.data(), n,
+                                   out_x.data(), out_y.data(), out_z.data());
+        }},
+        {"triangle_bounds", [&] {
+            obvi::triangle_bounds(positions.data(), indices.data(), n, boxes.data());
+        }},
+        {"morton_codes_30", [&] {
+            obvi::morton_codes_30(x.data(), y.data(), z.data(), n, offset, scale30, codes30.data());
+        }},
+        {"morton_codes_63", [&] {
+            obvi::morton_codes_63(x.data(), y.data(), z.data(), n, offset, scale63, codes63.data());
+        }},
+    };
+
+    const simd_isa default_isa = obvi::batch_isa();
+    std::printf("%zu elements, default instruction set: %s\n", n, obvi::to_string(default_isa));
+    std::printf("%-18s %-8s %12s %9s\n", "kernel", "isa", "M elem/s", "speedup");
+    for(simd_isa isa : {simd_isa::SCALAR, simd_isa::SSE2, simd_isa::NEON, simd_isa::AVX2}) {
+        if(!obvi::set_batch_isa(isa)) {
+            continue;
+        }
+        for(kernel_test& test : tests) {
+            test.run(); // warm up (page in the outputs)
+            const double sec = best_time(opts.repeats, test.run);
+            if(isa == simd_isa::SCALAR) {
+                test.scalar_sec = sec;
+            }
+            std::printf("%-18s %-8s %12.1f %8.2fx\n", test.name, obvi::to_string(isa),
+                        double(n) / sec * 1e-6, test.scalar_sec / sec);
+        }
+    }
+    obvi::set_batch_isa(default_isa);
+    return 0;
+}
@@ -0,0 +1,574 @@
+/* Benchmark of bvh build and query throughput (util library).
+ *
+ * For each set of boxes, a bvh is built with every build type at every thread count, and each
+ * phase of the build and each query functor is timed. The quality of each tree (SAH cost,
+ * depth) and the number of nodes an average query visits are reported too, since they show
+ * regressions in the builders without any timing noise.
+ *
+ * Usage:
+ *   bench_bvh [--sizes N,N,...] [--max-size N] [--threads N,N,...] [--queries N]
+ *             [--mesh file]... [--json out.json] [--quick]
+ *
+ * Synthetic sets are made at sizes 1K, 10K, 100K, ... up to --max-size (default 1M; 100M needs
+ * about 10 GB of memory), unless --sizes picks them. Each --mesh adds the triangle boxes of a
+ * mesh file. Threads default to 1, 2, 4, ... up to the number of processors. --quick does a tiny
+ * run, for smoke testing. Results are written as JSON to stdout (or the --json file), with a
+ * readable summary on stderr.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/compat_omp.hpp>
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/vec3.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::bvh_build_stats;
+using obvi::bvh_build_type;
+using obvi::bvh_builder;
+using obvi::vec3f;
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    double seconds_since(clock_type::time_point start) {
+        return std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+
+    struct options {
+        std::vector<size_t>      sizes;
+        size_t                   max_size    = 1000000;
+        std::vector<int>         threads;
+        size_t                   num_queries = 100000;
+        std::vector<std::string> meshes;
+        std::string              json_path;
+    };
+
+    struct dataset {
+        std::string        name;
+        std::vector<bboxf> boxes;
+    };
+
+    // Boxes up to one unit across, scattered in a cube at about one box per unit volume.
+    std::vector<bboxf> make_uniform(size_t count, unsigned seed) {
+        const float  side = std::cbrt(float(count));
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<float> pos(0.0f, side);
+        std::uniform_real_distribution<float> size(0.0f, 1.0f);
+
+        std::vector<bboxf> boxes(count);
+        for(bboxf& box : boxes) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            box = bboxf(pt);
+            box.expand(pt + vec3f(size(gen), size(gen), size(gen)));
+        }
+        return boxes;
+    }
+
+    // Long, thin rods along random axes (like the parts of a CAD assembly), at the same density.
+    std::vector<bboxf> make_thin(size_t count, unsigned seed) {
+        const float  side = std::cbrt(float(count));
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<float> pos(0.0f, side);
+        std::uniform_real_distribution<float> length(1.0f, 20.0f);
+        std::uniform_int_distribution<int>    axis(0, 2);
+
+        std::vector<bboxf> boxes(count);
+        for(bboxf& box : boxes) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            vec3f ext(0.05f, 0.05f, 0.05f);
+            ext[(size_t)axis(gen)] = length(gen);
+            box = bboxf(pt);
+            box.expand(pt + ext);
+        }
+        return boxes;
+    }
+
+    // Shape of a tree, independent of how fast it was built.
+    struct tree_quality {
+        size_t nodes          = 0;
+        size_t max_depth      = 0;
+        double avg_leaf_depth = 0;
+        double sah_cost       = 0; // with unit node and object costs, relative to the root's area
+    };
+
+    tree_quality measure_tree(const bvh& tree) {
+        tree_quality q;
+        const bvh::node_list nodes = tree.nodes();
+        q.nodes = nodes.size();
+        if(nodes.empty()) {
+            return q;
+        }
+
+        // Expected number of nodes and objects a random ray through the root would touch.
+        const double root_area  = std::max(double(nodes[0].box.surface_area()), 1e-30);
+        double       leaf_depth = 0;
+        std::vector<std::pair<size_t, size_t>> stack = {{0, 0}}; // (node index, depth)
+        while(!stack.empty()) {
+            size_t idx   = stack.back().first;
+            size_t depth = stack.back().second;
+            stack.pop_back();
+
+            const bvh::node& nd = nodes[idx];
+            q.sah_cost += double(nd.box.surface_area()) / root_area;
+            if(nd.is_leaf()) {
+                q.max_depth  = std::max(q.max_depth, depth);
+                leaf_depth  += double(depth);
+                continue;
+            }
+            size_t left = idx + 1;
+            stack.push_back({left, depth + 1});
+            stack.push_back({left + nodes[left].subtree_size(), depth + 1});
+        }
+        q.avg_leaf_depth = leaf_depth / double(tree.size());
+        return q;
+    }
+
+    // Wraps a bvh intersection functor, and counts how many boxes (== nodes) it's asked about.
+    template<typename intersect_func>
+    struct counting_func {
+        intersect_func func;
+        size_t        *count;
+        bool operator()(const bboxf& box) {
+            ++*count;
+            return func(box);
+        }
+    };
+
+    // Random queries of every type, inside (or around) the given bounds.
+    struct query_set {
+        std::vector<bvh::intersect_point>   points;
+        std::vector<bvh::intersect_box>     boxes;
+        std::vector<bvh::intersect_segment> segments;
+        std::vector<bvh::intersect_ray>     rays;
+        std::vector<bvh::intersect_sphere>  spheres;
+        std::vector<vec3f>                  ray_origins; // same rays, for bvh::ray_query
+        std::vector<vec3f>                  ray_dirs;
+    };
+
+    query_set make_queries(const bboxf& bounds, size_t count, unsigned seed) {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+        const vec3f ext = bounds.max_pt - bounds.min_pt;
+        auto rand_pt = [&]() {
+            return bounds.min_pt + vec3f(unit(gen) * ext[0], unit(gen) * ext[1], unit(gen) * ext[2]);
+        };
+        auto rand_dir = [&]() {
+            vec3f d;
+            do {
+                d = vec3f(dir(gen), dir(gen), dir(gen));
+            } while(d.normsqd() < 1e-4f);
+            return d.normalized();
+        };
+
+        query_set qs;
+        for(size_t i=0; i<count; ++i) {
+            qs.points.emplace_back(rand_pt());
+
+            vec3f pt = rand_pt();
+            bboxf box(pt);
+            box.expand(pt + vec3f(2,2,2));
+            qs.boxes.emplace_back(box);
+
+            pt = rand_pt();
+            qs.segments.emplace_back(pt, pt + rand_dir() * 5.0f);
+            qs.ray_origins.push_back(rand_pt());
+            qs.ray_dirs.push_back(rand_dir());
+            qs.rays.emplace_back(qs.ray_origins.back(), qs.ray_dirs.back());
+            qs.spheres.emplace_back(rand_pt(), 1.0f);
+        }
+        return qs;
+    }
+
+    // Cost of one kind of query on a tree, measured on one thread.
+    struct query_cost {
+        double nodes   = 0; // nodes visited per query
+        double matches = 0; // objects returned per query
+    };
+
+    template<typename intersect_func>
+    query_cost measure_query(const bvh& tree, const std::vector<intersect_func>& queries) {
+        static constexpr size_t max_sample = 2000;
+        const size_t sample = std::min(queries.size(), max_sample);
+        size_t visits  = 0;
+        size_t matches = 0;
+        for(size_t i=0; i<sample; ++i) {
+            auto query = tree.make_query(counting_func<intersect_func>{queries[i], &visits});
+            while(query.next(nullptr)) {
+                matches++;
+            }
+        }
+        query_cost cost;
+        if(sample > 0) {
+            cost.nodes   = double(visits) / double(sample);
+            cost.matches = double(matches) / double(sample);
+        }
+        return cost;
+    }
+
+    // Queries per second, running all of them with bvh::query_batch().
+    template<typename intersect_func>
+    double batch_rate(const bvh& tree, const std::vector<intersect_func>& queries) {
+        bvh::batch_result res;
+        clock_type::time_point start = clock_type::now();
+        tree.query_batch(queries, res);
+        return double(queries.size()) / std::max(seconds_since(start), 1e-9);
+    }
+
+    // Rays per second, finding only the closest box along each ray (with bvh::ray_query).
+    double closest_rate(const bvh& tree, const query_set& qs) {
+        const size_t       count = qs.ray_origins.size();
+        std::vector<float> hits(count); // stored, so the work can't be optimized away
+        clock_type::time_point start = clock_type::now();
+#       pragma omp parallel for schedule(dynamic, 256) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)count; ++i) {
+            auto   query = tree.make_ray_query(qs.ray_origins[(size_t)i], qs.ray_dirs[(size_t)i]);
+            size_t obj_idx;
+            float  entry_t;
+            while(query.next(&obj_idx, &entry_t)) {
+                query.shrink(entry_t); // boxes are the objects' exact shapes here
+            }
+            hits[(size_t)i] = query.max_t();
+        }
+        return double(count) / std::max(seconds_since(start), 1e-9);
+    }
+
+    // Results of one build and its queries, at one thread count.
+    struct timing {
+        int             threads = 1;
+        double          build_sec = 0;
+        double          rebuild_sec = 0; // with scratch memory kept from the last build
+        bvh_build_stats phases;
+        double          point_rate = 0, box_rate = 0, segment_rate = 0, ray_rate = 0;
+        double          ray_first_rate = 0, ray_closest_rate = 0, sphere_rate = 0;
+    };
+
+    struct run {
+        std::string               dataset;
+        size_t                    size = 0;
+        std::string               build;
+        tree_quality              quality;
+        query_cost                point, box, segment, ray, sphere;
+        std::vector<timing>       timings;
+    };
+
+    // Build several times (up to about a second in total) and keep the fastest. If builder isn't
+    // null, it's used for every build (warmed up first), otherwise each build starts from scratch.
+    double time_build(bvh& tree, const std::vector<bboxf>& boxes, bvh_build_type type,
+                      bvh_builder *builder, bvh_build_stats& out_phases) {
+        if(builder) {
+            tree.generate(boxes, *builder, type);
+        }
+        double best  = std::numeric_limits<double>::infinity();
+        double total = 0;
+        for(int rep=0; rep<5 && (rep == 0 || total < 1.0); ++rep) {
+            bvh_build_stats phases;
+            clock_type::time_point start = clock_type::now();
+            if(builder) {
+                tree.generate(boxes, *builder, type, &phases);
+            } else {
+                bvh fresh;
+                fresh.generate(boxes, type, &phases);
+                if(rep == 0) {
+                    tree = fresh;
+                }
+            }
+            double sec = seconds_since(start);
+            total += sec;
+            if(sec < best) {
+                best       = sec;
+                out_phases = phases;
+            }
+        }
+        return best;
+    }
+
+    run benchmark(const dataset& data, bvh_build_type type, const options& opts) {
+        run r;
+        r.dataset = data.name;
+        r.size    = data.boxes.size();
+        r.build   = (type == bvh_build_type::SAH)? "sah" : "morton";
+
+        bvh tree;
+        for(int threads : opts.threads) {
+            omp_set_num_threads(threads);
+
+            timing t;
+            t.threads   = threads;
+            bvh_build_stats   rebuild_phases;
+            bvh_builder       builder;
+            t.build_sec   = time_build(tree, data.boxes, type, nullptr, t.phases);
+            t.rebuild_sec = time_build(tree, data.boxes, type, &builder, rebuild_phases);
+
+            query_set qs = make_queries(tree.bounds(), opts.num_queries, 17);
+            t.point_rate   = batch_rate(tree, qs.points);
+            t.box_rate     = batch_rate(tree, qs.boxes);
+            t.segment_rate = batch_rate(tree, qs.segments);
+            t.ray_rate     = batch_rate(tree, qs.rays);
+            t.sphere_rate  = batch_rate(tree, qs.spheres);
+            {
+                std::vector<uint32_t>  first;
+                clock_type::time_point start = clock_type::now();
+                tree.query_batch_first(qs.rays, first);
+                t.ray_first_rate = double(qs.rays.size()) / std::max(seconds_since(start), 1e-9);
+            }
+            t.ray_closest_rate = closest_rate(tree, qs);
+            r.timings.push_back(t);
+
+            // Tree shape and query costs don't depend on the thread count, only measure once.
+            if(r.timings.size() == 1) {
+                r.quality = measure_tree(tree);
+                r.point   = measure_query(tree, qs.points);
+                r.box     = measure_query(tree, qs.boxes);
+                r.segment = measure_query(tree, qs.segments);
+                r.ray     = measure_query(tree, qs.rays);
+                r.sphere  = measure_query(tree, qs.spheres);
+            }
+        }
+        return r;
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Output.
+    std::string json_string(const std::string& str) {
+        std::string out = "\"";
+        for(char c : str) {
+            if(c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    std::string json_number(double val) {
+        if(!std::isfinite(val)) {
+            return "null";
+        }
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.6g", val);
+        return buf;
+    }
+
+    void write_cost(std::ostream& out, const char *name, const query_cost& cost, bool last) {
+        out << "        " << json_string(name) << ": {\"nodes\": " << json_number(cost.nodes)
+            << ", \"matches\": " << json_number(cost.matches) << "}" << (last ? "\n" : ",\n");
+    }
+
+    void write_json(std::ostream& out, const std::vector<run>& runs, const options& opts) {
+        out << "{\n";
+        out << "  \"benchmark\": \"bvh\",\n";
+        out << "  \"version\": 1,\n";
+        out << "  \"num_procs\": " << omp_get_num_procs() << ",\n";
+        out << "  \"queries\": " << opts.num_queries << ",\n";
+        out << "  \"runs\": [\n";
+        for(size_t i=0; i<runs.size(); ++i) {
+            const run& r = runs[i];
+            out << "    {\n";
+            out << "      \"dataset\": " << json_string(r.dataset) << ",\n";
+            out << "      \"size\": " << r.size << ",\n";
+            out << "      \"build\": " << json_string(r.build) << ",\n";
+            out << "      \"tree\": {\"nodes\": " << r.quality.nodes
+                << ", \"max_depth\": " << r.quality.max_depth
+                << ", \"avg_leaf_depth\": " << json_number(r.quality.avg_leaf_depth)
+                << ", \"sah_cost\": " << json_number(r.quality.sah_cost) << "},\n";
+            out << "      \"per_query\": {\n";
+            write_cost(out, "point", r.point, false);
+            write_cost(out, "box", r.box, false);
+            write_cost(out, "segment", r.segment, false);
+            write_cost(out, "ray", r.ray, false);
+            write_cost(out, "sphere", r.sphere, true);
+            out << "      },\n";
+            out << "      \"timings\": [\n";
+            for(size_t j=0; j<r.timings.size(); ++j) {
+                const timing& t = r.timings[j];
+                out << "        {\"threads\": " << t.threads
+                    << ", \"build_sec\": " << json_number(t.build_sec)
+                    << ", \"rebuild_sec\": " << json_number(t.rebuild_sec)
+                    << ", \"bounds_sec\": " << json_number(t.phases.bounds_sec)
+                    << ", \"morton_sec\": " << json_number(t.phases.morton_sec)
+                    << ", \"sort_sec\": " << json_number(t.phases.sort_sec)
+                    << ", \"tree_sec\": " << json_number(t.phases.tree_sec)
+                    << ",\n         \"queries_per_sec\": {"
+                    << "\"point\": " << json_number(t.point_rate)
+                    << ", \"box\": " << json_number(t.box_rate)
+                    << ", \"segment\": " << json_number(t.segment_rate)
+                    << ", \"ray\": " << json_number(t.ray_rate)
+                    << ", \"ray_first\": " << json_number(t.ray_first_rate)
+                    << ", \"ray_closest\": " << json_number(t.ray_closest_rate)
+                    << ", \"sphere\": " << json_number(t.sphere_rate) << "}}"
+                    << (j + 1 < r.timings.size() ? ",\n" : "\n");
+            }
+            out << "      ]\n";
+            out << "    }" << (i + 1 < runs.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n";
+        out << "}\n";
+    }
+
+    void print_summary(const run& r) {
+        std::fprintf(stderr, "%-12s %10zu %-6s  depth %3zu  sah %8.1f  ray visits %8.1f\n",
+                     r.dataset.c_str(), r.size, r.build.c_str(), r.quality.max_depth,
+                     r.quality.sah_cost, r.ray.nodes);
+        for(const timing& t : r.timings) {
+            std::fprintf(stderr, "    %3d threads: build %9.4f s (sort %8.4f, tree %8.4f)"
+                         "  rebuild %9.4f s  %10.3g rays/s  %10.3g boxes/s\n", t.threads,
+                         t.build_sec, t.phases.sort_sec, t.phases.tree_sec, t.rebuild_sec,
+                         t.ray_rate, t.box_rate);
+        }
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Command line.
+    template<typename T>
+    bool parse_list(const char *str, std::vector<T>& out) {
+        out.clear();
+        char *end = nullptr;
+        for(;;) {
+            unsigned long long val = std::strtoull(str, &end, 10);
+            if(end == str || val == 0) {
+                return false;
+            }
+            out.push_back(T(val));
+            if(*end == '\0') {
+                return true;
+            }
+            if(*end != ',') {
+                return false;
+            }
+            str = end + 1;
+        }
+    }
+
+    bool parse_args(int argc, char *argv[], options& opts) {
+        bool quick = false;
+        for(int i=1; i<argc; ++i) {
+            std::string arg  = argv[i];
+            const char *next = (i + 1 < argc)? argv[i + 1] : nullptr;
+            if(arg == "--quick") {
+                quick = true;
+            } else if(next && arg == "--sizes") {
+                if(!parse_list(argv[++i], opts.sizes)) {
+                    return false;
+                }
+            } else if(next && arg == "--max-size") {
+                opts.max_size = std::strtoull(argv[++i], nullptr, 10);
+            } else if(next && arg == "--threads") {
+                if(!parse_list(argv[++i], opts.threads)) {
+                    return false;
+                }
+            } else if(next && arg == "--queries") {
+                opts.num_queries = std::strtoull(argv[++i], nullptr, 10);
+            } else if(next && arg == "--mesh") {
+                opts.meshes.push_back(argv[++i]);
+            } else if(next && arg == "--json") {
+                opts.json_path = argv[++i];
+            } else {
+                return false;
+            }
+        }
+
+        if(quick) {
+            opts.max_size    = 10000;
+            opts.num_queries = 1000;
+        }
+        if(opts.sizes.empty()) {
+            for(size_t size = 1000; size <= std::min(opts.max_size, bvh::max_size); size *= 10) {
+                opts.sizes.push_back(size);
+            }
+        }
+        if(opts.threads.empty()) {
+            const int max_threads = std::max(omp_get_num_procs(), 1);
+            for(int t = 1; t < max_threads && !quick; t *= 2) {
+                opts.threads.push_back(t);
+            }
+            opts.threads.push_back(max_threads);
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    options opts;
+    if(!parse_args(argc, argv, opts)) {
+        std::fprintf(stderr, "usage: %s [--sizes N,N,...] [--max-size N] [--threads N,N,...]"
+                     " [--queries N] [--mesh file]... [--json out.json] [--quick]\n", argv[0]);
+        return 2;
+    }
+
+    // Synthetic sets one at a time (so only one is in memory), then the meshes.
+    std::vector<run> runs;
+    auto bench_all_types = [&](const dataset& data) {
+        for(bvh_build_type type : {bvh_build_type::MORTON, bvh_build_type::SAH}) {
+            runs.push_back(benchmark(data, type, opts));
+            print_summary(runs.back());
+        }
+    };
+    for(size_t size : opts.sizes) {
+        bench_all_types({"uniform", make_uniform(size, 1)});
+        bench_all_types({"thin", make_thin(size, 2)});
+    }
+    for(const std::string& path : opts.meshes) {
+        obvi::mesh  m;
+        std::string err;
+        if(!obvi::load_mesh(path, m, &err)) {
+            std::fprintf(stderr, "failed to load %s: %s\n", path.c_str(), err.c_str());
+            return 1;
+        }
+        dataset data;
+        data.name = "mesh:" + path;
+        m.triangle_boxes(data.boxes);
+        bench_all_types(data);
+    }
+
+    if(opts.json_path.empty()) {
+        write_json(std::cout, runs, opts);
+    } else {
+        std::ofstream out(opts.json_path);
+        write_json(out, runs, opts);
+        if(!out) {
+            std::fprintf(stderr, "failed to write %s\n", opts.json_path.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+/* Implementation of CPU and GPU frame time measurement.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include "frame_profiler.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+    constexpr double smoothing  = 0.1;     // weight of the newest frame in the averages
+    constexpr size_t max_events = 4000000; // stop recording a trace past this (~100 MB of JSON)
+
+    // Exponential moving average (starts at the first value).
+    void smooth_value(double& avg, double val, bool first) {
+        avg = first ? val : avg + smoothing * (val - avg);
+    }
+
+    double ms_between(std::chrono::steady_clock::time_point begin,
+                      std::chrono::steady_clock::time_point end) {
+        return std::chrono::duration<double, std::milli>(end - begin).count();
+    }
+}
+
+constexpr size_t obvi::frame_profiler::max_gpu_sections;
+constexpr size_t obvi::frame_profiler::num_query_sets;
+
+bool obvi::frame_profiler::init() {
+    if(!initializeOpenGLFunctions()) {
+        return false;
+    }
+    for(query_set& qs : sets) {
+        glGenQueries(GLsizei(max_gpu_sections), qs.time_queries);
+        glGenQueries(1, &qs.prim_query);
+    }
+    initialized = true;
+    return true;
+}
+
+void obvi::frame_profiler::destroy() {
+    if(!initialized) {
+        return;
+    }
+    for(query_set& qs : sets) {
+        glDeleteQueries(GLsizei(max_gpu_sections), qs.time_queries);
+        glDeleteQueries(1, &qs.prim_query);
+        qs = query_set();
+    }
+    initialized = false;
+    gpu_active  = false;
+}
+
+void obvi::frame_profiler::begin_frame() {
+    const clock_type::time_point now = clock_type::now();
+    if(have_frame) {
+        smooth_value(stats.interval_ms, ms_between(frame_start, now), stats.interval_ms == 0);
+    }
+    frame_start = now;
+    have_frame  = true;
+    frame_cpu.clear();
+    stats.draw_calls    = 0;
+    stats.draw_commands = 0;
+
+    if(!initialized) {
+        return;
+    }
+    // Read back the last frame that used this set of queries, if the GPU is done with it.
+    query_set& qs = sets[cur_set];
+    if(qs.pending) {
+        read_results(qs);
+    }
+    qs.num_sections   = 0;
+    qs.frame_start_us = to_us(now);
+    glBeginQuery(GL_PRIMITIVES_GENERATED, qs.prim_query);
+}
+
+void obvi::frame_profiler::end_frame() {
+    const clock_type::time_point now = clock_type::now();
+    if(initialized) {
+        if(gpu_active) {
+            end_gpu();
+        }
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        sets[cur_set].pending = true;
+        cur_set = (cur_set + 1) % num_query_sets;
+    }
+
+    const bool first = stats.frame_ms == 0;
+    smooth_value(stats.frame_ms, ms_between(frame_start, now), first);
+    for(const section_time& sec : frame_cpu) {
+        smooth(stats.cpu, sec.name, sec.ms);
+    }
+    if(trace_on) {
+        trace("frame", 1, to_us(frame_start), to_us(now) - to_us(frame_start));
+        trace("draw_commands", 0, to_us(now), double(stats.draw_commands));
+    }
+}
+
+void obvi::frame_profiler::begin_gpu(const char *name) {
+    query_set& qs = sets[cur_set];
+    if(!initialized || gpu_active || qs.num_sections >= max_gpu_sections) {
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, qs.time_queries[qs.num_sections]);
+    qs.names[qs.num_sections] = name;
+    gpu_active = true;
+}
+
+void obvi::frame_profiler::end_gpu() {
+    if(!gpu_active) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    sets[cur_set].num_sections++;
+    gpu_active = false;
+}
+
+void obvi::frame_profiler::add_draws(size_t calls, size_t commands) {
+    stats.draw_calls    += calls;
+    stats.draw_commands += commands;
+}
+
+void obvi::frame_profiler::start_trace() {
+    events.clear();
+    trace_on = true;
+}
+
+bool obvi::frame_profiler::stop_trace(const std::string& path) {
+    trace_on = false;
+
+    // Chrome's trace event format: "X" events have a start and duration, "C" events are counters,
+    // and "M" events name the tracks. Times are in microseconds.
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+           "\"args\": {\"name\": \"CPU\"}},\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, "
+           "\"args\": {\"name\": \"GPU\"}}";
+    char buf[256];
+    for(const trace_event& ev : events) {
+        if(ev.track == 0) {
+            std::snprintf(buf, sizeof(buf), ",\n{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, "
+                          "\"ts\": %.3f, \"args\": {\"%s\": %.0f}}",
+                          ev.name, ev.ts_us, ev.name, ev.dur_us);
+        } else {
+            std::snprintf(buf, sizeof(buf), ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                          "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                          ev.name, ev.track, ev.ts_us, ev.dur_us);
+        }
+        out << buf;
+    }
+    out << "\n]}\n";
+    events.clear();
+    events.shrink_to_fit();
+    return bool(out);
+}
+
+void obvi::frame_profiler::add_cpu(const char *name, clock_type::time_point begin,
+                                   clock_type::time_point end) {
+    const double ms = ms_between(begin, end);
+    bool found = false;
+    for(section_time& sec : frame_cpu) {
+        if(std::strcmp(sec.name, name) == 0) {
+            sec.ms += ms; // same section more than once in a frame: add them up
+            found   = true;
+            break;
+        }
+    }
+    if(!found) {
+        frame_cpu.push_back({name, ms});
+    }
+    if(trace_on) {
+        trace(name, 1, to_us(begin), to_us(end) - to_us(begin));
+    }
+}
+
+void obvi::frame_profiler::read_results(query_set& qs) {
+    qs.pending = false;
+
+    // Queries finish in order, so if the last one (ended in end_frame()) is done, they all are.
+    // If not, drop this frame's results instead of waiting.
+    GLint available = 0;
+    glGetQueryObjectiv(qs.prim_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available) {
+        return;
+    }
+
+    GLuint64 prims = 0;
+    glGetQueryObjectui64v(qs.prim_query, GL_QUERY_RESULT, &prims);
+    stats.triangles = uint64_t(prims);
+
+    double total_ms = 0;
+    double ts_us    = qs.frame_start_us;
+    for(size_t i = 0; i < qs.num_sections; ++i) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(qs.time_queries[i], GL_QUERY_RESULT, &ns);
+        const double ms = double(ns) * 1e-6;
+        smooth(stats.gpu, qs.names[i], ms);
+        total_ms += ms;
+        if(trace_on) {
+            trace(qs.names[i], 2, ts_us, ms * 1e3);
+            ts_us += ms * 1e3;
+        }
+    }
+    smooth_value(stats.gpu_ms, total_ms, stats.gpu_ms == 0);
+    if(trace_on) {
+        trace("triangles", 0, qs.frame_start_us, double(prims));
+    }
+}
+
+double obvi::frame_profiler::to_us(clock_type::time_point t) const {
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+}
+
+void obvi::frame_profiler::trace(const char *name, int track, double ts_us, double dur_us) {
+    if(events.size() < max_events) {
+        events.push_back({name, track, ts_us, dur_us});
+    }
+}
+
+void obvi::frame_profiler::smooth(std::vector<section_time>& list, const char *name, double ms) {
+    for(section_time& sec : list) {
+        if(std::strcmp(sec.name, name) == 0) {
+            smooth_value(sec.ms, ms, false);
+            return;
+        }
+    }
+    list.push_back({name, ms});
+}
@@ -0,0 +1,162 @@
+/* Header for measuring where frame time goes, on the CPU and on the GPU.
+ *
+ * CPU sections are timed with cpu_scope (RAII). GPU sections are timed with GL_TIME_ELAPSED
+ * queries, and every frame counts the primitives the GPU drew with a GL_PRIMITIVES_GENERATED
+ * query. Queries are kept in two sets that alternate between frames, and a set is only read back
+ * when it comes around again, if the GPU has finished with it, so reading results never stalls.
+ * GPU numbers are therefore one frame behind the CPU numbers.
+ *
+ * Results are smoothed over recent frames for display (see get_summary()). Everything can also
+ * be recorded to a Chrome trace file (open in chrome://tracing or https://ui.perfetto.dev).
+ *
+ * Usage, every frame:
+ *   begin_frame();
+ *   { frame_profiler::cpu_scope scope(prof, "cull"); begin_gpu("cull"); ...; end_gpu(); }
+ *   add_draws(...);
+ *   end_frame();
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_FRAME_PROFILER_HPP
+#define OBVI_FRAME_PROFILER_HPP
+
+#include <QOpenGLFunctions_4_3_Core>
+
+#include <array>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace obvi {
+
+struct frame_profiler : protected QOpenGLFunctions_4_3_Core {
+    static constexpr size_t max_gpu_sections = 8; // per frame, more are ignored
+    static constexpr size_t num_query_sets   = 2; // frames of GPU queries in flight
+
+    // Time spent in one named section (milliseconds, smoothed over recent frames).
+    struct section_time {
+        const char *name;
+        double      ms;
+    };
+
+    struct summary {
+        double                    frame_ms      = 0; // CPU time, begin_frame() to end_frame()
+        double                    interval_ms   = 0; // from one begin_frame() to the next
+        std::vector<section_time> cpu;
+        std::vector<section_time> gpu;
+        double                    gpu_ms        = 0; // sum of GPU sections
+        uint64_t                  triangles     = 0; // drawn by the GPU, last measured frame
+        size_t                    draw_calls    = 0; // this frame's counts from add_draws()
+        size_t                    draw_commands = 0;
+    };
+
+    // Time the enclosing block of CPU code. Names must be string literals (they're kept).
+    struct cpu_scope {
+        cpu_scope(frame_profiler& prof, const char *name)
+            : owner(prof), section(name), start(clock_type::now()) {}
+        ~cpu_scope() { owner.add_cpu(section, start, clock_type::now()); }
+
+        cpu_scope(const cpu_scope&) = delete;
+        cpu_scope& operator=(const cpu_scope&) = delete;
+
+    private:
+        frame_profiler&                       owner;
+        const char                           *section;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Create query objects. OpenGL context must be current.
+    bool init();
+
+    // Free query objects. OpenGL context must be current.
+    void destroy();
+
+    void begin_frame();
+    void end_frame();
+
+    /* Time the GPU commands issued between these calls. GPU sections can't nest or overlap, and
+     * there can be at most max_gpu_sections of them per frame. Names must be string literals.
+     */
+    void begin_gpu(const char *name);
+    void end_gpu();
+
+    // Count draw calls, and the draws made by indirect commands, for this frame.
+    void add_draws(size_t calls, size_t commands);
+
+    const summary& get_summary() const { return stats; }
+
+    /* Record every frame from now on, until stop_trace() writes the recording to a Chrome trace
+     * (JSON) file. GPU sections are placed end-to-end from the start of their frame, since only
+     * their durations are measured. Returns false if the file couldn't be written.
+     */
+    void start_trace();
+    bool stop_trace(const std::string& path);
+    bool tracing() const { return trace_on; }
+
+private:
+    using clock_type = std::chrono::steady_clock;
+
+    struct query_set {
+        GLuint      time_queries[max_gpu_sections] = {};
+        const char *names[max_gpu_sections]        = {};
+        size_t      num_sections   = 0;
+        GLuint      prim_query     = 0;
+        bool        pending        = false; // queries were issued, results not read yet
+        double      frame_start_us = 0;     // for placing GPU sections in the trace
+    };
+
+    struct trace_event {
+        const char *name;
+        int         track;  // 1: CPU, 2: GPU, 0: counter
+        double      ts_us;
+        double      dur_us; // counter value, for counters
+    };
+
+    void   add_cpu(const char *name, clock_type::time_point begin, clock_type::time_point end);
+    void   read_results(query_set& qs);
+    double to_us(clock_type::time_point t) const;
+    void   trace(const char *name, int track, double ts_us, double dur_us);
+
+    static void smooth(std::vector<section_time>& list, const char *name, double ms);
+
+    std::array<query_set, num_query_sets> sets;
+    size_t                    cur_set     = 0;
+    bool                      gpu_active  = false;
+    bool                      initialized = false;
+
+    clock_type::time_point    epoch       = clock_type::now();
+    clock_type::time_point    frame_start;
+    bool                      have_frame  = false;
+    std::vector<section_time> frame_cpu; // this frame's CPU sections (not smoothed)
+    summary                   stats;
+
+    bool                      trace_on = false;
+    std::vector<trace_event>  events;
+};
+
+} // END namespace obvi
+
+#endif // OBVI_FRAME_PROFILER_HPP
@@ -0,0 +1,270 @@
+/* Implementation of hierarchical-Z occlusion culling of mesh chunks on the GPU.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include "hiz_culler.hpp"
+
+#include <QDebug>
+
+#include <algorithm>
+
+#include <obvi/util/depth_pyramid.hpp>
+
+namespace {
+    // Must match chunk_info in shaders/hiz_cull.comp (std430 layout).
+    struct gpu_chunk {
+        float    box_min[4];
+        float    box_max[4];
+        uint32_t first_index;
+        uint32_t num_indices;
+        int32_t  base_vertex;
+        uint32_t object;
+        uint32_t lods[obvi::mesh_chunk::max_lods][2]; // first_index, num_indices
+    };
+    static_assert(sizeof(gpu_chunk) == 80, "gpu_chunk must match std430 layout of chunk_info");
+
+    // Must match DrawElementsIndirectCommand (and draw_command in shaders/hiz_cull.comp).
+    constexpr size_t draw_command_size = 5 * sizeof(uint32_t);
+
+    constexpr GLuint cull_group_size  = 64; // local_size_x in hiz_cull.comp
+    constexpr GLuint build_group_size = 8;  // local_size_x,y in hiz_build.comp
+
+    GLuint num_groups(GLuint count, GLuint group_size) {
+        return (count + group_size - 1) / group_size;
+    }
+}
+
+bool obvi::hiz_culler::init() {
+    if(!initializeOpenGLFunctions()) {
+        qWarning() << "hiz_culler: OpenGL 4.3 core functions not available";
+        return false;
+    }
+
+    bool ok = build_prog.addCacheableShaderFromSourceFile(QOpenGLShader::Compute, ":/hiz_build.comp")
+           && build_prog.link()
+           && cull_prog.addCacheableShaderFromSourceFile(QOpenGLShader::Compute, ":/hiz_cull.comp")
+           && cull_prog.link();
+    if(!ok) {
+        qWarning() << "hiz_culler: failed to build compute shaders";
+        return false;
+    }
+
+    GLuint bufs[4];
+    glGenBuffers(4, bufs);
+    chunk_buf     = bufs[0];
+    candidate_buf = bufs[1];
+    cmd_buf       = bufs[2];
+    counter_buf   = bufs[3];
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glGenFramebuffers(1, &depth_fbo);
+    return true;
+}
+
+void obvi::hiz_culler::destroy() {
+    if(chunk_buf) {
+        GLuint bufs[4] = {chunk_buf, candidate_buf, cmd_buf, counter_buf};
+        glDeleteBuffers(4, bufs);
+        chunk_buf = candidate_buf = cmd_buf = counter_buf = 0;
+    }
+    if(depth_fbo) {
+        glDeleteFramebuffers(1, &depth_fbo);
+        depth_fbo = 0;
+    }
+    resize_pyramid(0, 0);
+    build_prog.removeAllShaders();
+    cull_prog.removeAllShaders();
+}
+
+void obvi::hiz_culler::set_items(const std::vector<item>& items) {
+    std::vector<gpu_chunk> data(items.size());
+    for(size_t i = 0; i < items.size(); ++i) {
+        const item& c = items[i];
+        gpu_chunk&  g = data[i];
+        for(size_t j = 0; j < 3; ++j) {
+            g.box_min[j] = c.bounds.min_pt[j];
+            g.box_max[j] = c.bounds.max_pt[j];
+        }
+        g.box_min[3]  = g.box_max[3] = 0.0f;
+        g.first_index = c.first_index;
+        g.num_indices = c.num_indices;
+        g.base_vertex = c.base_vertex;
+        g.object      = c.object;
+        for(size_t j = 0; j < mesh_chunk::max_lods; ++j) {
+            // Missing levels fall back to full detail.
+            const bool has_lod = j < c.num_lods;
+            g.lods[j][0] = has_lod ? c.lods[j].first_index : c.first_index;
+            g.lods[j][1] = has_lod ? c.lods[j].num_indices : c.num_indices;
+        }
+    }
+    num_chunks   = items.size();
+    cmd_capacity = std::max<size_t>(num_chunks, 1);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk_buf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(std::max<size_t>(data.size(), 1) * sizeof(gpu_chunk)),
+                 data.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, candidate_buf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(cmd_capacity * sizeof(uint32_t)), nullptr,
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cmd_buf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(cmd_capacity * draw_command_size), nullptr,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    invalidate();
+}
+
+GLsizei obvi::hiz_culler::cull(const std::vector<uint32_t>& candidates, GLuint object_buf,
+                               bool enable) {
+    size_t count = std::min(candidates.size(), num_chunks);
+    if(count == 0) {
+        return 0;
+    }
+
+    // Upload this frame's candidates.
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, candidate_buf);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, GLsizeiptr(count * sizeof(uint32_t)),
+                    candidates.data());
+
+    // Zero the command count, and the commands themselves (slots past the final count must be
+    // empty draws).
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buf);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cmd_buf);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, GLsizeiptr(count * draw_command_size),
+                         GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, chunk_buf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, candidate_buf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cmd_buf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counter_buf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, object_buf);
+
+    cull_prog.bind();
+    bool use_hiz = enable && pyramid_valid;
+    glUniform1ui(cull_prog.uniformLocation("num_candidates"), GLuint(count));
+    glUniform1i(cull_prog.uniformLocation("hiz_valid"), use_hiz ? 1 : 0);
+    if(use_hiz) {
+        glUniformMatrix4fv(cull_prog.uniformLocation("hiz_view_proj"), 1, GL_FALSE,
+                           pyramid_view_proj.data());
+        glUniform2i(cull_prog.uniformLocation("hiz_size"), pyr_width, pyr_height);
+        glUniform1i(cull_prog.uniformLocation("hiz_levels"), pyr_levels);
+        glUniform1i(cull_prog.uniformLocation("hiz"), 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, pyramid_tex);
+    }
+    glDispatchCompute(num_groups(GLuint(count), cull_group_size), 1, 1);
+    cull_prog.release();
+
+    // Make commands visible to the indirect draw that follows.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    return GLsizei(count);
+}
+
+void obvi::hiz_culler::update_pyramid(GLuint src_fbo, int width, int height,
+                                      const std::array<float,16>& view_proj) {
+    if(width <= 0 || height <= 0 || !depth_fbo) {
+        return;
+    }
+    if(width != pyr_width || height != pyr_height) {
+        resize_pyramid(width, height);
+    }
+
+    // Copy depth buffer (this also resolves it, if the framebuffer is multisampled).
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_fbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, src_fbo);
+
+    // Reduce into pyramid, one level at a time.
+    build_prog.bind();
+    int loc_src_level = build_prog.uniformLocation("src_level");
+    int loc_src_size  = build_prog.uniformLocation("src_size");
+    int loc_copy_only = build_prog.uniformLocation("copy_only");
+    glUniform1i(build_prog.uniformLocation("src"), 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    int w = width, h = height;
+    for(int level = 0; level < pyr_levels; ++level) {
+        int dst_w = (level == 0)? w : std::max(w / 2, 1);
+        int dst_h = (level == 0)? h : std::max(h / 2, 1);
+
+        glBindTexture(GL_TEXTURE_2D, (level == 0)? depth_tex : pyramid_tex);
+        glUniform1i(loc_src_level, (level == 0)? 0 : level - 1);
+        glUniform2i(loc_src_size, w, h);
+        glUniform1i(loc_copy_only, (level == 0)? 1 : 0);
+        glBindImageTexture(0, pyramid_tex, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute(num_groups(GLuint(dst_w), build_group_size),
+                          num_groups(GLuint(dst_h), build_group_size), 1);
+
+        // Next level reads what this one wrote.
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        w = dst_w;
+        h = dst_h;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    build_prog.release();
+
+    pyramid_view_proj = view_proj;
+    pyramid_valid     = true;
+}
+
+void obvi::hiz_culler::resize_pyramid(int width, int height) {
+    if(depth_tex) {
+        glDeleteTextures(1, &depth_tex);
+        glDeleteTextures(1, &pyramid_tex);
+        depth_tex = pyramid_tex = 0;
+    }
+    pyr_width     = width;
+    pyr_height    = height;
+    pyr_levels    = 0;
+    pyramid_valid = false;
+    if(width <= 0 || height <= 0) {
+        return;
+    }
+
+    pyr_levels = depth_pyramid::num_levels(width, height);
+
+    // Depth copy target. Format must match the window's depth buffer for the blit to work
+    // (see main.cpp, where the window format is set).
+    glGenTextures(1, &depth_tex);
+    glBindTexture(GL_TEXTURE_2D, depth_tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_tex, 0);
+
+    glGenTextures(1, &pyramid_tex);
+    glBindTexture(GL_TEXTURE_2D, pyramid_tex);
+    glTexStorage2D(GL_TEXTURE_2D, pyr_levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
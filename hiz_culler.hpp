@@ -0,0 +1,131 @@
+/* Header for hierarchical-Z occlusion culling of mesh chunks on the GPU.
+ *
+ * Every frame, after drawing, the depth buffer is copied and reduced into a depth pyramid (each
+ * level holds the farthest depth of the 2x2 texels under it in the level below). Next frame, a
+ * compute shader tests each chunk's bounding box against the pyramid level where the box covers
+ * at most 2x2 texels, and appends a draw command for every chunk that might be visible to an
+ * indirect draw buffer. Draw it with glMultiDrawElementsIndirect().
+ *
+ * Chunks can belong to different objects (see scene_batch). Each chunk's box is in mesh coords,
+ * and is moved into the world by its object's transform, read from the object buffer.
+ *
+ * The test uses the previous frame's depth and matrices, so an object that was hidden and
+ * becomes visible can show up one frame late. Chunks whose box crosses the camera plane are
+ * never culled.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_HIZ_CULLER_HPP
+#define OBVI_HIZ_CULLER_HPP
+
+#include <QOpenGLFunctions_4_3_Core>
+#include <QOpenGLShaderProgram>
+
+#include <array>
+#include <vector>
+
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/mesh.hpp>
+
+namespace obvi {
+
+struct hiz_culler : protected QOpenGLFunctions_4_3_Core {
+    // One chunk of one object, stored in shared vertex and index buffers.
+    struct item {
+        bboxf    bounds;          // in mesh coords
+        uint32_t first_index = 0; // offset into index buffer
+        uint32_t num_indices = 0;
+        int32_t  base_vertex = 0; // offset of the mesh's first vertex in the vertex buffer
+        uint32_t object      = 0; // index in object buffer (also passed as the draw's base instance)
+
+        // Simplified versions of the chunk (first_index is an offset into the index buffer).
+        uint32_t num_lods = 0;
+        mesh_lod lods[mesh_chunk::max_lods];
+    };
+
+    // Entry of the candidate list passed to cull(): item index, and level of detail to draw it at
+    // (0 = full detail, i = lods[i-1]).
+    static uint32_t candidate(size_t item_idx, size_t level) {
+        return uint32_t(item_idx) | (uint32_t(level) << candidate_level_shift);
+    }
+    static constexpr uint32_t candidate_level_shift = 29; // must match hiz_cull.comp
+
+    // Create shaders and buffers. OpenGL context must be current.
+    bool init();
+
+    // Free all OpenGL objects. OpenGL context must be current.
+    void destroy();
+
+    // Upload chunk ranges and bounds (call again if the scene changes).
+    void set_items(const std::vector<item>& items);
+
+    /* Test the given items against the depth pyramid, build indirect draw commands for the ones
+     * that might be visible. Returns the max number of commands to draw (pass as drawcount to
+     * glMultiDrawElementsIndirect, unused slots are zero-sized draws that cost ~nothing).
+     *
+     * object_buf is the std430 object_info buffer used by the vertex shader (see shaders/flat.vert).
+     * If enable is false, the depth test is skipped (all candidates get a draw command).
+     */
+    GLsizei cull(const std::vector<uint32_t>& candidates, GLuint object_buf, bool enable);
+
+    // Buffer to bind to GL_DRAW_INDIRECT_BUFFER before calling glMultiDrawElementsIndirect().
+    GLuint command_buffer() const { return cmd_buf; }
+
+    /* Rebuild the depth pyramid from the depth buffer of the given framebuffer (call at the end
+     * of each frame). view_proj is the (projection * view) matrix used when drawing the frame.
+     */
+    void update_pyramid(GLuint src_fbo, int width, int height,
+                        const std::array<float,16>& view_proj);
+
+    // Throw away the current pyramid (e.g., the scene was replaced).
+    void invalidate() { pyramid_valid = false; }
+
+private:
+    void resize_pyramid(int width, int height);
+
+    QOpenGLShaderProgram build_prog;
+    QOpenGLShaderProgram cull_prog;
+
+    GLuint chunk_buf     = 0; // std430 chunk_info for every item
+    GLuint candidate_buf = 0; // item indices to test this frame
+    GLuint cmd_buf       = 0; // compacted DrawElementsIndirectCommands
+    GLuint counter_buf   = 0; // number of commands written (atomic counter)
+    size_t num_chunks    = 0;
+    size_t cmd_capacity  = 0;
+
+    GLuint depth_tex     = 0; // copy of the depth buffer
+    GLuint depth_fbo     = 0; // framebuffer for depth_tex, so we can blit into it
+    GLuint pyramid_tex   = 0; // R32F depth pyramid, with full mip chain
+    int    pyr_width     = 0;
+    int    pyr_height    = 0;
+    int    pyr_levels    = 0;
+    bool   pyramid_valid = false;
+
+    std::array<float,16> pyramid_view_proj; // matrix the pyramid was rendered with
+};
+
+} // END namespace obvi
+
+#endif // OBVI_HIZ_CULLER_HPP
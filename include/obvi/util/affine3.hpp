@@ -40,6 +40,7 @@
 
 #include <obvi/util/vec3.hpp>
 #include <obvi/util/mat3.hpp>
+#include <obvi/util/bbox.hpp>
 
 namespace obvi {
 
@@ -94,14 +95,10 @@ struct affine3
         arr.fill(GLreal(0));
 
         // Store rotation matrix in upper-left 3x3 of 4x4.
-        // Multiply diagonal of rotation matrix by uscale as we store it.
+        // Multiply rotation matrix by uscale as we store it (x' = rot * (x * uscale) + tr).
         for(size_t col=0; col<3; ++col) {
             for(size_t row=0; row<3; ++row) {
-                real val = rot(row, col);
-                if(row == col) {
-                    val *= uscale;
-                }
-                arr[colmajor(row, col)] = GLreal(val);
+                arr[colmajor(row, col)] = GLreal(rot(row, col) * uscale);
             }
         }
 
@@ -124,7 +121,7 @@ struct affine3
     }
 
     // Combine two affine transformations into a single affine transform.
-    friend const affine3& operator*(const affine3& lhs, const affine3& rhs) {
+    friend affine3 operator*(const affine3& lhs, const affine3& rhs) {
         return affine3(lhs) *= rhs;
     }
 
@@ -133,10 +130,34 @@ struct affine3
         return aff.rot * (vec * aff.uscale) + aff.tr;
     }
 
+    // Transform the given bounding box (returns the axis-aligned box that encloses the result).
+    friend bbox<real> operator*(const affine3& aff, const bbox<real>& box) {
+        if(box.is_empty()) {
+            return box;
+        }
+        // Transform the center, then project the rotated half-extents of the box onto each axis.
+        vec3<real> center = aff * box.center();
+        vec3<real> half   = (box.max_pt - box.min_pt) * (real(0.5) * std::abs(aff.uscale));
+        vec3<real> ext;
+        for(size_t row=0; row<3; ++row) {
+            ext[row] = std::abs(aff.rot(row,0)) * half.x() + std::abs(aff.rot(row,1)) * half.y()
+                     + std::abs(aff.rot(row,2)) * half.z();
+        }
+        bbox<real> out(center - ext);
+        out.expand(center + ext);
+        return out;
+    }
+
+    // Rotate the given direction vector (ignores the translation and scale parts of transform).
+    vec3<real> rotate(const vec3<real>& dir) const {
+        return rot * dir;
+    }
+
     affine3& inv_inplace() {
+        // Inverse of y = rot * (scale * x) + tr is x = rot^T * (y / scale) - (rot^T * tr) / scale.
         rot.trans_inplace();
-        tr = -(rot * tr);
         uscale = real(1) / uscale;
+        tr = -(rot * tr) * uscale;
         return *this;
     }
     friend affine3& inv_inplace(affine3& aff) {
@@ -0,0 +1,107 @@
+/* Header-only allocator that returns memory aligned to a given boundary.
+ *
+ * C++14's std::allocator doesn't respect the alignment of over-aligned types (e.g., alignas(64)),
+ * so containers of cache-line aligned structures need to use this instead.
+ *
+ * Usage example:
+ * \code
+ * std::vector<my_node, obvi::aligned_allocator<my_node, 64>> nodes;
+ * \endcode
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_ALIGNED_ALLOCATOR_HPP
+#define OBVI_ALIGNED_ALLOCATOR_HPP
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new> // for std::bad_alloc
+
+#ifdef _MSC_VER
+#  include <malloc.h> // provides _aligned_malloc() and _aligned_free()
+#endif
+
+namespace obvi {
+
+// Allocate 'size' bytes aligned to 'alignment' (which must be a power of two, and a multiple of
+// sizeof(void*)). Returns nullptr on failure. Memory must be freed with aligned_free().
+static inline void* aligned_malloc(size_t size, size_t alignment) {
+#ifdef _MSC_VER
+    return _aligned_malloc(size, alignment);
+#else
+    void *ptr = nullptr;
+    if(posix_memalign(&ptr, alignment, size) != 0) {
+        return nullptr;
+    }
+    return ptr;
+#endif
+}
+
+static inline void aligned_free(void *ptr) {
+#ifdef _MSC_VER
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+template<typename T, size_t alignment>
+struct aligned_allocator {
+    static_assert(alignment >= alignof(T), "alignment must be at least the type's alignment");
+    static_assert((alignment & (alignment - 1)) == 0, "alignment must be a power of two");
+
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = aligned_allocator<U, alignment>;
+    };
+
+    aligned_allocator() {}
+
+    template<typename U>
+    aligned_allocator(const aligned_allocator<U, alignment>&) {}
+
+    T* allocate(size_t n) {
+        size_t align = (alignment < sizeof(void*))? sizeof(void*) : alignment;
+        void  *ptr   = (n > 0)? aligned_malloc(n * sizeof(T), align) : nullptr;
+        if(n > 0 && !ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t) {
+        aligned_free(ptr);
+    }
+
+    template<typename U>
+    bool operator==(const aligned_allocator<U, alignment>&) const { return true; }
+    template<typename U>
+    bool operator!=(const aligned_allocator<U, alignment>&) const { return false; }
+};
+
+} // END namespace obvi
+#endif // OBVI_ALIGNED_ALLOCATOR_HPP
@@ -0,0 +1,99 @@
+/* Public header for batch geometry kernels (transforms, triangle bounds, and Morton codes).
+ *
+ * Each function processes a whole array at once, using the widest SIMD instruction set the CPU
+ * supports. The instruction set is picked at runtime the first time one of these functions is
+ * called, so a single binary built for baseline x86-64 (SSE2) still uses AVX2 where it's
+ * available. Every path gives exactly the same results (no FMA, same operation order), so the
+ * choice of instruction set never changes a BVH or a Morton order.
+ *
+ * None of these functions are multithreaded: call them on blocks of the input from inside your
+ * own OpenMP loops.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_BATCH_HPP
+#define OBVI_BATCH_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <obvi/util/affine3.hpp>
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/vec3.hpp>
+
+namespace obvi {
+
+enum class simd_isa {
+    SCALAR, // plain C++ loops
+    SSE2,
+    NEON,
+    AVX2
+};
+
+// Name of the instruction set, for logs and benchmark output.
+const char *to_string(simd_isa isa);
+
+// Instruction set used by the batch functions (detected on first use).
+simd_isa batch_isa();
+
+/* Force the batch functions to use the given instruction set, for testing and benchmarks.
+ *
+ * Returns false (and changes nothing) if it isn't compiled in or this CPU doesn't support it.
+ * SCALAR is always available. Safe to call while other threads are running batch functions: calls
+ * already in progress finish with the old instruction set.
+ */
+bool set_batch_isa(simd_isa isa);
+
+/* Apply tf to n points, stored as separate arrays of x, y and z coordinates (structure of arrays).
+ *
+ * The scale is folded into the rotation first, so results can differ from tf * point in the last
+ * bit.
+ *
+ * The output arrays may be the same as the input arrays (transform in place), but must not
+ * partially overlap them.
+ */
+void transform_points(const affine3f& tf, const float *x, const float *y, const float *z,
+                      size_t n, float *out_x, float *out_y, float *out_z);
+
+/* Bounding box of each of num_tris triangles, given three indices into positions per triangle
+ * (same layout as mesh::positions and mesh::indices).
+ */
+void triangle_bounds(const vec3f *positions, const uint32_t *indices, size_t num_tris,
+                     bboxf *out_boxes);
+
+/* Morton codes of n points: out[i] = morton_encode_30((x[i] - offset.x()) * scale.x(), ...).
+ *
+ * Pick offset and scale to map the points onto [0,morton_30_max) in each dimension (values
+ * outside that range are clamped, NaNs map to 0).
+ */
+void morton_codes_30(const float *x, const float *y, const float *z, size_t n,
+                     const vec3f& offset, const vec3f& scale, uint32_t *out);
+
+// Same as morton_codes_30(), but for morton_encode_63() (range is [0,morton_63_max)).
+void morton_codes_63(const float *x, const float *y, const float *z, size_t n,
+                     const vec3f& offset, const vec3f& scale, uint64_t *out);
+
+} // END namespace obvi
+#endif // OBVI_BATCH_HPP
@@ -33,6 +33,7 @@
 #include <cmath>
 #include <algorithm> // for min and max
 #include <limits>
+#include <stdint.h>
 #include <obvi/util/vec3.hpp>
 
 namespace obvi {
@@ -68,6 +69,15 @@ struct bbox {
         return (min_pt + max_pt) * real(0.5);
     }
 
+    // Calculate the surface area of the bounding box (zero if the box is empty).
+    real surface_area() const {
+        if(is_empty()) {
+            return real(0);
+        }
+        vec3r d = max_pt - min_pt;
+        return real(2) * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+    }
+
     // Expand the bounding box to include the given point.
     void expand(const vec3r& pt) {
         if(is_empty()) {
@@ -81,8 +91,11 @@ struct bbox {
         }
     }
 
-    // Expand the bounding box to include the given bounding box.
+    // Expand the bounding box to include the given bounding box (does nothing if box is empty).
     void expand(const bbox& box) {
+        if(box.is_empty()) {
+            return;
+        }
         if(is_empty()) {
             min_pt = box.min_pt;
             max_pt = box.max_pt;
@@ -94,6 +107,21 @@ struct bbox {
         }
     }
 
+    // Squared distance from the given point to the closest point on or inside the box.
+    //
+    // Returns zero if the point is inside the box, or infinity if the box is empty.
+    real distance_squared(const vec3r& pt) const {
+        if(is_empty()) {
+            return std::numeric_limits<real>::infinity();
+        }
+        real dist2 = real(0);
+        for(size_t i=0; i<3; ++i) {
+            real d = std::max(min_pt[i] - pt[i], std::max(real(0), pt[i] - max_pt[i]));
+            dist2 += d * d;
+        }
+        return dist2;
+    }
+
     // point <-> bbox intersection
     bool intersects_point(const vec3r& pt) const {
         return pt.x() >= min_pt.x() && pt.x() <= max_pt.x()
@@ -150,42 +178,81 @@ struct bbox {
         return true;
     }
 
+    // Factor the far distance of a ray/box test is multiplied by, so that rounding error can't
+    // cause a miss: 1 + 2*gamma(3), where gamma(n) = n*u / (1 - n*u) and u is the unit roundoff.
+    static constexpr real ray_pad =
+        real(1) + real(2) * (real(1.5) * std::numeric_limits<real>::epsilon())
+                          / (real(1) - real(1.5) * std::numeric_limits<real>::epsilon());
+
     // ray <-> bbox intersection
     //
     // origin: origin of ray
     // inv_dir: element-wise inverse (reciprocal) of normalized ray direction vector
     //
     bool intersects_ray(const vec3r& origin, const vec3r& inv_norm_dir) const {
+        return intersects_ray(origin, inv_norm_dir, std::numeric_limits<real>::infinity(), nullptr);
+    }
+
+    // ray <-> bbox intersection, limited to the part of the ray on [0, max_t].
+    //
+    // If out_entry_t isn't null, it's set to the distance along the ray where it enters the box
+    // (0 if the origin is inside the box). Only valid if the function returns true.
+    //
+    bool intersects_ray(const vec3r& origin, const vec3r& inv_norm_dir, real max_t,
+                        real *out_entry_t) const {
+        uint8_t dir_neg[3];
+        ray_signs(inv_norm_dir, dir_neg);
+        return intersects_ray_precalc(origin, inv_norm_dir, dir_neg, max_t, out_entry_t);
+    }
+
+    // Get the per-axis direction signs used by intersects_ray_precalc() (1 if negative, else 0).
+    static void ray_signs(const vec3r& inv_norm_dir, uint8_t dir_neg[3]) {
+        for(size_t i=0; i<3; ++i) {
+            dir_neg[i] = std::signbit(inv_norm_dir[i])? 1 : 0;
+        }
+    }
+
+    // ray <-> bbox intersection, using per-ray data that was computed ahead of time (from
+    // ray_signs()). Use this when testing the same ray against many boxes.
+    bool intersects_ray_precalc(const vec3r& origin, const vec3r& inv_norm_dir,
+                                const uint8_t dir_neg[3], real max_t, real *out_entry_t) const {
         if(is_empty()) {
             return false;
         }
 
-        // Naive algorithm, adapted from the following source (Andrew Kensler, public domain):
-        //   psgraphics.blogspot.com/2016/02/new-simple-ray-box-test-from-andrew.html
+        // Robust slab test, from Thiago Ize, "Robust BVH Ray Traversal" (JCGT, 2013).
         //
-        // Kinda slow, but is definitely correct in all edge cases.
+        // The near and far plane on each axis are picked using the sign of the ray direction, so
+        // there's no need to sort the two distances. The far distance is padded by the maximum
+        // rounding error of the subtract and multiply, so a ray that grazes an edge (or hits an
+        // infinitely thin box) is never missed.
         //
-        // TODO: figure out how to make this faster, while still detecting intersections with
-        //       infinitely thin planes.
-        real tmax = std::numeric_limits<real>::infinity();
-        real tmin = -tmax;
+        // If the ray is parallel to an axis and its origin lies on one of the box's planes, we
+        // get 0 * INF = NaN. std::max(acc, NaN) and std::min(acc, NaN) both return acc, so that
+        // axis just doesn't limit the hit interval (no need to branch on std::isinf).
+        real tmin = real(0);
+        real tmax = max_t;
         for(size_t i=0; i<3; ++i) {
-            if(!std::isinf(inv_norm_dir[i])) { // Avoid NaN's from 0 * INF
-                real t0 = (min_pt[i] - origin[i]) * inv_norm_dir[i];
-                real t1 = (max_pt[i] - origin[i]) * inv_norm_dir[i];
-
-                tmin = std::max(tmin, std::min(t0, t1));
-                tmax = std::min(tmax, std::max(t0, t1));
-            } else if (origin[i] < min_pt[i] || origin[i] > max_pt[i]) {
-                return false;
-            }
+            real near_plane = dir_neg[i]? max_pt[i] : min_pt[i];
+            real far_plane  = dir_neg[i]? min_pt[i] : max_pt[i];
+            real t0 = (near_plane - origin[i]) * inv_norm_dir[i];
+            real t1 = (far_plane  - origin[i]) * inv_norm_dir[i] * ray_pad;
+            tmin = std::max(tmin, t0);
+            tmax = std::min(tmax, t1);
+        }
+        if(!(tmin <= tmax)) {
+            return false;
+        }
+        if(out_entry_t) {
+            *out_entry_t = tmin;
         }
-        //static constexpr real epsfac = real(1) + real(2) * std::numeric_limits<real>::epsilon();
-        //tmax *= epsfac;
-        return tmax >= tmin && tmax >= real(0);
+        return true;
     }
 };
 
+template<typename real>
+constexpr real bbox<real>::ray_pad;
+
 using bboxf = bbox<float>;
 using bboxd = bbox<double>;
 
@@ -52,14 +52,62 @@
 #ifndef OBVI_BVH_HPP
 #define OBVI_BVH_HPP
 
+#include <algorithm>
+#include <memory>
 #include <vector>
+#include <limits>
 
+#include <obvi/util/first_touch_allocator.hpp>
 #include <obvi/util/math.hpp>
 #include <obvi/util/vec3.hpp>
 #include <obvi/util/bbox.hpp>
+#include <obvi/util/frustum.hpp>
+#include <obvi/util/simd.hpp>
 
 namespace obvi {
 
+enum class bvh_build_type {
+    MORTON, // Linear BVH from sorted Morton codes (fastest to build, lower quality tree)
+    SAH     // Binned surface area heuristic (slower to build, faster queries)
+};
+
+// Time spent in each phase of bvh::generate(), in seconds. Phases that the build type doesn't
+// have are left at zero.
+struct bvh_build_stats {
+    double bounds_sec = 0; // bounding box of all the objects
+    double morton_sec = 0; // Morton codes of the box centers (MORTON only)
+    double sort_sec   = 0; // radix sort of the Morton codes (MORTON only)
+    double tree_sec   = 0; // building the tree itself
+};
+
+/* Scratch memory for building BVHs (sorted Morton codes, the radix tree, work lists), kept
+ * between calls to bvh::generate(). Rebuilding trees of about the same size over and over (e.g.,
+ * the top level of a scene every frame) then doesn't allocate anything, or page fault on fresh
+ * memory. Big arrays are spread over NUMA nodes when they're first allocated (see
+ * first_touch_allocator.hpp).
+ *
+ * A builder can only be used by one build at a time. Copies start out empty.
+ */
+struct bvh_builder {
+    bvh_builder();
+    bvh_builder(const bvh_builder&);
+    bvh_builder(bvh_builder&&);
+    bvh_builder& operator=(const bvh_builder&);
+    bvh_builder& operator=(bvh_builder&&);
+    ~bvh_builder();
+
+    // Free all scratch memory.
+    void clear();
+
+    // Bytes of scratch memory held right now.
+    size_t capacity_bytes() const;
+
+private:
+    friend struct bvh;
+    struct scratch; // defined in bvh.cpp
+    std::unique_ptr<scratch> data;
+};
+
 struct bvh {
     //max number of objects in BVH is 2^30, because number of BVH nodes is (2*num_leaves-1), and
     //the number of nodes must fit in a 31-bit unsigned integer.
@@ -67,35 +115,155 @@ struct bvh {
 
     void clear() {
         tree.clear();
-        num_leaves = 0;
+        build_area.clear();
+        num_leaves   = 0;
+        borrowed     = nullptr;
+        num_borrowed = 0;
     }
 
     /* Create a new BVH from the given list of object bounding boxes.
      *
      * Any previously-generated tree data will be wiped first.
      *
+     * The build type selects the algorithm used to split objects between child nodes. The
+     * default (MORTON) is very fast to build, but can produce poor trees for scenes with long,
+     * thin objects. SAH takes several times longer to build, but the resulting tree usually
+     * visits far fewer nodes per query. Both produce the same node layout.
+     *
      * Returns 'false' if there are too many boxes (i.e., resulting tree would exhaust
      * the index space). This won't occur unless you try to make a BVH with more than
      * ~1 billion (2^30) objects in a single tree.
+     *
+     * If out_stats isn't null, it's set to the time taken by each phase of the build.
+     */
+    bool generate(const std::vector<bboxf>& boxes,
+                  bvh_build_type build_type = bvh_build_type::MORTON,
+                  bvh_build_stats *out_stats = nullptr);
+
+    /* Same as above, but with scratch memory from the given builder, so that repeated builds
+     * reuse it. The tree's own nodes are reused too, if this bvh already has room for them.
+     */
+    bool generate(const std::vector<bboxf>& boxes, bvh_builder& builder,
+                  bvh_build_type build_type = bvh_build_type::MORTON,
+                  bvh_build_stats *out_stats = nullptr);
+
+    /* Update the BVH after some of the objects have moved or changed size.
+     *
+     * The tree structure is kept, only the node bounding boxes are recomputed (bottom-up). This
+     * is much faster than generate(), but the tree gets less efficient as objects move farther
+     * from where they were when it was built.
+     *
+     * If rebuild_threshold is greater than zero, any subtree whose surface area has grown by more
+     * than that factor since it was built (e.g., 2.0 == doubled) is rebuilt in place with the SAH
+     * builder. The rest of the tree is left untouched. The areas to compare against are the ones
+     * recorded by generate() (or by the first refit of a borrowed tree), not the ones from the
+     * last refit, so a tree that degrades slowly over many refits still gets rebuilt.
+     *
+     * The given list of boxes must be the same size and order as the one that was passed to
+     * generate(). Returns 'false' (and doesn't change anything) if the size doesn't match.
+     *
+     * If the nodes are borrowed (see borrow()), they're copied first, and the bvh owns them from
+     * then on.
      */
-    bool generate(const std::vector<bboxf>& boxes);
+    bool refit(const std::vector<bboxf>& boxes, float rebuild_threshold = 0.0f);
 
     size_t size() const {
         return num_leaves;
     }
 
     const bboxf& bounds() const {
-        return (tree.size() > 0)? tree[0].box : bvh::empty_box;
+        node_list list = nodes();
+        return (list.size() > 0)? list[0].box : bvh::empty_box;
     }
 
     template<typename intersect_func> struct query; //defined at bottom of file
 
+    template<typename packet_func> struct packet_query; //defined at bottom of file
+
+    struct ray_query; //defined at bottom of file
+
+    struct nearest_query; //defined at bottom of file
+
     // Make an intersection query.
     template<typename intersect_func>
     query<intersect_func> make_query(intersect_func ifunc) const {
         return query<intersect_func>(*this, ifunc);
     }
 
+    // Make an intersection query for a packet of several queries at once (see packet functors).
+    template<typename packet_func>
+    packet_query<packet_func> make_packet_query(packet_func pfunc) const {
+        return packet_query<packet_func>(*this, pfunc);
+    }
+
+    // Make a closest-first ray query (see ray_query), limited to the part of the ray on [0,max_t].
+    ray_query make_ray_query(const vec3f& ray_origin, const vec3f& ray_norm_dir,
+                             float max_t = std::numeric_limits<float>::infinity()) const;
+
+    // Make a nearest-first point query (see nearest_query), limited to objects whose boxes are
+    // within sqrt(max_dist2) of the point.
+    nearest_query make_nearest_query(const vec3f& pt,
+                                     float max_dist2 = std::numeric_limits<float>::infinity()) const;
+
+    /* Find the (up to) k objects whose bounding boxes are closest to the given point.
+     *
+     * Indices are returned in order of increasing distance. Objects whose boxes are farther than
+     * sqrt(max_dist2) from the point are ignored. If out_dist2 isn't null, it's set to the squared
+     * distance to each returned object's box.
+     */
+    std::vector<size_t> nearest(const vec3f& pt, size_t k,
+                                float max_dist2 = std::numeric_limits<float>::infinity(),
+                                std::vector<float> *out_dist2 = nullptr) const;
+
+    // Results of a batch query, stored in compressed sparse row (CSR) format.
+    //
+    // The objects matched by query i are matches[offsets[i]] to matches[offsets[i+1] - 1], in the
+    // same order that bvh::query would return them. offsets has one more entry than there are
+    // queries, so the total number of matches is offsets.back().
+    struct batch_result {
+        std::vector<size_t>   offsets;
+        std::vector<uint32_t> matches; // object indices (always fit in 32 bits, see max_size)
+    };
+
+    // Value stored by query_batch_first() for queries that didn't intersect anything.
+    static constexpr uint32_t no_match = 0xFFFFFFFFu;
+
+    /* Run many independent queries in parallel, and store all of their matches.
+     *
+     * Queries are split into blocks that are handed out to threads dynamically, and each thread
+     * appends matches to its own buffer, so threads never contend with each other for memory.
+     * The per-thread buffers are then copied into the output in query order.
+     *
+     * Implemented for intersect_point, intersect_box, intersect_segment, intersect_ray and
+     * intersect_sphere.
+     */
+    template<typename intersect_func>
+    void query_batch(const intersect_func *queries, size_t count, batch_result& out) const;
+
+    template<typename intersect_func>
+    void query_batch(const std::vector<intersect_func>& queries, batch_result& out) const {
+        query_batch(queries.data(), queries.size(), out);
+    }
+
+    /* Run many independent queries in parallel, and store only the first match of each one.
+     *
+     * Each query stops as soon as it finds a match, so this is much faster than query_batch()
+     * when you only need to know whether anything was hit (e.g., for collision or occlusion
+     * checks). out_first must have room for count entries, it gets the index of the first
+     * object found by each query (in bvh::query order), or no_match.
+     *
+     * Implemented for the same functors as query_batch().
+     */
+    template<typename intersect_func>
+    void query_batch_first(const intersect_func *queries, size_t count, uint32_t *out_first) const;
+
+    template<typename intersect_func>
+    void query_batch_first(const std::vector<intersect_func>& queries,
+                           std::vector<uint32_t>& out_first) const {
+        out_first.resize(queries.size());
+        query_batch_first(queries.data(), queries.size(), out_first.data());
+    }
+
     // internal bvh node.
     struct node {
         bboxf    box;
@@ -107,6 +275,45 @@ struct bvh {
         size_t subtree_size() const { return (is_leaf())? (size_t)1 : (size_t)num; }
     }; // 28 bytes
 
+    // Read-only view of an array of nodes (either the bvh's own, or borrowed ones).
+    struct node_list {
+        const node *ptr   = nullptr;
+        size_t      count = 0;
+
+        size_t      size() const                 { return count; }
+        bool        empty() const                { return count == 0; }
+        const node* data() const                 { return ptr; }
+        const node* begin() const                { return ptr; }
+        const node* end() const                  { return ptr + count; }
+        const node& operator[](size_t idx) const { return ptr[idx]; }
+    };
+
+    // Read-only access to the tree nodes, for code that needs to convert, save or walk the tree
+    // itself.
+    //
+    // Nodes are stored in depth-first traversal order: the left child of an internal node
+    // immediately follows it, and the right child immediately follows the entire left subtree.
+    node_list nodes() const {
+        return borrowed? node_list{borrowed, num_borrowed} : node_list{tree.data(), tree.size()};
+    }
+
+    /* Use a tree that's stored somewhere else (e.g., nodes() of a bvh saved to a memory-mapped
+     * cache file), without copying it. The nodes must stay valid and unchanged until this bvh is
+     * cleared, regenerated, refit or destroyed. Copies of this bvh borrow the same nodes.
+     *
+     * num_objects is the number of boxes the tree was generated from. The tree's structure is
+     * checked first (subtree sizes, leaf count and object indices), so queries can't read outside
+     * the array even if the nodes came from a corrupt file. Returns 'false' (and leaves the bvh
+     * empty) if the check fails.
+     */
+    bool borrow(const node *tree_nodes, size_t count, size_t num_objects);
+
+    /* Same as borrow(), but the nodes are copied, so they don't need to stay valid afterwards
+     * (e.g., nodes downloaded from the GPU, see bvh_cuda.hpp). The nodes must not be this bvh's
+     * own nodes().
+     */
+    bool assign(const node *tree_nodes, size_t count, size_t num_objects);
+
 
     // intersection functors.
     struct intersect_point {
@@ -136,19 +343,100 @@ struct bvh {
             return box.intersects_segment_precalc(d, seg_a_d, ad);
         }
     };
+    struct intersect_sphere {
+        vec3f center;
+        float radius2;
+        intersect_sphere(const vec3f& sphere_center, float radius)
+            : center(sphere_center), radius2(radius * radius) {}
+        bool operator()(const bboxf& box) {
+            return box.distance_squared(center) <= radius2;
+        }
+    };
+    struct intersect_frustum {
+        frustumf fr;
+        intersect_frustum(const frustumf& view_frustum) : fr(view_frustum) {}
+        bool operator()(const bboxf& box) {
+            return fr.intersects_box(box);
+        }
+    };
     struct intersect_ray {
-        vec3f origin;
-        vec3f inv_norm_dir;
+        vec3f   origin;
+        vec3f   inv_norm_dir;
+        uint8_t dir_neg[3]; // direction signs, computed once instead of at every node
         intersect_ray(const vec3f& ray_origin, const vec3f &ray_norm_dir)
-            : origin(ray_origin), inv_norm_dir(ray_norm_dir.inv()) {}
+            : origin(ray_origin), inv_norm_dir(ray_norm_dir.inv()) {
+            bboxf::ray_signs(inv_norm_dir, dir_neg);
+        }
         bool operator()(const bboxf& box) {
-            return box.intersects_ray(origin, inv_norm_dir);
+            return box.intersects_ray_precalc(origin, inv_norm_dir, dir_neg,
+                                              std::numeric_limits<float>::infinity(), nullptr);
+        }
+    };
+
+    // packet intersection functors.
+    //
+    // These test up to N queries against a box at once, using SIMD instructions. They return a
+    // bitmask, with bit i set if query i intersects the box.
+    template<size_t N>
+    struct intersect_ray_packet {
+        static_assert(N <= 32, "packet must fit in a 32-bit mask");
+
+        floatv<N> origin[3];       // SoA origins (origin[0] is x component of all rays, etc.)
+        floatv<N> inv_norm_dir[3]; // SoA element-wise inverse of normalized ray directions
+        uint32_t  valid;           // lanes that contain a ray
+
+        // Copy up to N rays into the packet. If there are fewer than N rays, the rest of the
+        // lanes are filled with copies of the first ray, and masked off.
+        intersect_ray_packet(const vec3f *ray_origins, const vec3f *ray_norm_dirs, size_t count) {
+            count = std::min(count, N);
+            valid = (uint32_t)((uint64_t(1) << count) - 1);
+
+            float o[3][N], d[3][N];
+            for(size_t lane=0; lane<N; ++lane) {
+                size_t src = (lane < count)? lane : 0;
+                vec3f  inv = (count > 0)? ray_norm_dirs[src].inv() : vec3f(1,1,1);
+                for(size_t i=0; i<3; ++i) {
+                    o[i][lane] = (count > 0)? ray_origins[src][i] : 0.0f;
+                    d[i][lane] = inv[i];
+                }
+            }
+            for(size_t i=0; i<3; ++i) {
+                origin[i]       = floatv<N>::load(o[i]);
+                inv_norm_dir[i] = floatv<N>::load(d[i]);
+            }
+        }
+
+        uint32_t operator()(const bboxf& box) const {
+            if(box.is_empty()) {
+                return 0;
+            }
+            const floatv<N> pinf(std::numeric_limits<float>::infinity());
+            const floatv<N> ninf(-std::numeric_limits<float>::infinity());
+
+            // Same slab test as bbox::intersects_ray, just without branches.
+            floatv<N> tmin = ninf;
+            floatv<N> tmax = pinf;
+            for(size_t i=0; i<3; ++i) {
+                floatv<N> t0 = (floatv<N>(box.min_pt[i]) - origin[i]) * inv_norm_dir[i];
+                floatv<N> t1 = (floatv<N>(box.max_pt[i]) - origin[i]) * inv_norm_dir[i];
+                // A NaN means the ray is parallel to this axis, and its origin lies exactly on
+                // one of the box planes (0 * INF). So, this axis doesn't limit the hit interval.
+                tmin = max(tmin, min(replace_nan(t0, ninf), replace_nan(t1, ninf)));
+                tmax = min(tmax, max(replace_nan(t0, pinf), replace_nan(t1, pinf)));
+            }
+            tmax = tmax * floatv<N>(bboxf::ray_pad); // conservative, see bboxf::ray_pad
+            return cmple_mask(tmin, tmax) & cmple_mask(floatv<N>(0.0f), tmax) & valid;
         }
     };
 
 private:
-    std::vector<node> tree; // BVH tree, stored linearly in depth-first-traversal order
-    size_t            num_leaves = 0;
+    // BVH tree, stored linearly in depth-first-traversal order.
+    std::vector<node, first_touch_allocator<node>> tree;
+
+    std::vector<float> build_area; // surface area of each node when it was built (see refit())
+    size_t             num_leaves   = 0;
+    const node        *borrowed     = nullptr; // if not null, used instead of tree (see borrow())
+    size_t             num_borrowed = 0;
 
     const static bboxf empty_box;
 };
@@ -168,7 +456,7 @@ private:
 template<typename intersect_func>
 struct bvh::query {
     query(const bvh& targ, intersect_func ifunc)
-        : next_node(0), tree(targ.tree), intersects(ifunc) {}
+        : next_node(0), tree(targ.nodes()), intersects(ifunc) {}
 
     void reset() { next_node = 0; }
 
@@ -202,9 +490,289 @@ struct bvh::query {
 
 private:
     size_t                   next_node;
-    const std::vector<node>& tree;
+    node_list                tree;
     intersect_func           intersects;
 };
 
+
+/* Iterator that conducts a BVH intersection query for a packet of queries at once.
+ *
+ * The tree is traversed once for the whole packet: a subtree is entered if any active query in
+ * the packet intersects it. This is much faster than running each query on its own when the
+ * queries are coherent (e.g., neighboring rays from a camera).
+ *
+ * packet_func:
+ *   Functor that accepts a bboxf as an argument, and returns a bitmask indicating which of
+ *   your queries intersect that bbox (see intersect_ray_packet).
+ *        uint32_t packet_func(const bboxf& box);
+ */
+template<typename packet_func>
+struct bvh::packet_query {
+    packet_query(const bvh& targ, packet_func pfunc)
+        : next_node(0), tree(targ.nodes()), intersects(pfunc) {}
+
+    void reset() { next_node = 0; active = ~0u; }
+
+    void reset(packet_func pfunc) { reset(); intersects = pfunc; }
+
+    // Stop testing the given queries for the rest of the traversal (e.g., because they were
+    // occlusion rays that already found a hit).
+    void deactivate(uint32_t mask) { active &= ~mask; }
+
+    uint32_t active_mask() const { return active; }
+
+    /* Find the next object whose bounding box was intersected by at least one active query.
+     * Returns false once there are no more objects (or no more active queries).
+     *
+     * out_match is set to the object's index in the vector that was passed to generate(), and
+     * out_mask is set to the mask of queries that intersected the object's bounding box.
+     */
+    bool next(size_t *out_match, uint32_t *out_mask) {
+        while(next_node < tree.size() && active != 0) {
+            const node& nd   = tree[next_node];
+            uint32_t    mask = intersects(nd.box) & active;
+            if(mask != 0) {
+                // Set next_node to the next node in a depth-first traversal of the tree.
+                next_node++;
+                if(nd.is_leaf()) {
+                    if(out_match) {
+                        *out_match = (size_t)(nd.num & 0x7FFFFFFFu);
+                    }
+                    if(out_mask) {
+                        *out_mask = mask;
+                    }
+                    return true;
+                }
+            } else {
+                // If no query intersected this node, skip past the entire subtree.
+                next_node += nd.subtree_size();
+            }
+        }
+        return false;
+    }
+
+private:
+    size_t                   next_node;
+    node_list                tree;
+    packet_func              intersects;
+    uint32_t                 active = ~0u;
+};
+
+
+
+/* Iterator that conducts a closest-first BVH ray query.
+ *
+ * Unlike bvh::query, children are visited in near-to-far order (by the distance at which the
+ * ray enters their bounding box), and every subtree that the ray enters past max_t() is skipped.
+ * Each time the caller confirms a hit on an actual object, they should call shrink() with the
+ * distance to that hit, so that all farther subtrees are culled.
+ *
+ * Usage example (find closest triangle):
+ * \code
+ * auto   query  = bvh.make_ray_query(origin, dir);
+ * size_t best   = SIZE_MAX;
+ * size_t obj_idx;
+ * float  box_t;
+ * while(query.next(&obj_idx, &box_t)) {
+ *     float hit_t;
+ *     if(intersect_triangle(tris[obj_idx], origin, dir, &hit_t) && hit_t < query.max_t()) {
+ *         best = obj_idx;
+ *         query.shrink(hit_t);
+ *     }
+ * }
+ * \endcode
+ *
+ * Same threading rules as bvh::query.
+ */
+struct bvh::ray_query {
+    ray_query(const bvh& targ, const vec3f& ray_origin, const vec3f& ray_norm_dir, float max_t)
+        : tree(targ.nodes()), origin(ray_origin), inv_norm_dir(ray_norm_dir.inv()),
+          start_t(max_t) {
+        bboxf::ray_signs(inv_norm_dir, dir_neg);
+        reset();
+    }
+
+    void reset() {
+        stack.clear();
+        cur_max_t = start_t;
+        float entry_t = 0.0f;
+        if(!tree.empty() && intersects(tree[0].box, &entry_t)) {
+            stack.push_back({0, entry_t});
+        }
+    }
+
+    // Current end of the ray - objects whose boxes begin past this distance won't be returned.
+    float max_t() const { return cur_max_t; }
+
+    // Shorten the ray, so that nothing past the given distance is visited. Never lengthens it.
+    void shrink(float max_t) { cur_max_t = std::min(cur_max_t, max_t); }
+
+    /* Return the index of the next object whose bounding box is entered by the ray before max_t().
+     * If no additional objects were found, returns false.
+     *
+     * out_entry_t is set to the distance along the ray where it enters the object's bounding box.
+     * Objects are returned in roughly near-to-far order, but it's not strict (box entry distance
+     * isn't the same as the distance to the object inside it), so keep calling next() until it
+     * returns false to be sure you have the closest hit.
+     */
+    bool next(size_t *out_match, float *out_entry_t) {
+        while(!stack.empty()) {
+            entry e = stack.back();
+            stack.pop_back();
+            if(e.t > cur_max_t) {
+                continue; // ray was shortened since this node was pushed.
+            }
+
+            const node& nd = tree[e.idx];
+            if(nd.is_leaf()) {
+                if(out_match) {
+                    *out_match = (size_t)(nd.num & 0x7FFFFFFFu);
+                }
+                if(out_entry_t) {
+                    *out_entry_t = e.t;
+                }
+                return true;
+            }
+
+            // Test both children, push the far one first so the near one is visited next.
+            size_t left  = e.idx + 1;
+            size_t right = left + tree[left].subtree_size();
+            float  left_t    = 0.0f;
+            float  right_t   = 0.0f;
+            bool   hit_left  = intersects(tree[left].box, &left_t);
+            bool   hit_right = intersects(tree[right].box, &right_t);
+            if(hit_left && hit_right) {
+                if(left_t <= right_t) {
+                    stack.push_back({right, right_t});
+                    stack.push_back({left, left_t});
+                } else {
+                    stack.push_back({left, left_t});
+                    stack.push_back({right, right_t});
+                }
+            } else if(hit_left) {
+                stack.push_back({left, left_t});
+            } else if(hit_right) {
+                stack.push_back({right, right_t});
+            }
+        }
+        return false;
+    }
+
+private:
+    bool intersects(const bboxf& box, float *out_entry_t) const {
+        return box.intersects_ray_precalc(origin, inv_norm_dir, dir_neg, cur_max_t, out_entry_t);
+    }
+
+    struct entry {
+        size_t idx; // index of node in tree
+        float  t;   // distance where ray enters node's box
+    };
+
+    node_list                tree;
+    vec3f                    origin;
+    vec3f                    inv_norm_dir;
+    uint8_t                  dir_neg[3];
+    float                    start_t;
+    float                    cur_max_t;
+    std::vector<entry>       stack;
+};
+
+
+/* Iterator that conducts a nearest-first BVH point query.
+ *
+ * Objects are returned in order of increasing distance from the query point to their bounding
+ * boxes. The tree is searched best-first: nodes are kept in a priority queue ordered by box
+ * distance, so only nodes that are closer than the next result are ever opened.
+ *
+ * If the caller computes the exact distance to each object, they can call shrink() with the
+ * squared distance of the best object found so far. Everything farther away is then skipped, and
+ * the query stops as soon as no remaining box could contain anything closer.
+ *
+ * Same threading rules as bvh::query.
+ */
+struct bvh::nearest_query {
+    nearest_query(const bvh& targ, const vec3f& pt, float max_dist2)
+        : tree(targ.nodes()), point(pt), start_dist2(max_dist2) { reset(); }
+
+    void reset() {
+        heap.clear();
+        cur_max_dist2 = start_dist2;
+        if(!tree.empty()) {
+            push(0);
+        }
+    }
+
+    // Current search radius (squared) - objects whose boxes are farther away won't be returned.
+    float max_dist2() const { return cur_max_dist2; }
+
+    // Shrink the search radius. Never grows it.
+    void shrink(float max_dist2) { cur_max_dist2 = std::min(cur_max_dist2, max_dist2); }
+
+    /* Return the index of the next-closest object, or false if there are no more objects within
+     * the search radius.
+     *
+     * out_dist2 is set to the squared distance from the query point to the object's bounding box.
+     */
+    bool next(size_t *out_match, float *out_dist2) {
+        while(!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), farther);
+            entry e = heap.back();
+            heap.pop_back();
+            if(e.dist2 > cur_max_dist2) {
+                // Everything left in the queue is at least this far away.
+                heap.clear();
+                return false;
+            }
+
+            const node& nd = tree[e.idx];
+            if(nd.is_leaf()) {
+                if(out_match) {
+                    *out_match = (size_t)(nd.num & 0x7FFFFFFFu);
+                }
+                if(out_dist2) {
+                    *out_dist2 = e.dist2;
+                }
+                return true;
+            }
+
+            size_t left = e.idx + 1;
+            push(left);
+            push(left + tree[left].subtree_size());
+        }
+        return false;
+    }
+
+private:
+    struct entry {
+        float  dist2; // squared distance from query point to node's box
+        size_t idx;   // index of node in tree
+    };
+
+    static bool farther(const entry& a, const entry& b) { return a.dist2 > b.dist2; }
+
+    void push(size_t idx) {
+        float dist2 = tree[idx].box.distance_squared(point);
+        if(dist2 <= cur_max_dist2) {
+            heap.push_back({dist2, idx});
+            std::push_heap(heap.begin(), heap.end(), farther);
+        }
+    }
+
+    node_list                tree;
+    vec3f                    point;
+    float                    start_dist2;
+    float                    cur_max_dist2;
+    std::vector<entry>       heap; // min-heap on dist2
+};
+
+inline bvh::nearest_query bvh::make_nearest_query(const vec3f& pt, float max_dist2) const {
+    return nearest_query(*this, pt, max_dist2);
+}
+
+inline bvh::ray_query bvh::make_ray_query(const vec3f& ray_origin, const vec3f& ray_norm_dir,
+                                          float max_t) const {
+    return ray_query(*this, ray_origin, ray_norm_dir, max_t);
+}
+
 } // END namespace obvi
 #endif // OBVI_BVH_HPP
@@ -0,0 +1,269 @@
+/* Public header for class that implements a 4-wide bounding-volume hierarchy (BVH4).
+ *
+ * A BVH4 is made by collapsing a regular (binary) BVH, so that each node has up to four children
+ * instead of two. The bounding boxes of all four children are stored in the parent node in
+ * structure-of-arrays form, so a query can be tested against all of them with a single set of
+ * SIMD instructions. The tree has about half as many levels as the binary tree it was made from,
+ * so queries do about half as many node fetches.
+ *
+ * Usage example:
+ * \code
+ * obvi::bvh bvh;
+ * bvh.generate(bboxes);
+ *
+ * obvi::bvh4 bvh4;
+ * bvh4.generate(bvh);
+ *
+ * auto pt_query = bvh4.make_query(bvh4::intersect_point(vec3f(1.0f, 2.5f, 1.2f)));
+ * size_t obj_idx;
+ * while(pt_query.next(&obj_idx)) {
+ *     printf("intersection: box# %zu\n", obj_idx);
+ * }
+ * \endcode
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_BVH4_HPP
+#define OBVI_BVH4_HPP
+
+#include <vector>
+#include <limits>
+
+#include <obvi/util/aligned_allocator.hpp>
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/simd.hpp>
+#include <obvi/util/vec3.hpp>
+
+namespace obvi {
+
+/* Iterator that conducts an intersection query on a 4-wide BVH (bvh4 or bvh4_compact).
+ *
+ * Same rules as bvh::query - multiple iterators can be used on the same tree in parallel, but
+ * it's not safe to modify the tree while iterators that point to it are being used.
+ *
+ * node_type:
+ *   The tree's node type. Must provide child[], valid_mask() and is_leaf(), like bvh4::node.
+ *
+ * intersect_func:
+ *   Functor that accepts a node as an argument, and returns a bitmask indicating which
+ *   of the node's children your object intersects (see bvh4::intersect_point, etc.).
+ *        uint32_t intersect_func(const node_type& node);
+ */
+template<typename node_type, typename intersect_func>
+struct wide_bvh_query {
+    static constexpr size_t width = 4;
+
+    using node_vector = std::vector<node_type, aligned_allocator<node_type, 64>>;
+
+    wide_bvh_query(const node_vector& targ, intersect_func ifunc)
+        : tree(targ), intersects(ifunc) { reset(); }
+
+    void reset() {
+        stack.clear();
+        num_pending = 0;
+        if(!tree.empty()) {
+            stack.push_back(0);
+        }
+    }
+
+    void reset(intersect_func ifunc) { reset(); intersects = ifunc; }
+
+    /* Return the index of the next object whose bounding box was intersected by the query.
+     * If no additional objects were found, returns false.
+     *
+     * The returned index corresponds to the bounding box's location in the vector of bounding
+     * boxes that was used to generate the binary BVH this tree was made from.
+     */
+    bool next(size_t *out_match) {
+        for(;;) {
+            if(num_pending > 0) {
+                // Return leaves found in the last node we tested, before testing any more nodes.
+                uint32_t obj_idx = pending[--num_pending];
+                if(out_match) {
+                    *out_match = (size_t)obj_idx;
+                }
+                return true;
+            }
+            if(stack.empty()) {
+                return false;
+            }
+
+            const node_type& nd = tree[stack.back()];
+            stack.pop_back();
+
+            // Go through children in reverse, so they come off the stacks in order.
+            uint32_t mask = intersects(nd) & nd.valid_mask();
+            for(size_t i=width; i-- > 0;) {
+                if(mask & (1u << i)) {
+                    uint32_t ref = nd.child[i];
+                    if(node_type::is_leaf(ref)) {
+                        pending[num_pending++] = ref & 0x7FFFFFFFu;
+                    } else {
+                        stack.push_back(ref);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    const node_vector&    tree;
+    intersect_func        intersects;
+    std::vector<uint32_t> stack;          // nodes left to test
+    uint32_t              pending[width]; // leaves left to return from the last tested node
+    size_t                num_pending = 0;
+};
+
+
+struct bvh4 {
+    static constexpr size_t width = 4;
+
+    void clear() {
+        tree.clear();
+        num_leaves = 0;
+        root_box.clear();
+    }
+
+    /* Create a new BVH4 by collapsing the given binary BVH.
+     *
+     * Any previously-generated tree data will be wiped first. The binary BVH isn't referenced
+     * after this call returns, so it can be cleared or re-used.
+     *
+     * At each level, the child with the largest surface area is repeatedly replaced by its own
+     * children until each node has four children (or only leaves are left).
+     */
+    void generate(const bvh& binary);
+
+    size_t size() const {
+        return num_leaves;
+    }
+
+    const bboxf& bounds() const {
+        return root_box;
+    }
+
+    // internal bvh4 node.
+    struct alignas(64) node {
+        float    min[3][width]; // min[axis][i] is the min corner of child i's box, along axis.
+        float    max[3][width]; // max[axis][i] is the max corner of child i's box, along axis.
+        uint32_t child[width];  // high bit == 0: 31 low bits are index of child node in tree.
+                                // high bit == 1: child is a leaf, 31 low bits are index of object.
+        uint32_t count;         // number of children in use (1-4), unused slots are at the end.
+
+        // Bitmask of children that are in use.
+        uint32_t valid_mask() const { return (1u << count) - 1; }
+        // True if the given child is a leaf (object), false if it's another node.
+        static bool is_leaf(uint32_t ref) { return ref > 0x7FFFFFFF; }
+    }; // 128 bytes (two cache lines)
+
+    template<typename intersect_func>
+    using query = wide_bvh_query<node, intersect_func>;
+
+    // Make an intersection query.
+    template<typename intersect_func>
+    query<intersect_func> make_query(intersect_func ifunc) const {
+        return query<intersect_func>(tree, ifunc);
+    }
+
+    // Read-only access to the tree nodes. The root is nodes()[0], and parents come before children.
+    const std::vector<node, aligned_allocator<node, 64>>& nodes() const {
+        return tree;
+    }
+
+
+    // intersection functors.
+    //
+    // These test a single query against all children of a node, and return a bitmask with bit i
+    // set if child i intersects the query.
+    struct intersect_point {
+        float4v point[3];
+        intersect_point(const vec3f& pt) : point{float4v(pt[0]), float4v(pt[1]), float4v(pt[2])} {}
+        uint32_t operator()(const node& nd) const {
+            uint32_t mask = 0xF;
+            for(size_t i=0; i<3; ++i) {
+                mask &= cmple_mask(float4v::load(nd.min[i]), point[i]);
+                mask &= cmple_mask(point[i], float4v::load(nd.max[i]));
+            }
+            return mask;
+        }
+    };
+    struct intersect_box {
+        float4v qmin[3];
+        float4v qmax[3];
+        bool    empty;
+        intersect_box(const bboxf& bx)
+            : qmin{float4v(bx.min_pt[0]), float4v(bx.min_pt[1]), float4v(bx.min_pt[2])},
+              qmax{float4v(bx.max_pt[0]), float4v(bx.max_pt[1]), float4v(bx.max_pt[2])},
+              empty(bx.is_empty()) {}
+        uint32_t operator()(const node& nd) const {
+            if(empty) {
+                return 0;
+            }
+            uint32_t mask = 0xF;
+            for(size_t i=0; i<3; ++i) {
+                mask &= cmple_mask(float4v::load(nd.min[i]), qmax[i]);
+                mask &= cmple_mask(qmin[i], float4v::load(nd.max[i]));
+            }
+            return mask;
+        }
+    };
+    struct intersect_ray {
+        float4v origin[3];
+        float4v inv_norm_dir[3];
+        intersect_ray(const vec3f& ray_origin, const vec3f &ray_norm_dir) {
+            vec3f inv = ray_norm_dir.inv();
+            for(size_t i=0; i<3; ++i) {
+                origin[i]       = float4v(ray_origin[i]);
+                inv_norm_dir[i] = float4v(inv[i]);
+            }
+        }
+        uint32_t operator()(const node& nd) const {
+            const float4v pinf(std::numeric_limits<float>::infinity());
+            const float4v ninf(-std::numeric_limits<float>::infinity());
+
+            // Same slab test as bvh::intersect_ray_packet, except it's one ray and four boxes.
+            float4v tmin = ninf;
+            float4v tmax = pinf;
+            for(size_t i=0; i<3; ++i) {
+                float4v t0 = (float4v::load(nd.min[i]) - origin[i]) * inv_norm_dir[i];
+                float4v t1 = (float4v::load(nd.max[i]) - origin[i]) * inv_norm_dir[i];
+                tmin = max(tmin, min(replace_nan(t0, ninf), replace_nan(t1, ninf)));
+                tmax = min(tmax, max(replace_nan(t0, pinf), replace_nan(t1, pinf)));
+            }
+            tmax = tmax * float4v(bboxf::ray_pad); // conservative, see bboxf::ray_pad
+            return cmple_mask(tmin, tmax) & cmple_mask(float4v(0.0f), tmax);
+        }
+    };
+
+private:
+    std::vector<node, aligned_allocator<node, 64>> tree; // root is tree[0], parents before children
+    size_t                                         num_leaves = 0;
+    bboxf                                          root_box;
+};
+
+
+} // END namespace obvi
+#endif // OBVI_BVH4_HPP
@@ -0,0 +1,111 @@
+/* Public header for the CUDA BVH backend (GPU builds and batch queries).
+ *
+ * bvh_cuda keeps a BVH in GPU memory, in the same node layout as bvh. It's meant to build the
+ * tree itself (same linear BVH as bvh_build_type::MORTON), or take one that was built on the CPU,
+ * and run big batches of point, box and ray queries against it with one GPU thread per query.
+ * Use it when a frame needs many thousands of queries (picking, collision checks) or a rebuild of
+ * a big scene, and the CPU is busy with other work.
+ *
+ * The CUDA kernels aren't part of the library yet, so for now every function just returns
+ * 'false' with an error message (the same as on a machine with no usable GPU). Callers can use
+ * it already and fall back to bvh, without any #ifdefs of their own.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_BVH_CUDA_HPP
+#define OBVI_BVH_CUDA_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/bvh.hpp>
+
+namespace obvi {
+
+struct bvh_cuda {
+    bvh_cuda();
+    ~bvh_cuda();
+
+    bvh_cuda(const bvh_cuda&)            = delete;
+    bvh_cuda& operator=(const bvh_cuda&) = delete;
+
+    bvh_cuda(bvh_cuda&&);
+    bvh_cuda& operator=(bvh_cuda&&);
+
+    // True if the library was built with CUDA support, and there's a GPU we can use. If not,
+    // out_error (if given) is set to the reason.
+    static bool available(std::string *out_error = nullptr);
+
+    // Free the GPU memory.
+    void clear();
+
+    // Number of objects the tree was built from.
+    size_t size() const;
+
+    /* Build the tree on the GPU from the given boxes (any previous tree is wiped first).
+     *
+     * The result is exactly the same as bvh::generate() with bvh_build_type::MORTON, so results
+     * don't change when you switch between the CPU and the GPU. Returns 'false' on any CUDA error,
+     * or if there are more than bvh::max_size boxes.
+     */
+    bool generate(const std::vector<bboxf>& boxes, std::string *out_error = nullptr);
+
+    // Copy a tree that was built on the CPU (any build type) to the GPU.
+    bool upload(const bvh& tree, std::string *out_error = nullptr);
+
+    // Copy the tree back from the GPU (e.g., to run the other query types on the CPU).
+    bool download(bvh& out_tree, std::string *out_error = nullptr) const;
+
+    /* Run one query per GPU thread, and store all of their matches (see bvh::query_batch()).
+     *
+     * Matches are in the same order as bvh::query would return them, so results are identical to
+     * the CPU. On failure, out is cleared.
+     */
+    bool query_batch(const std::vector<bvh::intersect_point>& queries, bvh::batch_result& out,
+                     std::string *out_error = nullptr) const;
+    bool query_batch(const std::vector<bvh::intersect_box>& queries, bvh::batch_result& out,
+                     std::string *out_error = nullptr) const;
+    bool query_batch(const std::vector<bvh::intersect_ray>& queries, bvh::batch_result& out,
+                     std::string *out_error = nullptr) const;
+
+    // Store only the first match of each query, or bvh::no_match (see bvh::query_batch_first()).
+    bool query_batch_first(const std::vector<bvh::intersect_point>& queries,
+                           std::vector<uint32_t>& out_first, std::string *out_error = nullptr) const;
+    bool query_batch_first(const std::vector<bvh::intersect_box>& queries,
+                           std::vector<uint32_t>& out_first, std::string *out_error = nullptr) const;
+    bool query_batch_first(const std::vector<bvh::intersect_ray>& queries,
+                           std::vector<uint32_t>& out_first, std::string *out_error = nullptr) const;
+
+private:
+    struct impl; // defined in bvh_cuda.cpp
+    std::unique_ptr<impl> data;
+};
+
+} // END namespace obvi
+#endif // OBVI_BVH_CUDA_HPP
@@ -51,9 +51,12 @@
 #ifndef OBVI_CAMERA3_HPP
 #define OBVI_CAMERA3_HPP
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 #include <obvi/util/affine3.hpp>
+#include <obvi/util/frustum.hpp>
 #include <obvi/util/math.hpp>
 
 namespace obvi {
@@ -179,6 +182,56 @@ struct camera3
         to_gl_internal(arr, view * model);
     }
 
+    // Return the six clipping planes of the camera's view volume, in world coords.
+    frustum<real> get_frustum() const {
+        // Rows of the projection matrix (see recalc_*() for layouts).
+        real rows[4][4];
+        switch(proj_type) {
+            case camera_type::ORTHOGRAPHIC: {
+                const real r[4][4] = {{p[0], 0, 0, p[4]}, {0, p[1], 0, p[5]}, {0, 0, p[2], p[3]},
+                                      {0, 0, 0, 1}};
+                std::copy(&r[0][0], &r[0][0] + 16, &rows[0][0]);
+            }
+            break;
+            case camera_type::PERSPECTIVE: {
+                const real r[4][4] = {{p[0], 0, p[4], 0}, {0, p[1], p[5], 0}, {0, 0, p[2], p[3]},
+                                      {0, 0, -1, 0}};
+                std::copy(&r[0][0], &r[0][0] + 16, &rows[0][0]);
+            }
+            break;
+        }
+
+        // Clip space planes are -w <= x,y,z <= w, so each eye-space plane is (row3 +/- row i).
+        // See: Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the
+        //      World-View-Projection Matrix"
+        frustum<real> eye;
+        for(size_t i=0; i<3; ++i) {
+            for(size_t s=0; s<2; ++s) {
+                real sgn = (s == 0)? real(1) : real(-1);
+                eye.set_plane(2*i + s, rows[3][0] + sgn*rows[i][0], rows[3][1] + sgn*rows[i][1],
+                              rows[3][2] + sgn*rows[i][2], rows[3][3] + sgn*rows[i][3]);
+            }
+        }
+
+        // View transform maps world coords into eye coords.
+        return eye.to_local(view);
+    }
+
+    /* Return the height on screen of something of the given size in world coords, at the given
+     * distance in front of the camera. Result is a fraction of the screen height.
+     */
+    real screen_fraction(real world_size, real distance) const {
+        // p[1] scales eye-space y to NDC, which spans 2 units from bottom to top.
+        switch(proj_type) {
+            case camera_type::ORTHOGRAPHIC:
+                return real(0.5) * p[1] * world_size;
+            case camera_type::PERSPECTIVE:
+                return real(0.5) * p[1] * world_size
+                       / std::max(distance, std::numeric_limits<real>::min());
+        }
+        return real(0);
+    }
+
     // Reverse the camera transform - convert vector in clip coords back to world coords.
     vec3<real> unproject(const vec3<real>& vec) const {
         vec3<real> res = vec;
@@ -297,7 +350,7 @@ private:
 
         res.x() = invp[0]*vec.x() + invp[4];
         res.y() = invp[1]*vec.y() + invp[5];
-        res.z() = -vec.z();
+        res.z() = real(-1);
 
         /*
           Since 'res' is a 3D vector (w is assumed to be 1), but the result of an inverse
@@ -330,28 +383,25 @@ private:
     // Compute (ortho projection * aff), store column-wise in arr for export to OpenGL.
     template<typename GLreal>
     void to_gl_internal_orthographic(std::array<GLreal, 16>& arr, const affine3<real>& aff) const {
-        const mat3<real>& rot = aff.rotation();
-        const vec3<real>& tr  = aff.translation();
+        const vec3<real>& tr = aff.translation();
 
         // Initialize with all zeros.
         arr.fill(GLreal(0));
 
         // Combine scale with rotation matrix, then compute upper-left 3x3 of result.
-        real s00 = rot(0,0) * aff.scale();
-        real s11 = rot(1,1) * aff.scale();
-        real s22 = rot(2,2) * aff.scale();
+        mat3<real> rot = aff.rotation() * aff.scale();
 
-        arr[colmajor(0,0)] = GLreal( p[0]*s00 );
+        arr[colmajor(0,0)] = GLreal( p[0]*rot(0,0) );
         arr[colmajor(0,1)] = GLreal( p[0]*rot(0,1) );
         arr[colmajor(0,2)] = GLreal( p[0]*rot(0,2) );
 
         arr[colmajor(1,0)] = GLreal( p[1]*rot(1,0) );
-        arr[colmajor(1,1)] = GLreal( p[1]*s11 );
+        arr[colmajor(1,1)] = GLreal( p[1]*rot(1,1) );
         arr[colmajor(1,2)] = GLreal( p[1]*rot(1,2) );
 
         arr[colmajor(2,0)] = GLreal( p[2]*rot(2,0) );
         arr[colmajor(2,1)] = GLreal( p[2]*rot(2,1) );
-        arr[colmajor(2,2)] = GLreal( p[2]*s22 );
+        arr[colmajor(2,2)] = GLreal( p[2]*rot(2,2) );
 
         // Compute upper-right 3x1 of result.
         arr[colmajor(0,3)] = GLreal( p[0]*tr.x() + p[4] );
@@ -364,28 +414,25 @@ private:
     // Compute (perspective projection * aff), store column-wise in arr for export to OpenGL.
     template<typename GLreal>
     void to_gl_internal_perspective(std::array<GLreal, 16>& arr, const affine3<real>& aff) const {
-        const mat3<real>& rot = aff.rotation();
-        const vec3<real>& tr  = aff.translation();
+        const vec3<real>& tr = aff.translation();
 
         // Initialize with all zeros.
         arr.fill(GLreal(0));
 
         // Combine scale with rotation matrix, then compute upper-left 3x3 of result.
-        real s00 = rot(0,0) * aff.scale();
-        real s11 = rot(1,1) * aff.scale();
-        real s22 = rot(2,2) * aff.scale();
+        mat3<real> rot = aff.rotation() * aff.scale();
 
-        arr[colmajor(0,0)] = GLreal( p[0]*s00      + p[4]*rot(2,0) );
+        arr[colmajor(0,0)] = GLreal( p[0]*rot(0,0) + p[4]*rot(2,0) );
         arr[colmajor(0,1)] = GLreal( p[0]*rot(0,1) + p[4]*rot(2,1) );
-        arr[colmajor(0,2)] = GLreal( p[0]*rot(0,2) + p[4]*s22 );
+        arr[colmajor(0,2)] = GLreal( p[0]*rot(0,2) + p[4]*rot(2,2) );
 
         arr[colmajor(1,0)] = GLreal( p[1]*rot(1,0) + p[5]*rot(2,0) );
-        arr[colmajor(1,1)] = GLreal( p[1]*s11      + p[5]*rot(2,1) );
-        arr[colmajor(1,2)] = GLreal( p[1]*rot(1,2) + p[5]*s22 );
+        arr[colmajor(1,1)] = GLreal( p[1]*rot(1,1) + p[5]*rot(2,1) );
+        arr[colmajor(1,2)] = GLreal( p[1]*rot(1,2) + p[5]*rot(2,2) );
 
         arr[colmajor(2,0)] = GLreal( p[2]*rot(2,0) );
         arr[colmajor(2,1)] = GLreal( p[2]*rot(2,1) );
-        arr[colmajor(2,2)] = GLreal( p[2]*s22 );
+        arr[colmajor(2,2)] = GLreal( p[2]*rot(2,2) );
 
         // Compute upper-right 3x1 of result.
         arr[colmajor(0,3)] = GLreal( p[0]*tr.x() + p[4]*tr.z() );
@@ -395,7 +442,7 @@ private:
         // Compute bottom row (1x4) of result.
         arr[colmajor(3,0)] = GLreal( -rot(2,0) );
         arr[colmajor(3,1)] = GLreal( -rot(2,1) );
-        arr[colmajor(3,2)] = GLreal( -s22 );
+        arr[colmajor(3,2)] = GLreal( -rot(2,2) );
         arr[colmajor(3,3)] = GLreal( -tr.z() );
     }
 };
@@ -0,0 +1,176 @@
+/* Header-only CPU copy of the hierarchical-Z depth pyramid used for occlusion culling.
+ *
+ * Level 0 is the depth buffer. Each level after that is half the size of the one before it
+ * (rounded down, but at least 1), and each texel holds the max (farthest) depth of the texels it
+ * covers in the level before it. Viewport sizes usually aren't powers of two, so the last column
+ * and row of a level also cover the leftover column and row of the level before it.
+ *
+ * This is the same pyramid built by shaders/hiz_build.comp and read by shaders/hiz_cull.comp.
+ * Keep them in sync: the copy here exists so the texel selection can be tested without a GL
+ * context.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_DEPTH_PYRAMID_HPP
+#define OBVI_DEPTH_PYRAMID_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace obvi {
+
+struct depth_pyramid {
+    // Texels of a level, given the level 0 texel range [x0,x1] x [y0,y1] they come from.
+    struct footprint {
+        int level = 0;
+        int x0 = 0, y0 = 0; // inclusive
+        int x1 = 0, y1 = 0; // inclusive, at most one more than x0 and y0
+    };
+
+    // Number of levels in a pyramid with the given level 0 size (0 if the size is empty).
+    static int num_levels(int width, int height) {
+        int levels = 0;
+        if(width > 0 && height > 0) {
+            for(int dim = std::max(width, height); dim > 0; dim /= 2) {
+                levels++;
+            }
+        }
+        return levels;
+    }
+
+    // Width or height of a level, given the width or height of level 0.
+    static int level_size(int size0, int level) {
+        return std::max(size0 >> level, 1);
+    }
+
+    /* Pick the level and the (at most) 2x2 texels of it that cover a rectangle in [0,1] texture
+     * coordinates.
+     *
+     * The rectangle is mapped to level 0 texels first, and then shifted down to the level. Scaling
+     * the coordinates by the level's own size instead would be wrong when sizes aren't powers of
+     * two, since the level's last texel covers more than its share of the viewport.
+     */
+    static footprint find_footprint(float u_min, float v_min, float u_max, float v_max,
+                                    int width, int height, int levels) {
+        footprint fp;
+        if(width <= 0 || height <= 0 || levels <= 0) {
+            return fp;
+        }
+        u_min = clamp01(u_min);
+        v_min = clamp01(v_min);
+        u_max = clamp01(u_max);
+        v_max = clamp01(v_max);
+
+        // Start at the level where the rectangle is at most one texel wide.
+        float size_px = std::max((u_max - u_min) * float(width), (v_max - v_min) * float(height));
+        int   level   = int(std::ceil(std::log2(std::max(size_px, 1.0f))));
+        level         = std::min(std::max(level, 0), levels - 1);
+
+        int x0 = std::min(int(u_min * float(width)),  width - 1);
+        int y0 = std::min(int(v_min * float(height)), height - 1);
+        int x1 = std::min(int(u_max * float(width)),  width - 1);
+        int y1 = std::min(int(v_max * float(height)), height - 1);
+
+        // Rounding can leave the texel range one too wide for that level, move up if so.
+        while(level < levels - 1 && ((x1 >> level) - (x0 >> level) > 1 ||
+                                     (y1 >> level) - (y0 >> level) > 1)) {
+            level++;
+        }
+
+        const int lw = level_size(width, level);
+        const int lh = level_size(height, level);
+        fp.level = level;
+        fp.x0    = std::min(x0 >> level, lw - 1);
+        fp.y0    = std::min(y0 >> level, lh - 1);
+        fp.x1    = std::min(x1 >> level, lw - 1);
+        fp.y1    = std::min(y1 >> level, lh - 1);
+        return fp;
+    }
+
+    // Build the pyramid from a row-major depth buffer. An empty size makes an empty pyramid.
+    void build(const float *depth, int width, int height) {
+        w = std::max(width, 0);
+        h = std::max(height, 0);
+        texels.assign((size_t)num_levels(w, h), std::vector<float>());
+        if(texels.empty()) {
+            return;
+        }
+        texels[0].assign(depth, depth + (size_t)w * (size_t)h);
+
+        for(int level = 1; level < levels(); ++level) {
+            const int sw = level_size(w, level - 1), sh = level_size(h, level - 1);
+            const int dw = level_size(w, level),     dh = level_size(h, level);
+            const std::vector<float>& src = texels[(size_t)level - 1];
+            std::vector<float>&       dst = texels[(size_t)level];
+            dst.assign((size_t)dw * (size_t)dh, 0.0f);
+
+            for(int y=0; y<dh; ++y) {
+                // Normally 2x2 source texels, plus the leftovers for the last row and column.
+                const int sy1 = (y == dh - 1)? sh - 1 : std::min(2 * y + 1, sh - 1);
+                for(int x=0; x<dw; ++x) {
+                    const int sx1 = (x == dw - 1)? sw - 1 : std::min(2 * x + 1, sw - 1);
+                    float d = 0.0f;
+                    for(int sy = 2 * y; sy <= sy1; ++sy) {
+                        for(int sx = 2 * x; sx <= sx1; ++sx) {
+                            d = std::max(d, src[(size_t)sy * (size_t)sw + (size_t)sx]);
+                        }
+                    }
+                    dst[(size_t)y * (size_t)dw + (size_t)x] = d;
+                }
+            }
+        }
+    }
+
+    int width() const  { return w; }
+    int height() const { return h; }
+    int levels() const { return (int)texels.size(); }
+
+    float at(int level, int x, int y) const {
+        return texels[(size_t)level][(size_t)y * (size_t)level_size(w, level) + (size_t)x];
+    }
+
+    // Farthest depth anywhere in the rectangle (conservative, may look at a few extra texels).
+    float max_depth(float u_min, float v_min, float u_max, float v_max) const {
+        if(texels.empty()) {
+            return 1.0f;
+        }
+        footprint fp = find_footprint(u_min, v_min, u_max, v_max, w, h, levels());
+        return std::max(std::max(at(fp.level, fp.x0, fp.y0), at(fp.level, fp.x1, fp.y0)),
+                        std::max(at(fp.level, fp.x0, fp.y1), at(fp.level, fp.x1, fp.y1)));
+    }
+
+private:
+    static float clamp01(float v) {
+        return std::min(std::max(v, 0.0f), 1.0f);
+    }
+
+    int w = 0;
+    int h = 0;
+    std::vector<std::vector<float>> texels; // one array per level, row-major
+};
+
+} // END namespace obvi
+#endif // OBVI_DEPTH_PYRAMID_HPP
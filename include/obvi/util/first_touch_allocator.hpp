@@ -0,0 +1,85 @@
+/* Header-only allocator that spreads big arrays over the NUMA nodes of the threads that use them.
+ *
+ * Operating systems put each page of memory on the NUMA node of the thread that writes to it
+ * first. std::vector constructs its elements on the calling thread, so without help a big array
+ * ends up on one node, and threads on every other node read it the slow way. This allocator
+ * writes to every page of big allocations from an OpenMP loop with static scheduling first, so
+ * each thread's share of the array is local to it (as long as the loops that fill and read the
+ * array use static scheduling too). Small allocations, and ones made from inside a parallel
+ * region, are left alone.
+ *
+ * Usage example:
+ * \code
+ * std::vector<float, obvi::first_touch_allocator<float>> values(n);
+ * \endcode
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_FIRST_TOUCH_ALLOCATOR_HPP
+#define OBVI_FIRST_TOUCH_ALLOCATOR_HPP
+
+#include <stddef.h>
+#include <memory>
+
+namespace obvi {
+
+/* Write to every page of the given memory from an OpenMP loop with static scheduling, if it's at
+ * least first_touch_min_bytes long and this isn't called from inside a parallel region.
+ */
+const size_t first_touch_min_bytes = size_t(1) << 20;
+void first_touch(void *ptr, size_t bytes);
+
+template<typename T>
+struct first_touch_allocator {
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = first_touch_allocator<U>;
+    };
+
+    first_touch_allocator() {}
+
+    template<typename U>
+    first_touch_allocator(const first_touch_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        T *ptr = std::allocator<T>().allocate(n);
+        first_touch(ptr, n * sizeof(T));
+        return ptr;
+    }
+
+    void deallocate(T *ptr, size_t n) {
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template<typename U>
+    bool operator==(const first_touch_allocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const first_touch_allocator<U>&) const { return false; }
+};
+
+} // END namespace obvi
+#endif // OBVI_FIRST_TOUCH_ALLOCATOR_HPP
@@ -0,0 +1,155 @@
+/* Header-only class that implements a view frustum (six clipping planes) in 3D space.
+ *
+ * Each plane is stored with its normal pointing into the frustum, so a point is inside the
+ * frustum if it's on the positive side of (or on) all six planes. Normals are unit-length, so
+ * plane.distance(pt) is the true signed distance.
+ *
+ * Usually obtained from a camera, see camera3::get_frustum().
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_FRUSTUM_HPP
+#define OBVI_FRUSTUM_HPP
+
+#include <cmath>
+
+#include <obvi/util/affine3.hpp>
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/vec3.hpp>
+
+namespace obvi {
+
+template<typename real>
+struct frustum
+{
+    using vec3r = vec3<real>;
+
+    enum plane_idx {
+        LEFT = 0, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, NUM_PLANES
+    };
+
+    vec3r normal[NUM_PLANES]; // unit normal of each plane, points into frustum
+    real  dist[NUM_PLANES];   // signed distance of plane from origin, along normal (times -1)
+
+    // Default frustum has degenerate planes that accept everything.
+    frustum() {
+        for(size_t i=0; i<NUM_PLANES; ++i) {
+            dist[i] = real(1);
+        }
+    }
+
+    // Set plane from the equation a*x + b*y + c*z + d >= 0 (normalizes it).
+    void set_plane(size_t i, real a, real b, real c, real d) {
+        real len = std::sqrt(a*a + b*b + c*c);
+        real inv = (len > real(0))? real(1) / len : real(0);
+        normal[i].set(a * inv, b * inv, c * inv);
+        dist[i] = d * inv;
+    }
+
+    // Signed distance from point to plane i (positive == inside).
+    real distance(size_t i, const vec3r& pt) const {
+        return normal[i].dot(pt) + dist[i];
+    }
+
+    bool intersects_point(const vec3r& pt) const {
+        for(size_t i=0; i<NUM_PLANES; ++i) {
+            if(distance(i, pt) < real(0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool intersects_sphere(const vec3r& center, real radius) const {
+        for(size_t i=0; i<NUM_PLANES; ++i) {
+            if(distance(i, center) < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Return true if the box might be inside the frustum.
+     *
+     * Conservative: boxes that are entirely outside a single plane are always rejected, but a
+     * few large boxes near the frustum's corners are accepted even though they're outside.
+     */
+    bool intersects_box(const bbox<real>& box) const {
+        if(box.is_empty()) {
+            return false;
+        }
+        for(size_t i=0; i<NUM_PLANES; ++i) {
+            // Test the corner of the box that's farthest along the plane normal.
+            const vec3r& n = normal[i];
+            vec3r far_pt((n[0] >= real(0))? box.max_pt[0] : box.min_pt[0],
+                         (n[1] >= real(0))? box.max_pt[1] : box.min_pt[1],
+                         (n[2] >= real(0))? box.max_pt[2] : box.min_pt[2]);
+            if(distance(i, far_pt) < real(0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Return true if the box is entirely inside the frustum.
+    bool contains_box(const bbox<real>& box) const {
+        if(box.is_empty()) {
+            return false;
+        }
+        for(size_t i=0; i<NUM_PLANES; ++i) {
+            // Test the corner of the box that's nearest along the plane normal.
+            const vec3r& n = normal[i];
+            vec3r near_pt((n[0] >= real(0))? box.min_pt[0] : box.max_pt[0],
+                          (n[1] >= real(0))? box.min_pt[1] : box.max_pt[1],
+                          (n[2] >= real(0))? box.min_pt[2] : box.max_pt[2]);
+            if(distance(i, near_pt) < real(0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Express this frustum in another coordinate system.
+     *
+     * to_this maps points from the other coordinate system into this frustum's coordinates (e.g.,
+     * pass an object's model transform to turn a world-space frustum into an object-space one).
+     */
+    frustum to_local(const affine3<real>& to_this) const {
+        // n.(s*R*x + t) + d = (s*R^T*n).x + (n.t + d)
+        frustum    res;
+        mat3<real> rot_t = to_this.rotation().trans();
+        for(size_t i=0; i<NUM_PLANES; ++i) {
+            vec3r n = rot_t * (normal[i] * to_this.scale());
+            res.set_plane(i, n[0], n[1], n[2], normal[i].dot(to_this.translation()) + dist[i]);
+        }
+        return res;
+    }
+};
+
+using frustumf = frustum<float>;
+using frustumd = frustum<double>;
+
+} // END namespace obvi
+#endif // OBVI_FRUSTUM_HPP
@@ -0,0 +1,144 @@
+/* Header-only 64-bit hash of a block of memory (xxHash64).
+ *
+ * Not cryptographic: meant for telling files and buffers apart (e.g., to key a cache on the
+ * contents of a source file), at close to memory bandwidth. Gives the same values as the
+ * reference xxHash64 implementation (https://github.com/Cyan4973/xxHash), on any platform.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_HASH_HPP
+#define OBVI_HASH_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // for memcpy
+
+namespace obvi {
+
+namespace hash_detail {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t prime3 = 0x165667B19E3779F9ull;
+    const uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+    inline uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    // Little-endian loads (memcpy, since the data may not be aligned).
+    inline uint64_t read64(const unsigned char *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        uint64_t v = 0;
+        for(int i=7; i>=0; --i) {
+            v = (v << 8) | p[i];
+        }
+        return v;
+#else
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+#endif
+    }
+    inline uint32_t read32(const unsigned char *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+             | ((uint32_t)p[3] << 24);
+#else
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+#endif
+    }
+
+    inline uint64_t lane_round(uint64_t acc, uint64_t input) {
+        acc += input * prime2;
+        acc  = rotl(acc, 31);
+        return acc * prime1;
+    }
+
+    inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+        acc ^= lane_round(0, val);
+        return acc * prime1 + prime4;
+    }
+} // END namespace hash_detail
+
+inline uint64_t hash64(const void *data, size_t size, uint64_t seed = 0) {
+    using namespace hash_detail;
+    const unsigned char *p   = static_cast<const unsigned char*>(data);
+    const unsigned char *end = p + size;
+
+    uint64_t h;
+    if(size >= 32) {
+        // Four independent lanes of 8 bytes each, so the multiplies can overlap.
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = lane_round(v1, read64(p));
+            v2 = lane_round(v2, read64(p + 8));
+            v3 = lane_round(v3, read64(p + 16));
+            v4 = lane_round(v4, read64(p + 24));
+            p += 32;
+        } while(p <= limit);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    } else {
+        h = seed + prime5;
+    }
+    h += (uint64_t)size;
+
+    // Remaining 0-31 bytes.
+    for(; p + 8 <= end; p += 8) {
+        h ^= lane_round(0, read64(p));
+        h  = rotl(h, 27) * prime1 + prime4;
+    }
+    if(p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * prime1;
+        h  = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for(; p < end; ++p) {
+        h ^= (uint64_t)(*p) * prime5;
+        h  = rotl(h, 11) * prime1;
+    }
+
+    // Final mix, so every input bit affects every output bit.
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // END namespace obvi
+#endif // OBVI_HASH_HPP
@@ -0,0 +1,102 @@
+/* Header-only class that picks a level of detail for each mesh chunk, from how big the chunk's
+ * simplification error would look on screen.
+ *
+ * Level 0 is the full-detail chunk, and level i > 0 is chunk.lods[i-1] (see simplify_chunks()).
+ * The coarsest level whose error covers at most max_pixel_error pixels is chosen. Distance is
+ * measured from the camera to the nearest point of the chunk's bounding box, so the estimate is
+ * conservative for every triangle in the chunk.
+ *
+ * To keep chunks that sit right at a switching distance from flickering between two levels, a
+ * chunk only moves to a coarser level once that level's error is (1 - hysteresis) of the limit,
+ * and only moves back to a finer level once its current error is (1 + hysteresis) of the limit.
+ *
+ * Example:
+ * \code
+ * obvi::lod_selector lod;
+ * lod.set_view(camera, viewport_height_px);
+ * vec3f  cam_local = inv_model * camera.get_position();
+ * size_t level     = lod.select(chunk, cam_local, model.scale(), last_level);
+ * \endcode
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_LOD_HPP
+#define OBVI_LOD_HPP
+
+#include <cmath>
+
+#include <obvi/util/camera3.hpp>
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/vec3.hpp>
+
+namespace obvi {
+
+struct lod_selector {
+    float max_pixel_error = 1.0f; // largest error to allow on screen, in pixels
+    float hysteresis      = 0.2f; // fraction of max_pixel_error, see top of file
+
+    // Set the camera and viewport height (in pixels) used for this frame.
+    void set_view(const camera3f& cam, float viewport_height_px) {
+        camera = cam;
+        height = viewport_height_px;
+    }
+
+    /* Size on screen, in pixels, of an error in mesh coords, at the chunk's nearest point.
+     *
+     * cam_local is the camera position in mesh coords, and scale is the uniform scale of the
+     * mesh-to-world transform (see affine3::scale()).
+     */
+    float pixel_error(float error, const bboxf& bounds, const vec3f& cam_local, float scale) const {
+        float dist = std::sqrt(bounds.distance_squared(cam_local)) * std::abs(scale);
+        return camera.screen_fraction(error * std::abs(scale), dist) * height;
+    }
+
+    // Choose a level for the chunk, given the level it was drawn with last frame.
+    size_t select(const mesh_chunk& chunk, const vec3f& cam_local, float scale,
+                  size_t prev_level) const {
+        // Pixels per unit of error, at the nearest point of the chunk.
+        float  px    = pixel_error(1.0f, chunk.bounds, cam_local, scale);
+        size_t level = 0;
+        for(size_t i=1; i<=chunk.num_lods; ++i) {
+            float limit = max_pixel_error;
+            if(i > prev_level) {
+                limit *= 1.0f - hysteresis;
+            } else if(i == prev_level) {
+                limit *= 1.0f + hysteresis;
+            }
+            if(chunk.lods[i-1].error * px <= limit) {
+                level = i;
+            }
+        }
+        return level;
+    }
+
+private:
+    camera3f camera;
+    float    height = 1.0f;
+};
+
+} // END namespace obvi
+#endif // OBVI_LOD_HPP
@@ -0,0 +1,81 @@
+/* Public header for read-only memory-mapped files.
+ *
+ * Maps a whole file into the process's address space, so it can be parsed in place (no read()
+ * calls, and no copy of the file contents into a separate buffer). Pages are loaded by the OS on
+ * demand, so multi-GB files can be mapped even if they don't fit in RAM all at once.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_MAPPED_FILE_HPP
+#define OBVI_MAPPED_FILE_HPP
+
+#include <string>
+#include <utility>
+
+namespace obvi {
+
+struct mapped_file {
+    mapped_file() {}
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&)            = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other) { *this = std::move(other); }
+    mapped_file& operator=(mapped_file&& other);
+
+    /* Map the given file into memory (read-only).
+     *
+     * Any previously mapped file is closed first. Returns 'false' if the file couldn't be
+     * opened or mapped. Empty files can be opened, but data() will be null.
+     */
+    bool open(const std::string& path);
+
+    void close();
+
+    bool is_open() const {
+        return opened;
+    }
+
+    const char* data() const {
+        return ptr;
+    }
+
+    size_t size() const {
+        return len;
+    }
+
+private:
+    const char* ptr    = nullptr;
+    size_t      len    = 0;
+    bool        opened = false;
+#ifdef _WIN32
+    void*       file_handle = nullptr;
+    void*       map_handle  = nullptr;
+#endif
+};
+
+} // END namespace obvi
+#endif // OBVI_MAPPED_FILE_HPP
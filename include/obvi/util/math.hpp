@@ -79,6 +79,17 @@ namespace obvi {
 #endif
     }
 
+    static inline uint32_t count_leading_zeros_64(uint64_t x) {
+#if defined(__GNUC__)
+        // GCC or Clang
+        return (x > 0)? (uint32_t)__builtin_clzll(x) : 64u;
+#else
+        // Visual Studio (_BitScanReverse64 is only available on 64-bit targets) and others.
+        uint32_t hi = (uint32_t)(x >> 32);
+        return (hi > 0)? count_leading_zeros(hi) : 32u + count_leading_zeros((uint32_t)x);
+#endif
+    }
+
     /* Expand a 10-bit integer into 30 bits by inserting 2 zeros above each bit.
      *
      * E.g., 1111111111 becomes 001001001001001001001001001001.
@@ -122,5 +133,42 @@ namespace obvi {
         return (xx * 4) + (yy * 2) + zz;
     }
 
+    /* Expand a 21-bit integer into 63 bits by inserting 2 zeros above each bit.
+     *
+     * This is a helper function for morton_encode_63.
+     */
+    static inline uint64_t expand_bits_63(uint64_t v)
+    {
+        v = v & 0x1FFFFFu; // mask off everything above first 21 bits.
+        v = (v | (v << 32)) & 0x001F00000000FFFFull;
+        v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+        v = (v | (v <<  8)) & 0x100F00F00F00F00Full;
+        v = (v | (v <<  4)) & 0x10C30C30C30C30C3ull;
+        v = (v | (v <<  2)) & 0x1249249249249249ull;
+        return v;
+    }
+
+    const uint32_t morton_63_max = 1 << 21u; // 21 bits per dim
+
+    /* Convert a 3D point into a 63-bit morton code.
+     *
+     * Same as morton_encode_30, except that each value (x,y,z) must lie on the range
+     * [0,morton_63_max). This divides each dimension into ~2 million buckets instead of 1024, so
+     * far fewer objects share the same code in large, detailed scenes.
+     */
+    template<typename real>
+    static inline uint64_t morton_encode_63(real x, real y, real z) {
+        // Clamp x,y,z to [0,2^21 - 1].
+        x = std::min(std::max(x, real(0)), real(morton_63_max - 1));
+        y = std::min(std::max(y, real(0)), real(morton_63_max - 1));
+        z = std::min(std::max(z, real(0)), real(morton_63_max - 1));
+        // Truncate value to integer, then pass to expand_bits.
+        uint64_t xx = expand_bits_63(uint64_t(x));
+        uint64_t yy = expand_bits_63(uint64_t(y));
+        uint64_t zz = expand_bits_63(uint64_t(z));
+        // Interleave bits from the expanded x,y,z values, to form a single 63-bit code.
+        return (xx * 4) + (yy * 2) + zz;
+    }
+
 } // END namespace obvi
 #endif // OBVI_MATH_HPP
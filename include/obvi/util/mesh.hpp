@@ -0,0 +1,269 @@
+/* Public header for triangle meshes, and the functions that load them from disk.
+ *
+ * Supported file formats:
+ *   STL - binary and ASCII.
+ *   PLY - binary (little or big endian) and ASCII. Reads vertex positions, optional per-vertex
+ *         colors (red/green/blue/alpha), and faces. Polygons are split into triangle fans.
+ *   OBJ - vertex positions and faces (texture coordinates and normals are skipped). Polygons are
+ *         split into triangle fans, negative (relative) indices are supported.
+ *
+ * Files are memory-mapped and parsed in place, straight into the final mesh arrays (no
+ * intermediate copies). Binary STL, binary PLY vertex data, and OBJ files are parsed in parallel.
+ *
+ * Usage example:
+ * \code
+ * obvi::mesh  m;
+ * std::string err;
+ * if(!obvi::load_mesh("part.stl", m, &err)) {
+ *     printf("error: %s\n", err.c_str());
+ * }
+ *
+ * obvi::optimize_mesh(m); // weld duplicate vertices, reorder for GPU caches
+ *
+ * std::vector<obvi::bboxf> boxes;
+ * m.triangle_boxes(boxes);
+ *
+ * obvi::bvh bvh;
+ * bvh.generate(boxes); // object index in bvh == triangle index in mesh
+ * \endcode
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_MESH_HPP
+#define OBVI_MESH_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <obvi/util/affine3.hpp>
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/vec3.hpp>
+
+namespace obvi {
+
+/* Ray <-> triangle intersection (Moller & Trumbore, "Fast, Minimum Storage Ray/Triangle
+ * Intersection", 1997). Both sides of the triangle count.
+ *
+ * The ray direction doesn't need to be normalized, out_t is measured in multiples of it. Returns
+ * true if the ray hits the triangle at a distance on [0,max_t].
+ */
+inline bool intersect_ray_triangle(const vec3f& origin, const vec3f& dir, const vec3f& a,
+                                   const vec3f& b, const vec3f& c, float max_t, float *out_t) {
+    const vec3f e1  = b - a;
+    const vec3f e2  = c - a;
+    const vec3f p   = dir.cross(e2);
+    const float det = e1.dot(p);
+    if(det == 0.0f) {
+        return false; // ray is parallel to the triangle, or the triangle is degenerate
+    }
+    // Comparisons are written so that NaNs (from a nearly-zero det) count as a miss.
+    const float inv_det = 1.0f / det;
+    const vec3f s = origin - a;
+    const float u = s.dot(p) * inv_det;
+    if(!(u >= 0.0f && u <= 1.0f)) {
+        return false;
+    }
+    const vec3f q = s.cross(e1);
+    const float v = dir.dot(q) * inv_det;
+    if(!(v >= 0.0f && u + v <= 1.0f)) {
+        return false;
+    }
+    const float t = e2.dot(q) * inv_det;
+    if(!(t >= 0.0f && t <= max_t)) {
+        return false;
+    }
+    if(out_t) {
+        *out_t = t;
+    }
+    return true;
+}
+
+struct mesh {
+    std::vector<vec3f>    positions; // vertex positions
+    std::vector<uint32_t> colors;    // optional RGBA8 color of each vertex (R in low byte)
+    std::vector<uint32_t> indices;   // three vertex indices per triangle
+
+    void clear() {
+        positions.clear();
+        colors.clear();
+        indices.clear();
+    }
+
+    size_t num_vertices() const {
+        return positions.size();
+    }
+
+    size_t num_triangles() const {
+        return indices.size() / 3;
+    }
+
+    bool has_colors() const {
+        return !colors.empty();
+    }
+
+    // Get the three corners of the given triangle.
+    void triangle(size_t tri_idx, vec3f& a, vec3f& b, vec3f& c) const {
+        const uint32_t *idx = indices.data() + 3 * tri_idx;
+        a = positions[idx[0]];
+        b = positions[idx[1]];
+        c = positions[idx[2]];
+    }
+
+    // Calculate the bounding box of all the vertices.
+    bboxf bounds() const;
+
+    // Calculate the bounding box of every triangle (in parallel), for use with bvh::generate().
+    void triangle_boxes(std::vector<bboxf>& out_boxes) const;
+
+    /* Find the closest of triangles [first_tri, first_tri + num_tris) that the ray hits at a
+     * distance on [0,max_t] (see intersect_ray_triangle()). Returns false if none are hit,
+     * otherwise out_tri and out_t are set to the closest hit.
+     */
+    bool intersect_ray(const vec3f& origin, const vec3f& dir, size_t first_tri, size_t num_tris,
+                       float max_t, size_t *out_tri, float *out_t) const;
+};
+
+enum class mesh_format {
+    UNKNOWN, // guess from file extension
+    STL,
+    PLY,
+    OBJ
+};
+
+/* Load a triangle mesh from the given file.
+ *
+ * Any previous contents of out_mesh are wiped first. If format is UNKNOWN, it's picked based on
+ * the file extension (case-insensitive).
+ *
+ * Returns 'false' if the file couldn't be read or parsed. If out_error isn't null, it's set to a
+ * short description of the problem.
+ */
+bool load_mesh(const std::string& path, mesh& out_mesh, std::string *out_error = nullptr,
+               mesh_format format = mesh_format::UNKNOWN);
+
+/* Same as load_mesh(), but parse a file that's already in memory.
+ *
+ * The format must be specified (it can't be guessed without a file name).
+ */
+bool parse_mesh(const char *data, size_t size, mesh_format format, mesh& out_mesh,
+                std::string *out_error = nullptr);
+
+/* Merge vertices that have exactly the same position and color, and remove triangles that become
+ * degenerate (two or more corners at the same vertex).
+ *
+ * STL files (and some OBJ/PLY exporters) store every triangle corner separately, so this usually
+ * shrinks the vertex arrays by a factor of ~6 on closed meshes.
+ */
+void weld_vertices(mesh& m);
+
+/* Reorder triangles to make good use of the GPU's post-transform vertex cache.
+ *
+ * Uses Tom Forsyth's "Linear-Speed Vertex Cache Optimisation" (greedy, scores vertices by their
+ * position in a simulated LRU cache and by how many triangles still need them), so the result is
+ * good for any cache size.
+ */
+void optimize_vertex_cache(mesh& m);
+
+/* Reorder vertices to match the order they're first used by the triangles, so vertex fetches
+ * walk memory more or less sequentially. Vertices that aren't used by any triangle are dropped.
+ *
+ * Run this after optimize_vertex_cache().
+ */
+void optimize_vertex_fetch(mesh& m);
+
+// Run weld_vertices(), optimize_vertex_cache() and optimize_vertex_fetch(), in that order.
+void optimize_mesh(mesh& m);
+
+// Simplified version of a mesh chunk (see simplify_chunks()).
+struct mesh_lod {
+    uint32_t first_index = 0; // offset of first index in the LOD index list (not mesh.indices)
+    uint32_t num_indices = 0; // 3 * number of triangles
+    float    error       = 0; // estimated distance from the full-detail surface, in mesh coords
+};
+
+// Contiguous range of triangles in a mesh, used to draw (or skip) parts of the mesh separately.
+struct mesh_chunk {
+    static constexpr size_t max_lods = 4;
+
+    uint32_t first_index; // offset of first index in mesh.indices (3 * first triangle)
+    uint32_t num_indices; // 3 * number of triangles
+    bboxf    bounds;      // bounding box of all the chunk's triangles
+
+    uint32_t num_lods = 0; // number of simplified versions, each coarser than the one before it
+    mesh_lod lods[max_lods];
+};
+
+/* Reorder triangles into spatially compact chunks of at most max_tris triangles each, so the
+ * renderer can cull whole chunks at a time.
+ *
+ * Chunks are subtrees of a bvh built over the triangles (small neighboring subtrees are merged).
+ * Triangles inside each chunk are ordered the same way as optimize_vertex_cache() would, so run
+ * this instead of optimize_vertex_cache(), then run optimize_vertex_fetch().
+ */
+void partition_mesh(mesh& m, std::vector<mesh_chunk>& out_chunks, size_t max_tris = 4096);
+
+/* Build up to max_lods simplified versions of each chunk, with about half as many triangles per
+ * level, by quadric error edge collapse (Garland & Heckbert, "Surface Simplification Using
+ * Quadric Error Metrics", 1997). Edges are collapsed onto one of their existing vertices, so the
+ * levels index into the same vertex list as the full-detail mesh.
+ *
+ * Vertices on chunk borders and on open edges of the mesh are never moved, so neighboring chunks
+ * still meet without cracks when drawn at different levels.
+ *
+ * Triangles of every level are appended to out_lod_indices, and each chunk's lods[] are set to
+ * ranges in that list. Levels that wouldn't remove at least a quarter of the previous level's
+ * triangles are left out. Run after optimize_vertex_fetch(), since the levels aren't remapped.
+ */
+void simplify_chunks(const mesh& m, std::vector<mesh_chunk>& chunks,
+                     std::vector<uint32_t>& out_lod_indices,
+                     size_t max_lods = mesh_chunk::max_lods);
+
+/* Vertex positions of a mesh, quantized to 16 bits for upload to the GPU.
+ *
+ * Positions are stored relative to the mesh's bounding box, scaled so the longest side of the box
+ * maps to [0,65535]. Meant to be read as a normalized unsigned short attribute (value in [0,1]),
+ * then mapped back to original coordinates by prepending the dequantize transform to the model
+ * matrix. Max error is 1/131070th of the longest side of the box, on each axis.
+ *
+ * Scaling is uniform (same on every axis) so the dequantize transform fits in an affine3.
+ */
+struct quantized_positions {
+    static constexpr size_t stride = 4; // values per vertex: x, y, z, and padding to 8 bytes
+
+    std::vector<uint16_t> values;     // stride values per vertex
+    affine3f              dequantize; // maps normalized values back to original coordinates
+};
+
+void quantize_positions(const mesh& m, quantized_positions& out);
+
+/* Average number of vertex cache misses per triangle (ACMR), if drawn on a GPU with a FIFO
+ * post-transform cache of the given size. Lower is better: 3 is the worst case, ~0.5-0.7 is
+ * typical for well-ordered meshes.
+ */
+float vertex_cache_miss_ratio(const mesh& m, size_t cache_size = 16);
+
+} // END namespace obvi
+#endif // OBVI_MESH_HPP
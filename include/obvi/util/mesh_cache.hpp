@@ -0,0 +1,118 @@
+/* Public header for mesh cache files.
+ *
+ * Loading, welding, partitioning and simplifying a big mesh takes a long time, so the result is
+ * saved to a cache file named after a hash of the source file's contents. Reopening the same
+ * source then maps the cache file into memory instead of redoing all that work; the chunk bvh
+ * uses the mapped nodes in place (see bvh::borrow()).
+ *
+ * File layout (all little-endian, every section starts on a 64-byte boundary):
+ *
+ *     header:   magic "OBVICACH", format version, header size, hash of the source file
+ *     sections: table of (offset, count, element size) for each array below
+ *     positions, colors, indices, chunks, lod indices, chunk bvh nodes
+ *
+ * Everything is checked when a file is loaded (sizes, index ranges, bvh structure), so a
+ * truncated or corrupt cache file is rejected instead of crashing the renderer.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_MESH_CACHE_HPP
+#define OBVI_MESH_CACHE_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/mapped_file.hpp>
+#include <obvi/util/mesh.hpp>
+
+namespace obvi {
+
+// A mesh that's been split into chunks and simplified, plus a bvh over the chunk bounds.
+struct prepared_mesh {
+    mesh                    geom;
+    std::vector<mesh_chunk> chunks;
+    std::vector<uint32_t>   lod_indices; // triangles of the chunks' simplified levels
+    bvh                     chunk_bvh;   // object index == chunk index
+    mapped_file             cache_file;  // open if chunk_bvh borrows its nodes from a cache file
+
+    // (Re)build chunk_bvh from the chunk bounds.
+    void generate_chunk_bvh();
+};
+
+// File extension of cache files.
+extern const char *const mesh_cache_extension;
+
+// File name (no directory) of the cache file for a source file with the given hash.
+std::string mesh_cache_name(uint64_t source_hash);
+
+/* Hash the contents of a file with hash64(), to use as a cache key.
+ *
+ * Returns 'false' if the file couldn't be read. If out_error isn't null, it's set to a short
+ * description of the problem.
+ */
+bool hash_file(const std::string& path, uint64_t *out_hash, std::string *out_error = nullptr);
+
+/* Save a prepared mesh (including its chunk bvh) to the given cache file.
+ *
+ * The file is written under a temporary name first, then renamed, so another process never sees
+ * a half-written file. Returns 'false' if the file couldn't be written.
+ */
+bool save_mesh_cache(const std::string& path, uint64_t source_hash, const prepared_mesh& pm,
+                     std::string *out_error = nullptr);
+
+// Sizes of the arrays in a cache file (see read_mesh_cache_info()).
+struct mesh_cache_info {
+    size_t num_vertices    = 0;
+    size_t num_indices     = 0; // 3 * number of full-detail triangles
+    size_t num_chunks      = 0;
+    size_t num_lod_indices = 0;
+    bool   has_colors      = false;
+    size_t file_size       = 0;
+};
+
+/* Read the sizes of the arrays in a cache file, without loading them.
+ *
+ * Only the header is checked, so load_mesh_cache() can still fail on the same file. Returns
+ * 'false' for the same reasons as load_mesh_cache().
+ */
+bool read_mesh_cache_info(const std::string& path, uint64_t source_hash, mesh_cache_info& out,
+                          std::string *out_error = nullptr);
+
+/* Load a prepared mesh from the given cache file.
+ *
+ * The mesh arrays are copied out of the file, but the chunk bvh borrows its nodes from the
+ * mapped file, which is kept open in out.cache_file. Any previous contents of out are wiped
+ * first.
+ *
+ * Returns 'false' (and leaves out empty) if the file doesn't exist, was made from a source file
+ * with a different hash, was written by a different version of this code, or is corrupt.
+ */
+bool load_mesh_cache(const std::string& path, uint64_t source_hash, prepared_mesh& out,
+                     std::string *out_error = nullptr);
+
+} // END namespace obvi
+#endif // OBVI_MESH_CACHE_HPP
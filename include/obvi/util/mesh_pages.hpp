@@ -0,0 +1,87 @@
+/* Public header for splitting prepared meshes into pages that can be loaded one at a time.
+ *
+ * Meshes bigger than the memory of the machine that views them can't be loaded all at once.
+ * Instead, a mesh is split once into pages (subtrees of whole chunks, taken from the top levels
+ * of the chunk bvh, so every page is spatially compact), and every page is saved to its own
+ * cache file. A residency manager (see residency.hpp) then loads and drops pages depending on
+ * what the camera can see.
+ *
+ * Every mesh also gets a proxy: one chunk per page, holding the coarsest level of detail of the
+ * page's chunks. The proxy is always loaded, and is drawn in place of pages that aren't.
+ *
+ * The source mesh still has to fit in memory once, while it's being split.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_MESH_PAGES_HPP
+#define OBVI_MESH_PAGES_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <obvi/util/mesh_cache.hpp>
+
+namespace obvi {
+
+const size_t default_page_tris = size_t(1) << 20; // full-detail triangles per page
+
+/* Split a prepared mesh into pages of at most max_tris full-detail triangles each (a page can
+ * only be bigger if it's a single chunk). Each page is a prepared mesh of its own, with just the
+ * vertices its chunks use, in mesh coords.
+ *
+ * out_proxy gets one chunk per page (chunk i is a stand-in for page i, with the same bounds), and
+ * a chunk bvh over them. pm.chunk_bvh is used to pick the pages, it's generated first if it
+ * doesn't match the chunks.
+ */
+void split_mesh_pages(const prepared_mesh& pm, size_t max_tris,
+                      std::vector<prepared_mesh>& out_pages, prepared_mesh& out_proxy);
+
+// Cache key of a mesh split with the given page size (pages and proxy are named after it).
+uint64_t mesh_page_key(uint64_t source_hash, size_t max_tris);
+
+// File names (no directory) of the proxy and the pages of a split mesh.
+std::string mesh_proxy_name(uint64_t key);
+std::string mesh_page_name(uint64_t key, size_t page_idx);
+
+/* Save the pages of a split mesh in the given directory, then its proxy. Since the proxy is
+ * written last, load_mesh_proxy() only works once every page has been saved.
+ */
+bool save_mesh_pages(const std::string& dir, uint64_t key, const std::vector<prepared_mesh>& pages,
+                     const prepared_mesh& proxy, std::string *out_error = nullptr);
+
+/* Load the proxy of a split mesh, and the sizes of its pages (out_pages[i] is proxy chunk i),
+ * so memory can be budgeted before any pages are loaded. Returns 'false' if the proxy or any of
+ * the pages is missing or unreadable.
+ */
+bool load_mesh_proxy(const std::string& dir, uint64_t key, prepared_mesh& out_proxy,
+                     std::vector<mesh_cache_info>& out_pages, std::string *out_error = nullptr);
+
+// Load one page of a split mesh (see load_mesh_cache()).
+bool load_mesh_page(const std::string& dir, uint64_t key, size_t page_idx, prepared_mesh& out,
+                    std::string *out_error = nullptr);
+
+} // END namespace obvi
+#endif // OBVI_MESH_PAGES_HPP
@@ -0,0 +1,77 @@
+/* Public header for an allocator of ranges inside a block of fixed size (e.g., a GPU buffer).
+ *
+ * Only keeps track of offsets, it never touches the memory itself. Free ranges are kept sorted by
+ * offset and merged with their neighbors when freed, and each allocation takes the smallest free
+ * range it fits in (best fit), which keeps fragmentation low when blocks of many different sizes
+ * come and go.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_RANGE_ALLOCATOR_HPP
+#define OBVI_RANGE_ALLOCATOR_HPP
+
+#include <stddef.h>
+#include <map>
+
+namespace obvi {
+
+struct range_allocator {
+    range_allocator() {}
+    explicit range_allocator(size_t capacity) { reset(capacity); }
+
+    // Free everything, and set the total size.
+    void reset(size_t capacity);
+
+    // Add free space at the end (new_capacity must not be smaller than the current capacity).
+    void grow(size_t new_capacity);
+
+    /* Reserve size units. Returns 'false' if there's no free range big enough (grow() and try
+     * again). Empty ranges always succeed, with offset 0.
+     */
+    bool allocate(size_t size, size_t *out_offset);
+
+    // Release a range returned by allocate() (size must match).
+    void free(size_t offset, size_t size);
+
+    size_t capacity() const {
+        return cap;
+    }
+
+    // Total size of all allocated ranges.
+    size_t used() const {
+        return num_used;
+    }
+
+    // Size of the biggest range that allocate() could return right now.
+    size_t largest_free() const;
+
+private:
+    std::map<size_t, size_t> free_ranges; // offset -> size, no two ranges touch
+    size_t                   cap      = 0;
+    size_t                   num_used = 0;
+};
+
+} // END namespace obvi
+#endif // OBVI_RANGE_ALLOCATOR_HPP
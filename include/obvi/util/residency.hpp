@@ -0,0 +1,147 @@
+/* Public header for deciding which pages of a scene to keep in host and GPU memory.
+ *
+ * Every page (see mesh_pages.hpp) is on disk, loaded into host memory, or also sent to the GPU.
+ * Each frame, update() rates every page by how big it looks from the camera (pages outside the
+ * view frustum count for less, so pages just out of view get prefetched), picks the best pages
+ * that fit into the host and GPU budgets, and says what to load, upload and evict to get there.
+ *
+ * Pages that are no longer wanted aren't evicted right away: they're only dropped when their
+ * memory is needed for a better page, least recently wanted first (LRU), so looking back at
+ * something that was just seen doesn't have to reload it.
+ *
+ * Pages on the GPU are always also in host memory (the renderer needs their triangles for
+ * picking), so the GPU budget should be smaller than the host budget.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_RESIDENCY_HPP
+#define OBVI_RESIDENCY_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include <obvi/util/affine3.hpp>
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/camera3.hpp>
+
+namespace obvi {
+
+enum class residency : uint8_t {
+    DISK,    // not loaded
+    LOADING, // load requested, not done yet (host memory is already counted)
+    HOST,    // in host memory
+    GPU      // in host memory, and sent to the GPU
+};
+
+struct residency_manager {
+    size_t host_budget    = size_t(4) << 30; // bytes of pages allowed in host memory
+    size_t gpu_budget     = size_t(1) << 30; // bytes of pages allowed on the GPU
+    size_t max_loads      = 4;     // pages being loaded at the same time
+    float  min_pixels     = 2.0f;  // pages smaller than this on screen aren't wanted at all
+    float  outside_weight = 0.25f; // priority factor for pages outside the view frustum
+
+    // What the caller needs to do after update(), in this order.
+    struct actions {
+        std::vector<size_t> evict_gpu;  // free GPU copy (page stays in host memory)
+        std::vector<size_t> evict_host; // free host copy (GPU copy was already in evict_gpu)
+        std::vector<size_t> load;       // start loading, call loaded() when done
+        std::vector<size_t> upload;     // send to the GPU (page must already be loaded)
+    };
+
+    // Remove all pages.
+    void clear();
+
+    // Add a page, and return its index. Sizes are in bytes.
+    size_t add_page(size_t host_bytes, size_t gpu_bytes);
+
+    /* Add a copy of a page to the scene, and return its index. Bounds are in page coords, model
+     * transforms them into world coords. A page is as important as its most important copy.
+     */
+    size_t add_instance(size_t page_idx, const bboxf& bounds, const affine3f& model);
+
+    // Move an instance.
+    void set_transform(size_t instance_idx, const affine3f& model);
+
+    /* Rate every page from the given camera (viewport height is in pixels), and fill in what
+     * needs to happen to bring the best pages in. Page states are changed right away (e.g., a
+     * page in out.upload is already GPU), so the caller must do everything it's asked to.
+     */
+    void update(const camera3f& camera, float viewport_height, actions& out);
+
+    /* Finish a load requested by update(). If it failed, the page goes back to DISK, and won't
+     * be requested again.
+     */
+    void loaded(size_t page_idx, bool ok);
+
+    residency state(size_t page_idx) const {
+        return pages[page_idx].state;
+    }
+
+    // How big the page looked on screen in the last update(), in pixels (0 if not wanted).
+    float priority(size_t page_idx) const {
+        return pages[page_idx].priority;
+    }
+
+    size_t num_pages() const {
+        return pages.size();
+    }
+
+    // Number of pages in the given state.
+    size_t count(residency state) const;
+
+    // Bytes of (loading and) loaded pages in host memory, and of pages on the GPU.
+    size_t host_used() const { return host_bytes; }
+    size_t gpu_used() const  { return gpu_bytes; }
+
+private:
+    struct page {
+        size_t    host_size;
+        size_t    gpu_size;
+        residency state       = residency::DISK;
+        bool      failed      = false;
+        float     priority    = 0.0f;
+        uint64_t  host_wanted = 0; // last update() the page was wanted in host memory
+        uint64_t  gpu_wanted  = 0; // last update() the page was wanted on the GPU
+    };
+    struct instance {
+        size_t page_idx;
+        bboxf  bounds;       // page coords
+        bboxf  world_bounds;
+    };
+
+    bool make_room(bool gpu, size_t bytes, actions& out);
+
+    std::vector<page>     pages;
+    std::vector<instance> instances;
+    std::vector<size_t>   order; // pages by priority, reused every update()
+    uint64_t              frame       = 0;
+    size_t                host_bytes  = 0;
+    size_t                gpu_bytes   = 0;
+    size_t                num_loading = 0;
+};
+
+} // END namespace obvi
+#endif // OBVI_RESIDENCY_HPP
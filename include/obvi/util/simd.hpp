@@ -0,0 +1,267 @@
+/* Header-only wrappers for 4-wide and 8-wide SIMD float vectors.
+ *
+ * Provides just enough operations to run bounding box tests on several rays (or several boxes)
+ * at once. Uses SSE on x86, NEON on ARM, and AVX for 8-wide vectors if the compiler was told it
+ * can use AVX (e.g., -mavx or /arch:AVX). Falls back to plain loops on other targets, which the
+ * compiler will usually vectorize on its own.
+ *
+ * Comparisons return a bitmask, with bit i set if the comparison was true for element i.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_SIMD_HPP
+#define OBVI_SIMD_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // for memcpy
+#include <algorithm> // for std::min, std::max
+
+#if defined(__AVX__) && !defined(OBVI_SIMD_AVX)
+#   define OBVI_SIMD_AVX
+#endif
+#if (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) \
+    && !defined(OBVI_SIMD_SSE)
+#   define OBVI_SIMD_SSE
+#endif
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(OBVI_SIMD_NEON)
+#   define OBVI_SIMD_NEON
+#endif
+
+#if defined(OBVI_SIMD_AVX)
+#   include <immintrin.h>
+#elif defined(OBVI_SIMD_SSE)
+#   include <emmintrin.h>
+#elif defined(OBVI_SIMD_NEON)
+#   include <arm_neon.h>
+#endif
+
+namespace obvi {
+
+// Generic N-wide float vector, implemented with plain loops.
+template<size_t N>
+struct floatv {
+    static constexpr size_t width = N;
+
+    float v[N];
+
+    floatv() {}
+    explicit floatv(float x) {
+        for(size_t i=0; i<N; ++i) { v[i] = x; }
+    }
+
+    static floatv load(const float *p) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = p[i]; }
+        return ret;
+    }
+    // Load N bytes, and convert each one to a float.
+    static floatv load_u8(const uint8_t *p) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = float(p[i]); }
+        return ret;
+    }
+    void store(float *p) const {
+        for(size_t i=0; i<N; ++i) { p[i] = v[i]; }
+    }
+
+    friend floatv operator+(const floatv& a, const floatv& b) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = a.v[i] + b.v[i]; }
+        return ret;
+    }
+    friend floatv operator-(const floatv& a, const floatv& b) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = a.v[i] - b.v[i]; }
+        return ret;
+    }
+    friend floatv operator*(const floatv& a, const floatv& b) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = a.v[i] * b.v[i]; }
+        return ret;
+    }
+    friend floatv min(const floatv& a, const floatv& b) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = std::min(a.v[i], b.v[i]); }
+        return ret;
+    }
+    friend floatv max(const floatv& a, const floatv& b) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = std::max(a.v[i], b.v[i]); }
+        return ret;
+    }
+    // Replace any NaN elements in 'a' with the corresponding element from 'b'.
+    friend floatv replace_nan(const floatv& a, const floatv& b) {
+        floatv ret;
+        for(size_t i=0; i<N; ++i) { ret.v[i] = (a.v[i] == a.v[i])? a.v[i] : b.v[i]; }
+        return ret;
+    }
+    friend uint32_t cmple_mask(const floatv& a, const floatv& b) {
+        uint32_t mask = 0;
+        for(size_t i=0; i<N; ++i) { mask |= uint32_t(a.v[i] <= b.v[i]) << i; }
+        return mask;
+    }
+};
+
+#if defined(OBVI_SIMD_SSE)
+template<>
+struct floatv<4> {
+    static constexpr size_t width = 4;
+
+    __m128 v;
+
+    floatv() {}
+    floatv(__m128 x) : v(x) {}
+    explicit floatv(float x) : v(_mm_set1_ps(x)) {}
+
+    static floatv load(const float *p) { return _mm_loadu_ps(p); }
+    static floatv load_u8(const uint8_t *p) {
+        int32_t bytes;
+        memcpy(&bytes, p, sizeof(bytes));
+        __m128i zero = _mm_setzero_si128();
+        __m128i u8   = _mm_cvtsi32_si128(bytes);
+        __m128i u32  = _mm_unpacklo_epi16(_mm_unpacklo_epi8(u8, zero), zero);
+        return _mm_cvtepi32_ps(u32);
+    }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+
+    friend floatv operator+(const floatv& a, const floatv& b) { return _mm_add_ps(a.v, b.v); }
+    friend floatv operator-(const floatv& a, const floatv& b) { return _mm_sub_ps(a.v, b.v); }
+    friend floatv operator*(const floatv& a, const floatv& b) { return _mm_mul_ps(a.v, b.v); }
+    friend floatv min(const floatv& a, const floatv& b) { return _mm_min_ps(a.v, b.v); }
+    friend floatv max(const floatv& a, const floatv& b) { return _mm_max_ps(a.v, b.v); }
+    friend floatv replace_nan(const floatv& a, const floatv& b) {
+        __m128 ord = _mm_cmpord_ps(a.v, a.v);
+        return _mm_or_ps(_mm_and_ps(ord, a.v), _mm_andnot_ps(ord, b.v));
+    }
+    friend uint32_t cmple_mask(const floatv& a, const floatv& b) {
+        return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+    }
+};
+#elif defined(OBVI_SIMD_NEON)
+template<>
+struct floatv<4> {
+    static constexpr size_t width = 4;
+
+    float32x4_t v;
+
+    floatv() {}
+    floatv(float32x4_t x) : v(x) {}
+    explicit floatv(float x) : v(vdupq_n_f32(x)) {}
+
+    static floatv load(const float *p) { return vld1q_f32(p); }
+    static floatv load_u8(const uint8_t *p) {
+        uint32_t bytes;
+        memcpy(&bytes, p, sizeof(bytes));
+        uint16x8_t u16 = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(bytes)));
+        return vcvtq_f32_u32(vmovl_u16(vget_low_u16(u16)));
+    }
+    void store(float *p) const { vst1q_f32(p, v); }
+
+    friend floatv operator+(const floatv& a, const floatv& b) { return vaddq_f32(a.v, b.v); }
+    friend floatv operator-(const floatv& a, const floatv& b) { return vsubq_f32(a.v, b.v); }
+    friend floatv operator*(const floatv& a, const floatv& b) { return vmulq_f32(a.v, b.v); }
+    friend floatv min(const floatv& a, const floatv& b) { return vminq_f32(a.v, b.v); }
+    friend floatv max(const floatv& a, const floatv& b) { return vmaxq_f32(a.v, b.v); }
+    friend floatv replace_nan(const floatv& a, const floatv& b) {
+        return vbslq_f32(vceqq_f32(a.v, a.v), a.v, b.v);
+    }
+    friend uint32_t cmple_mask(const floatv& a, const floatv& b) {
+        static const uint32_t bits[4] = {1, 2, 4, 8};
+        uint32x4_t m = vandq_u32(vcleq_f32(a.v, b.v), vld1q_u32(bits));
+        uint32x2_t s = vorr_u32(vget_low_u32(m), vget_high_u32(m));
+        return vget_lane_u32(vorr_u32(s, vrev64_u32(s)), 0);
+    }
+};
+#endif
+
+#if defined(OBVI_SIMD_AVX)
+template<>
+struct floatv<8> {
+    static constexpr size_t width = 8;
+
+    __m256 v;
+
+    floatv() {}
+    floatv(__m256 x) : v(x) {}
+    explicit floatv(float x) : v(_mm256_set1_ps(x)) {}
+
+    static floatv load(const float *p) { return _mm256_loadu_ps(p); }
+    static floatv load_u8(const uint8_t *p) {
+        __m128 lo = floatv<4>::load_u8(p).v;
+        __m128 hi = floatv<4>::load_u8(p + 4).v;
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+    }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+
+    friend floatv operator+(const floatv& a, const floatv& b) { return _mm256_add_ps(a.v, b.v); }
+    friend floatv operator-(const floatv& a, const floatv& b) { return _mm256_sub_ps(a.v, b.v); }
+    friend floatv operator*(const floatv& a, const floatv& b) { return _mm256_mul_ps(a.v, b.v); }
+    friend floatv min(const floatv& a, const floatv& b) { return _mm256_min_ps(a.v, b.v); }
+    friend floatv max(const floatv& a, const floatv& b) { return _mm256_max_ps(a.v, b.v); }
+    friend floatv replace_nan(const floatv& a, const floatv& b) {
+        return _mm256_blendv_ps(b.v, a.v, _mm256_cmp_ps(a.v, a.v, _CMP_ORD_Q));
+    }
+    friend uint32_t cmple_mask(const floatv& a, const floatv& b) {
+        return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));
+    }
+};
+#elif defined(OBVI_SIMD_SSE) || defined(OBVI_SIMD_NEON)
+// No AVX => use a pair of 4-wide vectors.
+template<>
+struct floatv<8> {
+    static constexpr size_t width = 8;
+
+    floatv<4> lo, hi;
+
+    floatv() {}
+    floatv(const floatv<4>& l, const floatv<4>& h) : lo(l), hi(h) {}
+    explicit floatv(float x) : lo(x), hi(x) {}
+
+    static floatv load(const float *p) { return floatv(floatv<4>::load(p), floatv<4>::load(p + 4)); }
+    static floatv load_u8(const uint8_t *p) {
+        return floatv(floatv<4>::load_u8(p), floatv<4>::load_u8(p + 4));
+    }
+    void store(float *p) const { lo.store(p); hi.store(p + 4); }
+
+    friend floatv operator+(const floatv& a, const floatv& b) { return floatv(a.lo + b.lo, a.hi + b.hi); }
+    friend floatv operator-(const floatv& a, const floatv& b) { return floatv(a.lo - b.lo, a.hi - b.hi); }
+    friend floatv operator*(const floatv& a, const floatv& b) { return floatv(a.lo * b.lo, a.hi * b.hi); }
+    friend floatv min(const floatv& a, const floatv& b) { return floatv(min(a.lo, b.lo), min(a.hi, b.hi)); }
+    friend floatv max(const floatv& a, const floatv& b) { return floatv(max(a.lo, b.lo), max(a.hi, b.hi)); }
+    friend floatv replace_nan(const floatv& a, const floatv& b) {
+        return floatv(replace_nan(a.lo, b.lo), replace_nan(a.hi, b.hi));
+    }
+    friend uint32_t cmple_mask(const floatv& a, const floatv& b) {
+        return cmple_mask(a.lo, b.lo) | (cmple_mask(a.hi, b.hi) << 4);
+    }
+};
+#endif
+
+using float4v = floatv<4>;
+using float8v = floatv<8>;
+
+} // END namespace obvi
+#endif // OBVI_SIMD_HPP
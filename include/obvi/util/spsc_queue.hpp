@@ -0,0 +1,124 @@
+/* Public header for a lock-free, bounded, single-producer single-consumer queue.
+ *
+ * One thread pushes and one other thread pops, without locks or system calls, so neither can be
+ * held up by the other (e.g., the GUI thread sending input to a render thread in the middle of a
+ * long frame). The read and write positions are kept on separate cache lines, and each side keeps
+ * its own copy of the other side's position, so the threads only share a cache line when the
+ * queue looks full or empty.
+ *
+ * Example:
+ *
+ * obvi::spsc_queue<int> queue(64);
+ * // producer thread:
+ * queue.push(42); // false if full
+ * // consumer thread:
+ * int value;
+ * while(queue.pop(value)) {
+ *     ...
+ * }
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_SPSC_QUEUE_HPP
+#define OBVI_SPSC_QUEUE_HPP
+
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace obvi {
+
+template<typename T>
+struct spsc_queue {
+    // Room for at least min_capacity items (rounded up to a power of two).
+    explicit spsc_queue(size_t min_capacity) {
+        size_t cap = 1;
+        while(cap < min_capacity) {
+            cap *= 2;
+        }
+        slots.resize(cap);
+        mask = cap - 1;
+    }
+
+    spsc_queue(const spsc_queue&)            = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    // Add a copy of the item to the back of the queue (producer thread only). Returns 'false'
+    // (and changes nothing) if the queue is full.
+    bool push(const T& item) {
+        const size_t pos = tail.value.load(std::memory_order_relaxed);
+        if(pos - head_cache >= slots.size()) {
+            head_cache = head.value.load(std::memory_order_acquire);
+            if(pos - head_cache >= slots.size()) {
+                return false;
+            }
+        }
+        slots[pos & mask] = item;
+        tail.value.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Move the item at the front of the queue into out (consumer thread only). Returns 'false'
+    // if the queue is empty.
+    bool pop(T& out) {
+        const size_t pos = head.value.load(std::memory_order_relaxed);
+        if(pos == tail_cache) {
+            tail_cache = tail.value.load(std::memory_order_acquire);
+            if(pos == tail_cache) {
+                return false;
+            }
+        }
+        out = std::move(slots[pos & mask]);
+        head.value.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // True if there's nothing to pop. Only exact on the consumer thread (from any other thread,
+    // the answer may be out of date by the time it's returned).
+    bool empty() const {
+        return head.value.load(std::memory_order_acquire)
+            == tail.value.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+private:
+    struct alignas(64) position {
+        std::atomic<size_t> value{0};
+    };
+
+    std::vector<T> slots;
+    size_t         mask = 0;
+    position       head;           // next slot to pop (written by the consumer)
+    size_t         tail_cache = 0; // consumer's last look at tail
+    position       tail;           // next slot to push (written by the producer)
+    size_t         head_cache = 0; // producer's last look at head
+};
+
+} // END namespace obvi
+#endif // OBVI_SPSC_QUEUE_HPP
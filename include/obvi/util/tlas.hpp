@@ -0,0 +1,470 @@
+/* Public header for class that implements a two-level bounding-volume hierarchy.
+ *
+ * The bottom level is made of ordinary bvh trees (one per unique mesh). The top level is a bvh
+ * over instances, where each instance points to one of the bottom-level trees and places it in
+ * the world with an affine3f transform. The same bottom-level tree can be used by any number of
+ * instances, so instanced geometry is only stored once.
+ *
+ * Queries are given in world space. They're tested against the top level first, then
+ * transformed into each intersected instance's local space and tested against its bottom level.
+ * When instances move, only the (small) top level needs to be updated.
+ *
+ * Usage example:
+ * \code
+ * obvi::bvh bolt;
+ * bolt.generate(bolt_triangle_boxes);
+ *
+ * std::vector<obvi::tlas::instance> instances;
+ * for(const obvi::affine3f& xform : bolt_placements) {
+ *     instances.push_back({&bolt, xform});
+ * }
+ *
+ * obvi::tlas scene;
+ * scene.generate(instances);
+ *
+ * auto query = scene.make_query(obvi::tlas::intersect_point(vec3f(1.0f, 2.5f, 1.2f)));
+ * size_t inst_idx, obj_idx;
+ * while(query.next(&inst_idx, &obj_idx)) {
+ *     printf("intersection: instance# %zu, box# %zu\n", inst_idx, obj_idx);
+ * }
+ * \endcode
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_TLAS_HPP
+#define OBVI_TLAS_HPP
+
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <obvi/util/affine3.hpp>
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/frustum.hpp>
+#include <obvi/util/vec3.hpp>
+
+namespace obvi {
+
+struct tlas {
+    // A single placement of a bottom-level tree in the world.
+    struct instance {
+        const bvh* blas = nullptr; // bottom-level tree (not owned, must outlive the tlas)
+        affine3f   transform;      // transform from instance space to world space
+    };
+
+    void clear() {
+        insts.clear();
+        top.clear();
+    }
+
+    /* Build the top level of the hierarchy over the given instances.
+     *
+     * Any previously-generated data will be wiped first. The bottom-level trees are not copied
+     * or modified, they're only referenced by pointer - so they must not be destroyed or
+     * regenerated while this tlas is in use.
+     *
+     * Returns 'false' if there are too many instances (see bvh::generate()).
+     *
+     * Scratch memory is kept between calls, so rebuilding every frame doesn't allocate unless the
+     * number of instances grows.
+     */
+    bool generate(const std::vector<instance>& instances,
+                  bvh_build_type build_type = bvh_build_type::SAH);
+
+    /* Update the top level after some instances have moved (or switched to another bottom-level
+     * tree).
+     *
+     * Much faster than generate(), because the top level is refit instead of rebuilt (see
+     * bvh::refit() for the meaning of rebuild_threshold). The instance list must be the same size
+     * and order as the one passed to generate(). Returns 'false' if the size doesn't match.
+     */
+    bool update(const std::vector<instance>& instances, float rebuild_threshold = 2.0f);
+
+    // Number of instances.
+    size_t size() const {
+        return insts.size();
+    }
+
+    const bboxf& bounds() const {
+        return top.bounds();
+    }
+
+    const bvh* get_blas(size_t inst_idx) const {
+        return insts[inst_idx].blas;
+    }
+
+    const affine3f& get_transform(size_t inst_idx) const {
+        return insts[inst_idx].transform;
+    }
+
+    const affine3f& get_inv_transform(size_t inst_idx) const {
+        return insts[inst_idx].inv_transform;
+    }
+
+    template<typename intersect_func> struct query; //defined at bottom of file
+
+    // Make an intersection query (using one of the tlas intersection functors).
+    template<typename intersect_func>
+    query<intersect_func> make_query(intersect_func ifunc) const {
+        return query<intersect_func>(*this, ifunc);
+    }
+
+    struct ray_query; //defined at bottom of file
+
+    // Make a closest-first ray query (see ray_query), limited to the part of the ray on [0,max_t].
+    ray_query make_ray_query(const vec3f& ray_origin, const vec3f& ray_norm_dir,
+                             float max_t = std::numeric_limits<float>::infinity()) const;
+
+
+    // intersection functors.
+    //
+    // Each one holds a query in world space. world() returns the bvh functor used to test the
+    // top level, and local() returns the bvh functor used to test the bottom level of an
+    // instance, given the instance's inverse transform.
+    struct intersect_point {
+        vec3f point;
+        intersect_point(const vec3f& pt) : point(pt) {}
+        bvh::intersect_point world() const { return bvh::intersect_point(point); }
+        bvh::intersect_point local(const affine3f& inv) const {
+            return bvh::intersect_point(inv * point);
+        }
+    };
+    struct intersect_box {
+        bboxf qbox;
+        intersect_box(const bboxf& bx) : qbox(bx) {}
+        bvh::intersect_box world() const { return bvh::intersect_box(qbox); }
+        // Note: this is conservative if the instance is rotated (box gets bigger).
+        bvh::intersect_box local(const affine3f& inv) const {
+            return bvh::intersect_box(inv * qbox);
+        }
+    };
+    struct intersect_segment {
+        vec3f seg_a;
+        vec3f seg_b;
+        intersect_segment(const vec3f& a, const vec3f& b) : seg_a(a), seg_b(b) {}
+        bvh::intersect_segment world() const { return bvh::intersect_segment(seg_a, seg_b); }
+        bvh::intersect_segment local(const affine3f& inv) const {
+            return bvh::intersect_segment(inv * seg_a, inv * seg_b);
+        }
+    };
+    struct intersect_ray {
+        vec3f origin;
+        vec3f norm_dir;
+        intersect_ray(const vec3f& ray_origin, const vec3f& ray_norm_dir)
+            : origin(ray_origin), norm_dir(ray_norm_dir) {}
+        bvh::intersect_ray world() const { return bvh::intersect_ray(origin, norm_dir); }
+        // Transforms only have uniform scale, so the rotated direction is still normalized.
+        bvh::intersect_ray local(const affine3f& inv) const {
+            return bvh::intersect_ray(inv * origin, inv.rotate(norm_dir));
+        }
+    };
+    struct intersect_sphere {
+        vec3f center;
+        float radius;
+        intersect_sphere(const vec3f& sphere_center, float sphere_radius)
+            : center(sphere_center), radius(sphere_radius) {}
+        bvh::intersect_sphere world() const { return bvh::intersect_sphere(center, radius); }
+        bvh::intersect_sphere local(const affine3f& inv) const {
+            return bvh::intersect_sphere(inv * center, radius * std::abs(inv.scale()));
+        }
+    };
+    struct intersect_frustum {
+        frustumf fr;
+        intersect_frustum(const frustumf& view_frustum) : fr(view_frustum) {}
+        bvh::intersect_frustum world() const { return bvh::intersect_frustum(fr); }
+        // frustum::to_local() takes the forward transform (affine inverse is cheap).
+        bvh::intersect_frustum local(const affine3f& inv) const {
+            return bvh::intersect_frustum(fr.to_local(inv.inv()));
+        }
+    };
+
+private:
+    struct instance_data {
+        const bvh* blas;
+        affine3f   transform;
+        affine3f   inv_transform; // cached, so queries don't need to invert every time
+    };
+
+    // Copy the instances, and put their bounds (in world coords) in world_boxes.
+    void set_instances(const std::vector<instance>& instances);
+
+    std::vector<instance_data> insts;
+    bvh                        top; // one leaf per instance, leaf index == instance index
+    std::vector<bboxf>         world_boxes; // scratch for generate() and update()
+    bvh_builder                builder;     // scratch for generate(), reused by rebuilds
+};
+
+
+/* Iterator that conducts a two-level intersection query.
+ *
+ * Same threading rules as bvh::query. The bottom-level trees must not be modified while
+ * iterators that point to them are being used, either.
+ *
+ * intersect_func:
+ *   One of the tlas intersection functors (or anything else that provides world() and local()
+ *   methods that return bvh intersection functors).
+ */
+template<typename intersect_func>
+struct tlas::query {
+    using world_func = decltype(std::declval<intersect_func>().world());
+    using local_func = decltype(std::declval<intersect_func>().local(affine3f()));
+
+    query(const tlas& targ, intersect_func ifunc)
+        : insts(targ.insts), qfunc(ifunc), top_query(targ.top.make_query(ifunc.world())),
+          local(ifunc.local(affine3f())) {}
+
+    void reset() {
+        top_query.reset();
+        local_tree = bvh::node_list();
+    }
+
+    void reset(intersect_func ifunc) {
+        qfunc = ifunc;
+        top_query.reset(ifunc.world());
+        local_tree = bvh::node_list();
+    }
+
+    /* Find the next object (in any instance) whose bounding box was intersected by the query.
+     * If no additional objects were found, returns false.
+     *
+     * out_instance is set to the index of the instance in the list passed to generate(), and
+     * out_match is set to the object's index in the boxes used to generate the instance's bvh.
+     */
+    bool next(size_t *out_instance, size_t *out_match) {
+        for(;;) {
+            if(!local_tree.empty()) {
+                // Same traversal as bvh::query::next(), in the current instance's local space.
+                while(local_next < local_tree.size()) {
+                    const bvh::node& nd = local_tree[local_next];
+                    if(local(nd.box)) {
+                        local_next++;
+                        if(nd.is_leaf()) {
+                            if(out_instance) {
+                                *out_instance = inst_idx;
+                            }
+                            if(out_match) {
+                                *out_match = (size_t)(nd.num & 0x7FFFFFFFu);
+                            }
+                            return true;
+                        }
+                    } else {
+                        local_next += nd.subtree_size();
+                    }
+                }
+                local_tree = bvh::node_list();
+            }
+
+            // Find the next instance whose world-space box intersects the query.
+            if(!top_query.next(&inst_idx)) {
+                return false;
+            }
+            const instance_data& inst = insts[inst_idx];
+            if(inst.blas && inst.blas->size() > 0) {
+                local      = qfunc.local(inst.inv_transform);
+                local_tree = inst.blas->nodes();
+                local_next = 0;
+            }
+        }
+    }
+
+private:
+    const std::vector<instance_data>& insts;
+    intersect_func                    qfunc;
+    bvh::query<world_func>            top_query;
+    local_func                        local;               // query in current instance's space
+    bvh::node_list                    local_tree;          // nodes of current instance's bvh
+    size_t                            local_next = 0;
+    size_t                            inst_idx   = 0;
+};
+
+
+/* Iterator that conducts a closest-first two-level ray query.
+ *
+ * Works like bvh::ray_query, over the objects of every instance: nodes of the top level and of
+ * the bottom-level trees share one traversal stack, so they're all visited in near-to-far order.
+ * The ray is moved into each instance's space without renormalizing its direction, so distances
+ * along it are the same in world and instance space, and one shrink() culls both levels.
+ *
+ * After next() returns a match, local_origin() and local_dir() hold the ray in the matched
+ * instance's space, for exact tests against the object (distances found with them can be passed
+ * straight to shrink()).
+ *
+ * Same threading rules as tlas::query.
+ */
+struct tlas::ray_query {
+    ray_query(const tlas& targ, const vec3f& origin_world, const vec3f& ray_norm_dir, float max_t)
+        : insts(targ.insts), top_tree(targ.top.nodes()), origin(origin_world), dir(ray_norm_dir),
+          start_t(max_t) {
+        reset();
+    }
+
+    void reset() {
+        stack.clear();
+        cur_max_t = start_t;
+        load_ray(no_instance);
+        float entry_t = 0.0f;
+        if(!top_tree.empty() && intersects(top_tree[0].box, &entry_t)) {
+            stack.push_back({0, no_instance, entry_t});
+        }
+    }
+
+    // Current end of the ray - objects whose boxes begin past this distance won't be returned.
+    float max_t() const { return cur_max_t; }
+
+    // Shorten the ray, so that nothing past the given distance is visited. Never lengthens it.
+    void shrink(float max_t) { cur_max_t = std::min(cur_max_t, max_t); }
+
+    // Ray in the space of the instance last returned by next().
+    const vec3f& local_origin() const { return ray_origin; }
+    const vec3f& local_dir() const { return ray_dir; }
+
+    /* Find the next object (in any instance) whose bounding box is entered by the ray before
+     * max_t(). If no additional objects were found, returns false.
+     *
+     * out_instance and out_match are set like tlas::query::next(), and out_entry_t is set to the
+     * distance along the ray where it enters the object's bounding box. As with bvh::ray_query,
+     * the order isn't strict, so keep calling next() until it returns false.
+     */
+    bool next(size_t *out_instance, size_t *out_match, float *out_entry_t) {
+        while(!stack.empty()) {
+            entry e = stack.back();
+            stack.pop_back();
+            if(e.t > cur_max_t) {
+                continue; // ray was shortened since this node was pushed.
+            }
+
+            set_ray(e.inst);
+            const bvh::node_list tree = (e.inst == no_instance)? top_tree
+                                                               : insts[e.inst].blas->nodes();
+            const bvh::node& nd = tree[e.idx];
+            if(nd.is_leaf()) {
+                const size_t match = (size_t)(nd.num & 0x7FFFFFFFu);
+                if(e.inst != no_instance) {
+                    if(out_instance) {
+                        *out_instance = e.inst;
+                    }
+                    if(out_match) {
+                        *out_match = match;
+                    }
+                    if(out_entry_t) {
+                        *out_entry_t = e.t;
+                    }
+                    return true;
+                }
+
+                // Leaf of the top level: continue into the instance's bottom-level tree.
+                const instance_data& inst = insts[match];
+                if(inst.blas && inst.blas->size() > 0) {
+                    set_ray(match);
+                    float entry_t = 0.0f;
+                    if(intersects(inst.blas->nodes()[0].box, &entry_t)) {
+                        stack.push_back({0, match, entry_t});
+                    }
+                }
+                continue;
+            }
+
+            // Test both children, push the far one first so the near one is visited next.
+            size_t left  = e.idx + 1;
+            size_t right = left + tree[left].subtree_size();
+            float  left_t    = 0.0f;
+            float  right_t   = 0.0f;
+            bool   hit_left  = intersects(tree[left].box, &left_t);
+            bool   hit_right = intersects(tree[right].box, &right_t);
+            if(hit_left && hit_right) {
+                if(left_t <= right_t) {
+                    stack.push_back({right, e.inst, right_t});
+                    stack.push_back({left, e.inst, left_t});
+                } else {
+                    stack.push_back({left, e.inst, left_t});
+                    stack.push_back({right, e.inst, right_t});
+                }
+            } else if(hit_left) {
+                stack.push_back({left, e.inst, left_t});
+            } else if(hit_right) {
+                stack.push_back({right, e.inst, right_t});
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr size_t no_instance = std::numeric_limits<size_t>::max(); // top level
+
+    // Switch to the ray in the given instance's space (or world space), if not already there.
+    void set_ray(size_t inst) {
+        if(inst != ray_inst) {
+            load_ray(inst);
+        }
+    }
+
+    void load_ray(size_t inst) {
+        ray_inst = inst;
+        if(inst == no_instance) {
+            ray_origin = origin;
+            ray_dir    = dir;
+        } else {
+            const affine3f& inv = insts[inst].inv_transform;
+            ray_origin = inv * origin;
+            ray_dir    = inv.rotate(dir) * inv.scale(); // scaled too, so distances stay the same
+        }
+        inv_dir = ray_dir.inv();
+        bboxf::ray_signs(inv_dir, dir_neg);
+    }
+
+    bool intersects(const bboxf& box, float *out_entry_t) const {
+        return box.intersects_ray_precalc(ray_origin, inv_dir, dir_neg, cur_max_t, out_entry_t);
+    }
+
+    struct entry {
+        size_t idx;  // index of node in its tree
+        size_t inst; // instance whose bottom-level tree the node is in (no_instance: top level)
+        float  t;    // distance where ray enters node's box
+    };
+
+    const std::vector<instance_data>& insts;
+    bvh::node_list                    top_tree;
+    vec3f                             origin;     // world space
+    vec3f                             dir;
+    float                             start_t;
+    float                             cur_max_t;
+    std::vector<entry>                stack;
+
+    size_t  ray_inst = no_instance; // space that the ray below is in
+    vec3f   ray_origin;
+    vec3f   ray_dir;
+    vec3f   inv_dir;
+    uint8_t dir_neg[3];
+};
+
+inline tlas::ray_query tlas::make_ray_query(const vec3f& ray_origin, const vec3f& ray_norm_dir,
+                                            float max_t) const {
+    return ray_query(*this, ray_origin, ray_norm_dir, max_t);
+}
+
+} // END namespace obvi
+#endif // OBVI_TLAS_HPP
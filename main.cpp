@@ -25,11 +25,15 @@
  * * * * * * * * * * * *
  */
 
+#include <QDir>
 #include <QGuiApplication>
 #include <QScreen>
-#include <QDebug>
+#include <QStandardPaths>
 
 #include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 #include "main_window.hpp"
 
@@ -39,12 +43,55 @@ int main(int argc, char *argv[])
 
     obvi::main_window mainwin;
 
+    // Prepared meshes are cached in the user's cache dir by default.
+    std::string cache_dir =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation).toStdString();
+    if(!cache_dir.empty()) {
+        cache_dir += "/meshes";
+    }
+
+    // Parse command line:
+    //   obvi [--full-precision] [--continuous] [--grid N] [--cache-dir DIR] [--no-cache]
+    //        [--page-tris N] [--host-budget MB] [--gpu-budget MB] [files...]
+    std::vector<std::string> mesh_paths;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--full-precision") {
+            mainwin.set_compact_vertices(false); // send float positions to GPU instead of 16-bit
+        } else if(arg == "--continuous") {
+            mainwin.set_continuous_redraw(true); // redraw every frame, even when nothing changes
+        } else if(arg == "--grid" && i + 1 < argc) {
+            mainwin.set_grid_copies(std::atoi(argv[++i])); // show N x N copies of the meshes
+        } else if(arg == "--cache-dir" && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if(arg == "--no-cache") {
+            cache_dir.clear(); // always load and prepare mesh files from scratch (no paging)
+        } else if(arg == "--page-tris" && i + 1 < argc) {
+            mainwin.set_page_tris(std::strtoull(argv[++i], nullptr, 10)); // 0 turns paging off
+        } else if(arg == "--host-budget" && i + 1 < argc) {
+            mainwin.set_host_budget(std::strtoull(argv[++i], nullptr, 10) << 20); // MB of pages
+        } else if(arg == "--gpu-budget" && i + 1 < argc) {
+            mainwin.set_gpu_budget(std::strtoull(argv[++i], nullptr, 10) << 20);
+        } else {
+            mesh_paths.push_back(argv[i]);
+        }
+    }
+
+    // Mesh files given on command line (if any) are loaded in the background once the window
+    // is up, so it can start drawing right away.
+    mainwin.set_mesh_paths(mesh_paths);
+    if(!cache_dir.empty() && QDir().mkpath(QString::fromStdString(cache_dir))) {
+        mainwin.set_cache_dir(cache_dir);
+    }
+
     // Set our required OpenGL type and version.
     QSurfaceFormat format;
     format.setRenderableType(QSurfaceFormat::OpenGL);
     format.setProfile(QSurfaceFormat::CoreProfile); // Leave out old stuff from before OpenGL 3.
     format.setVersion(4,3); // OpenGL 4.3
     format.setSamples(4); // Enable multisampling.
+    format.setDepthBufferSize(24);  // depth format must match hiz_culler's copy of the depth buffer
+    format.setStencilBufferSize(8);
     mainwin.setFormat(format); // MUST be called BEFORE show().
 
     // Set window size (use fraction of screen geometry, so it is independent of screen resolution).
@@ -27,124 +27,167 @@
 #include "main_window.hpp"
 
 #include <QKeyEvent>
+#include <QMouseEvent>
 #include <QDebug>
+#include <QFontDatabase>
+#include <QMetaObject>
+#include <QPainter>
+#include <QTimer>
 
 #include <obvi/util/bbox.hpp>
 
-// TODO: read data from disk instead of relying on hardcoded vertex data below.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+// Triangle to show if no mesh file is loaded.
 namespace {
-    static constexpr GLfloat vertex_data[] = {
-    //        Position           Color
-         0.00f, 0.75f,0.0f,  1.0f,0.0f,0.0f,  //vertex 0
-        -0.75f,-0.75f,0.0f,  0.0f,0.0f,1.0f,  //vertex 1
-         0.75f,-0.75f,0.0f,  0.0f,1.0f,0.0f,  //vertex 2
-    };
+    obvi::mesh default_mesh() {
+        obvi::mesh m;
+        m.positions = {{0.00f, 0.75f, 0.0f}, {-0.75f, -0.75f, 0.0f}, {0.75f, -0.75f, 0.0f}};
+        m.colors    = {0xFF0000FFu, 0xFFFF0000u, 0xFF00FF00u}; // red, blue, green
+        m.indices   = {0, 1, 2};
+        return m;
+    }
+}
 
-    static constexpr size_t num_vertices = sizeof(vertex_data) / (6 * sizeof(vertex_data[0]));
+constexpr GLuint obvi::main_window::no_object;
+constexpr size_t obvi::main_window::no_mesh;
+
+obvi::main_window::main_window() {
+    setSurfaceType(QWindow::OpenGLSurface);
+    gui_input.host_budget = pager.host_budget;
+    gui_input.gpu_budget  = pager.gpu_budget;
 }
 
 obvi::main_window::~main_window() {
-    // Clean up OpenGL objects.
-    makeCurrent();
-    v_obj.destroy();
-    v_buffer.destroy();
-    program.removeAllShaders();
+    // The render thread stops loading files and frees its OpenGL objects on its way out.
+    stop_rendering();
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-// OpenGL rendering callbacks.
-void obvi::main_window::initializeGL() {
-    initializeOpenGLFunctions(); // from parent QOpenGLFunctions
-    connect(this, SIGNAL(frameSwapped()), this, SLOT(update())); // continuously redraw (sync'd to refresh rate if Vsync enabled)
-    print_context_info(); // for debugging purposes only
 
-    // Point camera at center of object.
-    {
-        bboxf box;
-        for(size_t i = 0; i < num_vertices; ++i) {
-            const float *vtx = vertex_data + i * 6;
-            box.expand(vec3f(vtx[0],vtx[1],vtx[2]));
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// GUI thread: turn events into view_input snapshots for the render thread.
+bool obvi::main_window::event(QEvent *ev) {
+    // Without a render thread, frames are drawn when Qt delivers update requests (see
+    // wake_render()).
+    if(ev && ev->type() == QEvent::UpdateRequest && !threaded) {
+        if(gl && (render_once() || (view.continuous && view.exposed))) {
+            requestUpdate();
         }
-        vec3f center = box.center();
-        vec3f camera_pos = center - vec3f(0,0,3);
-        camera.look_at(camera_pos, center, vec3f(0,1,0));
+        return true;
     }
+    return QWindow::event(ev);
+}
 
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+void obvi::main_window::exposeEvent(QExposeEvent *ev) {
+    (void)ev;
+    gui_input.exposed = isExposed();
+    gui_input.exposes++;
+    update_size();
+    if(gui_input.exposed && !started) {
+        start_rendering();
+    }
+    if(gui_input.exposed || !threaded) {
+        post_input();
+        return;
+    }
 
-    // Hardcode a triangle in OpenGL state.
-    {
-        // Compile and link shader code from resource files we bundled inside the executable.
-        //   see: shaders/*.{vert,frag}
-        program.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":/flat.vert");
-        program.addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":/flat.frag");
-        program.link();
-        program.bind();
-        int loc_position     = program.attributeLocation("position");
-        int loc_color        = program.attributeLocation("color");
-
-        loc_model            = program.uniformLocation("model");
-        loc_view_proj        = program.uniformLocation("view_proj");
-        loc_light_dir_world  = program.uniformLocation("light_dir_world");
-        loc_camera_pos_world = program.uniformLocation("camera_pos_world");
-        int loc_diff_frac    = program.uniformLocation("diff_frac");
-        int loc_ambi_frac    = program.uniformLocation("ambi_frac");
-
-        // Create buffer to store vertex data in, and fill it with hardcoded values.
-        v_buffer.create();
-        v_buffer.bind();
-        v_buffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-        v_buffer.allocate(vertex_data, int(sizeof(vertex_data)));
-
-        // Create Vertex Array Object, store state values we'll use to draw an object.
-        v_obj.create();
-        v_obj.bind();
-
-        program.enableAttributeArray(loc_position);
-        program.enableAttributeArray(loc_color);
-        program.setAttributeBuffer(loc_position, GL_FLOAT, 0, 3, sizeof(float)*6);
-        program.setAttributeBuffer(loc_color, GL_FLOAT, sizeof(float)*3, 3, sizeof(float)*6);
-
-        program.setUniformValue(loc_diff_frac, 0.7f);
-        program.setUniformValue(loc_ambi_frac, 0.3f);
-
-        // Unbind everything we just set.
-        v_obj.release();
-        v_buffer.release();
-        program.release();
-    }
-
-    model_moved  = true;
-    camera_moved = true;
-    lens_changed = true;
+    // The surface can go away as soon as this returns, and the render thread might be in the
+    // middle of makeCurrent() or swapBuffers() on it. Like Qt's own threaded render loops, wait
+    // until the render thread has seen the change and let go of the surface. This snapshot has
+    // to get through, so keep trying until the render thread makes room in the queue.
+    while(!inputs.push(gui_input)) {
+        wake_render();
+        std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    wake_pending = true;
+    wake_cv.notify_one();
+    exposes_cv.wait(lock, [this]() { return exposes_seen == gui_input.exposes; });
 }
 
-void obvi::main_window::resizeGL(int width, int height) {
-    (void)width; (void)height;
-    lens_changed = true;
+void obvi::main_window::resizeEvent(QResizeEvent *ev) {
+    (void)ev;
+    update_size();
+    post_input();
 }
 
-void obvi::main_window::paintGL() {
-    // Clear previous contents of buffer by setting every pixel to the clear color.
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void obvi::main_window::update_size() {
+    gui_input.width       = std::max(width(), 1);
+    gui_input.height      = std::max(height(), 1);
+    gui_input.pixel_ratio = float(devicePixelRatio());
+}
 
-    bind_state();
-    {
-        // Send new model, view and projection matrices to GPU, if any have changed.
-        update_model();
-        update_camera();
+void obvi::main_window::post_input() {
+    // If the render thread is so far behind that the queue filled up, try again shortly (every
+    // snapshot is complete, so it only needs the last one to get through).
+    if(!inputs.push(gui_input) && !retry_pending) {
+        retry_pending = true;
+        QTimer::singleShot(1, this, [this]() {
+            retry_pending = false;
+            post_input();
+        });
+    }
+    wake_render();
+}
+
+// Settings can be changed before the window is shown too, they're sent with the first snapshot.
+void obvi::main_window::post_settings() {
+    if(started) {
+        post_input();
+    }
+}
 
-        // Draw the mesh.
-        glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+// Can be called from any thread (the loader calls it when a mesh is ready).
+void obvi::main_window::wake_render() {
+    if(threaded) {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            wake_pending = true;
+        }
+        wake_cv.notify_one();
+    } else {
+        QMetaObject::invokeMethod(this, "requestUpdate", Qt::QueuedConnection);
     }
-    release_state();
+}
 
-    glFinish(); // Minimizes screen tearing when window is resized.
+void obvi::main_window::start_rendering() {
+    started   = true;
+    gl_format = requestedFormat();
+
+    // Look the font up here, font database calls are only safe on the GUI thread. The render
+    // thread only reads it once started.
+    overlay_font = QFontDatabase::systemFont(QFontDatabase::FixedFont);
+
+    // The render thread creates its own context, and draws the overlay text with QPainter. If the
+    // platform can't do either from other threads, draw on the GUI thread instead (same code, just
+    // driven by update requests).
+    threaded = QOpenGLContext::supportsThreadedOpenGL() &&
+               QFontDatabase::supportsThreadedFontRendering();
+    if(threaded) {
+        render_thread = std::thread(&main_window::render_loop, this);
+    } else {
+        qWarning() << "Threaded OpenGL or font rendering isn't supported here, rendering on the GUI thread";
+        init_gl();
+    }
 }
 
+void obvi::main_window::stop_rendering() {
+    if(render_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            quit_requested = true;
+        }
+        wake_cv.notify_one();
+        render_thread.join();
+    } else {
+        release_gl();
+    }
+}
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-// Event handling.
+// Mouse and key events only record what happened, the render thread acts on it next frame.
 void obvi::main_window::keyPressEvent(QKeyEvent *ev) {
     if(!ev) {
         return;
@@ -152,29 +195,354 @@ void obvi::main_window::keyPressEvent(QKeyEvent *ev) {
     switch(ev->key()) {
         // Toggle animation on/off.
         case Qt::Key_A:
-        if(!animate) {
-            animate = true;
-            tstart = std::chrono::steady_clock::now();
-            update();
-        } else {
-            animate = false;
-        }
+        gui_input.animate = !gui_input.animate;
+        break;
+
+        // Toggle level of detail on/off.
+        case Qt::Key_L:
+        gui_input.lod = !gui_input.lod;
+        break;
+
+        // Toggle occlusion culling on/off.
+        case Qt::Key_O:
+        gui_input.occlusion = !gui_input.occlusion;
+        break;
+
+        // Toggle frame statistics overlay on/off.
+        case Qt::Key_S:
+        gui_input.show_stats = !gui_input.show_stats;
+        break;
+
+        // Start/stop recording a Chrome trace of every frame.
+        case Qt::Key_T:
+        gui_input.traces++;
         break;
+
+        default:
+        return;
+    }
+    post_input();
+}
+
+void obvi::main_window::mouseMoveEvent(QMouseEvent *ev) {
+    if(!ev) {
+        return;
+    }
+    gui_input.cursor_x = float(ev->x());
+    gui_input.cursor_y = float(ev->y());
+    gui_input.moves++;
+    post_input();
+}
+
+void obvi::main_window::mousePressEvent(QMouseEvent *ev) {
+    if(!ev || ev->button() != Qt::LeftButton) {
+        return;
+    }
+    gui_input.cursor_x = float(ev->x());
+    gui_input.cursor_y = float(ev->y());
+    gui_input.clicks++;
+    post_input();
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Render thread.
+void obvi::main_window::render_loop() {
+    init_gl();
+
+    // Draw whenever the GUI thread or the loader wakes us up, and keep going as long as the last
+    // frame asked for another one (animating, uploading, picking, or continuous redraw).
+    bool again = true;
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            if(!again && !(view.continuous && view.exposed)) {
+                wake_cv.wait(lock, [this]() { return wake_pending || quit_requested; });
+            }
+            wake_pending = false;
+            if(quit_requested) {
+                break;
+            }
+        }
+        again = render_once();
+    }
+
+    release_gl();
+}
+
+bool obvi::main_window::init_gl() {
+    gl.reset(new QOpenGLContext());
+    gl->setFormat(gl_format);
+    if(!gl->create() || !gl->makeCurrent(this)) {
+        qCritical() << "Failed to create an OpenGL context";
+        gl.reset();
+        return false;
+    }
+    initializeOpenGLFunctions(); // from parent QOpenGLFunctions_4_3_Core
+    print_context_info(); // for debugging purposes only
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+
+    // Compile and link shader code from resource files we bundled inside the executable.
+    //   see: shaders/*.{vert,frag}
+    // Vertex attributes and object transforms are set up by scene_batch.
+    program.reset(new QOpenGLShaderProgram());
+    program->addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":/flat.vert");
+    program->addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":/flat.frag");
+    program->link();
+    program->bind();
+    loc_view_proj        = program->uniformLocation("view_proj");
+    loc_light_dir_world  = program->uniformLocation("light_dir_world");
+    loc_camera_pos_world = program->uniformLocation("camera_pos_world");
+    loc_hover_object     = program->uniformLocation("hover_object");
+    loc_selected_object  = program->uniformLocation("selected_object");
+    program->setUniformValue(loc_hover_object, no_object);
+    program->setUniformValue(loc_selected_object, no_object);
+    program->setUniformValue(program->uniformLocation("diff_frac"), 0.7f);
+    program->setUniformValue(program->uniformLocation("ambi_frac"), 0.3f);
+    program->release();
+
+    // Set up occlusion culling (if it's not available, we just draw everything in the frustum).
+    culler.reset(new hiz_culler());
+    culler_ok = culler->init();
+
+    if(!profiler.init()) {
+        qWarning() << "GPU timers not available, only CPU times will be shown";
+    }
+
+    overlay_device.reset(new QOpenGLPaintDevice());
+
+    // Meshes and objects are sent to OpenGL a slice at a time, by scene.upload() in
+    // render_frame().
+    scene.init(compact_vertices, culler_ok ? culler.get() : nullptr);
+
+    // Start loading mesh files in the background. Each time one is ready, wake up the render
+    // thread, which adds it to the scene.
+    if(mesh_paths.empty()) {
+        obvi::mesh m = default_mesh();
+        std::vector<mesh_chunk> chunks;
+        std::vector<uint32_t>   lod_indices;
+        prepare_mesh(m, chunks, lod_indices);
+        place_objects(scene.add_mesh(std::move(m), std::move(chunks), std::move(lod_indices)));
+    } else {
+        loader.set_cache_dir(cache_dir);
+        loader.set_page_tris(page_tris);
+        loader.start(mesh_paths, [this]() {
+            wake_render();
+        });
+    }
+
+    camera_moved = true;
+    lens_changed = true;
+    return true;
+}
+
+void obvi::main_window::release_gl() {
+    // Stop loading files first, so the worker thread doesn't try to wake us up after we're gone.
+    loader.stop();
+    picker.stop();
+    if(!gl || !gl->makeCurrent(this)) {
+        return;
+    }
+
+    // Clean up OpenGL objects.
+    wait_for_previous_frame();
+    profiler.destroy();
+    if(culler) {
+        culler->destroy();
+    }
+    scene.destroy();
+    program.reset();
+    overlay_device.reset();
+    gl->doneCurrent();
+    gl.reset();
+}
+
+bool obvi::main_window::render_once() {
+    // Apply everything that happened on the GUI thread since the last frame. This happens even
+    // without a context, so the GUI thread never waits on exposeEvent() forever.
+    view_input in;
+    while(inputs.pop(in)) {
+        apply_input(in);
+    }
+    if(view.exposes != exposes_acked) {
+        if(!view.exposed && gl) {
+            gl->doneCurrent(); // let go of the surface before the GUI thread goes on
+        }
+        exposes_acked = view.exposes;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            exposes_seen = view.exposes;
+        }
+        exposes_cv.notify_all();
+    }
+    if(!gl) {
+        return false;
+    }
+    if(!view.exposed || !gl->makeCurrent(this)) {
+        return false; // nothing to draw on, wait for the next snapshot
+    }
+
+    const bool again = render_frame();
+    gl->swapBuffers(this); // may wait for vsync, which only holds up this thread
+    return again;
+}
+
+void obvi::main_window::apply_input(const view_input& in) {
+    if(in.width != view.width || in.height != view.height || in.pixel_ratio != view.pixel_ratio) {
+        lens_changed = true;
+    }
+    if(in.moves != view.moves || in.clicks != view.clicks) {
+        pick_wanted = true;
+    }
+    if(in.clicks != view.clicks) {
+        click_wanted = true;
     }
+    if(in.animate && !view.animate) {
+        tstart = std::chrono::steady_clock::now();
+    }
+    scene.set_lod_enabled(in.lod);
+    pager.host_budget = in.host_budget;
+    pager.gpu_budget  = in.gpu_budget;
+    if(!in.occlusion && view.occlusion && culler) {
+        culler->invalidate(); // pyramid isn't updated while off, so it will be stale
+    }
+    for(uint32_t t = view.traces; t != in.traces; ++t) {
+        toggle_trace();
+    }
+    view = in;
+}
+
+int obvi::main_window::pixel_width() const {
+    return int(float(view.width) * view.pixel_ratio + 0.5f);
+}
+
+int obvi::main_window::pixel_height() const {
+    return int(float(view.height) * view.pixel_ratio + 0.5f);
+}
+
+// Draw one frame into the back buffer. Returns true if another frame should follow.
+bool obvi::main_window::render_frame() {
+    using cpu_scope = frame_profiler::cpu_scope;
+    profiler.begin_frame();
+
+    // Don't let the CPU get more than one frame ahead of the GPU (keeps resizing smooth, without
+    // stalling on the frame we're about to draw like glFinish() would).
+    {
+        cpu_scope scope(profiler, "wait");
+        wait_for_previous_frame();
+    }
+
+    // Collect last frame's pick before anything in the scene changes (redraw if the highlighted
+    // objects changed).
+    const bool pick_changed = finish_pick();
+
+    // Clear previous contents of buffer by setting every pixel to the clear color. The overlay's
+    // QPainter turns off depth testing, so turn it back on.
+    glBindFramebuffer(GL_FRAMEBUFFER, gl->defaultFramebufferObject());
+    glViewport(0, 0, pixel_width(), pixel_height());
+    glEnable(GL_DEPTH_TEST);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Add meshes that finished loading, and send the GPU the next slice of scene data. Objects
+    // show up once their mesh's vertices are sent, and their chunks fill in as indices arrive.
+    bool uploading;
+    {
+        cpu_scope scope(profiler, "upload");
+        take_loaded_meshes();
+        uploading = scene.upload();
+    }
+    if(num_framed_objects() != framed_objects) {
+        frame_scene();
+    }
+
+    {
+        cpu_scope scope(profiler, "update_model");
+        update_model();
+    }
+    const bool changed = model_moved || camera_moved || lens_changed || pick_changed;
+    const bool moved   = model_moved;
+    model_moved = false;
+
+    program->bind();
+    {
+        // Send new view and projection matrices to GPU, if they've changed.
+        {
+            cpu_scope scope(profiler, "update_camera");
+            update_camera();
+        }
+
+        // Pick the mesh pages to bring in (and drop) for the new view.
+        {
+            cpu_scope scope(profiler, "pages");
+            uploading = update_pages(moved) || uploading;
+        }
+        if(pick_changed) {
+            program->setUniformValue(loc_hover_object, hover_object);
+            program->setUniformValue(loc_selected_object, selected_object);
+        }
+
+        // Find the chunks the camera can see (occlusion culling replaces our program), then
+        // draw all of them with one call.
+        {
+            cpu_scope scope(profiler, "cull");
+            profiler.begin_gpu("cull");
+            scene.cull(camera, float(pixel_height()), culler_ok ? culler.get() : nullptr,
+                       view.occlusion);
+            profiler.end_gpu();
+        }
+        {
+            cpu_scope scope(profiler, "draw");
+            profiler.begin_gpu("draw");
+            program->bind();
+            scene.draw();
+            profiler.end_gpu();
+        }
+        const size_t commands = scene.num_draw_commands();
+        profiler.add_draws(commands > 0 ? 1 : 0, commands);
+    }
+    program->release();
+
+    // Save this frame's depth for next frame's occlusion culling.
+    if(culler_ok && view.occlusion) {
+        cpu_scope scope(profiler, "pyramid");
+        profiler.begin_gpu("pyramid");
+        culler->update_pyramid(gl->defaultFramebufferObject(), pixel_width(), pixel_height(),
+                               view_proj);
+        profiler.end_gpu();
+    }
+
+    profiler.end_frame();
+    if(view.show_stats) {
+        draw_overlay();
+    }
+
+    frame_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // Pick with this frame's camera and scene while the GPU draws (collected next frame).
+    if(pick_wanted) {
+        start_pick();
+    }
+
+    // Keep drawing while animating or uploading. After anything else changes, draw one more
+    // frame: occlusion culling tests against the previous frame's depth, so chunks that just came
+    // into view only show up in the frame after.
+    return view.animate || uploading || changed || picker.running();
 }
 
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-// Private helper functions.
+// Private helper functions (render thread).
 void obvi::main_window::print_context_info() {
     // Code taken from here: https://www.trentreed.net/blog/qt5-opengl-part-0-creating-a-window/
 
     // Get version info.
-    const char* glType    = (context()->isOpenGLES())? "OpenGL ES" : "OpenGL";
+    const char* glType    = (gl->isOpenGLES())? "OpenGL ES" : "OpenGL";
     const char* glVersion = (const char *)glGetString(GL_VERSION);
 
     const char* glProfile = "";
-    switch(format().profile()) {
+    switch(gl->format().profile()) {
         case QSurfaceFormat::NoProfile:            glProfile = "(NoProfile)"; break;
         case QSurfaceFormat::CompatibilityProfile: glProfile = "(CompatibilityProfile)"; break;
         case QSurfaceFormat::CoreProfile:          glProfile = "(CoreProfile)"; break;
@@ -184,52 +552,281 @@ void obvi::main_window::print_context_info() {
     qDebug() << glType << glVersion << glProfile;
 }
 
-void obvi::main_window::bind_state() {
-    program.bind();
-    v_obj.bind();
+void obvi::main_window::toggle_trace() {
+    if(!profiler.tracing()) {
+        profiler.start_trace();
+        qDebug() << "Recording trace, press T again to save it";
+    } else if(profiler.stop_trace("obvi_trace.json")) {
+        qDebug() << "Saved trace to obvi_trace.json";
+    } else {
+        qCritical() << "Failed to write obvi_trace.json";
+    }
+}
+
+void obvi::main_window::take_loaded_meshes() {
+    obvi::mesh_loader::result res;
+    while(loader.take(res)) {
+        if(!res.error.empty()) {
+            qCritical() << "Failed to load" << res.path.c_str() << ":" << res.error.c_str();
+            continue;
+        }
+        if(!res.cache_error.empty()) {
+            qWarning() << "Couldn't cache" << res.path.c_str() << ":" << res.cache_error.c_str();
+        }
+        qDebug() << (res.cached ? "Loaded" : "Prepared") << res.path.c_str()
+                 << (res.cached ? "from cache" : "");
+        if(res.paged) {
+            qDebug() << "  split into" << res.pages.size() << "pages";
+            add_paged_mesh(res);
+        } else {
+            place_objects(scene.add_mesh(std::move(res.data)));
+        }
+    }
+}
+
+void obvi::main_window::add_paged_mesh(mesh_loader::result& res) {
+    // Draw the proxy like any other mesh, and track every copy of every page.
+    std::vector<bboxf> page_bounds;
+    for(const mesh_chunk& chunk : res.data.chunks) {
+        page_bounds.push_back(chunk.bounds);
+    }
+    const size_t first_object = scene.num_objects();
+    place_objects(scene.add_mesh(std::move(res.data)));
+    const size_t end_object = scene.num_objects();
+
+    for(size_t i = 0; i < res.pages.size() && i < page_bounds.size(); ++i) {
+        const mesh_cache_info& info = res.pages[i];
+        const size_t gpu_size  = scene.gpu_bytes(info.num_vertices,
+                                                 info.num_indices + info.num_lod_indices);
+        const size_t page_idx = pager.add_page(size_t(info.file_size), gpu_size);
+        for(size_t obj = first_object; obj < end_object; ++obj) {
+            pager.add_instance(page_idx, page_bounds[i], scene.get_transform(obj));
+            page_instance_objects.push_back(obj);
+        }
+
+        page_data pg;
+        pg.key          = res.page_key;
+        pg.index        = i;
+        pg.first_object = first_object;
+        pg.end_object   = end_object;
+        pages.push_back(std::move(pg));
+    }
+}
+
+bool obvi::main_window::update_pages(bool moved) {
+    if(pages.empty()) {
+        return false;
+    }
+
+    // Collect finished loads.
+    mesh_loader::page_result res;
+    while(loader.take_page(res)) {
+        page_data& pg = pages[res.token];
+        if(!res.error.empty()) {
+            qWarning() << "Failed to load page" << pg.index << ":" << res.error.c_str();
+        } else {
+            pg.host = std::move(res.data);
+        }
+        pager.loaded(res.token, res.error.empty());
+    }
+
+    // Rate pages from the current view (copies follow the proxy's objects).
+    if(moved) {
+        for(size_t i = 0; i < page_instance_objects.size(); ++i) {
+            pager.set_transform(i, scene.get_transform(page_instance_objects[i]));
+        }
+    }
+    pager.update(camera, float(pixel_height()), page_actions);
+
+    // GPU copies go back to host memory, the scene keeps the page's chunks and objects.
+    for(size_t idx : page_actions.evict_gpu) {
+        page_data& pg = pages[idx];
+        scene.evict_mesh(pg.mesh_id, &pg.host.geom, &pg.host.lod_indices);
+    }
+    for(size_t idx : page_actions.evict_host) {
+        pages[idx].host = prepared_mesh();
+    }
+    for(size_t idx : page_actions.load) {
+        loader.load_page({cache_dir, pages[idx].key, pages[idx].index, idx});
+    }
+    for(size_t idx : page_actions.upload) {
+        page_data& pg = pages[idx];
+        if(pg.mesh_id != no_mesh) {
+            if(!scene.reload_mesh(pg.mesh_id, std::move(pg.host.geom),
+                                  std::move(pg.host.lod_indices))) {
+                qWarning() << "Page" << pg.index << "doesn't match its first load";
+            }
+            pg.host = prepared_mesh();
+            continue;
+        }
+
+        // First upload: every copy of the proxy gets a copy of the page, which hides the proxy's
+        // chunk once it's fully sent.
+        pg.mesh_id = scene.add_mesh(std::move(pg.host));
+        pg.host    = prepared_mesh();
+        for(size_t obj = pg.first_object; obj < pg.end_object; ++obj) {
+            const size_t page_obj = scene.add_object(pg.mesh_id, scene.get_transform(obj));
+            scene.set_stand_in(obj, pg.index, page_obj);
+            page_objects.push_back(page_obj);
+        }
+    }
+    return !page_actions.evict_gpu.empty() || !page_actions.upload.empty();
+}
+
+size_t obvi::main_window::num_framed_objects() const {
+    // Objects of pages don't move the camera, they only replace parts of a proxy.
+    const size_t placed = scene.num_placed_objects();
+    return placed - size_t(std::lower_bound(page_objects.begin(), page_objects.end(), placed)
+                           - page_objects.begin());
 }
 
-void obvi::main_window::release_state() {
-    v_obj.release();
-    program.release();
+void obvi::main_window::frame_scene() {
+    // Point camera at center of scene, from far enough away that the whole thing is visible.
+    bboxf box        = scene.bounds();
+    vec3f center     = box.center();
+    scene_radius     = std::max(0.5f * std::sqrt((box.max_pt - box.min_pt).normsqd()), 1e-3f);
+    vec3f camera_pos = center - vec3f(0, 0, 3.0f * scene_radius);
+    camera.look_at(camera_pos, center, vec3f(0,1,0));
+
+    framed_objects = num_framed_objects();
+    camera_moved   = true;
+    lens_changed   = true;
+}
+
+void obvi::main_window::place_objects(size_t mesh_id) {
+    // One object for the mesh, repeated in a grid on the XZ plane if more than one copy was
+    // requested. Meshes load one at a time, so each one's grid is spaced by its own size.
+    const bboxf& box = scene.get_mesh(mesh_id).bounds();
+    vec3f extent  = box.max_pt - box.min_pt;
+    float spacing = 1.25f * std::max(extent[0], extent[2]);
+    for(int x = 0; x < grid_copies; ++x) {
+        for(int z = 0; z < grid_copies; ++z) {
+            scene.add_object(mesh_id, affine3f(vec3f(x * spacing, 0, z * spacing)));
+        }
+    }
 }
 
 void obvi::main_window::update_model() {
-    if(animate) {
+    if(view.animate) {
         static constexpr float two_pi      = 2.0f * pi<float>;
         static constexpr float rot_per_sec = 0.5f;
         auto tend = std::chrono::steady_clock::now();
         std::chrono::duration<float> fsec = tend - tstart;
 
-        model.set(model.rotation() * mat3f::yrot(two_pi * rot_per_sec * fsec.count()),
-            model.translation());
+        // Spin every object around its own origin (sent to the GPU in one upload by scene.cull()).
+        mat3f spin = mat3f::yrot(two_pi * rot_per_sec * fsec.count());
+        for(size_t i = 0; i < scene.num_objects(); ++i) {
+            const affine3f& model = scene.get_transform(i);
+            scene.set_transform(i, affine3f(model.rotation() * spin, model.translation()));
+        }
         tstart = tend;
         model_moved = true;
     }
-    if(model_moved) {
-        std::array<float, 16> mat_model;
-        model.to_gl(mat_model);
-        program.setUniformValue(loc_model, QMatrix4x4(mat_model.data()).transposed());
+}
+
+void obvi::main_window::wait_for_previous_frame() {
+    static constexpr GLuint64 timeout_ns = 100000000; // 0.1 sec, don't hang if the GPU does
+    if(frame_fence) {
+        glClientWaitSync(frame_fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+        glDeleteSync(frame_fence);
+        frame_fence = nullptr;
     }
-    model_moved = false;
+}
+
+bool obvi::main_window::finish_pick() {
+    if(!picker.running()) {
+        return false;
+    }
+    scene_batch::pick_result res;
+    const bool   hit    = picker.finish(res);
+    const GLuint object = hit ? GLuint(res.object_id) : no_object;
+    const GLuint old_hover    = hover_object;
+    const GLuint old_selected = selected_object;
+    hover_object = object;
+    if(pick_is_click) {
+        selected_object = object;
+        if(hit) {
+            qDebug() << "Picked object" << res.object_id << "triangle" << res.triangle << "at"
+                     << res.point[0] << res.point[1] << res.point[2];
+        }
+    }
+    return hover_object != old_hover || selected_object != old_selected;
+}
+
+void obvi::main_window::start_pick() {
+    // Ray from the near plane to the far plane, through the cursor (see camera3's NDC notes).
+    const float x = 2.0f * view.cursor_x / float(view.width) - 1.0f;
+    const float y = 1.0f - 2.0f * view.cursor_y / float(view.height);
+    const vec3f near_pt = camera.unproject(vec3f(x, y, -1.0f));
+    const vec3f far_pt  = camera.unproject(vec3f(x, y, 1.0f));
+    picker.start(scene, near_pt, (far_pt - near_pt).normalized());
+
+    pick_is_click = click_wanted;
+    pick_wanted   = false;
+    click_wanted  = false;
+}
+
+void obvi::main_window::draw_overlay() {
+    const frame_profiler::summary& stats = profiler.get_summary();
+
+    // Frame totals, the time of each CPU and GPU section (milliseconds), then the counters.
+    char        buf[128];
+    std::string text;
+    std::snprintf(buf, sizeof(buf), "frame %6.2f ms  (%5.1f fps)   cpu %6.2f ms   gpu %6.2f ms\n",
+                  stats.interval_ms, stats.interval_ms > 0 ? 1000.0 / stats.interval_ms : 0.0,
+                  stats.frame_ms, stats.gpu_ms);
+    text += buf;
+    text += "cpu:";
+    for(const frame_profiler::section_time& sec : stats.cpu) {
+        std::snprintf(buf, sizeof(buf), "  %s %.2f", sec.name, sec.ms);
+        text += buf;
+    }
+    text += "\ngpu:";
+    for(const frame_profiler::section_time& sec : stats.gpu) {
+        std::snprintf(buf, sizeof(buf), "  %s %.2f", sec.name, sec.ms);
+        text += buf;
+    }
+    std::snprintf(buf, sizeof(buf), "\n%llu triangles, %zu draw calls, %zu draw commands%s",
+                  (unsigned long long)stats.triangles, stats.draw_calls, stats.draw_commands,
+                  profiler.tracing() ? "   [recording trace]" : "");
+    text += buf;
+    if(!pages.empty()) {
+        std::snprintf(buf, sizeof(buf),
+                      "\npages: %zu gpu, %zu host, %zu loading, %zu on disk   host %zu MB   gpu %zu MB",
+                      pager.count(residency::GPU), pager.count(residency::HOST),
+                      pager.count(residency::LOADING), pager.count(residency::DISK),
+                      pager.host_used() >> 20, pager.gpu_used() >> 20);
+        text += buf;
+    }
+
+    overlay_device->setSize(QSize(pixel_width(), pixel_height()));
+    overlay_device->setDevicePixelRatio(qreal(view.pixel_ratio));
+    QPainter painter(overlay_device.get());
+    painter.setFont(overlay_font);
+    const QString str  = QString::fromStdString(text);
+    const QRect   box  = painter.boundingRect(QRect(10, 10, view.width - 20, view.height - 20),
+                                              Qt::AlignLeft | Qt::AlignTop, str);
+    painter.fillRect(box.adjusted(-5, -5, 5, 5), QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(box, Qt::AlignLeft | Qt::AlignTop, str);
 }
 
 void obvi::main_window::update_camera() {
     if(lens_changed) {
-        camera.set_perspective(deg2rad(45.0f), float(width()) / float(height()), 1.0f, 1e5f);
+        camera.set_perspective(deg2rad(45.0f), float(view.width) / float(view.height),
+            1e-2f * scene_radius, 1e3f * scene_radius);
     }
     if(camera_moved) {
         // Update camera position.
         const vec3f& camera_pos = camera.get_position();
-        program.setUniformValue(loc_camera_pos_world, camera_pos[0], camera_pos[1], camera_pos[2]);
+        program->setUniformValue(loc_camera_pos_world, camera_pos[0], camera_pos[1], camera_pos[2]);
         // Update light direction (light pointed in same direction as camera).
         vec3f look_dir = camera.get_look_dir();
-        program.setUniformValue(loc_light_dir_world, look_dir[0], look_dir[1], look_dir[2]);
+        program->setUniformValue(loc_light_dir_world, look_dir[0], look_dir[1], look_dir[2]);
     }
     if(lens_changed || camera_moved) {
-        std::array<float, 16> mat_view_proj;
-        camera.to_gl(mat_view_proj);
-        program.setUniformValue(loc_view_proj, QMatrix4x4(mat_view_proj.data()).transposed());
+        camera.to_gl(view_proj);
+        program->setUniformValue(loc_view_proj, QMatrix4x4(view_proj.data()).transposed());
     }
     lens_changed = false;
     camera_moved = false;
@@ -2,6 +2,14 @@
  *
  * Just a basic OpenGL display with no controls (for now).
  *
+ * All OpenGL work happens on a render thread, which owns the context, the scene and everything
+ * else needed to draw a frame. The GUI thread only turns Qt events into a snapshot of the window
+ * and input state (size, cursor, toggles, settings), and sends a copy over a lock-free queue each
+ * time it changes. A slow frame (big culls and uploads, or a swap that waits for vsync) then
+ * never delays event handling, and input is always applied to the next frame. The one exception
+ * is the window being hidden: the GUI thread waits for the render thread to let go of the
+ * surface first.
+ *
  * * * * * * * * * * * *
  * The MIT License (MIT)
  *
@@ -29,59 +37,229 @@
 #ifndef OBVI_MAIN_WINDOW_HPP
 #define OBVI_MAIN_WINDOW_HPP
 
-#include <QOpenGLWindow>
-#include <QOpenGLFunctions>
-#include <QOpenGLBuffer>
-#include <QOpenGLVertexArrayObject>
+#include <QWindow>
+#include <QFont>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_4_3_Core>
+#include <QOpenGLPaintDevice>
 #include <QOpenGLShaderProgram>
+#include <QSurfaceFormat>
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
-#include <obvi/util/affine3.hpp>
 #include <obvi/util/camera3.hpp>
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/residency.hpp>
+#include <obvi/util/spsc_queue.hpp>
+
+#include "frame_profiler.hpp"
+#include "hiz_culler.hpp"
+#include "mesh_loader.hpp"
+#include "picker.hpp"
+#include "scene_batch.hpp"
 
 namespace obvi {
 
-struct main_window : public QOpenGLWindow, protected QOpenGLFunctions {
+struct main_window : public QWindow, protected QOpenGLFunctions_4_3_Core {
     Q_OBJECT
 
 public:
+    main_window();
     ~main_window();
 
-    // Functions from QOpenGLWindow that are called by Qt during rendering.
-    void initializeGL();
-    void resizeGL(int width, int height);
-    void paintGL();
+    /* Mesh files to display. They're loaded in the background once the window is shown, and
+     * each one appears as soon as it's ready (all shown together, in their own coordinates).
+     * Must be called before the window is shown.
+     */
+    void set_mesh_paths(const std::vector<std::string>& paths) { mesh_paths = paths; }
+
+    /* Directory to keep prepared copies of mesh files in, so they open much faster next time
+     * (see mesh_cache.hpp). Empty (the default) turns the cache off. Must be called before the
+     * window is shown.
+     */
+    void set_cache_dir(const std::string& dir) { cache_dir = dir; }
+
+    /* Split meshes with more triangles than this into pages, which are loaded and dropped as the
+     * camera moves, so meshes bigger than memory can be viewed (default is default_page_tris, 0
+     * turns paging off). Needs a cache dir. Must be called before the window is shown.
+     */
+    void set_page_tris(size_t tris) { page_tris = tris; }
+
+    // Bytes of pages to keep in host memory, and on the GPU (see residency.hpp for defaults).
+    // Can be changed at any time, the render thread picks it up next frame.
+    void set_host_budget(size_t bytes) { gui_input.host_budget = bytes; post_settings(); }
+    void set_gpu_budget(size_t bytes)  { gui_input.gpu_budget = bytes; post_settings(); }
+
+    /* Show a grid of copies x copies of the loaded meshes, instead of just one (default is 1).
+     * Must be called before the window is shown.
+     */
+    void set_grid_copies(int copies) { grid_copies = std::max(copies, 1); }
+
+    /* Send 16-bit quantized positions to the GPU instead of 32-bit floats (default is true).
+     * Must be called before the window is shown.
+     */
+    void set_compact_vertices(bool enable) { compact_vertices = enable; }
+
+    /* Redraw at the display's refresh rate even when nothing changed (default is false: frames
+     * are only drawn when the view, the scene or the window changes, or while animating). Can be
+     * changed at any time.
+     */
+    void set_continuous_redraw(bool enable) { gui_input.continuous = enable; post_settings(); }
 
 private:
-    // Event handling.
+    // Window and input state (and settings), as of the last Qt event. The GUI thread sends a
+    // complete copy each time anything changes, so the render thread only needs the latest one.
+    // Events are counted, so it can tell one happened even if it skipped the snapshots in between.
+    struct view_input {
+        bool     exposed     = false;
+        uint32_t exposes     = 0;    // expose events so far (see exposeEvent())
+        int      width       = 1;    // window size, in device-independent pixels
+        int      height      = 1;
+        float    pixel_ratio = 1.0f; // device pixels per device-independent pixel
+        float    cursor_x    = 0.0f; // last mouse position, in window coords
+        float    cursor_y    = 0.0f;
+        uint32_t moves       = 0;    // mouse moves so far
+        uint32_t clicks      = 0;    // left clicks so far
+        uint32_t traces      = 0;    // presses of T so far (start/stop recording a trace)
+        bool     animate     = false;
+        bool     lod         = true;
+        bool     occlusion   = true;
+        bool     show_stats  = false;
+        bool     continuous  = false;
+        size_t   host_budget = 0;    // set from pager's defaults in the constructor
+        size_t   gpu_budget  = 0;
+    };
+
+    // Event handling (GUI thread).
+    bool event(QEvent *ev);
+    void exposeEvent(QExposeEvent *ev);
+    void resizeEvent(QResizeEvent *ev);
     void keyPressEvent(QKeyEvent *ev);
+    void mouseMoveEvent(QMouseEvent *ev);
+    void mousePressEvent(QMouseEvent *ev);
 
-    // Helper functions.
+    void update_size();
+    void post_input();
+    void post_settings();
+    void wake_render();
+    void start_rendering();
+    void stop_rendering();
+
+    // Rendering (render thread, or the GUI thread if the platform can't render from others).
+    void render_loop();
+    bool init_gl();
+    void release_gl();
+    bool render_once();
+    void apply_input(const view_input& in);
+    bool render_frame();
+    int  pixel_width() const;
+    int  pixel_height() const;
+
+    // Helper functions (render thread).
     void print_context_info();
+    void toggle_trace();
+
+    void take_loaded_meshes();
+    void add_paged_mesh(mesh_loader::result& res);
+    bool update_pages(bool moved);
+    void place_objects(size_t mesh_id);
+    size_t num_framed_objects() const;
+    void frame_scene();
 
-    void bind_state();
-    void release_state();
     void update_model();
     void update_camera();
+    void wait_for_previous_frame();
+    bool finish_pick();
+    void start_pick();
+    void draw_overlay();
+
+    // GUI thread state. Nothing else is touched by the GUI thread once rendering has started,
+    // except the queue and the wake up flags.
+    view_input               gui_input;
+    bool                     started       = false;
+    bool                     threaded      = false; // rendering on render_thread
+    bool                     retry_pending = false; // queue was full, send gui_input again soon
+    QSurfaceFormat           gl_format;
+    QFont                    overlay_font;  // set before render_thread starts, then read-only
 
-    // OpenGL object state.
-    QOpenGLBuffer            v_buffer;
-    QOpenGLVertexArrayObject v_obj;
-    QOpenGLShaderProgram     program;
-    int                      loc_model;
+    // Hand off from the GUI thread to the render thread.
+    obvi::spsc_queue<view_input> inputs{64};
+    std::thread                  render_thread;
+    std::mutex                   wake_mutex;
+    std::condition_variable      wake_cv;
+    bool                         wake_pending   = false; // guarded by wake_mutex
+    bool                         quit_requested = false; // guarded by wake_mutex
+    std::condition_variable      exposes_cv;             // signaled when exposes_seen changes
+    uint32_t                     exposes_seen   = 0;     // guarded by wake_mutex
+
+    // Everything below belongs to the render thread.
+    view_input                          view; // latest snapshot from the GUI thread
+    uint32_t                            exposes_acked = 0; // view.exposes as of the last ack
+    std::unique_ptr<QOpenGLContext>     gl;
+    std::unique_ptr<QOpenGLPaintDevice> overlay_device;
+
+    // OpenGL object state. Objects that own QObjects are created on the render thread, so the
+    // QObjects belong to it.
+    std::unique_ptr<QOpenGLShaderProgram> program;
     int                      loc_view_proj;
     int                      loc_light_dir_world;
     int                      loc_camera_pos_world;
+    int                      loc_hover_object;
+    int                      loc_selected_object;
 
     // Other object state.
-    obvi::affine3f model;
+    obvi::mesh_loader     loader;            // reads and prepares mesh files in the background
+    std::vector<std::string> mesh_paths;
+    std::string              cache_dir;
+    size_t                   page_tris = default_page_tris;
+    obvi::scene_batch     scene;             // every mesh and object, drawn with one call
+
+    // Pages of meshes too big to load at once. The proxy's objects are drawn until a page is
+    // on the GPU, then the page gets objects of its own, with the same transforms.
+    static constexpr size_t no_mesh = ~size_t(0);
+    struct page_data {
+        uint64_t      key;          // mesh_loader::result::page_key
+        size_t        index;        // page of its mesh (and chunk of the proxy it replaces)
+        size_t        first_object; // objects of the proxy
+        size_t        end_object;
+        size_t        mesh_id = no_mesh; // scene mesh, once the page was first uploaded
+        prepared_mesh host;              // loaded data, while it isn't in the scene
+    };
+    std::vector<page_data>             pages;        // index is the pager's page index
+    std::vector<size_t>                page_instance_objects; // pager instance -> proxy object
+    std::vector<size_t>                page_objects; // objects of pages (sorted)
+    obvi::residency_manager            pager;
+    obvi::residency_manager::actions   page_actions;
+    std::unique_ptr<obvi::hiz_culler> culler; // GPU occlusion culling of the scene's chunks
+    bool                  culler_ok = false;
+    obvi::frame_profiler  profiler;          // CPU and GPU time of each part of a frame
+    std::array<float, 16> view_proj;         // (projection * view) used this frame
+
+    // Picking (object under the mouse cursor is highlighted, clicking on one selects it).
+    static constexpr GLuint no_object = 0xFFFFFFFFu;
+    obvi::picker          picker;
+    bool                  pick_wanted   = false;  // mouse moved or clicked since the last pick
+    bool                  click_wanted  = false;
+    bool                  pick_is_click = false;  // the running pick was started by a click
+    GLuint                hover_object    = no_object;
+    GLuint                selected_object = no_object;
+    int                   grid_copies = 1;
+    size_t                framed_objects = 0; // number of placed objects when camera was aimed
+    float          scene_radius = 1.0f; // radius of sphere around scene, used to set clip planes
+    bool           compact_vertices = true;
     obvi::camera3f camera;
     bool           model_moved  = false;
     bool           lens_changed = false;
     bool           camera_moved = false;
 
-    bool           animate      = false;
+    GLsync         frame_fence  = nullptr; // signaled when the GPU finishes the last frame
 
     std::chrono::steady_clock::time_point tstart;
 };
@@ -0,0 +1,198 @@
+/* Implementation of loading meshes from disk on a background thread.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include "mesh_loader.hpp"
+
+#include <utility>
+
+void obvi::prepare_mesh(mesh& m, std::vector<mesh_chunk>& out_chunks,
+                        std::vector<uint32_t>& out_lod_indices) {
+    weld_vertices(m);
+    partition_mesh(m, out_chunks);
+    optimize_vertex_fetch(m);
+    simplify_chunks(m, out_chunks, out_lod_indices);
+}
+
+void obvi::mesh_loader::start(const std::vector<std::string>& paths,
+                              std::function<void()> on_result) {
+    stop();
+    cancel      = false;
+    notify      = on_result;
+    worker      = std::thread(&mesh_loader::run, this, paths, cache_dir, page_tris,
+                              std::move(on_result));
+    page_worker = std::thread(&mesh_loader::run_pages, this);
+}
+
+bool obvi::mesh_loader::take(result& out) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(done.empty()) {
+        return false;
+    }
+    out = std::move(done.front());
+    done.pop_front();
+    return true;
+}
+
+void obvi::mesh_loader::load_page(const page_request& req) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        page_requests.push_back(req);
+    }
+    page_wake.notify_one();
+}
+
+bool obvi::mesh_loader::take_page(page_result& out) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(pages_done.empty()) {
+        return false;
+    }
+    out = std::move(pages_done.front());
+    pages_done.pop_front();
+    return true;
+}
+
+void obvi::mesh_loader::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        cancel = true;
+    }
+    page_wake.notify_all();
+    if(worker.joinable()) {
+        worker.join();
+    }
+    if(page_worker.joinable()) {
+        page_worker.join();
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    done.clear();
+    page_requests.clear();
+    pages_done.clear();
+}
+
+void obvi::mesh_loader::run_pages() {
+    std::unique_lock<std::mutex> guard(lock);
+    while(true) {
+        page_wake.wait(guard, [this]() { return cancel || !page_requests.empty(); });
+        if(cancel) {
+            return;
+        }
+        page_request req = std::move(page_requests.front());
+        page_requests.pop_front();
+        guard.unlock();
+
+        page_result res;
+        res.token = req.token;
+        load_mesh_page(req.dir, req.key, req.page_idx, res.data, &res.error);
+        if(!res.error.empty()) {
+            res.data = prepared_mesh();
+        }
+
+        guard.lock();
+        pages_done.push_back(std::move(res));
+        guard.unlock();
+        if(notify) {
+            notify();
+        }
+        guard.lock();
+    }
+}
+
+void obvi::mesh_loader::run(std::vector<std::string> paths, std::string dir, size_t max_tris,
+                            std::function<void()> on_result) {
+    for(const std::string& path : paths) {
+        if(cancel) {
+            return;
+        }
+
+        result res;
+        res.path = path;
+        load(dir, max_tris, res);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            done.push_back(std::move(res));
+        }
+        if(on_result) {
+            on_result();
+        }
+    }
+}
+
+void obvi::mesh_loader::load(const std::string& dir, size_t max_tris, result& res) {
+    // Cache files are named after a hash of the source file's contents, so an edited file gets
+    // a new cache file instead of stale data. A mesh that was already split only needs its proxy.
+    uint64_t    hash = 0;
+    uint64_t    key  = 0;
+    std::string cache_path;
+    if(!dir.empty() && hash_file(res.path, &hash)) {
+        if(max_tris > 0) {
+            key = mesh_page_key(hash, max_tris);
+            if(load_mesh_proxy(dir, key, res.data, res.pages)) {
+                res.cached   = true;
+                res.paged    = true;
+                res.page_key = key;
+                return;
+            }
+            res.data = prepared_mesh();
+            res.pages.clear();
+        }
+        cache_path = dir + "/" + mesh_cache_name(hash);
+        res.cached = load_mesh_cache(cache_path, hash, res.data);
+    }
+
+    if(!res.cached) {
+        mesh& m = res.data.geom;
+        if(!load_mesh(res.path, m, &res.error)) {
+            m.clear();
+            return;
+        }
+        if(m.num_triangles() == 0) {
+            res.error = "mesh has no triangles";
+            m.clear();
+            return;
+        }
+        prepare_mesh(m, res.data.chunks, res.data.lod_indices);
+        res.data.generate_chunk_bvh();
+    }
+
+    // Split big meshes into pages. If that fails, keep the whole mesh (in the cache too).
+    if(max_tris > 0 && !cache_path.empty() && res.data.geom.num_triangles() > max_tris) {
+        std::vector<prepared_mesh> pages;
+        prepared_mesh              proxy;
+        split_mesh_pages(res.data, max_tris, pages, proxy);
+        if(save_mesh_pages(dir, key, pages, proxy, &res.cache_error)
+           && load_mesh_proxy(dir, key, proxy, res.pages, &res.cache_error)) {
+            res.data     = std::move(proxy);
+            res.paged    = true;
+            res.page_key = key;
+            return;
+        }
+        res.pages.clear();
+    }
+    if(!cache_path.empty() && !res.cached) {
+        save_mesh_cache(cache_path, hash, res.data, &res.cache_error);
+    }
+}
@@ -0,0 +1,140 @@
+/* Header for loading meshes from disk on a background thread.
+ *
+ * Parsing a big file and preparing it for drawing (welding, chunking, simplifying) can take many
+ * seconds, so it's done on a worker thread while the window keeps drawing. Finished meshes are
+ * handed back one at a time, to be added to the scene as soon as each one is ready.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_MESH_LOADER_HPP
+#define OBVI_MESH_LOADER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/mesh_cache.hpp>
+#include <obvi/util/mesh_pages.hpp>
+
+namespace obvi {
+
+/* Get a mesh ready for scene_batch::add_mesh(): share vertices between triangles, split the mesh
+ * into chunks that can be culled separately, order everything for the GPU's vertex caches, then
+ * build coarser versions of each chunk to draw when it's far away.
+ */
+void prepare_mesh(mesh& m, std::vector<mesh_chunk>& out_chunks,
+                  std::vector<uint32_t>& out_lod_indices);
+
+struct mesh_loader {
+    struct result {
+        std::string   path;
+        std::string   error;          // empty if the mesh was loaded
+        std::string   cache_error;    // why the cache file couldn't be written (mesh still loaded)
+        bool          cached = false; // true if the mesh was read from a cache file
+        prepared_mesh data;
+
+        // Meshes with more than page_tris triangles are split into pages (see mesh_pages.hpp).
+        // Then data is the proxy, and each page has to be loaded with load_page().
+        bool                         paged    = false;
+        uint64_t                     page_key = 0;
+        std::vector<mesh_cache_info> pages;   // sizes of the pages, one per proxy chunk
+    };
+
+    struct page_request {
+        std::string dir;      // cache directory the pages were saved in
+        uint64_t    key;      // result::page_key
+        size_t      page_idx;
+        size_t      token;    // passed back in the page_result
+    };
+
+    struct page_result {
+        size_t        token;
+        std::string   error; // empty if the page was loaded
+        prepared_mesh data;
+    };
+
+    ~mesh_loader() { stop(); }
+
+    /* Directory for cache files of prepared meshes (see mesh_cache.hpp). Empty (the default)
+     * turns the cache off. The directory must already exist. Used by the next call to start().
+     */
+    void set_cache_dir(const std::string& dir) { cache_dir = dir; }
+
+    /* Meshes with more triangles than this are split into pages, which are loaded one at a time
+     * with load_page() (default is default_page_tris, 0 turns paging off). Only works with a
+     * cache directory, since that's where the pages are kept. Used by the next call to start().
+     */
+    void set_page_tris(size_t tris) { page_tris = tris; }
+
+    /* Start loading the given files on a worker thread, in order. on_result is called from the
+     * worker thread every time a file is done (loaded or failed), e.g. to wake up the render thread.
+     */
+    void start(const std::vector<std::string>& paths, std::function<void()> on_result);
+
+    // Take the next finished file, if there is one. Returns false if none are ready.
+    bool take(result& out);
+
+    /* Load a page of a paged mesh on a second worker thread, which doesn't wait for files to
+     * finish. Requests are handled in order, and on_result is called when each one is done.
+     * Must be called between start() and stop().
+     */
+    void load_page(const page_request& req);
+
+    // Take the next finished page, if there is one. Returns false if none are ready.
+    bool take_page(page_result& out);
+
+    // Stop after the current file and page, and wait for the worker threads to exit.
+    void stop();
+
+private:
+    void run(std::vector<std::string> paths, std::string dir, size_t max_tris,
+             std::function<void()> on_result);
+    void run_pages();
+
+    // Load and prepare one file, using (or filling) the cache in dir if it isn't empty.
+    static void load(const std::string& dir, size_t max_tris, result& res);
+
+    std::thread               worker;
+    std::thread               page_worker;
+    std::mutex                lock;     // guards done, page_requests and pages_done
+    std::condition_variable   page_wake;
+    std::deque<result>        done;
+    std::deque<page_request>  page_requests;
+    std::deque<page_result>   pages_done;
+    std::function<void()>     notify;   // on_result, for the page worker
+    std::atomic<bool>         cancel{false};
+    std::string               cache_dir;
+    size_t                    page_tris = default_page_tris;
+};
+
+} // END namespace obvi
+
+#endif // OBVI_MESH_LOADER_HPP
@@ -0,0 +1,99 @@
+/* Implementation of background picking.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include "picker.hpp"
+
+void obvi::picker::start(const scene_batch& target, const vec3f& ray_origin,
+                         const vec3f& ray_dir) {
+    scene_batch::pick_result unused;
+    finish(unused);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        scene    = &target;
+        origin   = ray_origin;
+        dir      = ray_dir;
+        has_job  = true;
+        job_done = false;
+    }
+    if(!worker.joinable()) {
+        worker = std::thread(&picker::run, this);
+    }
+    wake.notify_all();
+    pending = true;
+}
+
+bool obvi::picker::finish(scene_batch::pick_result& out) {
+    if(!pending) {
+        return false;
+    }
+    pending = false;
+    std::unique_lock<std::mutex> guard(lock);
+    wake.wait(guard, [this]() { return job_done; });
+    if(hit) {
+        out = result;
+    }
+    return hit;
+}
+
+void obvi::picker::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    if(worker.joinable()) {
+        worker.join();
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    quit    = false;
+    has_job = false;
+    pending = false;
+}
+
+void obvi::picker::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    for(;;) {
+        wake.wait(guard, [this]() { return quit || has_job; });
+        if(has_job) {
+            // Pick without holding the lock (the render thread only waits for job_done).
+            has_job = false;
+            const scene_batch* target     = scene;
+            const vec3f        ray_origin = origin;
+            const vec3f        ray_dir    = dir;
+            guard.unlock();
+            scene_batch::pick_result res;
+            const bool found = target->pick(ray_origin, ray_dir, res);
+            guard.lock();
+            hit      = found;
+            result   = res;
+            job_done = true;
+            wake.notify_all();
+        }
+        if(quit) {
+            return;
+        }
+    }
+}
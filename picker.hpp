@@ -0,0 +1,86 @@
+/* Header for picking objects under the mouse cursor on a background thread.
+ *
+ * A pick casts a ray from the camera through the cursor, and finds the closest triangle it hits
+ * with scene_batch::pick(). That reads the scene without locking, so the scene must not change
+ * while a pick runs. The render thread starts at most one pick per frame, right after it's done
+ * drawing, and collects the result first thing in the next frame (before it changes anything).
+ * The pick overlaps with the GPU finishing the frame and with event handling, and any number of
+ * mouse moves between two frames turn into a single pick.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_PICKER_HPP
+#define OBVI_PICKER_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <obvi/util/vec3.hpp>
+
+#include "scene_batch.hpp"
+
+namespace obvi {
+
+struct picker {
+    ~picker() { stop(); }
+
+    /* Start picking along a ray in world coords (see scene_batch::pick()). If a pick is already
+     * running, waits for it first (its result is lost). The scene must not change until finish().
+     */
+    void start(const scene_batch& scene, const vec3f& origin, const vec3f& dir);
+
+    // True between start() and finish().
+    bool running() const { return pending; }
+
+    /* Wait for the pick started by start(). Returns true if it hit something, and sets out to the
+     * closest hit. Returns false if nothing was hit, or there was no pick running.
+     */
+    bool finish(scene_batch::pick_result& out);
+
+    // Wait for the current pick (if any), and for the worker thread to exit.
+    void stop();
+
+private:
+    void run();
+
+    std::thread             worker;
+    std::mutex              lock;    // guards everything below
+    std::condition_variable wake;    // signaled when a job is posted, done, or on quit
+    const scene_batch*      scene = nullptr;
+    vec3f                   origin;
+    vec3f                   dir;
+    bool                    has_job  = false;
+    bool                    job_done = false;
+    bool                    hit      = false;
+    bool                    quit     = false;
+    scene_batch::pick_result result;
+
+    bool pending = false; // only used by the thread that calls start() and finish()
+};
+
+} // END namespace obvi
+
+#endif // OBVI_PICKER_HPP
@@ -0,0 +1,710 @@
+/* Implementation of batched rendering of many mesh objects.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include "scene_batch.hpp"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+
+namespace {
+    // Must match object_info in shaders/flat.vert and shaders/hiz_cull.comp (std430 layout).
+    constexpr size_t floats_per_object = 32; // mesh_to_world and vertex_to_world matrices
+    constexpr GLuint object_binding    = 4;  // binding of object_buf in the shaders
+
+    // Must match DrawElementsIndirectCommand.
+    constexpr size_t uints_per_command = 5;
+
+    // Color of meshes that don't have vertex colors (light gray, RGBA8 with R in low byte).
+    constexpr uint32_t default_color = 0xFFCCCCCCu;
+}
+
+size_t obvi::scene_batch::add_mesh(mesh&& m, std::vector<mesh_chunk>&& chunks,
+                                   std::vector<uint32_t>&& lod_indices) {
+    prepared_mesh pm;
+    pm.geom        = std::move(m);
+    pm.chunks      = std::move(chunks);
+    pm.lod_indices = std::move(lod_indices);
+    return add_mesh(std::move(pm));
+}
+
+size_t obvi::scene_batch::add_mesh(prepared_mesh&& pm) {
+    if(pm.chunk_bvh.size() != pm.chunks.size()) {
+        pm.generate_chunk_bvh();
+    }
+    meshes.emplace_back();
+    mesh_data& md  = meshes.back();
+    md.geom        = std::move(pm.geom);
+    md.chunks      = std::move(pm.chunks);
+    md.lod_indices = std::move(pm.lod_indices);
+    md.chunk_bvh   = std::move(pm.chunk_bvh);
+    md.cache_file  = std::move(pm.cache_file); // mapping doesn't move, so borrowed nodes stay put
+    return meshes.size() - 1;
+}
+
+void obvi::scene_batch::evict_mesh(size_t mesh_id, mesh *out_geom,
+                                   std::vector<uint32_t> *out_lod_indices) {
+    mesh_data& md = meshes[mesh_id];
+    if(!md.resident) {
+        return;
+    }
+    md.resident = false;
+    if(md.allocated) {
+        vert_alloc.free(size_t(md.base_vertex), md.alloc_verts);
+        index_alloc.free(md.first_index, md.alloc_indices);
+        md.allocated = false;
+    }
+    md.verts_sent = md.indices_sent = 0;
+    send_queue.erase(std::remove(send_queue.begin(), send_queue.end(), mesh_id), send_queue.end());
+    std::vector<uint8_t>().swap(md.staged_positions);
+    std::vector<uint32_t>().swap(md.staged_colors);
+
+    if(out_geom) {
+        *out_geom = std::move(md.geom);
+    }
+    if(out_lod_indices) {
+        *out_lod_indices = std::move(md.lod_indices);
+    }
+    md.geom        = mesh();
+    md.lod_indices = std::vector<uint32_t>();
+}
+
+bool obvi::scene_batch::reload_mesh(size_t mesh_id, mesh&& geom,
+                                    std::vector<uint32_t>&& lod_indices) {
+    mesh_data& md = meshes[mesh_id];
+    if(md.resident) {
+        return false;
+    }
+    for(const mesh_chunk& chunk : md.chunks) {
+        if(size_t(chunk.first_index) + chunk.num_indices > geom.indices.size()) {
+            return false;
+        }
+        for(uint32_t j = 0; j < chunk.num_lods; ++j) {
+            if(size_t(chunk.lods[j].first_index) + chunk.lods[j].num_indices > lod_indices.size()) {
+                return false;
+            }
+        }
+    }
+    md.geom        = std::move(geom);
+    md.lod_indices = std::move(lod_indices);
+    md.resident    = true;
+    reloaded.push_back(mesh_id); // gets a new place in the shared buffers on the next upload()
+    return true;
+}
+
+size_t obvi::scene_batch::add_object(size_t mesh_id, const affine3f& model) {
+    objects.emplace_back();
+    objects.back().mesh_id    = mesh_id;
+    objects.back().model      = model;
+    objects.back().first_item = 0;
+    return objects.size() - 1;
+}
+
+void obvi::scene_batch::set_stand_in(size_t object_id, size_t chunk, size_t other_object) {
+    object_data& obj        = objects[object_id];
+    const size_t num_chunks = meshes[obj.mesh_id].chunks.size();
+    if(chunk >= num_chunks || other_object >= objects.size()) {
+        return;
+    }
+    if(obj.stand_in_for.empty()) {
+        obj.stand_in_for.assign(num_chunks, size_t(no_object));
+    }
+    obj.stand_in_for[chunk]             = other_object;
+    objects[other_object].has_stand_in = true;
+}
+
+void obvi::scene_batch::set_transform(size_t object_id, const affine3f& model) {
+    objects[object_id].model = model;
+    if(object_id >= instances.size()) {
+        return; // not uploaded yet
+    }
+    instances[object_id].transform = model;
+    if(dirty_begin < dirty_end) {
+        dirty_begin = std::min(dirty_begin, object_id);
+        dirty_end   = std::max(dirty_end, object_id + 1);
+    } else {
+        dirty_begin = object_id;
+        dirty_end   = object_id + 1;
+    }
+}
+
+bool obvi::scene_batch::init(bool compact, hiz_culler* culler) {
+    if(!initializeOpenGLFunctions()) {
+        qWarning() << "scene_batch: OpenGL 4.3 core functions not available";
+        return false;
+    }
+    destroy();
+
+    compact_vertices = compact;
+    item_culler      = culler;
+    pos_stride       = compact_vertices ? quantized_positions::stride * sizeof(uint16_t)
+                                        : sizeof(vec3f);
+    glGenVertexArrays(1, &vao);
+    return true;
+}
+
+bool obvi::scene_batch::upload(size_t max_bytes) {
+    if(!vao) {
+        return false;
+    }
+    reserve_meshes();
+    place_objects();
+
+    // Send mesh data in the order the meshes were added (or reloaded), so the first one shows
+    // up first.
+    size_t budget = std::max<size_t>(max_bytes, 1);
+    while(!send_queue.empty() && budget > 0) {
+        mesh_data& md = meshes[send_queue.front()];
+        budget -= std::min(budget, send_mesh_data(md, budget));
+        if(md.vertices_done() && md.lods_done()) {
+            send_queue.pop_front();
+        }
+    }
+    if(vao_dirty) {
+        setup_vertex_array();
+    }
+    if(items_dirty && item_culler) {
+        item_culler->set_items(items);
+    }
+    items_dirty = false;
+    return !send_queue.empty() || reserved_meshes < meshes.size();
+}
+
+void obvi::scene_batch::destroy() {
+    if(vao) {
+        glDeleteVertexArrays(1, &vao);
+        vao = 0;
+    }
+    GLuint bufs[6] = {pos_buf, color_buf, index_buf, id_buf, object_buf, cmd_buf};
+    for(GLuint buf : bufs) {
+        if(buf) {
+            glDeleteBuffers(1, &buf);
+        }
+    }
+    pos_buf = color_buf = index_buf = id_buf = object_buf = cmd_buf = 0;
+    vert_capacity = index_capacity = object_capacity = cmd_capacity = 0;
+    vao_dirty     = false;
+
+    // Everything has to be sent again after the next init().
+    for(mesh_data& md : meshes) {
+        md.verts_sent = md.indices_sent = 0;
+        md.allocated  = false;
+        std::vector<uint8_t>().swap(md.staged_positions);
+        std::vector<uint32_t>().swap(md.staged_colors);
+    }
+    reserved_meshes = 0;
+    reloaded.clear();
+    send_queue.clear();
+    vert_alloc.reset(0);
+    index_alloc.reset(0);
+    items_dirty = false;
+    size_error  = false;
+    items.clear();
+    levels.clear();
+    instances.clear();
+    top.clear();
+    dirty_begin = dirty_end = 0;
+    num_draws   = 0;
+    cmd_source  = nullptr;
+}
+
+void obvi::scene_batch::reserve_meshes() {
+    // Find a place in the shared buffers for new meshes, then for meshes that were reloaded.
+    for(; reserved_meshes < meshes.size() && !size_error; ++reserved_meshes) {
+        mesh_data& md = meshes[reserved_meshes];
+        if(!md.resident) {
+            continue; // evicted before it was ever sent
+        }
+        if(!reserve(md)) {
+            break;
+        }
+        send_queue.push_back(reserved_meshes);
+    }
+    for(size_t mesh_id : reloaded) {
+        mesh_data& md = meshes[mesh_id];
+        if(!md.resident || md.allocated || mesh_id >= reserved_meshes || !reserve(md)) {
+            continue;
+        }
+        send_queue.push_back(mesh_id);
+
+        // The mesh's chunks moved, update the items of every placed object that uses it.
+        for(size_t i = 0; i < instances.size(); ++i) {
+            if(objects[i].mesh_id == mesh_id) {
+                fill_items(i);
+            }
+        }
+    }
+    reloaded.clear();
+
+    // Grow shared buffers to fit everything that was placed.
+    if(vert_alloc.capacity() > vert_capacity) {
+        size_t cap = vert_alloc.capacity();
+        pos_buf    = grow_buffer(pos_buf, vert_capacity * pos_stride, cap * pos_stride);
+        color_buf  = grow_buffer(color_buf, vert_capacity * sizeof(uint32_t), cap * sizeof(uint32_t));
+        vert_capacity = cap;
+        vao_dirty     = true;
+    }
+    if(index_alloc.capacity() > index_capacity) {
+        size_t cap = index_alloc.capacity();
+        index_buf  = grow_buffer(index_buf, index_capacity * sizeof(uint32_t), cap * sizeof(uint32_t));
+        index_capacity = cap;
+        vao_dirty      = true;
+    }
+}
+
+bool obvi::scene_batch::reserve(mesh_data& md) {
+    // If there's no free range big enough, add space at the end (by at least half, so repeated
+    // additions don't grow the buffers too often).
+    const size_t nverts   = md.geom.num_vertices();
+    const size_t nindices = md.num_indices();
+    size_t       first_vert, first_index;
+    if(!vert_alloc.allocate(nverts, &first_vert)) {
+        vert_alloc.grow(vert_alloc.capacity() + std::max(nverts, vert_alloc.capacity() / 2));
+        vert_alloc.allocate(nverts, &first_vert);
+    }
+    if(!index_alloc.allocate(nindices, &first_index)) {
+        index_alloc.grow(index_alloc.capacity() + std::max(nindices, index_alloc.capacity() / 2));
+        index_alloc.allocate(nindices, &first_index);
+    }
+    if(first_vert + nverts > size_t(std::numeric_limits<int32_t>::max())
+       || first_index + nindices > size_t(std::numeric_limits<uint32_t>::max())) {
+        qWarning() << "scene_batch: too many vertices or triangles to draw";
+        vert_alloc.free(first_vert, nverts);
+        index_alloc.free(first_index, nindices);
+        size_error = true;
+        return false;
+    }
+    md.base_vertex   = int32_t(first_vert);
+    md.first_index   = uint32_t(first_index);
+    md.allocated     = true;
+    md.alloc_verts   = nverts;
+    md.alloc_indices = nindices;
+    md.verts_sent    = md.indices_sent = 0;
+
+    {
+        // Convert vertices to the format the GPU reads.
+        md.staged_positions.resize(md.geom.num_vertices() * pos_stride);
+        if(compact_vertices) {
+            quantized_positions qpos;
+            quantize_positions(md.geom, qpos);
+            std::memcpy(md.staged_positions.data(), qpos.values.data(),
+                        qpos.values.size() * sizeof(uint16_t));
+            md.dequantize = qpos.dequantize;
+        } else {
+            std::memcpy(md.staged_positions.data(), md.geom.positions.data(),
+                        md.geom.positions.size() * sizeof(vec3f));
+            md.dequantize = affine3f();
+        }
+        if(md.geom.has_colors()) {
+            md.staged_colors = md.geom.colors;
+        } else {
+            md.staged_colors.assign(md.geom.num_vertices(), default_color);
+        }
+    }
+    return true;
+}
+
+void obvi::scene_batch::place_objects() {
+    // Objects are placed in order, once their mesh has a place in the shared buffers.
+    size_t first_new = instances.size();
+    size_t end       = first_new;
+    while(end < objects.size() && objects[end].mesh_id < reserved_meshes) {
+        ++end;
+    }
+    if(end == first_new) {
+        return;
+    }
+
+    // Every chunk of every object gets its own draw item, and every object its own instance.
+    for(size_t i = first_new; i < end; ++i) {
+        object_data&     obj = objects[i];
+        const mesh_data& md  = meshes[obj.mesh_id];
+        obj.first_item = items.size();
+        items.resize(items.size() + md.chunks.size());
+        fill_items(i);
+        instances.push_back({&md.chunk_bvh, obj.model});
+    }
+    levels.resize(items.size(), 0);
+    if(items.size() >= (size_t(1) << hiz_culler::candidate_level_shift) || !top.generate(instances)) {
+        qWarning() << "scene_batch: too many objects";
+        items.resize(objects[first_new].first_item);
+        levels.resize(items.size());
+        instances.resize(first_new);
+        top.generate(instances);
+        return;
+    }
+
+    // Object transforms, and the per-instance ids that index them.
+    if(end > object_capacity) {
+        object_capacity = std::max(end, object_capacity + object_capacity / 2);
+        if(id_buf) {
+            glDeleteBuffers(1, &id_buf);
+            glDeleteBuffers(1, &object_buf);
+        }
+        glGenBuffers(1, &id_buf);
+        glGenBuffers(1, &object_buf);
+
+        std::vector<uint32_t> ids(object_capacity);
+        for(size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = uint32_t(i);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, id_buf);
+        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(ids.size() * sizeof(uint32_t)), ids.data(),
+                     GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, object_buf);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     GLsizeiptr(object_capacity * floats_per_object * sizeof(float)), nullptr,
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        write_objects(0, end);
+        vao_dirty = true;
+    } else {
+        write_objects(first_new, end);
+    }
+
+    // Commands for drawing without the GPU culler.
+    if(items.size() > cmd_capacity) {
+        cmd_capacity = std::max(items.size(), cmd_capacity + cmd_capacity / 2);
+        if(!cmd_buf) {
+            glGenBuffers(1, &cmd_buf);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cmd_buf);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                     GLsizeiptr(cmd_capacity * uints_per_command * sizeof(uint32_t)), nullptr,
+                     GL_STREAM_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    items_dirty = true;
+}
+
+void obvi::scene_batch::fill_items(size_t object_id) {
+    const object_data& obj = objects[object_id];
+    const mesh_data&   md  = meshes[obj.mesh_id];
+    for(size_t c = 0; c < md.chunks.size(); ++c) {
+        const mesh_chunk& chunk = md.chunks[c];
+        hiz_culler::item& it    = items[obj.first_item + c];
+        it             = hiz_culler::item();
+        it.bounds      = chunk.bounds;
+        it.first_index = md.first_index + chunk.first_index;
+        it.num_indices = chunk.num_indices;
+        it.base_vertex = md.base_vertex;
+        it.object      = uint32_t(object_id);
+        it.num_lods    = chunk.num_lods;
+        for(uint32_t j = 0; j < chunk.num_lods; ++j) {
+            it.lods[j] = chunk.lods[j];
+            it.lods[j].first_index += md.first_index + uint32_t(md.geom.indices.size());
+        }
+    }
+    items_dirty = true;
+}
+
+bool obvi::scene_batch::drawable(size_t item) const {
+    const hiz_culler::item& it  = items[item];
+    const object_data&      obj = objects[it.object];
+    const mesh_data&        md  = meshes[obj.mesh_id];
+
+    // Objects with a stand-in pop in all at once, instead of chunk by chunk.
+    if(obj.has_stand_in) {
+        return md.full_detail_done();
+    }
+    if(!md.ready(it)) {
+        return false;
+    }
+    if(!obj.stand_in_for.empty()) {
+        size_t other = obj.stand_in_for[item - obj.first_item];
+        if(other != no_object && other < instances.size()
+           && meshes[objects[other].mesh_id].full_detail_done()) {
+            return false; // the real thing is drawn instead
+        }
+    }
+    return true;
+}
+
+size_t obvi::scene_batch::send_mesh_data(mesh_data& md, size_t max_bytes) {
+    size_t sent = 0;
+
+    // Vertices first, chunks can't be drawn without them.
+    const size_t nverts = md.geom.num_vertices();
+    if(md.verts_sent < nverts) {
+        size_t count = std::min(nverts - md.verts_sent,
+                                std::max<size_t>(max_bytes / (pos_stride + sizeof(uint32_t)), 1));
+        size_t dst   = size_t(md.base_vertex) + md.verts_sent;
+        glBindBuffer(GL_ARRAY_BUFFER, pos_buf);
+        glBufferSubData(GL_ARRAY_BUFFER, GLintptr(dst * pos_stride), GLsizeiptr(count * pos_stride),
+                        md.staged_positions.data() + md.verts_sent * pos_stride);
+        glBindBuffer(GL_ARRAY_BUFFER, color_buf);
+        glBufferSubData(GL_ARRAY_BUFFER, GLintptr(dst * sizeof(uint32_t)),
+                        GLsizeiptr(count * sizeof(uint32_t)), md.staged_colors.data() + md.verts_sent);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        md.verts_sent += count;
+        sent          += count * (pos_stride + sizeof(uint32_t));
+        if(md.vertices_done()) {
+            std::vector<uint8_t>().swap(md.staged_positions);
+            std::vector<uint32_t>().swap(md.staged_colors);
+        }
+        if(sent >= max_bytes) {
+            return sent;
+        }
+    }
+
+    // Then full-detail triangles in chunk order, then the simplified levels.
+    glBindBuffer(GL_COPY_WRITE_BUFFER, index_buf);
+    const size_t nfull = md.geom.indices.size();
+    while(!md.lods_done() && sent < max_bytes) {
+        const bool      full  = md.indices_sent < nfull;
+        const uint32_t* src   = full ? md.geom.indices.data() + md.indices_sent
+                                     : md.lod_indices.data() + (md.indices_sent - nfull);
+        size_t          avail = full ? nfull - md.indices_sent : md.num_indices() - md.indices_sent;
+        size_t          count = std::min(avail,
+                                         std::max<size_t>((max_bytes - sent) / sizeof(uint32_t), 1));
+        glBufferSubData(GL_COPY_WRITE_BUFFER,
+                        GLintptr((size_t(md.first_index) + md.indices_sent) * sizeof(uint32_t)),
+                        GLsizeiptr(count * sizeof(uint32_t)), src);
+        md.indices_sent += count;
+        sent            += count * sizeof(uint32_t);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return sent;
+}
+
+GLuint obvi::scene_batch::grow_buffer(GLuint buf, size_t used_bytes, size_t new_bytes) {
+    GLuint bigger;
+    glGenBuffers(1, &bigger);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(std::max<size_t>(new_bytes, 1)), nullptr,
+                 GL_STATIC_DRAW);
+    if(buf) {
+        if(used_bytes > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buf);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                                GLsizeiptr(used_bytes));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &buf);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return bigger;
+}
+
+void obvi::scene_batch::setup_vertex_array() {
+    if(!pos_buf || !id_buf) {
+        return; // nothing to draw yet
+    }
+    vao_dirty = false;
+
+    // Vertex layout of shaders/flat.vert.
+    glBindVertexArray(vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, pos_buf);
+    glEnableVertexAttribArray(0);
+    if(compact_vertices) {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, GLsizei(pos_stride), nullptr);
+    } else {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, GLsizei(pos_stride), nullptr);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, color_buf);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(uint32_t), nullptr);
+
+    // Object id advances once per instance, starting from the draw command's base instance
+    // (OpenGL 4.3 doesn't have gl_DrawID or gl_BaseInstance).
+    glBindBuffer(GL_ARRAY_BUFFER, id_buf);
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(uint32_t), nullptr);
+    glVertexAttribDivisor(2, 1);
+
+    // Index buffer binding is stored in the VAO, so it must be released after the VAO.
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void obvi::scene_batch::cull(const camera3f& camera, float viewport_height, hiz_culler* culler,
+                             bool occlusion) {
+    num_draws  = 0;
+    cmd_source = nullptr;
+    if(!vao) {
+        return;
+    }
+    sync_objects();
+
+    // Frustum cull on the CPU, down to individual chunks.
+    visible.clear();
+    auto   query = top.make_query(tlas::intersect_frustum(camera.get_frustum()));
+    size_t obj_idx, chunk_idx;
+    while(query.next(&obj_idx, &chunk_idx)) {
+        visible.push_back(uint32_t(objects[obj_idx].first_item + chunk_idx));
+    }
+    std::sort(visible.begin(), visible.end()); // draw in buffer order
+
+    // Skip chunks that haven't been sent to the GPU yet, and pick a level of detail for the rest.
+    // Every chunk is independent, so big views are split into blocks that run on all cores
+    // (items are object-major, so each object's camera position is only computed once per block).
+    constexpr uint32_t not_ready  = 0xFFFFFFFFu;
+    const size_t       block      = 4096;
+    const size_t       num_blocks = (visible.size() + block - 1) / block;
+    lod.set_view(camera, viewport_height);
+#   pragma omp parallel for schedule(dynamic) if(num_blocks > 1) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int b = 0; b < int(num_blocks); ++b) {
+        const size_t first    = size_t(b) * block;
+        const size_t last     = std::min(first + block, visible.size());
+        size_t       last_obj = size_t(-1);
+        vec3f        cam_local;
+        float        scale    = 1.0f;
+        for(size_t i = first; i < last; ++i) {
+            const uint32_t          entry = visible[i];
+            const hiz_culler::item& it    = items[entry];
+            const object_data&      obj   = objects[it.object];
+            const mesh_data&        md    = meshes[obj.mesh_id];
+            if(!drawable(entry)) {
+                visible[i] = not_ready;
+                continue;
+            }
+            size_t level = 0;
+            if(lod_enabled && it.num_lods > 0 && md.lods_done()) {
+                if(it.object != last_obj) {
+                    last_obj  = it.object;
+                    cam_local = top.get_inv_transform(last_obj) * camera.get_position();
+                    scale     = obj.model.scale();
+                }
+                level = lod.select(md.chunks[entry - obj.first_item], cam_local, scale,
+                                   levels[entry]);
+            }
+            levels[entry] = uint8_t(level);
+            visible[i]    = hiz_culler::candidate(entry, level);
+        }
+    }
+    visible.erase(std::remove(visible.begin(), visible.end(), not_ready), visible.end());
+
+    if(culler) {
+        // Remove chunks hidden behind what was drawn last frame, commands are written on the GPU.
+        num_draws  = culler->cull(visible, object_buf, occlusion);
+        cmd_source = culler;
+        return;
+    }
+
+    size_t count = std::min(visible.size(), cmd_capacity);
+    cmd_scratch.resize(count * uints_per_command);
+#   pragma omp parallel for if(count > block) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int j = 0; j < int(count); ++j) {
+        const size_t            i     = size_t(j);
+        const size_t            item  = visible[i] & ((1u << hiz_culler::candidate_level_shift) - 1);
+        const size_t            level = visible[i] >> hiz_culler::candidate_level_shift;
+        const hiz_culler::item& it    = items[item];
+        uint32_t*               cmd   = &cmd_scratch[i * uints_per_command];
+        cmd[0] = (level == 0) ? it.num_indices : it.lods[level-1].num_indices;
+        cmd[1] = 1; // instance count
+        cmd[2] = (level == 0) ? it.first_index : it.lods[level-1].first_index;
+        cmd[3] = uint32_t(it.base_vertex);
+        cmd[4] = it.object; // base instance
+    }
+    if(count > 0) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cmd_buf);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0,
+                        GLsizeiptr(cmd_scratch.size() * sizeof(uint32_t)), cmd_scratch.data());
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    num_draws = GLsizei(count);
+}
+
+void obvi::scene_batch::draw() {
+    if(num_draws == 0) {
+        return;
+    }
+    glBindVertexArray(vao);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, object_binding, object_buf);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cmd_source ? cmd_source->command_buffer() : cmd_buf);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, num_draws, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+bool obvi::scene_batch::pick(const vec3f& origin, const vec3f& dir, pick_result& out) const {
+    // Visit chunks along the ray near-to-far, and test the triangles of each one exactly. Every
+    // hit shortens the ray, so the search stops soon after the first surface.
+    auto   query = top.make_ray_query(origin, dir);
+    bool   found = false;
+    size_t object_id, chunk_id;
+    while(query.next(&object_id, &chunk_id, nullptr)) {
+        const object_data& obj = objects[object_id];
+        const mesh_data&   md  = meshes[obj.mesh_id];
+        if(!drawable(obj.first_item + chunk_id)) {
+            continue; // not drawn
+        }
+        const mesh_chunk& chunk = md.chunks[chunk_id];
+        size_t tri;
+        float  t;
+        if(md.geom.intersect_ray(query.local_origin(), query.local_dir(), chunk.first_index / 3,
+                                 chunk.num_indices / 3, query.max_t(), &tri, &t)) {
+            query.shrink(t);
+            out.object_id = object_id;
+            out.triangle  = tri;
+            out.t         = t;
+            found         = true;
+        }
+    }
+    if(found) {
+        out.point = origin + dir * out.t;
+    }
+    return found;
+}
+
+void obvi::scene_batch::sync_objects() {
+    if(dirty_begin >= dirty_end) {
+        return;
+    }
+    top.update(instances);
+    write_objects(dirty_begin, dirty_end);
+    dirty_begin = dirty_end = 0;
+}
+
+void obvi::scene_batch::write_objects(size_t begin, size_t end) {
+    if(begin >= end) {
+        return;
+    }
+    object_scratch.resize((end - begin) * floats_per_object);
+    std::array<float, 16> mat;
+    for(size_t i = begin; i < end; ++i) {
+        const object_data& obj = objects[i];
+        float*             dst = &object_scratch[(i - begin) * floats_per_object];
+        obj.model.to_gl(mat);
+        std::copy(mat.begin(), mat.end(), dst);
+        (obj.model * meshes[obj.mesh_id].dequantize).to_gl(mat);
+        std::copy(mat.begin(), mat.end(), dst + 16);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, object_buf);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, GLintptr(begin * floats_per_object * sizeof(float)),
+                    GLsizeiptr(object_scratch.size() * sizeof(float)), object_scratch.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
@@ -0,0 +1,321 @@
+/* Header for batched rendering of many mesh objects.
+ *
+ * Every mesh is stored in one shared vertex buffer and one shared index buffer, and the transform
+ * of every object lives in one shader storage buffer. All visible chunks of all objects are then
+ * drawn with a single glMultiDrawElementsIndirect() call, where each command's base vertex picks
+ * the mesh and its base instance picks the object. CPU cost of a frame doesn't depend on how many
+ * objects there are, only on how many chunks pass the frustum test.
+ *
+ * Frustum culling is done on the CPU with a two-level tree (tlas over objects, bvh over chunks of
+ * each mesh). Each surviving chunk is drawn at a level of detail picked by lod_selector, from how
+ * far it is from the camera. Occlusion culling is then done on the GPU by hiz_culler, if available.
+ *
+ * Meshes can be added at any time. upload() streams new vertex and index data to the GPU a
+ * limited amount per call (growing the shared buffers as needed), so a big mesh can be spread
+ * over several frames, and each chunk is drawn as soon as its triangles have arrived.
+ *
+ * For scenes that don't fit in GPU memory, meshes can also be evicted (their vertices and
+ * triangles are freed, but their chunks stay in the scene so they can still be culled) and
+ * reloaded later. Space freed in the shared buffers is reused by the next meshes sent. A chunk
+ * of another object can be set to stand in for an evicted mesh (see set_stand_in()), e.g. a
+ * coarse proxy from split_mesh_pages().
+ *
+ * Usage:
+ *   1. init() once the OpenGL context is current.
+ *   2. add_mesh() and add_object() whenever new meshes are ready.
+ *   3. Each frame: upload(), set_transform() for anything that moved, cull(), bind the shader,
+ *      draw().
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_SCENE_BATCH_HPP
+#define OBVI_SCENE_BATCH_HPP
+
+#include <QOpenGLFunctions_4_3_Core>
+
+#include <deque>
+#include <vector>
+
+#include <obvi/util/affine3.hpp>
+#include <obvi/util/bbox.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/camera3.hpp>
+#include <obvi/util/lod.hpp>
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/mesh_cache.hpp>
+#include <obvi/util/range_allocator.hpp>
+#include <obvi/util/tlas.hpp>
+
+#include "hiz_culler.hpp"
+
+namespace obvi {
+
+struct scene_batch : protected QOpenGLFunctions_4_3_Core {
+    static constexpr size_t default_upload_bytes = size_t(32) << 20; // per call to upload()
+
+    // Closest triangle hit by a ray (see pick()).
+    struct pick_result {
+        size_t object_id = 0;
+        size_t triangle  = 0; // index in the object's mesh (full-detail triangles)
+        float  t         = 0; // distance along the ray, in multiples of its direction
+        vec3f  point;         // hit point, in world coords
+    };
+
+    /* Take ownership of a mesh that was split into chunks by partition_mesh(), along with the
+     * chunks' simplified levels from simplify_chunks() (may be empty). Returns the mesh's id, to
+     * pass to add_object(). Sent to the GPU by upload().
+     */
+    size_t add_mesh(mesh&& m, std::vector<mesh_chunk>&& chunks,
+                    std::vector<uint32_t>&& lod_indices = std::vector<uint32_t>());
+
+    /* Same as above, but also takes the chunk bvh (e.g., from a cache file), which is only
+     * rebuilt if it doesn't match the chunks. If its nodes are borrowed, the cache file is kept
+     * open for as long as the scene.
+     */
+    size_t add_mesh(prepared_mesh&& pm);
+
+    /* Free a mesh's vertices and triangles, on the GPU and in host memory. Its chunks and chunk
+     * bvh are kept (so objects using it can still be culled), but aren't drawn or picked until
+     * reload_mesh(). If out_geom and out_lod_indices aren't null, the mesh's arrays are moved
+     * into them instead of being freed.
+     */
+    void evict_mesh(size_t mesh_id, mesh *out_geom = nullptr,
+                    std::vector<uint32_t> *out_lod_indices = nullptr);
+
+    /* Put back the vertices and triangles of an evicted mesh (must be the same ones it had, e.g.
+     * from evict_mesh() or the same cache file). Sent to the GPU by upload(). Returns false if
+     * the mesh isn't evicted, or the arrays don't match its chunks.
+     */
+    bool reload_mesh(size_t mesh_id, mesh&& geom, std::vector<uint32_t>&& lod_indices);
+
+    // True if the mesh has been evicted (and not reloaded since).
+    bool is_evicted(size_t mesh_id) const {
+        return !meshes[mesh_id].resident;
+    }
+
+    // GPU memory used by a mesh with the given number of vertices and indices (full detail and
+    // simplified levels), in bytes. Only valid after init().
+    size_t gpu_bytes(size_t num_vertices, size_t num_indices) const {
+        return num_vertices * (pos_stride + sizeof(uint32_t)) + num_indices * sizeof(uint32_t);
+    }
+
+    // Place a copy of a mesh in the world. Returns the object's id. Sent to the GPU by upload().
+    size_t add_object(size_t mesh_id, const affine3f& model);
+
+    /* Draw chunk of object_id only while every full-detail triangle of other_object can't be
+     * drawn (not sent yet, or evicted), and draw other_object only once all of them can. Used
+     * to show a coarse proxy until the real thing is on the GPU, without drawing both.
+     */
+    void set_stand_in(size_t object_id, size_t chunk, size_t other_object);
+
+    // Move an object. Sent to the GPU with the next cull() (one upload for all changed objects).
+    void set_transform(size_t object_id, const affine3f& model);
+
+    const affine3f& get_transform(size_t object_id) const {
+        return objects[object_id].model;
+    }
+
+    size_t num_meshes() const {
+        return meshes.size();
+    }
+
+    size_t num_objects() const {
+        return objects.size();
+    }
+
+    // Number of objects that upload() has placed in the world so far (included in bounds()).
+    size_t num_placed_objects() const {
+        return instances.size();
+    }
+
+    const mesh& get_mesh(size_t mesh_id) const {
+        return meshes[mesh_id].geom;
+    }
+
+    // Turn level of detail selection on/off (if off, everything is drawn at full detail).
+    void set_lod_enabled(bool enable) { lod_enabled = enable; }
+    bool get_lod_enabled() const { return lod_enabled; }
+
+    // Settings for level of detail selection (largest allowed error in pixels, hysteresis).
+    lod_selector& get_lod_selector() { return lod; }
+
+    // Bounds of every placed object, in world coords.
+    const bboxf& bounds() const {
+        return top.bounds();
+    }
+
+    /* Create OpenGL objects. OpenGL context must be current. If compact_vertices is true,
+     * positions are sent as 16-bit integers (see quantize_positions()), otherwise as floats.
+     *
+     * If culler isn't null, its item list is kept up to date with this scene's chunks.
+     */
+    bool init(bool compact_vertices, hiz_culler* culler = nullptr);
+
+    /* Send meshes and objects added since the last call to the GPU. New objects are placed right
+     * away, but at most max_bytes of vertex and index data are sent per call. Returns true if
+     * there's still data waiting to be sent. OpenGL context must be current.
+     */
+    bool upload(size_t max_bytes = default_upload_bytes);
+
+    // Free all OpenGL objects (meshes and objects are kept). OpenGL context must be current.
+    void destroy();
+
+    /* Find the chunks that may be visible from the camera, pick their levels of detail, and build
+     * this frame's draw commands. viewport_height is in pixels. If culler is null, only frustum
+     * culling is done. Must be called before draw(). Unbinds the current shader program (the
+     * culler runs compute shaders). Level of detail selection and draw command building are split
+     * between threads (OpenMP) for big views.
+     */
+    void cull(const camera3f& camera, float viewport_height, hiz_culler* culler, bool occlusion);
+
+    /* Draw everything that passed cull() with one call, using the currently bound shader program
+     * (must follow the vertex layout and object buffer of shaders/flat.vert).
+     */
+    void draw();
+
+    // Indirect draw commands built by the last cull(), all drawn by one call in draw(). Includes
+    // chunks removed by occlusion culling (their commands are empty).
+    size_t num_draw_commands() const {
+        return size_t(num_draws);
+    }
+
+    /* Find the closest full-detail triangle hit by a ray in world coords, on any object whose
+     * triangles have been sent to the GPU. Returns false if nothing was hit.
+     *
+     * Only reads CPU-side data (no OpenGL calls), so it may run on another thread, as long as
+     * the scene isn't changed until it's done. Objects moved with set_transform() are only seen
+     * here after the next cull().
+     */
+    bool pick(const vec3f& origin, const vec3f& dir, pick_result& out) const;
+
+private:
+    struct mesh_data {
+        mesh                    geom;
+        std::vector<mesh_chunk> chunks;
+        std::vector<uint32_t>   lod_indices;      // triangles of the chunks' simplified levels
+        bvh                     chunk_bvh;        // object index == chunk index
+        mapped_file             cache_file;       // if open, chunk_bvh borrows its nodes from it
+        affine3f                dequantize;       // GPU vertex positions -> mesh coords
+        int32_t                 base_vertex = 0;  // offset in vertex buffer
+        uint32_t                first_index = 0;  // offset in index buffer (lod_indices follow)
+        bool                    resident      = true;  // false if evicted
+        bool                    allocated     = false; // has ranges in the shared buffers
+        size_t                  alloc_verts   = 0;     // size of those ranges
+        size_t                  alloc_indices = 0;
+
+        // Upload progress.
+        std::vector<uint8_t>  staged_positions;  // GPU format, freed once sent
+        std::vector<uint32_t> staged_colors;
+        size_t                verts_sent   = 0;
+        size_t                indices_sent = 0;
+
+        size_t num_indices() const {
+            return geom.indices.size() + lod_indices.size();
+        }
+        bool vertices_done() const {
+            return resident && verts_sent == geom.num_vertices();
+        }
+        bool lods_done() const {
+            return resident && indices_sent == num_indices();
+        }
+        // True if every full-detail triangle can be drawn.
+        bool full_detail_done() const {
+            return vertices_done() && indices_sent >= geom.indices.size();
+        }
+        // True if the item's full-detail triangles can be drawn.
+        bool ready(const hiz_culler::item& it) const {
+            return vertices_done() && it.first_index + it.num_indices <= first_index + indices_sent;
+        }
+    };
+    struct object_data {
+        size_t              mesh_id;
+        affine3f            model;
+        size_t              first_item;           // index of object's first chunk in item list
+        bool                has_stand_in = false; // only drawn once mesh is full_detail_done()
+        std::vector<size_t> stand_in_for;         // per chunk: object it stands in for, or none
+    };
+
+    static constexpr size_t no_object = ~size_t(0); // in stand_in_for
+
+    void   reserve_meshes();
+    bool   reserve(mesh_data& md);
+    void   place_objects();
+    void   fill_items(size_t object_id);
+    bool   drawable(size_t item) const;
+    size_t send_mesh_data(mesh_data& md, size_t max_bytes);
+    GLuint grow_buffer(GLuint buf, size_t used_bytes, size_t new_bytes);
+    void   setup_vertex_array();
+    void   sync_objects();
+    void   write_objects(size_t begin, size_t end);
+
+    std::deque<mesh_data>         meshes;    // deque, so tlas instances can point into it
+    std::vector<object_data>      objects;
+    std::vector<tlas::instance>   instances; // one per placed object, same order
+    tlas                          top;
+    std::vector<hiz_culler::item> items;     // every chunk of every placed object, object-major
+    std::vector<uint8_t>          levels;    // level of detail each item was last drawn with
+    std::vector<uint32_t>         visible;   // hiz_culler::candidate() entries, reused every frame
+
+    lod_selector lod;
+    bool         lod_enabled = true;
+
+    bool        compact_vertices = true;
+    hiz_culler* item_culler      = nullptr; // gets a copy of items
+    size_t      pos_stride       = 0;       // bytes per vertex in pos_buf
+    bool        vao_dirty        = false;   // buffers were replaced, redo vertex array setup
+
+    size_t              reserved_meshes = 0;     // meshes that have been given their place
+    std::vector<size_t> reloaded;                // reloaded meshes that need a new place
+    std::deque<size_t>  send_queue;              // meshes with data left to send, in order
+    range_allocator     vert_alloc;              // vertices in the shared buffers
+    range_allocator     index_alloc;             // indices in the shared buffers
+    bool                items_dirty = false;     // items changed, send them to the culler again
+    bool                size_error  = false;
+
+    size_t dirty_begin = 0; // range of objects whose transform changed since the last upload
+    size_t dirty_end   = 0;
+
+    hiz_culler* cmd_source = nullptr; // where this frame's commands are (null: cmd_buf)
+    GLsizei     num_draws  = 0;
+
+    GLuint vao        = 0;
+    GLuint pos_buf    = 0; // positions of all meshes
+    GLuint color_buf  = 0; // RGBA8 colors of all meshes
+    GLuint index_buf  = 0; // triangles of all meshes (indices are relative to mesh's base vertex)
+    GLuint id_buf     = 0; // 0, 1, 2, ... read as per-instance object id
+    GLuint object_buf = 0; // std430 object_info for every object
+    GLuint cmd_buf    = 0; // indirect draw commands, when there's no GPU culler
+    size_t vert_capacity   = 0;
+    size_t index_capacity  = 0;
+    size_t object_capacity = 0;
+    size_t cmd_capacity    = 0;
+
+    std::vector<float>    object_scratch;
+    std::vector<uint32_t> cmd_scratch;
+};
+
+} // END namespace obvi
+
+#endif // OBVI_SCENE_BATCH_HPP
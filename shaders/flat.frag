@@ -1,12 +1,15 @@
 #version 430 core
 in vec4 f_color;
 in vec4 f_pos_world;
+flat in uint f_object;
 layout(location=0) out vec4 out_color;
 
 uniform vec3  camera_pos_world; //location of camera in world coords
 uniform vec3  light_dir_world; //direction that light source is shining into the scene (world coords).
 uniform float diff_frac;
 uniform float ambi_frac;
+uniform uint  hover_object;    // object under the mouse cursor (0xFFFFFFFF if none)
+uniform uint  selected_object; // object that was clicked on (0xFFFFFFFF if none)
 
 void main() {
     // Set initial brightness to ambient component.
@@ -30,6 +33,14 @@ void main() {
         brightness += diff_frac * cosang;
     }
 
-    out_color.rgb = brightness * f_color.rgb;
+    // Tint the selected object orange, and lighten the one under the cursor.
+    vec3 color = f_color.rgb;
+    if(f_object == selected_object) {
+        color = mix(color, vec3(1.0f, 0.6f, 0.1f), 0.5f);
+    } else if(f_object == hover_object) {
+        color = mix(color, vec3(1.0f, 1.0f, 1.0f), 0.35f);
+    }
+
+    out_color.rgb = brightness * color;
     out_color.a   = 1.0f; // alpha=1 (fully opaque).
 }
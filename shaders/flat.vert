@@ -1,15 +1,24 @@
 #version 430 core
 layout(location=0) in vec3 position;
 layout(location=1) in vec3 color;
+layout(location=2) in uint object_id; // per-instance attribute, equal to the draw's base instance
 out vec4 f_color;
 out vec4 f_pos_world;
+flat out uint f_object;
+
+// Must match object_info in hiz_cull.comp.
+struct object_info {
+    mat4 mesh_to_world;   // model matrix: transforms from object coords to world coords
+    mat4 vertex_to_world; // model matrix with position dequantization folded in
+};
+layout(std430, binding = 4) readonly buffer object_buf { object_info objects[]; };
 
-uniform mat4 model;     // model matrix: transforms from object coords to world coords
 uniform mat4 view_proj; // projection * view matrix: transforms from world coords to clip coords
 
 void main() {
-    f_color = vec4(color, 1.0f);
+    f_color  = vec4(color, 1.0f);
+    f_object = object_id;
 
-    f_pos_world = model * vec4(position, 1.0f);
+    f_pos_world = objects[object_id].vertex_to_world * vec4(position, 1.0f);
     gl_Position = view_proj * f_pos_world;
 }
@@ -105,9 +105,11 @@ TEMPLATE_TEST_CASE("affine3 set and get", "[affine3]", float, double) {
         aff.set(mat, vec, sca);
         aff.to_gl(g);
 
-        mat(0,0) *= sca;
-        mat(1,1) *= sca;
-        mat(2,2) *= sca;
+        for(size_t row=0; row<3; ++row) {
+            for(size_t col=0; col<3; ++col) {
+                mat(row,col) *= sca;
+            }
+        }
         MAT3_EQUAL(mat, g[0], g[4], g[8], g[1], g[5], g[9], g[2], g[6], g[10]);
         VEC3_EQUAL(vec, g[12], g[13], g[14]);
         REQUIRE( g[3]  == 0.0_a );
@@ -128,3 +130,61 @@ TEMPLATE_TEST_CASE("affine3 vector transform", "[affine3]", float, double) {
         VEC3_EQUAL(vec, -0.4_a, 0.3_a, 0.5_a);
     }
 }
+
+TEMPLATE_TEST_CASE("affine3 combine and invert", "[affine3]", float, double) {
+    using T     = TestType;
+    using vec3t = vec3<T>;
+
+    affine3<T> aff(mat3<T>::yrot(T(0.7)) * mat3<T>::xrot(T(-0.4)), vec3t(1,-2,3), T(2.5));
+    affine3<T> other(mat3<T>::zrot(T(1.1)), vec3t(-4,0,2), T(0.5));
+    vec3t      pt(T(0.3), T(-1.2), T(4));
+
+    SECTION( "combine" ) {
+        affine3<T> both = aff * other;
+        vec3t expected  = aff * (other * pt);
+        vec3t vec       = both * pt;
+        REQUIRE( vec.x() == Approx(expected.x()) );
+        REQUIRE( vec.y() == Approx(expected.y()) );
+        REQUIRE( vec.z() == Approx(expected.z()) );
+    }
+
+    SECTION( "invert" ) {
+        vec3t vec = aff.inv() * (aff * pt);
+        REQUIRE( vec.x() == Approx(pt.x()) );
+        REQUIRE( vec.y() == Approx(pt.y()) );
+        REQUIRE( vec.z() == Approx(pt.z()) );
+        REQUIRE( aff.inv().scale() == Approx(T(0.4)) );
+    }
+
+    SECTION( "rotate direction" ) {
+        vec3t dir = aff.rotate(vec3t(0,0,1));
+        vec3t ref = aff * vec3t(0,0,1) - aff * vec3t(0,0,0);
+        REQUIRE( dir.x() * T(2.5) == Approx(ref.x()) );
+        REQUIRE( dir.y() * T(2.5) == Approx(ref.y()) );
+        REQUIRE( dir.z() * T(2.5) == Approx(ref.z()) );
+    }
+
+    SECTION( "transform box" ) {
+        obvi::bbox<T> box(1,2,3, 4,5,6);
+        obvi::bbox<T> res = aff * box;
+
+        // Transformed box must contain all eight transformed corners, and touch at least one of
+        // them on each face.
+        for(size_t axis=0; axis<3; ++axis) {
+            T lo = std::numeric_limits<T>::infinity();
+            T hi = -lo;
+            for(size_t corner=0; corner<8; ++corner) {
+                vec3t c((corner & 1)? box.max_pt.x() : box.min_pt.x(),
+                        (corner & 2)? box.max_pt.y() : box.min_pt.y(),
+                        (corner & 4)? box.max_pt.z() : box.min_pt.z());
+                vec3t tc = aff * c;
+                lo = std::min(lo, tc[axis]);
+                hi = std::max(hi, tc[axis]);
+            }
+            REQUIRE( res.min_pt[axis] == Approx(lo) );
+            REQUIRE( res.max_pt[axis] == Approx(hi) );
+        }
+
+        REQUIRE( (aff * obvi::bbox<T>()).is_empty() );
+    }
+}
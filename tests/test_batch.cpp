@@ -0,0 +1,193 @@
+/* Unit tests for batch geometry kernels (every instruction set this CPU supports).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+
+#include <catch2/catch.hpp>
+#include <obvi/util/batch.hpp>
+#include <obvi/util/math.hpp>
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+using obvi::affine3f;
+using obvi::bboxf;
+using obvi::mat3f;
+using obvi::simd_isa;
+using obvi::vec3f;
+
+namespace {
+    // Instruction sets to test. Each one is only checked if it's available on this CPU.
+    const simd_isa all_isas[] = {simd_isa::SCALAR, simd_isa::SSE2, simd_isa::NEON, simd_isa::AVX2};
+
+    // Odd size, so every implementation's leftover (non-SIMD) loop gets some elements too.
+    const size_t num_points = 1003;
+
+    struct soa_points {
+        std::vector<float> x, y, z;
+    };
+
+    soa_points random_points(size_t n, float lo, float hi, unsigned seed) {
+        std::mt19937                          gen(seed);
+        std::uniform_real_distribution<float> dist(lo, hi);
+        soa_points pts;
+        for(size_t i=0; i<n; ++i) {
+            pts.x.push_back(dist(gen));
+            pts.y.push_back(dist(gen));
+            pts.z.push_back(dist(gen));
+        }
+        return pts;
+    }
+
+    // Restores the default instruction set at the end of each test.
+    struct isa_guard {
+        simd_isa saved = obvi::batch_isa();
+        ~isa_guard() { obvi::set_batch_isa(saved); }
+    };
+}
+
+TEST_CASE("batch isa selection", "[batch]") {
+    isa_guard guard;
+
+    REQUIRE( obvi::set_batch_isa(simd_isa::SCALAR) );
+    REQUIRE( obvi::batch_isa() == simd_isa::SCALAR );
+    REQUIRE( std::string(obvi::to_string(simd_isa::AVX2)) == "avx2" );
+
+    // Default is the widest one available.
+    REQUIRE( obvi::set_batch_isa(guard.saved) );
+    for(simd_isa isa : all_isas) {
+        if(int(isa) > int(guard.saved)) {
+            REQUIRE_FALSE( obvi::set_batch_isa(isa) );
+        }
+    }
+}
+
+TEST_CASE("batch transform_points", "[batch]") {
+    isa_guard guard;
+
+    affine3f tf(mat3f::zrot(0.7f) * mat3f::xrot(-1.2f), vec3f(3.0f, -2.0f, 0.5f), 2.5f);
+    soa_points in = random_points(num_points, -100.0f, 100.0f, 1);
+
+    REQUIRE( obvi::set_batch_isa(simd_isa::SCALAR) );
+    soa_points ref = in;
+    obvi::transform_points(tf, in.x.data(), in.y.data(), in.z.data(), num_points,
+                           ref.x.data(), ref.y.data(), ref.z.data());
+    for(size_t i=0; i<num_points; ++i) {
+        vec3f expected = tf * vec3f(in.x[i], in.y[i], in.z[i]);
+        REQUIRE( ref.x[i] == Approx(expected.x()).margin(1e-3) );
+        REQUIRE( ref.y[i] == Approx(expected.y()).margin(1e-3) );
+        REQUIRE( ref.z[i] == Approx(expected.z()).margin(1e-3) );
+    }
+
+    for(simd_isa isa : all_isas) {
+        if(!obvi::set_batch_isa(isa)) {
+            continue;
+        }
+        INFO( obvi::to_string(isa) );
+        // Transform in place, results must match the scalar code exactly.
+        soa_points res = in;
+        obvi::transform_points(tf, res.x.data(), res.y.data(), res.z.data(), num_points,
+                               res.x.data(), res.y.data(), res.z.data());
+        REQUIRE( res.x == ref.x );
+        REQUIRE( res.y == ref.y );
+        REQUIRE( res.z == ref.z );
+    }
+}
+
+TEST_CASE("batch triangle_bounds", "[batch]") {
+    isa_guard guard;
+
+    soa_points pts = random_points(500, -10.0f, 10.0f, 2);
+    std::vector<vec3f> positions;
+    for(size_t i=0; i<pts.x.size(); ++i) {
+        positions.emplace_back(pts.x[i], pts.y[i], pts.z[i]);
+    }
+    std::mt19937 gen(3);
+    std::uniform_int_distribution<uint32_t> pick(0, uint32_t(positions.size() - 1));
+    std::vector<uint32_t> indices;
+    for(size_t i=0; i<3 * num_points; ++i) {
+        indices.push_back(pick(gen));
+    }
+
+    for(simd_isa isa : all_isas) {
+        if(!obvi::set_batch_isa(isa)) {
+            continue;
+        }
+        INFO( obvi::to_string(isa) );
+        std::vector<bboxf> boxes(num_points);
+        obvi::triangle_bounds(positions.data(), indices.data(), num_points, boxes.data());
+        for(size_t t=0; t<num_points; ++t) {
+            bboxf expected(positions[indices[3 * t]]);
+            expected.expand(positions[indices[3 * t + 1]]);
+            expected.expand(positions[indices[3 * t + 2]]);
+            for(size_t d=0; d<3; ++d) {
+                REQUIRE( boxes[t].min_pt[d] == expected.min_pt[d] );
+                REQUIRE( boxes[t].max_pt[d] == expected.max_pt[d] );
+            }
+        }
+    }
+}
+
+TEST_CASE("batch morton codes", "[batch]") {
+    isa_guard guard;
+
+    // Some points fall outside the mapped range on purpose, to check clamping.
+    soa_points pts   = random_points(num_points, -2.0f, 12.0f, 4);
+    pts.x[5]         = std::numeric_limits<float>::quiet_NaN();
+    pts.y[6]         = std::numeric_limits<float>::infinity();
+    pts.z[7]         = -std::numeric_limits<float>::infinity();
+    const vec3f off(0.0f, 0.0f, 0.0f);
+    const vec3f scale30(102.3f, 100.0f, 97.0f);
+    const vec3f scale63(209715.1f, 200000.0f, 190000.0f);
+
+    // Reference: the single-point functions (NaN maps to 0 in the batch versions).
+    auto fix_nan = [](float v) { return std::isnan(v)? 0.0f : v; };
+    std::vector<uint32_t> ref30(num_points);
+    std::vector<uint64_t> ref63(num_points);
+    for(size_t i=0; i<num_points; ++i) {
+        vec3f p30 = (vec3f(fix_nan(pts.x[i]), pts.y[i], pts.z[i]) - off) * scale30;
+        vec3f p63 = (vec3f(fix_nan(pts.x[i]), pts.y[i], pts.z[i]) - off) * scale63;
+        ref30[i] = obvi::morton_encode_30(p30.x(), p30.y(), p30.z());
+        ref63[i] = obvi::morton_encode_63(p63.x(), p63.y(), p63.z());
+    }
+
+    for(simd_isa isa : all_isas) {
+        if(!obvi::set_batch_isa(isa)) {
+            continue;
+        }
+        INFO( obvi::to_string(isa) );
+        std::vector<uint32_t> codes30(num_points);
+        std::vector<uint64_t> codes63(num_points);
+        obvi::morton_codes_30(pts.x.data(), pts.y.data(), pts.z.data(), num_points, off, scale30,
+                              codes30.data());
+        obvi::morton_codes_63(pts.x.data(), pts.y.data(), pts.z.data(), num_points, off, scale63,
+                              codes63.data());
+        REQUIRE( codes30 == ref30 );
+        REQUIRE( codes63 == ref63 );
+    }
+}
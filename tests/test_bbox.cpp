@@ -127,6 +127,11 @@ TEMPLATE_TEST_CASE("bbox creation", "[bbox]", float, double) {
         box.expand(bboxt(-1,-2,-3, 13,12,11));
         VEC3_EQUAL(box.min_pt, -3,-4,-5);
         VEC3_EQUAL(box.max_pt, 15,18,16);
+
+        // Expand by empty box (no change).
+        box.expand(bboxt());
+        VEC3_EQUAL(box.min_pt, -3,-4,-5);
+        VEC3_EQUAL(box.max_pt, 15,18,16);
     }
 
     SECTION( "calculate box center" ) {
@@ -141,6 +146,16 @@ TEMPLATE_TEST_CASE("bbox creation", "[bbox]", float, double) {
         center = box.center();
         VEC3_EQUAL(center, 2.5_a, 4.0_a, 5.0_a);
     }
+
+    SECTION( "calculate box surface area" ) {
+        REQUIRE( box.surface_area() == 0 );
+
+        box = bboxt(1,2,3, 2,4,6);
+        REQUIRE( box.surface_area() == 22 );
+
+        box = bboxt(vec3t(1,2,3));
+        REQUIRE( box.surface_area() == 0 );
+    }
 }
 
 TEMPLATE_TEST_CASE("bbox intersection", "[bbox]", float, double) {
@@ -450,4 +465,48 @@ TEMPLATE_TEST_CASE("bbox intersection", "[bbox]", float, double) {
         REQUIRE( box.intersects_ray(vec3t(T(2.5),T(3.5),0),  zpos) );
         REQUIRE( box.intersects_ray(vec3t(T(2.5),T(3.5),10), zneg) );
     }
+
+    SECTION( "point distance" ) {
+        REQUIRE( box.distance_squared(box.center()) == T(0) );
+        REQUIRE( box.distance_squared(vec3t(4,5,6)) == T(0) );  // on corner
+        REQUIRE( box.distance_squared(vec3t(0,3,4)) == T(1) );  // off -X face
+        REQUIRE( box.distance_squared(vec3t(2,3,8)) == T(4) );  // off +Z face
+        REQUIRE( box.distance_squared(vec3t(6,7,8)) == T(12) ); // off +XYZ corner
+        REQUIRE( bboxt().distance_squared(vec3t(0,0,0)) == std::numeric_limits<T>::infinity() );
+    }
+
+    SECTION( "bbox/ray entry distance" ) {
+        static const vec3t xpos = vec3t(1,0,0).inv(), zneg = vec3t(0,0,-1).inv();
+        static const T     inf  = std::numeric_limits<T>::infinity();
+        T t = -1;
+
+        // Origin outside box, ray hits -X face.
+        REQUIRE( box.intersects_ray(vec3t(-2,T(3.5),T(4.5)), xpos, inf, &t) );
+        REQUIRE( t == T(3) );
+
+        // Origin outside box, ray hits +Z face.
+        REQUIRE( box.intersects_ray(vec3t(T(2.5),T(3.5),10), zneg, inf, &t) );
+        REQUIRE( t == T(4) );
+
+        // Origin inside box.
+        REQUIRE( box.intersects_ray(box.center(), xpos, inf, &t) );
+        REQUIRE( t == T(0) );
+
+        // Direction has negative zero components (inverse is -INF instead of +INF).
+        REQUIRE( box.intersects_ray(vec3t(T(2.5),0,T(4.5)), vec3t(T(-0.0),1,T(-0.0)).inv(), inf, &t) );
+        REQUIRE( t == T(2) );
+        REQUIRE_FALSE( box.intersects_ray(vec3t(0,0,T(4.5)), vec3t(T(-0.0),1,0).inv(), inf, &t) );
+
+        // Precomputed ray signs give the same answer.
+        uint8_t neg[3];
+        bboxt::ray_signs(zneg, neg);
+        REQUIRE( neg[0] == 0 );
+        REQUIRE( neg[2] == 1 );
+        REQUIRE( box.intersects_ray_precalc(vec3t(T(2.5),T(3.5),10), zneg, neg, inf, &t) );
+        REQUIRE( t == T(4) );
+
+        // Box is past the end of the ray.
+        REQUIRE_FALSE( box.intersects_ray(vec3t(-2,T(3.5),T(4.5)), xpos, T(2.5), &t) );
+        REQUIRE( box.intersects_ray(vec3t(-2,T(3.5),T(4.5)), xpos, T(3), &t) );
+    }
 }
@@ -0,0 +1,680 @@
+/* Unit tests for bvh (util library).
+ *
+ *
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/bvh.hpp>
+#include "test_helpers.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::bvh_build_type;
+using obvi::bvh_builder;
+using obvi::frustumf;
+using obvi::vec3f;
+using obvi_test::run_query;
+
+namespace {
+    // Generate a repeatable set of random boxes, with a mix of cube-ish and long, thin shapes.
+    std::vector<bboxf> make_mixed_boxes(size_t count, unsigned seed) {
+        std::vector<bboxf> boxes = obvi_test::make_boxes(count, seed);
+        for(size_t i=0; i<boxes.size(); i+=7) {
+            size_t axis = i % 3;
+            boxes[i].max_pt[axis] += 19.0f * (boxes[i].max_pt[axis] - boxes[i].min_pt[axis]);
+        }
+        return boxes;
+    }
+
+    // Test every box individually, return sorted list of matched object indices.
+    template<typename intersect_func>
+    std::vector<size_t> brute_force(const std::vector<bboxf>& boxes, intersect_func ifunc) {
+        std::vector<size_t> res;
+        for(size_t i=0; i<boxes.size(); ++i) {
+            if(ifunc(boxes[i])) {
+                res.push_back(i);
+            }
+        }
+        return res;
+    }
+}
+
+TEST_CASE("bvh generate", "[bvh]") {
+    auto build_type = GENERATE(bvh_build_type::MORTON, bvh_build_type::SAH);
+    bvh tree;
+
+    SECTION( "empty" ) {
+        REQUIRE( tree.generate(std::vector<bboxf>(), build_type) );
+        REQUIRE( tree.size() == 0 );
+        REQUIRE( tree.bounds().is_empty() );
+        REQUIRE( run_query(tree, bvh::intersect_point(vec3f(0,0,0))).empty() );
+        REQUIRE_FALSE( tree.make_ray_query(vec3f(0,0,0), vec3f(1,0,0)).next(nullptr, nullptr) );
+    }
+
+    SECTION( "single box" ) {
+        std::vector<bboxf> boxes = {bboxf(1,2,3, 4,5,6)};
+        REQUIRE( tree.generate(boxes, build_type) );
+        REQUIRE( tree.size() == 1 );
+        REQUIRE( run_query(tree, bvh::intersect_point(vec3f(2,3,4))) == std::vector<size_t>{0} );
+        REQUIRE( run_query(tree, bvh::intersect_point(vec3f(0,0,0))).empty() );
+    }
+
+    SECTION( "duplicate boxes" ) {
+        std::vector<bboxf> boxes(100, bboxf(1,2,3, 4,5,6));
+        REQUIRE( tree.generate(boxes, build_type) );
+        REQUIRE( tree.size() == 100 );
+        REQUIRE( run_query(tree, bvh::intersect_point(vec3f(2,3,4))).size() == 100 );
+    }
+
+    SECTION( "bounds" ) {
+        std::vector<bboxf> boxes = make_mixed_boxes(1000, 1);
+        bboxf root;
+        for(const bboxf& box : boxes) {
+            root.expand(box);
+        }
+        REQUIRE( tree.generate(boxes, build_type) );
+        REQUIRE( tree.size() == boxes.size() );
+        REQUIRE( tree.bounds().min_pt.x() == root.min_pt.x() );
+        REQUIRE( tree.bounds().min_pt.y() == root.min_pt.y() );
+        REQUIRE( tree.bounds().min_pt.z() == root.min_pt.z() );
+        REQUIRE( tree.bounds().max_pt.x() == root.max_pt.x() );
+        REQUIRE( tree.bounds().max_pt.y() == root.max_pt.y() );
+        REQUIRE( tree.bounds().max_pt.z() == root.max_pt.z() );
+    }
+}
+
+TEST_CASE("bvh builder", "[bvh]") {
+    auto build_type = GENERATE(bvh_build_type::MORTON, bvh_build_type::SAH);
+
+    std::vector<bboxf> boxes = make_mixed_boxes(5000, 7);
+    bvh         plain, tree;
+    bvh_builder builder;
+    REQUIRE( builder.capacity_bytes() == 0 );
+    REQUIRE( plain.generate(boxes, build_type) );
+    REQUIRE( tree.generate(boxes, builder, build_type) );
+    const size_t scratch = builder.capacity_bytes();
+    REQUIRE( scratch > 0 );
+
+    // Same tree as without a builder, no matter how often the scratch memory was reused.
+    for(int pass=0; pass<3; ++pass) {
+        REQUIRE( tree.nodes().size() == plain.nodes().size() );
+        for(size_t i=0; i<plain.nodes().size(); ++i) {
+            REQUIRE( tree.nodes()[i].num == plain.nodes()[i].num );
+        }
+
+        // Smaller builds, then the same one again, fit in the memory we already have.
+        std::vector<bboxf> fewer(boxes.begin(), boxes.begin() + 1000 * (pass + 1));
+        REQUIRE( tree.generate(fewer, builder, build_type) );
+        REQUIRE( tree.size() == fewer.size() );
+        REQUIRE( tree.generate(boxes, builder, build_type) );
+        REQUIRE( builder.capacity_bytes() == scratch );
+    }
+
+    SECTION( "edge cases" ) {
+        REQUIRE( tree.generate(std::vector<bboxf>(), builder, build_type) );
+        REQUIRE( tree.size() == 0 );
+        REQUIRE( tree.generate({bboxf(1,2,3, 4,5,6)}, builder, build_type) );
+        REQUIRE( run_query(tree, bvh::intersect_point(vec3f(2,3,4))) == std::vector<size_t>{0} );
+    }
+
+    SECTION( "copies start empty" ) {
+        bvh_builder copy(builder);
+        REQUIRE( copy.capacity_bytes() == 0 );
+        builder.clear();
+        REQUIRE( builder.capacity_bytes() == 0 );
+    }
+}
+
+TEST_CASE("bvh assign", "[bvh]") {
+    std::vector<bboxf> boxes = make_mixed_boxes(1000, 5);
+    bvh src;
+    REQUIRE( src.generate(boxes) );
+    std::vector<bvh::node> nodes(src.nodes().begin(), src.nodes().end());
+
+    // Copies the nodes, the caller's array can go away afterwards.
+    bvh tree;
+    REQUIRE( tree.assign(nodes.data(), nodes.size(), boxes.size()) );
+    REQUIRE( tree.nodes().data() != nodes.data() );
+    REQUIRE( tree.size() == boxes.size() );
+    nodes.assign(nodes.size(), bvh::node());
+    for(size_t i=0; i<src.nodes().size(); ++i) {
+        REQUIRE( tree.nodes()[i].num == src.nodes()[i].num );
+    }
+    for(size_t i=0; i<boxes.size(); i+=50) {
+        auto res = run_query(tree, bvh::intersect_point(boxes[i].center()));
+        REQUIRE( std::find(res.begin(), res.end(), i) != res.end() );
+    }
+
+    // Same checks as borrow(): wrong sizes or a broken structure leave the tree empty.
+    nodes.assign(src.nodes().begin(), src.nodes().end());
+    REQUIRE_FALSE( tree.assign(nodes.data(), nodes.size(), boxes.size() + 1) );
+    REQUIRE( tree.nodes().empty() );
+    REQUIRE( tree.size() == 0 );
+    REQUIRE_FALSE( tree.assign(nodes.data(), nodes.size() - 1, boxes.size()) );
+    REQUIRE_FALSE( tree.assign(nullptr, nodes.size(), boxes.size()) );
+    nodes[1].num = uint32_t(nodes.size());
+    REQUIRE_FALSE( tree.assign(nodes.data(), nodes.size(), boxes.size()) );
+    REQUIRE( tree.nodes().empty() );
+    REQUIRE( tree.assign(nullptr, 0, 0) );
+    REQUIRE( tree.size() == 0 );
+
+    // An assigned tree can be refit like a generated one.
+    nodes.assign(src.nodes().begin(), src.nodes().end());
+    REQUIRE( tree.assign(nodes.data(), nodes.size(), boxes.size()) );
+    for(bboxf& box : boxes) {
+        box.min_pt -= vec3f(1,1,1);
+        box.max_pt += vec3f(1,1,1);
+    }
+    REQUIRE( tree.refit(boxes) );
+    REQUIRE( tree.bounds().min_pt.x() == Approx(src.bounds().min_pt.x() - 1.0f) );
+}
+
+TEST_CASE("bvh query", "[bvh]") {
+    auto build_type = GENERATE(bvh_build_type::MORTON, bvh_build_type::SAH);
+
+    std::vector<bboxf> boxes = make_mixed_boxes(5000, 42);
+    bvh tree;
+    REQUIRE( tree.generate(boxes, build_type) );
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> pos(-120.0f, 120.0f);
+
+    SECTION( "point query" ) {
+        for(int i=0; i<100; ++i) {
+            bvh::intersect_point ifunc(vec3f(pos(gen), pos(gen), pos(gen)));
+            REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+        }
+        // Point on corner of a box.
+        bvh::intersect_point ifunc(boxes[10].max_pt);
+        auto res = run_query(tree, ifunc);
+        REQUIRE( std::find(res.begin(), res.end(), 10) != res.end() );
+        REQUIRE( res == brute_force(boxes, ifunc) );
+    }
+
+    SECTION( "box query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            bboxf qbox(pt);
+            qbox.expand(pt + vec3f(10,10,10));
+            bvh::intersect_box ifunc(qbox);
+            REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+        }
+    }
+
+    SECTION( "segment query" ) {
+        for(int i=0; i<100; ++i) {
+            bvh::intersect_segment ifunc(vec3f(pos(gen), pos(gen), pos(gen)),
+                                         vec3f(pos(gen), pos(gen), pos(gen)));
+            REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+        }
+    }
+
+    SECTION( "ray query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f origin(pos(gen), pos(gen), pos(gen));
+            vec3f dir = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+            bvh::intersect_ray ifunc(origin, dir);
+            REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+        }
+        // Axis-aligned rays.
+        for(size_t axis=0; axis<3; ++axis) {
+            vec3f dir;
+            dir[axis] = 1.0f;
+            bvh::intersect_ray ifunc(vec3f(0,0,0), dir);
+            REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+        }
+    }
+
+    SECTION( "closest-first ray query" ) {
+        const float inf = std::numeric_limits<float>::infinity();
+        for(int i=0; i<100; ++i) {
+            vec3f origin(pos(gen), pos(gen), pos(gen));
+            vec3f dir = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+            vec3f inv = dir.inv();
+
+            // Without shrinking the ray, should find the same objects as intersect_ray.
+            std::vector<size_t> all;
+            auto   query = tree.make_ray_query(origin, dir);
+            size_t idx;
+            float  t;
+            while(query.next(&idx, &t)) {
+                all.push_back(idx);
+            }
+            std::sort(all.begin(), all.end());
+            REQUIRE( all == brute_force(boxes, bvh::intersect_ray(origin, dir)) );
+
+            // Closest hit, treating the boxes themselves as the objects.
+            float expected = inf;
+            for(const bboxf& box : boxes) {
+                if(box.intersects_ray(origin, inv, inf, &t)) {
+                    expected = std::min(expected, t);
+                }
+            }
+
+            float  best    = inf;
+            size_t visited = 0;
+            query.reset();
+            while(query.next(&idx, &t)) {
+                ++visited;
+                REQUIRE( t <= query.max_t() );
+                if(t < best) {
+                    best = t;
+                    query.shrink(t);
+                }
+            }
+            REQUIRE( best == expected );
+            REQUIRE( visited <= all.size() );
+        }
+    }
+
+    SECTION( "frustum query" ) {
+        frustumf fr;
+        for(int i=0; i<100; ++i) {
+            // Random box-shaped frustum, with one slanted side.
+            vec3f lo(pos(gen), pos(gen), pos(gen));
+            fr.set_plane(frustumf::LEFT,       1, 0, 0, -lo[0]);
+            fr.set_plane(frustumf::RIGHT,     -1, 0, 0,  lo[0] + 30.0f);
+            fr.set_plane(frustumf::BOTTOM,     0, 1, 0, -lo[1]);
+            fr.set_plane(frustumf::TOP,        0,-1, 0,  lo[1] + 30.0f);
+            fr.set_plane(frustumf::NEAR_PLANE, 0, 0, 1, -lo[2]);
+            fr.set_plane(frustumf::FAR_PLANE, -1, 0,-1,  lo[2] + lo[0] + 40.0f);
+            bvh::intersect_frustum ifunc(fr);
+            REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+        }
+    }
+
+    SECTION( "sphere query" ) {
+        for(int i=0; i<100; ++i) {
+            bvh::intersect_sphere ifunc(vec3f(pos(gen), pos(gen), pos(gen)), 15.0f);
+            REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+        }
+    }
+
+    SECTION( "nearest query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+
+            std::vector<float> expected;
+            for(const bboxf& box : boxes) {
+                expected.push_back(box.distance_squared(pt));
+            }
+            std::sort(expected.begin(), expected.end());
+
+            // Full query returns every object, in order of increasing distance.
+            std::vector<float> dists;
+            auto   query = tree.make_nearest_query(pt);
+            size_t idx;
+            float  dist2;
+            while(query.next(&idx, &dist2)) {
+                REQUIRE( dist2 == boxes[idx].distance_squared(pt) );
+                dists.push_back(dist2);
+            }
+            REQUIRE( dists == expected );
+
+            // k nearest.
+            std::vector<float> knn_dists;
+            std::vector<size_t> knn = tree.nearest(pt, 10, std::numeric_limits<float>::infinity(),
+                                                   &knn_dists);
+            REQUIRE( knn.size() == 10 );
+            REQUIRE( knn_dists == std::vector<float>(expected.begin(), expected.begin() + 10) );
+
+            // Limited radius.
+            float max_dist2 = 100.0f;
+            knn = tree.nearest(pt, boxes.size(), max_dist2);
+            auto num_in_range = std::upper_bound(expected.begin(), expected.end(), max_dist2)
+                                - expected.begin();
+            REQUIRE( knn.size() == (size_t)num_in_range );
+        }
+    }
+
+    SECTION( "nearest query with shrinking radius" ) {
+        // Use the distance to each box's center as the exact object distance.
+        for(int i=0; i<100; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+
+            float expected = std::numeric_limits<float>::infinity();
+            for(const bboxf& box : boxes) {
+                expected = std::min(expected, (box.center() - pt).normsqd());
+            }
+
+            float  best    = std::numeric_limits<float>::infinity();
+            size_t visited = 0;
+            auto   query   = tree.make_nearest_query(pt);
+            size_t idx;
+            float  dist2;
+            while(query.next(&idx, &dist2)) {
+                ++visited;
+                float d2 = (boxes[idx].center() - pt).normsqd();
+                if(d2 < best) {
+                    best = d2;
+                    query.shrink(d2);
+                }
+            }
+            REQUIRE( best == expected );
+            REQUIRE( visited < boxes.size() );
+        }
+    }
+
+    SECTION( "closest-first ray query with max distance" ) {
+        vec3f origin(-120, 0, 0);
+        vec3f dir(1, 0, 0);
+        std::vector<size_t> res;
+        auto   query = tree.make_ray_query(origin, dir, 50.0f);
+        size_t idx;
+        float  t;
+        while(query.next(&idx, &t)) {
+            REQUIRE( t <= 50.0f );
+            res.push_back(idx);
+        }
+        std::sort(res.begin(), res.end());
+
+        std::vector<size_t> expected;
+        for(size_t j=0; j<boxes.size(); ++j) {
+            if(boxes[j].intersects_ray(origin, dir.inv(), 50.0f, &t)) {
+                expected.push_back(j);
+            }
+        }
+        REQUIRE( res == expected );
+    }
+}
+
+TEST_CASE("bvh batch query", "[bvh]") {
+    std::vector<bboxf> boxes = make_mixed_boxes(5000, 42);
+    bvh tree;
+    REQUIRE( tree.generate(boxes, bvh_build_type::SAH) );
+
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> pos(-120.0f, 120.0f);
+
+    // Check batch results against running each query on its own.
+    auto check_batch = [&](const auto& queries) {
+        bvh::batch_result res;
+        tree.query_batch(queries, res);
+        REQUIRE( res.offsets.size() == queries.size() + 1 );
+        REQUIRE( res.offsets.back() == res.matches.size() );
+
+        std::vector<uint32_t> first;
+        tree.query_batch_first(queries, first);
+        REQUIRE( first.size() == queries.size() );
+
+        size_t num_empty = 0;
+        for(size_t i=0; i<queries.size(); ++i) {
+            std::vector<size_t> expected;
+            auto   query = tree.make_query(queries[i]);
+            size_t idx;
+            while(query.next(&idx)) {
+                expected.push_back(idx);
+            }
+            std::vector<size_t> got(res.matches.begin() + (ptrdiff_t)res.offsets[i],
+                                    res.matches.begin() + (ptrdiff_t)res.offsets[i + 1]);
+            REQUIRE( got == expected );
+            if(expected.empty()) {
+                REQUIRE( first[i] == bvh::no_match );
+                num_empty++;
+            } else {
+                REQUIRE( first[i] == expected[0] );
+            }
+        }
+        REQUIRE( num_empty < queries.size() ); // make sure the test actually found something
+    };
+
+    SECTION( "point" ) {
+        std::vector<bvh::intersect_point> queries;
+        for(int i=0; i<2000; ++i) {
+            queries.emplace_back(vec3f(pos(gen), pos(gen), pos(gen)));
+        }
+        check_batch(queries);
+    }
+
+    SECTION( "box" ) {
+        std::vector<bvh::intersect_box> queries;
+        for(int i=0; i<2000; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            bboxf qbox(pt);
+            qbox.expand(pt + vec3f(10,10,10));
+            queries.emplace_back(qbox);
+        }
+        check_batch(queries);
+    }
+
+    SECTION( "ray" ) {
+        std::vector<bvh::intersect_ray> queries;
+        for(int i=0; i<2000; ++i) {
+            queries.emplace_back(vec3f(pos(gen), pos(gen), pos(gen)),
+                                 vec3f(pos(gen), pos(gen), pos(gen)).normalized());
+        }
+        check_batch(queries);
+    }
+
+    SECTION( "empty batch" ) {
+        bvh::batch_result res;
+        tree.query_batch(std::vector<bvh::intersect_point>(), res);
+        REQUIRE( res.offsets == std::vector<size_t>{0} );
+        REQUIRE( res.matches.empty() );
+    }
+}
+
+TEST_CASE("bvh refit", "[bvh]") {
+    auto  build_type = GENERATE(bvh_build_type::MORTON, bvh_build_type::SAH);
+    float threshold  = GENERATE(0.0f, 2.0f);
+
+    std::vector<bboxf> boxes = make_mixed_boxes(5000, 42);
+    bvh tree;
+    REQUIRE( tree.generate(boxes, build_type) );
+
+    // Drag a group of objects far away, and jitter the rest.
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+    for(size_t i=0; i<boxes.size(); ++i) {
+        vec3f offset = (i % 50 == 0)? vec3f(300, -200, 100)
+                                    : vec3f(jitter(gen), jitter(gen), jitter(gen));
+        boxes[i].min_pt += offset;
+        boxes[i].max_pt += offset;
+    }
+    REQUIRE( tree.refit(boxes, threshold) );
+    REQUIRE( tree.size() == boxes.size() );
+
+    bboxf root;
+    for(const bboxf& box : boxes) {
+        root.expand(box);
+    }
+    REQUIRE( tree.bounds().min_pt.x() == root.min_pt.x() );
+    REQUIRE( tree.bounds().max_pt.x() == root.max_pt.x() );
+
+    std::uniform_real_distribution<float> pos(-120.0f, 320.0f);
+    for(int i=0; i<100; ++i) {
+        vec3f pt(pos(gen), pos(gen), pos(gen));
+        bboxf qbox(pt);
+        qbox.expand(pt + vec3f(10,10,10));
+        bvh::intersect_box ifunc(qbox);
+        REQUIRE( run_query(tree, ifunc) == brute_force(boxes, ifunc) );
+    }
+    for(const bboxf& box : boxes) {
+        REQUIRE_FALSE( run_query(tree, bvh::intersect_point(box.center())).empty() );
+    }
+
+    // Refitting again with the same boxes shouldn't change anything.
+    std::vector<bvh::node> before(tree.nodes().begin(), tree.nodes().end());
+    REQUIRE( tree.refit(boxes, threshold) );
+    REQUIRE( tree.nodes().size() == before.size() );
+    for(size_t i=0; i<before.size(); ++i) {
+        REQUIRE( tree.nodes()[i].num == before[i].num );
+    }
+
+    // Wrong number of boxes.
+    boxes.pop_back();
+    REQUIRE_FALSE( tree.refit(boxes, threshold) );
+}
+
+TEST_CASE("bvh partial rebuild", "[bvh]") {
+    std::vector<bboxf> boxes = make_mixed_boxes(5000, 42);
+    bvh tree;
+    REQUIRE( tree.generate(boxes, bvh_build_type::SAH) );
+    REQUIRE( tree.refit(boxes, 1.5f) );
+    std::vector<bvh::node> before(tree.nodes().begin(), tree.nodes().end());
+
+    // Move a few objects a moderate distance. Only the subtrees around them should be rebuilt.
+    for(size_t i=0; i<5; ++i) {
+        boxes[i].min_pt += vec3f(40, 0, 0);
+        boxes[i].max_pt += vec3f(40, 0, 0);
+    }
+    REQUIRE( tree.refit(boxes, 1.5f) );
+
+    size_t changed = 0;
+    for(size_t i=0; i<before.size(); ++i) {
+        changed += (tree.nodes()[i].num != before[i].num)? size_t(1) : size_t(0);
+    }
+    REQUIRE( changed > 0 );
+    REQUIRE( changed < before.size() / 4 );
+
+    for(size_t i=0; i<boxes.size(); ++i) {
+        auto res = run_query(tree, bvh::intersect_point(boxes[i].center()));
+        REQUIRE( std::find(res.begin(), res.end(), i) != res.end() );
+    }
+}
+
+TEST_CASE("bvh partial rebuild after plain refit", "[bvh]") {
+    std::vector<bboxf> boxes = make_mixed_boxes(5000, 42);
+    bvh tree;
+    REQUIRE( tree.generate(boxes, bvh_build_type::SAH) );
+    std::vector<bvh::node> before(tree.nodes().begin(), tree.nodes().end());
+
+    // A refit without a threshold keeps the structure...
+    for(size_t i=0; i<5; ++i) {
+        boxes[i].min_pt += vec3f(40, 0, 0);
+        boxes[i].max_pt += vec3f(40, 0, 0);
+    }
+    REQUIRE( tree.refit(boxes) );
+    for(size_t i=0; i<before.size(); ++i) {
+        REQUIRE( tree.nodes()[i].num == before[i].num );
+    }
+
+    // ... but the next one with a threshold still compares against the areas from generate().
+    REQUIRE( tree.refit(boxes, 1.5f) );
+    size_t changed = 0;
+    for(size_t i=0; i<before.size(); ++i) {
+        changed += (tree.nodes()[i].num != before[i].num)? size_t(1) : size_t(0);
+    }
+    REQUIRE( changed > 0 );
+    REQUIRE( changed < before.size() / 4 );
+}
+
+TEMPLATE_TEST_CASE_SIG("bvh packet query", "[bvh]", ((size_t N), N), 4, 8) {
+    auto build_type = GENERATE(bvh_build_type::MORTON, bvh_build_type::SAH);
+
+    std::vector<bboxf> boxes = make_mixed_boxes(5000, 42);
+    bvh tree;
+    REQUIRE( tree.generate(boxes, build_type) );
+
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<float> pos(-120.0f, 120.0f);
+
+    // Run packet query, return sorted list of matched object indices for each ray in packet.
+    auto run_packet = [&](const bvh::intersect_ray_packet<N>& pfunc) {
+        std::vector<std::vector<size_t>> res(N);
+        auto     query = tree.make_packet_query(pfunc);
+        size_t   idx;
+        uint32_t mask;
+        while(query.next(&idx, &mask)) {
+            REQUIRE( mask != 0 );
+            for(size_t lane=0; lane<N; ++lane) {
+                if(mask & (1u << lane)) {
+                    res[lane].push_back(idx);
+                }
+            }
+        }
+        for(auto& r : res) {
+            std::sort(r.begin(), r.end());
+        }
+        return res;
+    };
+
+    SECTION( "random rays" ) {
+        for(int iter=0; iter<20; ++iter) {
+            vec3f origins[N], dirs[N];
+            for(size_t lane=0; lane<N; ++lane) {
+                origins[lane] = vec3f(pos(gen), pos(gen), pos(gen));
+                dirs[lane]    = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+            }
+            auto res = run_packet(bvh::intersect_ray_packet<N>(origins, dirs, N));
+            for(size_t lane=0; lane<N; ++lane) {
+                REQUIRE( res[lane] == run_query(tree, bvh::intersect_ray(origins[lane], dirs[lane])) );
+            }
+        }
+    }
+
+    SECTION( "axis-aligned rays" ) {
+        vec3f origins[N], dirs[N];
+        for(size_t lane=0; lane<N; ++lane) {
+            // Start some rays exactly on a box's corner, so we hit the 0 * INF case.
+            origins[lane] = (lane % 2 == 0)? boxes[lane].min_pt : vec3f(pos(gen), pos(gen), 0.0f);
+            dirs[lane]    = vec3f();
+            dirs[lane][lane % 3] = (lane % 4 < 2)? 1.0f : -1.0f;
+        }
+        auto res = run_packet(bvh::intersect_ray_packet<N>(origins, dirs, N));
+        for(size_t lane=0; lane<N; ++lane) {
+            REQUIRE( res[lane] == run_query(tree, bvh::intersect_ray(origins[lane], dirs[lane])) );
+        }
+    }
+
+    SECTION( "partial packet" ) {
+        vec3f origins[N], dirs[N];
+        for(size_t lane=0; lane<N; ++lane) {
+            origins[lane] = vec3f(pos(gen), pos(gen), pos(gen));
+            dirs[lane]    = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+        }
+        auto res = run_packet(bvh::intersect_ray_packet<N>(origins, dirs, 3));
+        for(size_t lane=0; lane<N; ++lane) {
+            if(lane < 3) {
+                REQUIRE( res[lane] == run_query(tree, bvh::intersect_ray(origins[lane], dirs[lane])) );
+            } else {
+                REQUIRE( res[lane].empty() );
+            }
+        }
+    }
+
+    SECTION( "deactivate" ) {
+        vec3f origins[N], dirs[N];
+        for(size_t lane=0; lane<N; ++lane) {
+            origins[lane] = tree.bounds().center();
+            dirs[lane]    = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+        }
+        auto     query = tree.make_packet_query(bvh::intersect_ray_packet<N>(origins, dirs, N));
+        size_t   idx;
+        uint32_t mask;
+        // Stop each ray as soon as it hits something, like an occlusion query would.
+        while(query.next(&idx, &mask)) {
+            REQUIRE( (mask & ~query.active_mask()) == 0 );
+            query.deactivate(mask);
+        }
+    }
+}
@@ -0,0 +1,121 @@
+/* Unit tests for bvh4 (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/bvh4.hpp>
+#include "test_helpers.hpp"
+
+#include <random>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::bvh4;
+using obvi::bvh_build_type;
+using obvi::vec3f;
+using obvi_test::make_boxes;
+using obvi_test::run_query;
+
+TEST_CASE("bvh4 generate", "[bvh4]") {
+    bvh  bin;
+    bvh4 tree;
+
+    SECTION( "empty" ) {
+        bin.generate(std::vector<bboxf>());
+        tree.generate(bin);
+        REQUIRE( tree.size() == 0 );
+        REQUIRE( run_query(tree, bvh4::intersect_point(vec3f(0,0,0))).empty() );
+    }
+
+    SECTION( "single box" ) {
+        bin.generate({bboxf(1,2,3, 4,5,6)});
+        tree.generate(bin);
+        REQUIRE( tree.size() == 1 );
+        REQUIRE( run_query(tree, bvh4::intersect_point(vec3f(2,3,4))) == std::vector<size_t>{0} );
+        REQUIRE( run_query(tree, bvh4::intersect_point(vec3f(0,0,0))).empty() );
+    }
+
+    SECTION( "empty boxes are skipped" ) {
+        bin.generate({bboxf(1,2,3, 4,5,6), bboxf(), bboxf(2,3,4, 5,6,7)});
+        tree.generate(bin);
+        REQUIRE( tree.size() == 3 );
+        REQUIRE( run_query(tree, bvh4::intersect_box(bboxf(-10,-10,-10, 10,10,10)))
+                 == (std::vector<size_t>{0, 2}) );
+    }
+}
+
+TEST_CASE("bvh4 query", "[bvh4]") {
+    auto build_type = GENERATE(bvh_build_type::MORTON, bvh_build_type::SAH);
+    auto num_boxes  = GENERATE(2, 3, 5, 17, 5000);
+
+    std::vector<bboxf> boxes = make_boxes((size_t)num_boxes, 42);
+    bvh  bin;
+    bvh4 tree;
+    REQUIRE( bin.generate(boxes, build_type) );
+    tree.generate(bin);
+    REQUIRE( tree.size() == boxes.size() );
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> pos(-120.0f, 120.0f);
+
+    SECTION( "point query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            if(i % 10 == 0) {
+                pt = boxes[(size_t)i % boxes.size()].max_pt; // exactly on corner
+            }
+            REQUIRE( run_query(tree, bvh4::intersect_point(pt))
+                     == run_query(bin, bvh::intersect_point(pt)) );
+        }
+    }
+
+    SECTION( "box query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            bboxf qbox(pt);
+            qbox.expand(pt + vec3f(10,10,10));
+            REQUIRE( run_query(tree, bvh4::intersect_box(qbox))
+                     == run_query(bin, bvh::intersect_box(qbox)) );
+        }
+    }
+
+    SECTION( "ray query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f origin(pos(gen), pos(gen), pos(gen));
+            vec3f dir = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+            if(i % 10 == 0) {
+                // Axis-aligned ray starting on a box corner.
+                origin = boxes[(size_t)i % boxes.size()].min_pt;
+                dir    = vec3f();
+                dir[(size_t)i % 3] = 1.0f;
+            }
+            REQUIRE( run_query(tree, bvh4::intersect_ray(origin, dir))
+                     == run_query(bin, bvh::intersect_ray(origin, dir)) );
+        }
+    }
+}
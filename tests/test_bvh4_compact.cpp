@@ -0,0 +1,179 @@
+/* Unit tests for bvh4_compact (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/bvh4.hpp>
+#include <obvi/util/bvh4_compact.hpp>
+#include "test_helpers.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::bvh4;
+using obvi::bvh4_compact;
+using obvi::bvh_build_type;
+using obvi::vec3f;
+using obvi_test::make_boxes;
+using obvi_test::run_query;
+
+namespace {
+    // Remove matches whose exact bounding box doesn't pass the given binary bvh functor.
+    template<typename bvh_func>
+    std::vector<size_t> filter(const std::vector<size_t>& res, const std::vector<bboxf>& boxes,
+                               bvh_func exact) {
+        std::vector<size_t> out;
+        for(size_t idx : res) {
+            if(exact(boxes[idx])) {
+                out.push_back(idx);
+            }
+        }
+        return out;
+    }
+
+    // Check that compressed query is conservative, and is exact once matches are filtered.
+    template<typename compact_func, typename bvh_func>
+    void check_query(const bvh4_compact& tree, const bvh& bin, const std::vector<bboxf>& boxes,
+                     compact_func cfunc, bvh_func bfunc) {
+        std::vector<size_t> res   = run_query(tree, cfunc);
+        std::vector<size_t> exact = run_query(bin, bfunc);
+        REQUIRE( std::includes(res.begin(), res.end(), exact.begin(), exact.end()) );
+        REQUIRE( filter(res, boxes, bfunc) == exact );
+    }
+}
+
+TEST_CASE("bvh4_compact generate", "[bvh4_compact]") {
+    bvh          bin;
+    bvh4         wide;
+    bvh4_compact tree;
+
+    REQUIRE( sizeof(bvh4_compact::node) == 64 );
+
+    SECTION( "empty" ) {
+        bin.generate(std::vector<bboxf>());
+        wide.generate(bin);
+        tree.generate(wide);
+        REQUIRE( tree.size() == 0 );
+        REQUIRE( run_query(tree, bvh4_compact::intersect_point(vec3f(0,0,0))).empty() );
+    }
+
+    SECTION( "single box" ) {
+        bin.generate({bboxf(1,2,3, 4,5,6)});
+        wide.generate(bin);
+        tree.generate(wide);
+        REQUIRE( tree.size() == 1 );
+        REQUIRE( tree.bounds().min_pt.x() == 1.0f );
+        REQUIRE( tree.bounds().max_pt.z() == 6.0f );
+        REQUIRE( run_query(tree, bvh4_compact::intersect_point(vec3f(2,3,4)))
+                 == std::vector<size_t>{0} );
+        REQUIRE( run_query(tree, bvh4_compact::intersect_point(vec3f(0,0,0))).empty() );
+    }
+
+    SECTION( "boxes are never shrunk" ) {
+        // Corners that don't land on the quantization grid.
+        std::vector<bboxf> boxes = {bboxf(0.1f,0.2f,0.3f, 0.7f,0.8f,0.9f),
+                                    bboxf(0.333f,-5.0f,1e-3f, 100.0f,-4.999f,1e-3f)};
+        bin.generate(boxes);
+        wide.generate(bin);
+        tree.generate(wide);
+
+        const bvh4_compact::node& nd = tree.nodes()[0];
+        for(size_t axis=0; axis<3; ++axis) {
+            obvi::float4v lo, hi;
+            nd.bounds(axis, lo, hi);
+            float flo[4], fhi[4];
+            lo.store(flo);
+            hi.store(fhi);
+            const bvh4::node& src = wide.nodes()[0];
+            for(size_t i=0; i<src.count; ++i) {
+                REQUIRE( flo[i] <= src.min[axis][i] );
+                REQUIRE( fhi[i] >= src.max[axis][i] );
+            }
+        }
+        for(const bboxf& box : boxes) {
+            REQUIRE( run_query(tree, bvh4_compact::intersect_point(box.min_pt)).size() >= 1 );
+            REQUIRE( run_query(tree, bvh4_compact::intersect_point(box.max_pt)).size() >= 1 );
+        }
+    }
+}
+
+TEST_CASE("bvh4_compact query", "[bvh4_compact]") {
+    auto build_type = GENERATE(bvh_build_type::MORTON, bvh_build_type::SAH);
+    auto num_boxes  = GENERATE(2, 3, 5, 17, 5000);
+
+    std::vector<bboxf> boxes = make_boxes((size_t)num_boxes, 42);
+    bvh          bin;
+    bvh4         wide;
+    bvh4_compact tree;
+    REQUIRE( bin.generate(boxes, build_type) );
+    wide.generate(bin);
+    tree.generate(wide);
+    REQUIRE( tree.size() == boxes.size() );
+    REQUIRE( tree.nodes().size() == wide.nodes().size() );
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> pos(-120.0f, 120.0f);
+
+    SECTION( "point query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            if(i % 10 == 0) {
+                pt = boxes[(size_t)i % boxes.size()].max_pt; // exactly on corner
+            }
+            check_query(tree, bin, boxes, bvh4_compact::intersect_point(pt),
+                        bvh::intersect_point(pt));
+        }
+    }
+
+    SECTION( "box query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            bboxf qbox(pt);
+            qbox.expand(pt + vec3f(10,10,10));
+            check_query(tree, bin, boxes, bvh4_compact::intersect_box(qbox),
+                        bvh::intersect_box(qbox));
+        }
+    }
+
+    SECTION( "ray query" ) {
+        for(int i=0; i<100; ++i) {
+            vec3f origin(pos(gen), pos(gen), pos(gen));
+            vec3f dir = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+            if(i % 10 == 0) {
+                // Axis-aligned ray starting on a box corner.
+                origin = boxes[(size_t)i % boxes.size()].min_pt;
+                dir    = vec3f();
+                dir[(size_t)i % 3] = 1.0f;
+            }
+            check_query(tree, bin, boxes, bvh4_compact::intersect_ray(origin, dir),
+                        bvh::intersect_ray(origin, dir));
+        }
+    }
+}
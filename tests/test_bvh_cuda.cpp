@@ -0,0 +1,160 @@
+/* Unit tests for bvh_cuda (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/bvh_cuda.hpp>
+#include "test_helpers.hpp"
+
+#include <string.h>
+#include <random>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::bvh_build_type;
+using obvi::bvh_cuda;
+using obvi::vec3f;
+
+namespace {
+    // Random boxes, plus a few duplicates (same Morton code) and an empty box.
+    std::vector<bboxf> make_boxes_with_dups(size_t count, unsigned seed) {
+        std::vector<bboxf> boxes = obvi_test::make_boxes(count, seed);
+        boxes.push_back(boxes[0]);
+        boxes.push_back(boxes[1]);
+        boxes.push_back(bboxf());
+        return boxes;
+    }
+}
+
+TEST_CASE("bvh_cuda without a GPU", "[bvh_cuda]") {
+    std::string err;
+    if(bvh_cuda::available(&err)) {
+        return; // covered by the tests below
+    }
+    CHECK_FALSE( err.empty() );
+
+    bvh_cuda gpu;
+    err.clear();
+    CHECK_FALSE( gpu.generate(make_boxes_with_dups(10, 1), &err) );
+    CHECK_FALSE( err.empty() );
+    CHECK( gpu.size() == 0 );
+
+    bvh cpu;
+    REQUIRE( cpu.generate(make_boxes_with_dups(10, 1)) );
+    CHECK_FALSE( gpu.upload(cpu) );
+
+    bvh::batch_result res;
+    std::vector<bvh::intersect_point> queries(3, bvh::intersect_point(vec3f(0,0,0)));
+    CHECK_FALSE( gpu.query_batch(queries, res) );
+    CHECK( res.offsets == std::vector<size_t>(4, 0) );
+    CHECK( res.matches.empty() );
+
+    std::vector<uint32_t> first;
+    CHECK_FALSE( gpu.query_batch_first(queries, first) );
+    CHECK( first == std::vector<uint32_t>(3, bvh::no_match) );
+}
+
+TEST_CASE("bvh_cuda", "[bvh_cuda]") {
+    if(!bvh_cuda::available()) {
+        return;
+    }
+    std::string err;
+
+    SECTION( "same tree as the CPU's Morton build" ) {
+        for(size_t count : {size_t(1), size_t(2), size_t(3), size_t(1000), size_t(20000)}) {
+            std::vector<bboxf> boxes = make_boxes_with_dups(count, 7);
+            if(count < 4) {
+                boxes.resize(count);
+            }
+            bvh cpu;
+            REQUIRE( cpu.generate(boxes, bvh_build_type::MORTON) );
+
+            bvh_cuda gpu;
+            REQUIRE( gpu.generate(boxes, &err) );
+            REQUIRE( gpu.size() == boxes.size() );
+
+            bvh down;
+            REQUIRE( gpu.download(down, &err) );
+            REQUIRE( down.nodes().size() == cpu.nodes().size() );
+            CHECK( memcmp(down.nodes().data(), cpu.nodes().data(),
+                          cpu.nodes().size() * sizeof(bvh::node)) == 0 );
+        }
+    }
+
+    SECTION( "queries match the CPU" ) {
+        std::vector<bboxf> boxes = make_boxes_with_dups(5000, 3);
+        bvh cpu;
+        REQUIRE( cpu.generate(boxes, bvh_build_type::SAH) );
+        bvh_cuda gpu;
+        REQUIRE( gpu.upload(cpu, &err) );
+
+        std::mt19937 gen(9);
+        std::uniform_real_distribution<float> pos(-120.0f, 120.0f);
+        std::vector<bvh::intersect_point> points;
+        std::vector<bvh::intersect_box>   qboxes;
+        std::vector<bvh::intersect_ray>   rays;
+        for(int i=0; i<2000; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            bboxf qbox(pt);
+            qbox.expand(pt + vec3f(10,10,10));
+            points.emplace_back(pt);
+            qboxes.emplace_back(qbox);
+            rays.emplace_back(pt, vec3f(pos(gen), pos(gen), pos(gen)).normalized());
+        }
+        rays.emplace_back(vec3f(0,0,0), vec3f(1,0,0)); // axis-aligned (infinite inverse)
+
+        auto check_same = [&](const auto& queries) {
+            bvh::batch_result expected, got;
+            cpu.query_batch(queries, expected);
+            REQUIRE( gpu.query_batch(queries, got, &err) );
+            CHECK( got.offsets == expected.offsets );
+            CHECK( got.matches == expected.matches );
+
+            std::vector<uint32_t> expected_first, got_first;
+            cpu.query_batch_first(queries, expected_first);
+            REQUIRE( gpu.query_batch_first(queries, got_first, &err) );
+            CHECK( got_first == expected_first );
+        };
+        check_same(points);
+        check_same(qboxes);
+        check_same(rays);
+    }
+
+    SECTION( "empty tree" ) {
+        bvh_cuda gpu;
+        REQUIRE( gpu.generate(std::vector<bboxf>(), &err) );
+        CHECK( gpu.size() == 0 );
+
+        bvh::batch_result res;
+        REQUIRE( gpu.query_batch(std::vector<bvh::intersect_point>(2, vec3f(0,0,0)), res) );
+        CHECK( res.offsets == std::vector<size_t>(3, 0) );
+
+        bvh down;
+        REQUIRE( gpu.download(down) );
+        CHECK( down.nodes().empty() );
+    }
+}
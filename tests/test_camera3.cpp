@@ -0,0 +1,86 @@
+/* Unit tests for camera3 (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/camera3.hpp>
+
+#include <array>
+#include <random>
+
+using obvi::camera3f;
+using obvi::camera_type;
+using obvi::vec3f;
+
+namespace {
+    // Transform a world point to normalized device coords with the camera's OpenGL matrix.
+    vec3f project(const camera3f& cam, const vec3f& pt) {
+        std::array<float, 16> m{};
+        cam.to_gl(m);
+        float clip[4];
+        for(size_t row=0; row<4; ++row) {
+            clip[row] = m[row] * pt[0] + m[4 + row] * pt[1] + m[8 + row] * pt[2] + m[12 + row];
+        }
+        return vec3f(clip[0], clip[1], clip[2]) / clip[3];
+    }
+
+    void check_pt(const vec3f& pt, const vec3f& expected) {
+        CHECK(pt[0] == Approx(expected[0]).margin(1e-3));
+        CHECK(pt[1] == Approx(expected[1]).margin(1e-3));
+        CHECK(pt[2] == Approx(expected[2]).margin(1e-3));
+    }
+}
+
+TEST_CASE("camera3 unproject", "[camera3]") {
+    camera3f cam;
+    cam.look_at(vec3f(1,2,-10), vec3f(1,2,0), vec3f(0,1,0));
+
+    SECTION( "perspective" ) {
+        REQUIRE(cam.set_perspective(0.8f, 1.5f, 0.5f, 100.0f));
+
+        // Center of the near and far planes.
+        check_pt(cam.unproject(vec3f(0, 0, -1)), vec3f(1, 2, -9.5f));
+        check_pt(cam.unproject(vec3f(0, 0,  1)), vec3f(1, 2, 90.0f));
+    }
+
+    SECTION( "orthographic" ) {
+        REQUIRE(cam.set_projection(camera_type::ORTHOGRAPHIC, -4, 4, -3, 3, 0.5f, 100.0f));
+
+        check_pt(cam.unproject(vec3f(0, 0, -1)), vec3f(1, 2, -9.5f));
+        check_pt(cam.unproject(vec3f(0, 0,  1)), vec3f(1, 2, 90.0f));
+        // Camera looks down +Z with +Y up, so screen right is world -X.
+        check_pt(cam.unproject(vec3f(1, 1, -1)), vec3f(-3, 5, -9.5f));
+    }
+
+    // Points inside the view volume should survive a round trip through the projection.
+    std::mt19937 gen(4);
+    std::uniform_real_distribution<float> ndc(-0.9f, 0.9f);
+    for(int i=0; i<100; ++i) {
+        vec3f pt   = cam.unproject(vec3f(ndc(gen), ndc(gen), ndc(gen)));
+        vec3f back = cam.unproject(project(cam, pt));
+        check_pt(back, pt);
+    }
+}
@@ -0,0 +1,121 @@
+/* Unit tests for depth_pyramid (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/depth_pyramid.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using obvi::depth_pyramid;
+
+namespace {
+    // Farthest depth of the level 0 texels under a rectangle, the slow way.
+    float brute_max_depth(const std::vector<float>& depth, int w, int h, float u_min, float v_min,
+                          float u_max, float v_max) {
+        int x0 = std::min(int(u_min * float(w)), w - 1), x1 = std::min(int(u_max * float(w)), w - 1);
+        int y0 = std::min(int(v_min * float(h)), h - 1), y1 = std::min(int(v_max * float(h)), h - 1);
+        float d = 0.0f;
+        for(int y=y0; y<=y1; ++y) {
+            for(int x=x0; x<=x1; ++x) {
+                d = std::max(d, depth[(size_t)y * (size_t)w + (size_t)x]);
+            }
+        }
+        return d;
+    }
+}
+
+TEST_CASE("depth_pyramid sizes", "[depth_pyramid]") {
+    CHECK(depth_pyramid::num_levels(0, 10) == 0);
+    CHECK(depth_pyramid::num_levels(1, 1) == 1);
+    CHECK(depth_pyramid::num_levels(1920, 1080) == 11);
+    CHECK(depth_pyramid::level_size(1920, 8) == 7);
+    CHECK(depth_pyramid::level_size(1080, 10) == 1);
+    CHECK(depth_pyramid::level_size(1080, 11) == 1);
+
+    depth_pyramid pyr;
+    pyr.build(nullptr, 0, 0);
+    CHECK(pyr.levels() == 0);
+    CHECK(pyr.max_depth(0, 0, 1, 1) == 1.0f);
+}
+
+TEST_CASE("depth_pyramid last texel covers leftovers", "[depth_pyramid]") {
+    // One row, 1920 wide: level 8 is 7 texels, and the last one covers level 0 texels 1536-1919.
+    const int w = 1920, h = 1;
+    std::vector<float> depth((size_t)w, 0.0f);
+    depth[1590] = 1.0f;
+
+    depth_pyramid pyr;
+    pyr.build(depth.data(), w, h);
+    CHECK(pyr.at(8, 5, 0) == 0.0f);
+    CHECK(pyr.at(8, 6, 0) == 1.0f);
+
+    // u in [0.76,0.83] is level 0 texels 1459-1593, which is level 8 texels 5 and 6. Scaling by
+    // the level 8 size (7) would have only looked at texel 5.
+    depth_pyramid::footprint fp = depth_pyramid::find_footprint(0.76f, 0, 0.83f, 1, w, h, pyr.levels());
+    CHECK(fp.level == 8);
+    CHECK(fp.x0 == 5);
+    CHECK(fp.x1 == 6);
+    CHECK(pyr.max_depth(0.76f, 0, 0.83f, 1) == 1.0f);
+
+    // Rectangle that runs off the right edge of the viewport.
+    CHECK(pyr.max_depth(0.82f, 0, 1, 1) == 1.0f);
+}
+
+TEST_CASE("depth_pyramid is conservative", "[depth_pyramid]") {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Viewports that aren't powers of two (odd sizes at every level).
+    const int sizes[][2] = {{643, 359}, {1000, 1}, {1, 777}, {3, 5}, {255, 257}};
+    for(const auto& size : sizes) {
+        const int w = size[0], h = size[1];
+        std::vector<float> depth((size_t)w * (size_t)h);
+        for(float& d : depth) {
+            d = unit(rng);
+            d = d * d * d; // mostly near, so the farthest texel matters
+        }
+        depth_pyramid pyr;
+        pyr.build(depth.data(), w, h);
+        REQUIRE(pyr.levels() == depth_pyramid::num_levels(w, h));
+
+        for(int i=0; i<500; ++i) {
+            float u0 = unit(rng), u1 = unit(rng), v0 = unit(rng), v1 = unit(rng);
+            float extent = unit(rng); // mix of tiny and huge rectangles
+            extent = extent * extent;
+            u1 = std::min(u0 + (u1 * extent), 1.0f);
+            v1 = std::min(v0 + (v1 * extent), 1.0f);
+
+            depth_pyramid::footprint fp = depth_pyramid::find_footprint(u0, v0, u1, v1, w, h,
+                                                                       pyr.levels());
+            REQUIRE(fp.x1 - fp.x0 <= 1);
+            REQUIRE(fp.y1 - fp.y0 <= 1);
+            REQUIRE(pyr.max_depth(u0, v0, u1, v1) >= brute_max_depth(depth, w, h, u0, v0, u1, v1));
+        }
+    }
+}
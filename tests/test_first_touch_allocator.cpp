@@ -0,0 +1,63 @@
+/* Unit tests for first_touch_allocator (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/first_touch_allocator.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+using obvi::first_touch_allocator;
+
+TEST_CASE("first_touch_allocator", "[first_touch_allocator]") {
+    SECTION( "small" ) {
+        std::vector<int, first_touch_allocator<int>> values = {1, 2, 3};
+        values.push_back(4);
+        REQUIRE( values.size() == 4 );
+        REQUIRE( values[3] == 4 );
+    }
+
+    SECTION( "big allocations still get constructed" ) {
+        const size_t n = 3 * obvi::first_touch_min_bytes / sizeof(uint32_t) + 7;
+        std::vector<uint32_t, first_touch_allocator<uint32_t>> values(n, 0xABCDu);
+        size_t bad = 0;
+        for(uint32_t v : values) {
+            bad += (v != 0xABCDu)? 1 : 0;
+        }
+        REQUIRE( bad == 0 );
+
+        std::vector<uint32_t, first_touch_allocator<uint32_t>> copy = values;
+        REQUIRE( copy == values );
+    }
+
+    SECTION( "null and empty" ) {
+        obvi::first_touch(nullptr, size_t(1) << 30);
+        first_touch_allocator<char> alloc;
+        char *ptr = alloc.allocate(1);
+        alloc.deallocate(ptr, 1);
+    }
+}
@@ -0,0 +1,152 @@
+/* Unit tests for frustum and camera3::get_frustum() (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/camera3.hpp>
+#include <obvi/util/frustum.hpp>
+
+#include <array>
+#include <random>
+
+using obvi::affine3f;
+using obvi::bboxf;
+using obvi::camera3f;
+using obvi::camera_type;
+using obvi::frustumf;
+using obvi::mat3f;
+using obvi::vec3f;
+
+namespace {
+    // Return true if point is inside the clip volume of the given (projection * view) matrix.
+    bool inside_clip(const std::array<float,16>& m, const vec3f& pt) {
+        float clip[4];
+        for(size_t row=0; row<4; ++row) {
+            clip[row] = m[row] * pt[0] + m[4 + row] * pt[1] + m[8 + row] * pt[2] + m[12 + row];
+        }
+        float w = clip[3];
+        return w > 0 && std::abs(clip[0]) <= w && std::abs(clip[1]) <= w && std::abs(clip[2]) <= w;
+    }
+
+    // Unit cube from (0,0,0) to (1,1,1), as a frustum.
+    frustumf unit_cube() {
+        frustumf fr;
+        fr.set_plane(frustumf::LEFT,        1, 0, 0, 0);
+        fr.set_plane(frustumf::RIGHT,      -2, 0, 0, 2); // not normalized on purpose
+        fr.set_plane(frustumf::BOTTOM,      0, 1, 0, 0);
+        fr.set_plane(frustumf::TOP,         0,-1, 0, 1);
+        fr.set_plane(frustumf::NEAR_PLANE,  0, 0, 1, 0);
+        fr.set_plane(frustumf::FAR_PLANE,   0, 0,-1, 1);
+        return fr;
+    }
+}
+
+TEST_CASE("frustum tests", "[frustum]") {
+    frustumf fr = unit_cube();
+
+    SECTION( "default accepts everything" ) {
+        frustumf all;
+        REQUIRE( all.intersects_point(vec3f(1e6f, -1e6f, 3)) );
+        REQUIRE( all.intersects_box(bboxf(-1,-1,-1, 1,1,1)) );
+        REQUIRE( !all.intersects_box(bboxf()) );
+    }
+
+    SECTION( "point" ) {
+        REQUIRE( fr.intersects_point(vec3f(0.5f, 0.5f, 0.5f)) );
+        REQUIRE( fr.intersects_point(vec3f(1, 1, 1)) ); // on boundary
+        REQUIRE( !fr.intersects_point(vec3f(1.1f, 0.5f, 0.5f)) );
+        REQUIRE( fr.distance(frustumf::RIGHT, vec3f(0.25f, 0, 0)) == Approx(0.75f) );
+    }
+
+    SECTION( "sphere" ) {
+        REQUIRE( fr.intersects_sphere(vec3f(1.4f, 0.5f, 0.5f), 0.5f) );
+        REQUIRE( !fr.intersects_sphere(vec3f(1.6f, 0.5f, 0.5f), 0.5f) );
+    }
+
+    SECTION( "box" ) {
+        REQUIRE( fr.intersects_box(bboxf(0.2f,0.2f,0.2f, 0.3f,0.3f,0.3f)) );
+        REQUIRE( fr.contains_box(bboxf(0.2f,0.2f,0.2f, 0.3f,0.3f,0.3f)) );
+        REQUIRE( fr.intersects_box(bboxf(-1,-1,-1, 0.1f,0.1f,0.1f)) );
+        REQUIRE( !fr.contains_box(bboxf(-1,-1,-1, 0.1f,0.1f,0.1f)) );
+        REQUIRE( fr.intersects_box(bboxf(-1,-1,-1, 2,2,2)) ); // frustum inside box
+        REQUIRE( !fr.intersects_box(bboxf(1.5f,0,0, 2,1,1)) );
+        REQUIRE( !fr.intersects_box(bboxf(0,0,-3, 1,1,-2)) );
+    }
+
+    SECTION( "to_local" ) {
+        // Object space is scaled by 2, rotated 90 deg about z, then moved by (10,0,0).
+        affine3f model(mat3f::zrot(float(M_PI / 2.0)), vec3f(10,0,0), 2.0f);
+        frustumf world = unit_cube();
+        world.set_plane(frustumf::LEFT,  1, 0, 0, -10);  // x >= 10
+        world.set_plane(frustumf::RIGHT,-1, 0, 0,  11);  // x <= 11
+        frustumf local = world.to_local(model);
+
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<float> pos(-2.0f, 2.0f);
+        for(int i=0; i<1000; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            REQUIRE( local.intersects_point(pt) == world.intersects_point(model * pt) );
+        }
+    }
+}
+
+TEST_CASE("camera3 frustum", "[frustum]") {
+    camera3f cam;
+    cam.look_at(vec3f(1,2,3), vec3f(-2,0,0), vec3f(0,1,0));
+
+    auto proj = GENERATE(camera_type::PERSPECTIVE, camera_type::ORTHOGRAPHIC);
+    if(proj == camera_type::PERSPECTIVE) {
+        REQUIRE( cam.set_perspective(0.8f, 1.5f, 0.5f, 20.0f) );
+    } else {
+        REQUIRE( cam.set_projection(camera_type::ORTHOGRAPHIC, -3, 4, -2, 2.5f, 0.5f, 20.0f) );
+    }
+
+    std::array<float,16> view_proj;
+    cam.to_gl(view_proj);
+    frustumf fr = cam.get_frustum();
+
+    // Planes must agree with the actual projection, except very close to the boundary.
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> pos(-15.0f, 15.0f);
+    size_t num_inside = 0;
+    for(int i=0; i<20000; ++i) {
+        vec3f pt(pos(gen), pos(gen), pos(gen));
+        bool  expect = inside_clip(view_proj, pt);
+        bool  near_edge = false;
+        for(size_t p=0; p<frustumf::NUM_PLANES; ++p) {
+            near_edge = near_edge || std::abs(fr.distance(p, pt)) < 1e-3f;
+        }
+        if(!near_edge) {
+            REQUIRE( fr.intersects_point(pt) == expect );
+        }
+        num_inside += (expect)? 1 : 0;
+    }
+    REQUIRE( num_inside > 100 );
+
+    // Camera position is behind the near plane, look target is inside.
+    REQUIRE( !fr.intersects_point(cam.get_position()) );
+    REQUIRE( fr.intersects_point(cam.get_position() + cam.get_look_dir() * 5.0f) );
+}
@@ -0,0 +1,78 @@
+/* Unit tests for hash64() (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <catch2/catch.hpp>
+#include <obvi/util/hash.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using obvi::hash64;
+
+TEST_CASE("hash64 reference values", "[hash]") {
+    // Values from the reference xxHash64 implementation.
+    CHECK(hash64("", 0) == 0xEF46DB3751D8E999ull);
+    CHECK(hash64(nullptr, 0) == 0xEF46DB3751D8E999ull);
+    CHECK(hash64("abc", 3) == 0x44BC2CF5AD770999ull);
+
+    const std::string fox = "The quick brown fox jumps over the lazy dog";
+    CHECK(hash64(fox.data(), fox.size()) == 0x0B242D361FDA71BCull);
+}
+
+TEST_CASE("hash64 input sizes", "[hash]") {
+    // Every tail length (0-31 bytes) after zero, one and two full 32-byte stripes must give a
+    // different value, and changing any single byte must change the hash.
+    std::vector<unsigned char> buf(96);
+    for(size_t i=0; i<buf.size(); ++i) {
+        buf[i] = (unsigned char)(i * 37 + 11);
+    }
+    std::vector<uint64_t> seen;
+    for(size_t len=0; len<=buf.size(); ++len) {
+        uint64_t h = hash64(buf.data(), len);
+        for(uint64_t prev : seen) {
+            REQUIRE(h != prev);
+        }
+        seen.push_back(h);
+
+        for(size_t i=0; i<len; ++i) {
+            buf[i] ^= 1;
+            CHECK(hash64(buf.data(), len) != h);
+            buf[i] ^= 1;
+        }
+    }
+
+    // Unaligned data hashes the same as aligned data.
+    std::vector<unsigned char> shifted(buf.size() + 1);
+    std::copy(buf.begin(), buf.end(), shifted.begin() + 1);
+    CHECK(hash64(shifted.data() + 1, buf.size()) == hash64(buf.data(), buf.size()));
+}
+
+TEST_CASE("hash64 seed", "[hash]") {
+    const char data[] = "some bytes to hash, longer than one 32-byte stripe";
+    CHECK(hash64(data, sizeof(data), 0) == hash64(data, sizeof(data)));
+    CHECK(hash64(data, sizeof(data), 1) != hash64(data, sizeof(data), 0));
+}
@@ -0,0 +1,73 @@
+/* Helpers shared by the unit tests for the bvh family of classes (util library).
+ *
+ *
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#ifndef OBVI_TEST_HELPERS_HPP
+#define OBVI_TEST_HELPERS_HPP
+
+#include <obvi/util/bbox.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace obvi_test {
+
+// Generate a repeatable set of random boxes. Each box has its min corner inside [-range, range]
+// on every axis, and sides of length [0, max_size].
+inline std::vector<obvi::bboxf> make_boxes(size_t count, unsigned seed, float range = 100.0f,
+                                           float max_size = 5.0f) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> pos(-range, range);
+    std::uniform_real_distribution<float> size(0.0f, max_size);
+
+    std::vector<obvi::bboxf> boxes;
+    for(size_t i=0; i<count; ++i) {
+        obvi::vec3f pt(pos(gen), pos(gen), pos(gen));
+        obvi::bboxf box(pt);
+        box.expand(pt + obvi::vec3f(size(gen), size(gen), size(gen)));
+        boxes.push_back(box);
+    }
+    return boxes;
+}
+
+// Run query to completion, return sorted list of matched object indices.
+template<typename tree_type, typename intersect_func>
+std::vector<size_t> run_query(const tree_type& tree, intersect_func ifunc) {
+    std::vector<size_t> res;
+    auto query = tree.make_query(ifunc);
+    size_t idx;
+    while(query.next(&idx)) {
+        res.push_back(idx);
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+} // END namespace obvi_test
+#endif // OBVI_TEST_HELPERS_HPP
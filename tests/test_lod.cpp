@@ -0,0 +1,120 @@
+/* Unit tests for lod_selector and camera3::screen_fraction() (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/camera3.hpp>
+#include <obvi/util/lod.hpp>
+#include <obvi/util/math.hpp>
+
+using obvi::bboxf;
+using obvi::camera3f;
+using obvi::camera_type;
+using obvi::lod_selector;
+using obvi::mesh_chunk;
+using obvi::vec3f;
+
+namespace {
+    // Unit cube chunk at the origin, with three levels whose error doubles each time.
+    mesh_chunk make_chunk() {
+        mesh_chunk chunk;
+        chunk.first_index = 0;
+        chunk.num_indices = 3000;
+        chunk.bounds      = bboxf(vec3f(0,0,0));
+        chunk.bounds.expand(vec3f(1,1,1));
+        chunk.num_lods    = 3;
+        for(uint32_t i=0; i<chunk.num_lods; ++i) {
+            chunk.lods[i].num_indices = 1500u >> i;
+            chunk.lods[i].error       = 0.01f * float(1u << i);
+        }
+        return chunk;
+    }
+}
+
+TEST_CASE("camera3 screen_fraction", "[lod]") {
+    camera3f cam;
+
+    // 90 degree vertical field of view: at distance d, the screen is 2*d tall.
+    REQUIRE(cam.set_perspective(obvi::deg2rad(90.0f), 1.5f, 0.1f, 100.0f));
+    CHECK(cam.screen_fraction(2.0f, 1.0f) == Approx(1.0f));
+    CHECK(cam.screen_fraction(1.0f, 10.0f) == Approx(0.05f));
+    CHECK(cam.screen_fraction(1.0f, 0.0f) > 1e6f); // inside the object, no divide by zero
+
+    // Orthographic: size doesn't depend on distance.
+    REQUIRE(cam.set_projection(camera_type::ORTHOGRAPHIC, -2, 2, -1, 1, 0.1f, 100.0f));
+    CHECK(cam.screen_fraction(1.0f, 1.0f) == Approx(0.5f));
+    CHECK(cam.screen_fraction(1.0f, 50.0f) == Approx(0.5f));
+}
+
+TEST_CASE("lod_selector", "[lod]") {
+    camera3f cam;
+    REQUIRE(cam.set_perspective(obvi::deg2rad(90.0f), 1.0f, 0.1f, 1000.0f));
+    cam.look_at(vec3f(0.5f, 0.5f, 10.0f), vec3f(0.5f, 0.5f, 0.0f), vec3f(0,1,0));
+
+    // 1000 pixel viewport: error e at distance d covers 500*e/d pixels.
+    lod_selector lod;
+    lod.set_view(cam, 1000.0f);
+    lod.hysteresis = 0.2f;
+
+    mesh_chunk chunk = make_chunk();
+    auto level_at = [&](float dist, size_t prev) {
+        return lod.select(chunk, vec3f(0.5f, 0.5f, 1.0f + dist), 1.0f, prev);
+    };
+
+    SECTION( "pixel error" ) {
+        CHECK(lod.pixel_error(0.01f, chunk.bounds, vec3f(0.5f, 0.5f, 6.0f), 1.0f) == Approx(1.0f));
+        // Scale applies to both the error and the distance, so it cancels out here.
+        CHECK(lod.pixel_error(0.01f, chunk.bounds, vec3f(0.5f, 0.5f, 6.0f), 3.0f) == Approx(1.0f));
+    }
+
+    SECTION( "distance" ) {
+        // Level i is allowed once 500*error(i)/d <= 1, i.e. d >= 5, 10, 20.
+        CHECK(level_at(0.0f, 0) == 0);  // inside the box
+        CHECK(level_at(4.0f, 0) == 0);
+        CHECK(level_at(7.0f, 0) == 1);
+        CHECK(level_at(15.0f, 0) == 2);
+        CHECK(level_at(30.0f, 0) == 3);
+        CHECK(level_at(1e6f, 0) == 3);
+
+        // Chunk with no simplified levels always uses full detail.
+        chunk.num_lods = 0;
+        CHECK(level_at(1e6f, 0) == 0);
+    }
+
+    SECTION( "hysteresis" ) {
+        // Just past the switch distance for level 1 (d = 5): a chunk at level 0 has to come
+        // further out before switching (d >= 5/0.8), once switched it stays until d < 5/1.2.
+        CHECK(level_at(5.5f, 0) == 0);
+        CHECK(level_at(6.5f, 0) == 1);
+        CHECK(level_at(5.5f, 1) == 1);
+        CHECK(level_at(4.5f, 1) == 1);
+        CHECK(level_at(4.0f, 1) == 0);
+
+        // Dropping several levels at once still works.
+        CHECK(level_at(4.0f, 3) == 0);
+        CHECK(level_at(30.0f, 3) == 3);
+    }
+}
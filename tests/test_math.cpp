@@ -33,8 +33,11 @@
 using namespace Catch::literals; // Provides "_a" UDL for approximate floating-point values.
 
 using obvi::count_leading_zeros;
+using obvi::count_leading_zeros_64;
 using obvi::expand_bits_30;
+using obvi::expand_bits_63;
 using obvi::morton_encode_30;
+using obvi::morton_encode_63;
 
 TEST_CASE("count_leading_zeros", "[math]") {
     REQUIRE( count_leading_zeros(0) == 32 );
@@ -45,6 +48,15 @@ TEST_CASE("count_leading_zeros", "[math]") {
     REQUIRE( count_leading_zeros(0x08000000u) == 4);
 }
 
+TEST_CASE("count_leading_zeros_64", "[math]") {
+    REQUIRE( count_leading_zeros_64(0) == 64 );
+    REQUIRE( count_leading_zeros_64(1) == 63 );
+    REQUIRE( count_leading_zeros_64(0xFFFFFFFFu) == 32 );
+    REQUIRE( count_leading_zeros_64(0x100000000ull) == 31 );
+    REQUIRE( count_leading_zeros_64(0xFFFFFFFFFFFFFFFFull) == 0 );
+    REQUIRE( count_leading_zeros_64(0x0800000000000000ull) == 4 );
+}
+
 TEST_CASE("expand_bits_30", "[math]") {
     REQUIRE( expand_bits_30(   0b1110110001u) == 0b001001001000001001000000000001u );
     REQUIRE( expand_bits_30(0b1011110110001u) == 0b001001001000001001000000000001u );
@@ -67,3 +79,27 @@ TEMPLATE_TEST_CASE("morton_encode_30", "[math]", float, double) {
     REQUIRE( morton_encode_30<T>(1030,0,0) == 0b100100100100100100100100100100u );
     REQUIRE( morton_encode_30<T>(-12,0,0)  == 0 );
 }
+
+TEST_CASE("expand_bits_63", "[math]") {
+    REQUIRE( expand_bits_63(0b1110110001u) == 0b001001001000001001000000000001u );
+    REQUIRE( expand_bits_63(0x1FFFFFu)     == 0x1249249249249249ull );
+    REQUIRE( expand_bits_63(0x3FFFFFu)     == 0x1249249249249249ull );
+}
+
+TEMPLATE_TEST_CASE("morton_encode_63", "[math]", float, double) {
+    typedef TestType T;
+
+    // Use all ones for a single dimension, make sure it gets completely full.
+    REQUIRE( morton_encode_63<T>(2097151,0,0) == 0x4924924924924924ull );
+    REQUIRE( morton_encode_63<T>(0,2097151,0) == 0x2492492492492492ull );
+    REQUIRE( morton_encode_63<T>(0,0,2097151) == 0x1249249249249249ull );
+
+    // Make sure order of bits within a single dimension is correct.
+    REQUIRE( morton_encode_63<T>(0b1011,0,0) == 0b100000100100u );
+    REQUIRE( morton_encode_63<T>(0,0b1011,0) == 0b010000010010u );
+    REQUIRE( morton_encode_63<T>(0,0,0b1011) == 0b001000001001u );
+
+    // Make sure inputs are being clamped to proper range.
+    REQUIRE( morton_encode_63<T>(3000000,0,0) == 0x4924924924924924ull );
+    REQUIRE( morton_encode_63<T>(-12,0,0)     == 0 );
+}
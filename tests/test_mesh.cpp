@@ -0,0 +1,743 @@
+/* Unit tests for mesh loading (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/mapped_file.hpp>
+#include <obvi/util/mesh.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::mapped_file;
+using obvi::mesh;
+using obvi::mesh_format;
+using obvi::vec3f;
+
+namespace {
+    // Write given bytes to a temporary file, which is deleted when this object goes out of scope.
+    struct temp_file {
+        std::string path;
+
+        temp_file(const std::string& name, const std::string& contents) : path("obvi_test_" + name) {
+            std::ofstream out(path, std::ios::binary);
+            out.write(contents.data(), (std::streamsize)contents.size());
+        }
+        ~temp_file() {
+            std::remove(path.c_str());
+        }
+    };
+
+    template<typename T>
+    void put(std::string& out, T val) {
+        char bytes[sizeof(T)];
+        memcpy(bytes, &val, sizeof(T)); // tests assume a little-endian host
+        out.append(bytes, sizeof(T));
+    }
+
+    template<typename T>
+    void put_be(std::string& out, T val) {
+        char bytes[sizeof(T)];
+        memcpy(bytes, &val, sizeof(T));
+        for(size_t i=sizeof(T); i>0; --i) {
+            out.push_back(bytes[i-1]);
+        }
+    }
+
+    void check_pt(const vec3f& pt, float x, float y, float z) {
+        CHECK(pt.x() == Approx(x));
+        CHECK(pt.y() == Approx(y));
+        CHECK(pt.z() == Approx(z));
+    }
+
+    // Two triangles that make up a unit square in the z=0 plane.
+    const float square[4][3] = {{0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}};
+
+    // Grid of n x n quads, stored like an STL file (every triangle has its own three vertices),
+    // with the triangles in random order.
+    mesh make_unwelded_grid(size_t n, unsigned seed) {
+        std::vector<std::array<vec3f,3>> tris;
+        for(size_t y=0; y<n; ++y) {
+            for(size_t x=0; x<n; ++x) {
+                vec3f p00((float)x, (float)y, 0), p10((float)x+1, (float)y, 0);
+                vec3f p01((float)x, (float)y+1, 0), p11((float)x+1, (float)y+1, 0);
+                tris.push_back({{p00, p10, p11}});
+                tris.push_back({{p00, p11, p01}});
+            }
+        }
+        std::mt19937 gen(seed);
+        std::shuffle(tris.begin(), tris.end(), gen);
+
+        mesh m;
+        for(const auto& tri : tris) {
+            for(const vec3f& pt : tri) {
+                m.indices.push_back((uint32_t)m.positions.size());
+                m.positions.push_back(pt);
+            }
+        }
+        return m;
+    }
+
+    // Sorted list of triangle corner positions, to check that two meshes have the same shape.
+    std::vector<std::array<float,9>> triangle_list(const mesh& m) {
+        std::vector<std::array<float,9>> list;
+        for(size_t t=0; t<m.num_triangles(); ++t) {
+            vec3f a, b, c;
+            m.triangle(t, a, b, c);
+            list.push_back({{a[0], a[1], a[2], b[0], b[1], b[2], c[0], c[1], c[2]}});
+        }
+        std::sort(list.begin(), list.end());
+        return list;
+    }
+}
+
+TEST_CASE("mapped_file", "[mesh]") {
+    temp_file   tmp("mapped.bin", "hello world");
+    mapped_file file;
+
+    REQUIRE(file.open(tmp.path));
+    CHECK(file.is_open());
+    REQUIRE(file.size() == 11);
+    CHECK(std::string(file.data(), file.size()) == "hello world");
+
+    mapped_file moved(std::move(file));
+    CHECK(!file.is_open());
+    CHECK(moved.is_open());
+    moved.close();
+    CHECK(!moved.is_open());
+
+    CHECK(!file.open("obvi_test_does_not_exist.bin"));
+}
+
+TEST_CASE("mesh load STL", "[mesh]") {
+    SECTION("binary") {
+        std::string data(80, ' ');
+        data.replace(0, 5, "solid"); // some exporters do this, make sure we still detect binary
+        put<uint32_t>(data, 2);
+        const int tris[2][3] = {{0,1,2}, {0,2,3}};
+        for(const auto& tri : tris) {
+            for(int i=0; i<3; ++i) { put<float>(data, (i==2)? 1.0f : 0.0f); } // normal
+            for(int v : tri) {
+                for(int i=0; i<3; ++i) { put<float>(data, square[v][i]); }
+            }
+            put<uint16_t>(data, 0);
+        }
+        temp_file tmp("binary.STL", data);
+
+        mesh        m;
+        std::string err;
+        REQUIRE(obvi::load_mesh(tmp.path, m, &err));
+        CHECK(err.empty());
+        REQUIRE(m.num_vertices() == 6);
+        REQUIRE(m.num_triangles() == 2);
+        CHECK(!m.has_colors());
+        check_pt(m.positions[4], 1, 1, 0);
+        CHECK(m.indices[5] == 5);
+
+        vec3f a, b, c;
+        m.triangle(1, a, b, c);
+        check_pt(a, 0, 0, 0);
+        check_pt(b, 1, 1, 0);
+        check_pt(c, 0, 1, 0);
+
+        // Truncated file must fail.
+        temp_file trunc("trunc.stl", data.substr(0, data.size() - 10));
+        CHECK(!obvi::load_mesh(trunc.path, m, &err));
+        CHECK(!err.empty());
+        CHECK(m.num_vertices() == 0);
+    }
+
+    SECTION("ascii") {
+        const char *data =
+            "solid square\r\n"
+            "  facet normal 0 0 1\r\n"
+            "    outer loop\r\n"
+            "      vertex 0 0 0\r\n"
+            "      vertex 1.0 0 0\r\n"
+            "      vertex 1e0 1E0 0\r\n"
+            "    endloop\r\n"
+            "  endfacet\r\n"
+            "  facet normal 0 0 1\n"
+            "    outer loop\n"
+            "      vertex 0 0 0\n"
+            "      vertex 1 1 0\n"
+            "      vertex -0.5 +100.25e-2 -1.5e+1\n"
+            "    endloop\n"
+            "  endfacet\n"
+            "endsolid square\n";
+        mesh m;
+        REQUIRE(obvi::parse_mesh(data, strlen(data), mesh_format::STL, m));
+        REQUIRE(m.num_triangles() == 2);
+        check_pt(m.positions[2], 1, 1, 0);
+        check_pt(m.positions[5], -0.5f, 1.0025f, -15.0f);
+    }
+}
+
+TEST_CASE("mesh load PLY", "[mesh]") {
+    SECTION("ascii with colors and quad") {
+        const char *data =
+            "ply\n"
+            "format ascii 1.0\n"
+            "comment made by hand\n"
+            "element vertex 4\n"
+            "property float x\n"
+            "property float y\n"
+            "property float z\n"
+            "property uchar red\n"
+            "property uchar green\n"
+            "property uchar blue\n"
+            "element face 1\n"
+            "property list uchar int vertex_indices\n"
+            "end_header\n"
+            "0 0 0 255 0 0\n"
+            "1 0 0 0 255 0\n"
+            "1 1 0 0 0 255\n"
+            "0 1 0 10 20 30\n"
+            "4 0 1 2 3\n";
+        mesh m;
+        REQUIRE(obvi::parse_mesh(data, strlen(data), mesh_format::PLY, m));
+        REQUIRE(m.num_vertices() == 4);
+        REQUIRE(m.num_triangles() == 2);
+        REQUIRE(m.has_colors());
+        CHECK(m.colors[0] == 0xFF0000FFu);
+        CHECK(m.colors[2] == 0xFFFF0000u);
+        CHECK(m.colors[3] == 0xFF1E140Au);
+        const uint32_t expect[6] = {0,1,2, 0,2,3};
+        for(size_t i=0; i<6; ++i) {
+            CHECK(m.indices[i] == expect[i]);
+        }
+        check_pt(m.bounds().max_pt, 1, 1, 0);
+    }
+
+    SECTION("binary little endian, triangles only") {
+        std::string data =
+            "ply\n"
+            "format binary_little_endian 1.0\n"
+            "element vertex 4\n"
+            "property float x\n"
+            "property float y\n"
+            "property float z\n"
+            "element face 2\n"
+            "property list uchar uint vertex_indices\n"
+            "end_header\n";
+        for(const auto& pt : square) {
+            for(float f : pt) { put<float>(data, f); }
+        }
+        const uint32_t tris[2][3] = {{0,1,2}, {0,2,3}};
+        for(const auto& tri : tris) {
+            put<uint8_t>(data, 3);
+            for(uint32_t v : tri) { put<uint32_t>(data, v); }
+        }
+        temp_file tmp("binary_le.ply", data);
+
+        mesh m;
+        REQUIRE(obvi::load_mesh(tmp.path, m));
+        REQUIRE(m.num_triangles() == 2);
+        CHECK(m.indices[4] == 2);
+        check_pt(m.positions[3], 0, 1, 0);
+    }
+
+    SECTION("binary big endian, mixed polygons and extra properties") {
+        std::string data =
+            "ply\n"
+            "format binary_big_endian 1.0\n"
+            "element vertex 5\n"
+            "property double x\n"
+            "property double y\n"
+            "property double z\n"
+            "property float nx\n"
+            "element face 2\n"
+            "property list uchar int vertex_indices\n"
+            "property uchar flags\n"
+            "element edge 1\n"
+            "property int vertex1\n"
+            "property int vertex2\n"
+            "end_header\n";
+        for(const auto& pt : square) {
+            for(float f : pt) { put_be<double>(data, f); }
+            put_be<float>(data, 0.0f);
+        }
+        for(int i=0; i<3; ++i) { put_be<double>(data, 2.0); }
+        put_be<float>(data, 0.0f);
+
+        put<uint8_t>(data, 4);
+        for(int v : {0,1,2,3}) { put_be<int32_t>(data, v); }
+        put<uint8_t>(data, 7);
+        put<uint8_t>(data, 3);
+        for(int v : {1,4,2}) { put_be<int32_t>(data, v); }
+        put<uint8_t>(data, 7);
+        put_be<int32_t>(data, 0);
+        put_be<int32_t>(data, 1);
+
+        mesh m;
+        std::string err;
+        REQUIRE(obvi::parse_mesh(data.data(), data.size(), mesh_format::PLY, m, &err));
+        REQUIRE(m.num_vertices() == 5);
+        REQUIRE(m.num_triangles() == 3);
+        check_pt(m.positions[4], 2, 2, 2);
+        CHECK(m.indices[6] == 1);
+        CHECK(m.indices[7] == 4);
+        CHECK(m.indices[8] == 2);
+    }
+
+    SECTION("bad index") {
+        const char *data =
+            "ply\nformat ascii 1.0\nelement vertex 1\nproperty float x\nproperty float y\n"
+            "property float z\nelement face 1\nproperty list uchar int vertex_indices\nend_header\n"
+            "0 0 0\n3 0 0 5\n";
+        mesh        m;
+        std::string err;
+        CHECK(!obvi::parse_mesh(data, strlen(data), mesh_format::PLY, m, &err));
+        CHECK(!err.empty());
+    }
+
+    SECTION("ascii indices are integers") {
+        // Indices must not go through float, which rounds anything past 2^24. A fractional index
+        // used to be truncated to a valid vertex, now it's an error.
+        const std::string header =
+            "ply\nformat ascii 1.0\nelement vertex 1\nproperty float x\nproperty float y\n"
+            "property float z\nelement face 1\nproperty list uchar int vertex_indices\nend_header\n"
+            "0 0 0\n";
+        mesh        m;
+        std::string err;
+        const std::string ok = header + "3 0 0 0\n";
+        CHECK(obvi::parse_mesh(ok.data(), ok.size(), mesh_format::PLY, m, &err));
+
+        // Negative, fractional and out of range indices, and negative list sizes.
+        for(const char *face : {"3 0 -1 0\n", "3 0 0.5 0\n", "3 0 99999999999999999999999 0\n",
+                                "-3 0 0 0\n"}) {
+            const std::string bad = header + face;
+            CHECK(!obvi::parse_mesh(bad.data(), bad.size(), mesh_format::PLY, m, &err));
+        }
+    }
+
+    SECTION("binary negative indices and list sizes") {
+        std::string data =
+            "ply\n"
+            "format binary_little_endian 1.0\n"
+            "element vertex 4\n"
+            "property float x\n"
+            "property float y\n"
+            "property float z\n"
+            "element face 1\n"
+            "property list char int vertex_indices\n"
+            "end_header\n";
+        for(const auto& pt : square) {
+            for(float f : pt) { put<float>(data, f); }
+        }
+        mesh        m;
+        std::string err;
+
+        std::string tri = data;
+        put<int8_t>(tri, 3);
+        for(int32_t v : {0, -1, 2}) { put<int32_t>(tri, v); }
+        CHECK(!obvi::parse_mesh(tri.data(), tri.size(), mesh_format::PLY, m, &err));
+
+        std::string quad = data;
+        put<int8_t>(quad, 4);
+        for(int32_t v : {0, 1, 2, -3}) { put<int32_t>(quad, v); }
+        CHECK(!obvi::parse_mesh(quad.data(), quad.size(), mesh_format::PLY, m, &err));
+
+        std::string neg_count = data;
+        put<int8_t>(neg_count, -1);
+        CHECK(!obvi::parse_mesh(neg_count.data(), neg_count.size(), mesh_format::PLY, m, &err));
+    }
+
+    SECTION("vertex count larger than the file") {
+        // Must fail cleanly instead of allocating the declared count first.
+        for(const char *format : {"ascii", "binary_little_endian"}) {
+            std::string data = std::string("ply\nformat ") + format + " 1.0\n"
+                "element vertex 4000000000\nproperty float x\nproperty float y\n"
+                "property float z\nend_header\n0 0 0\n";
+            mesh        m;
+            std::string err;
+            CHECK(!obvi::parse_mesh(data.data(), data.size(), mesh_format::PLY, m, &err));
+            CHECK(err == "PLY file is truncated");
+            CHECK(m.positions.capacity() < 1000);
+        }
+
+        const char *huge =
+            "ply\nformat ascii 1.0\nelement vertex 99999999999999999999999\nend_header\n";
+        mesh m;
+        CHECK(!obvi::parse_mesh(huge, strlen(huge), mesh_format::PLY, m));
+    }
+}
+
+TEST_CASE("mesh load OBJ", "[mesh]") {
+    SECTION("small") {
+        const char *data =
+            "# comment\r\n"
+            "o square\r\n"
+            "v 0 0 0\r\n"
+            "v 1 0 0\r\n"
+            "vt 0.5 0.5\r\n"
+            "vn 0 0 1\r\n"
+            "v 1 1 0\r\n"
+            "v 0 1 0 # trailing comment\r\n"
+            "f 1/1/1 2/1/1 3/1/1 4/1/1\r\n"
+            "v 2 2 2\r\n"
+            "\tf -5//1 -4//1 -1//1\r\n"
+            "f 2 3";
+        mesh m;
+        REQUIRE(obvi::parse_mesh(data, strlen(data), mesh_format::OBJ, m));
+        REQUIRE(m.num_vertices() == 5);
+        REQUIRE(m.num_triangles() == 3);
+        const uint32_t expect[9] = {0,1,2, 0,2,3, 0,1,4};
+        for(size_t i=0; i<9; ++i) {
+            CHECK(m.indices[i] == expect[i]);
+        }
+        check_pt(m.positions[4], 2, 2, 2);
+    }
+
+    SECTION("large (parsed in several chunks)") {
+        // A long strip of quads along x, big enough to be split into several chunks.
+        const size_t       n = 100000;
+        std::ostringstream ss;
+        for(size_t i=0; i<=n; ++i) {
+            ss << "v " << i << " 0 0\n";
+            ss << "v " << i << " 1 0\n";
+            if(i > 0) {
+                ss << "f -4 -2 -1 -3\n"; // relative indices, so each chunk needs the global offset
+            }
+        }
+        temp_file tmp("large.obj", ss.str());
+
+        mesh m;
+        REQUIRE(obvi::load_mesh(tmp.path, m));
+        REQUIRE(m.num_vertices() == 2 * (n + 1));
+        REQUIRE(m.num_triangles() == 2 * n);
+        bool ok = true;
+        for(size_t i=0; i<n && ok; ++i) {
+            const uint32_t *tri = m.indices.data() + 6 * i;
+            uint32_t base = (uint32_t)(2 * i);
+            ok = tri[0] == base && tri[1] == base + 2 && tri[2] == base + 3
+              && tri[3] == base && tri[4] == base + 3 && tri[5] == base + 1;
+        }
+        CHECK(ok);
+
+        bboxf box = m.bounds();
+        check_pt(box.min_pt, 0, 0, 0);
+        check_pt(box.max_pt, (float)n, 1, 0);
+
+        std::vector<bboxf> boxes;
+        m.triangle_boxes(boxes);
+        REQUIRE(boxes.size() == m.num_triangles());
+        check_pt(boxes[3].min_pt, 1, 0, 0);
+        check_pt(boxes[3].max_pt, 2, 1, 0);
+    }
+
+    SECTION("bad face") {
+        const char *data = "v 0 0 0\nf 1 2 3\n";
+        mesh m;
+        CHECK(!obvi::parse_mesh(data, strlen(data), mesh_format::OBJ, m));
+        CHECK(m.num_vertices() == 0);
+    }
+}
+
+TEST_CASE("mesh load errors", "[mesh]") {
+    mesh        m;
+    std::string err;
+    CHECK(!obvi::load_mesh("obvi_test_missing.obj", m, &err));
+    CHECK(!err.empty());
+    CHECK(!obvi::load_mesh("obvi_test_missing.xyz", m, &err));
+    CHECK(!obvi::parse_mesh("abc", 3, mesh_format::STL, m, &err));
+}
+
+TEST_CASE("mesh weld vertices", "[mesh]") {
+    mesh m = make_unwelded_grid(20, 1);
+    auto before = triangle_list(m);
+
+    // Add a triangle that becomes degenerate after welding (-0 and +0 count as the same value).
+    m.indices.insert(m.indices.end(), {(uint32_t)m.positions.size(), (uint32_t)m.positions.size() + 1, 0});
+    m.positions.push_back(vec3f(-0.0f, 0.0f, 0.0f));
+    m.positions.push_back(m.positions[0]);
+
+    obvi::weld_vertices(m);
+    CHECK(m.num_vertices() == 21 * 21);
+    CHECK(triangle_list(m) == before);
+
+    SECTION("vertices with different colors aren't merged") {
+        mesh c;
+        c.positions = {vec3f(0,0,0), vec3f(1,0,0), vec3f(0,1,0), vec3f(0,0,0)};
+        c.colors    = {1, 2, 3, 4};
+        c.indices   = {0, 1, 2, 3, 1, 2};
+        obvi::weld_vertices(c);
+        CHECK(c.num_vertices() == 4);
+        CHECK(c.num_triangles() == 2);
+    }
+}
+
+TEST_CASE("mesh optimize", "[mesh]") {
+    mesh m = make_unwelded_grid(64, 2);
+    auto before = triangle_list(m);
+
+    obvi::weld_vertices(m);
+    float acmr_before = obvi::vertex_cache_miss_ratio(m);
+
+    obvi::optimize_vertex_cache(m);
+    float acmr_after = obvi::vertex_cache_miss_ratio(m);
+    CHECK(triangle_list(m) == before);
+    CHECK(acmr_before > 1.5f); // random order is almost as bad as it gets
+    CHECK(acmr_after < 0.8f);
+
+    obvi::optimize_vertex_fetch(m);
+    CHECK(triangle_list(m) == before);
+    CHECK(obvi::vertex_cache_miss_ratio(m) == acmr_after); // only vertex order changed
+
+    // Vertices must be numbered in the order they're first used.
+    uint32_t next = 0;
+    bool     ok   = true;
+    for(uint32_t idx : m.indices) {
+        if(idx == next) {
+            next++;
+        }
+        ok = ok && idx < next;
+    }
+    CHECK(ok);
+    CHECK(next == m.num_vertices());
+
+    // Whole pipeline at once.
+    mesh m2 = make_unwelded_grid(64, 2);
+    obvi::optimize_mesh(m2);
+    CHECK(m2.num_vertices() == 65 * 65);
+    CHECK(m2.indices == m.indices);
+}
+
+TEST_CASE("mesh quantize positions", "[mesh]") {
+    mesh m = make_unwelded_grid(10, 3);
+    for(vec3f& pt : m.positions) {
+        pt = vec3f(pt[0] * 0.37f - 2.0f, pt[1] * 0.11f + 5.0f, pt[0] * pt[1] * 0.01f);
+    }
+
+    obvi::quantized_positions q;
+    obvi::quantize_positions(m, q);
+    REQUIRE(q.values.size() == m.num_vertices() * obvi::quantized_positions::stride);
+
+    // Longest side of box is 3.7 (x axis).
+    const float max_err = 3.7f / 131070.0f * 1.01f;
+    bool ok = true;
+    for(size_t i=0; i<m.num_vertices(); ++i) {
+        const uint16_t *val = q.values.data() + i * obvi::quantized_positions::stride;
+        vec3f norm((float)val[0] / 65535.0f, (float)val[1] / 65535.0f, (float)val[2] / 65535.0f);
+        vec3f pt = q.dequantize * norm;
+        ok = ok && (pt - m.positions[i]).abs().max_component() <= max_err;
+    }
+    CHECK(ok);
+    CHECK(q.dequantize.scale() == Approx(3.7f));
+
+    // Degenerate (single point) mesh mustn't divide by zero.
+    mesh pt;
+    pt.positions = {vec3f(1,2,3), vec3f(1,2,3)};
+    obvi::quantize_positions(pt, q);
+    CHECK(q.values[0] == 0);
+    check_pt(q.dequantize * vec3f(0,0,0), 1, 2, 3);
+}
+
+TEST_CASE("mesh partition", "[mesh]") {
+    mesh m = make_unwelded_grid(100, 4);
+    obvi::weld_vertices(m);
+    auto before = triangle_list(m);
+
+    std::vector<obvi::mesh_chunk> chunks;
+    obvi::partition_mesh(m, chunks, 1000);
+    CHECK(triangle_list(m) == before);
+    REQUIRE(chunks.size() >= 20);
+    CHECK(chunks.size() <= 40);
+
+    // Chunks must cover all the triangles in order, and have correct bounds.
+    uint32_t next = 0;
+    float    area = 0.0f;
+    for(const obvi::mesh_chunk& chunk : chunks) {
+        CHECK(chunk.first_index == next);
+        CHECK(chunk.num_indices > 0);
+        CHECK(chunk.num_indices <= 3000);
+        next += chunk.num_indices;
+
+        bboxf box;
+        for(uint32_t i=chunk.first_index; i<chunk.first_index + chunk.num_indices; ++i) {
+            box.expand(m.positions[m.indices[i]]);
+        }
+        check_pt(chunk.bounds.min_pt, box.min_pt[0], box.min_pt[1], box.min_pt[2]);
+        check_pt(chunk.bounds.max_pt, box.max_pt[0], box.max_pt[1], box.max_pt[2]);
+        vec3f ext = box.max_pt - box.min_pt;
+        area += ext[0] * ext[1];
+    }
+    CHECK(next == m.indices.size());
+    CHECK(area < 2.0f * 100.0f * 100.0f); // chunks are spatially compact, so they barely overlap
+
+    // Cache order inside chunks should be nearly as good as optimizing the whole mesh.
+    CHECK(obvi::vertex_cache_miss_ratio(m) < 0.9f);
+    obvi::optimize_vertex_fetch(m);
+    CHECK(triangle_list(m) == before);
+
+    // Empty mesh.
+    mesh empty;
+    obvi::partition_mesh(empty, chunks);
+    CHECK(chunks.empty());
+}
+
+TEST_CASE("mesh ray intersect", "[mesh]") {
+    const vec3f a(0,0,0), b(1,0,0), c(0,1,0);
+    float t = -1.0f;
+
+    // Hits from either side, with unnormalized directions measured in multiples of the direction.
+    CHECK(obvi::intersect_ray_triangle(vec3f(0.25f, 0.25f, 2), vec3f(0,0,-1), a, b, c, 10, &t));
+    CHECK(t == Approx(2.0f));
+    CHECK(obvi::intersect_ray_triangle(vec3f(0.25f, 0.25f, -2), vec3f(0,0,4), a, b, c, 10, &t));
+    CHECK(t == Approx(0.5f));
+
+    // Misses: outside the edges, behind the origin, past max_t, parallel, degenerate.
+    CHECK_FALSE(obvi::intersect_ray_triangle(vec3f(0.75f, 0.75f, 2), vec3f(0,0,-1), a, b, c, 10,
+                                             &t));
+    CHECK_FALSE(obvi::intersect_ray_triangle(vec3f(-0.1f, 0.5f, 2), vec3f(0,0,-1), a, b, c, 10,
+                                             &t));
+    CHECK_FALSE(obvi::intersect_ray_triangle(vec3f(0.25f, 0.25f, 2), vec3f(0,0,1), a, b, c, 10,
+                                             &t));
+    CHECK_FALSE(obvi::intersect_ray_triangle(vec3f(0.25f, 0.25f, 2), vec3f(0,0,-1), a, b, c, 1.5f,
+                                             &t));
+    CHECK_FALSE(obvi::intersect_ray_triangle(vec3f(-1, 0.25f, 0), vec3f(1,0,0), a, b, c, 10, &t));
+    CHECK_FALSE(obvi::intersect_ray_triangle(vec3f(0.5f, 0, 2), vec3f(0,0,-1), a, b, b, 10, &t));
+
+    // Closest of a range of triangles, compared with testing each one.
+    mesh m = make_unwelded_grid(8, 5);
+    for(size_t i=0; i<m.positions.size(); ++i) {
+        m.positions[i][2] = 0.1f * float(i / 3 % 7); // stack the triangles at different depths
+    }
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> pos(0.0f, 8.0f);
+    size_t num_hits = 0;
+    for(int i=0; i<200; ++i) {
+        vec3f  origin(pos(gen), pos(gen), 5.0f);
+        vec3f  dir = (vec3f(pos(gen), pos(gen), 0.0f) - origin).normalized();
+        size_t first = (size_t)i % 20;
+        size_t count = m.num_triangles() - first - (size_t)i % 7;
+
+        float  best_t   = 100.0f;
+        size_t best_tri = SIZE_MAX;
+        for(size_t tri=first; tri<first + count; ++tri) {
+            vec3f p0, p1, p2;
+            m.triangle(tri, p0, p1, p2);
+            float hit_t;
+            if(obvi::intersect_ray_triangle(origin, dir, p0, p1, p2, best_t, &hit_t)) {
+                best_t   = hit_t;
+                best_tri = tri;
+            }
+        }
+
+        size_t tri = SIZE_MAX;
+        bool   hit = m.intersect_ray(origin, dir, first, count, 100.0f, &tri, &t);
+        REQUIRE(hit == (best_tri != SIZE_MAX));
+        if(hit) {
+            CHECK(t == best_t);
+            num_hits++;
+        }
+    }
+    CHECK(num_hits > 100);
+    CHECK_FALSE(m.intersect_ray(vec3f(4,4,5), vec3f(0,0,1), 0, m.num_triangles(), 100, nullptr,
+                                nullptr));
+}
+
+TEST_CASE("mesh simplify", "[mesh]") {
+    std::vector<obvi::mesh_chunk> chunks;
+    std::vector<uint32_t>         lod_indices;
+
+    // Sum of triangle areas, of a list of triangles.
+    auto area = [](const mesh& m, const uint32_t* idx, size_t count) {
+        float sum = 0.0f;
+        for(size_t i=0; i<count; i+=3) {
+            vec3f a = m.positions[idx[i]], b = m.positions[idx[i+1]], c = m.positions[idx[i+2]];
+            sum += 0.5f * std::sqrt((b - a).cross(c - a).normsqd());
+        }
+        return sum;
+    };
+
+    SECTION( "flat" ) {
+        // Flat grid can be simplified with no error, and with the border locked, it must still
+        // cover exactly the same area.
+        mesh m = make_unwelded_grid(64, 5);
+        obvi::weld_vertices(m);
+        obvi::partition_mesh(m, chunks, 2048);
+        obvi::optimize_vertex_fetch(m);
+        obvi::simplify_chunks(m, chunks, lod_indices);
+
+        for(const obvi::mesh_chunk& chunk : chunks) {
+            REQUIRE(chunk.num_lods >= 2);
+            float    full     = area(m, m.indices.data() + chunk.first_index, chunk.num_indices);
+            uint32_t prev_num = chunk.num_indices;
+            for(uint32_t i=0; i<chunk.num_lods; ++i) {
+                const obvi::mesh_lod& lod = chunk.lods[i];
+                REQUIRE(size_t(lod.first_index) + lod.num_indices <= lod_indices.size());
+                CHECK(lod.num_indices % 3 == 0);
+                CHECK(lod.num_indices * 4 <= prev_num * 3);
+                CHECK(lod.error == Approx(0.0f).margin(1e-4f));
+                CHECK(area(m, lod_indices.data() + lod.first_index, lod.num_indices)
+                      == Approx(full).epsilon(1e-4f));
+                prev_num = lod.num_indices;
+            }
+        }
+        for(uint32_t idx : lod_indices) {
+            REQUIRE(idx < m.num_vertices());
+        }
+    }
+
+    SECTION( "curved" ) {
+        // Bumpy surface: error must grow with every level, and stay small next to the bumps.
+        mesh m = make_unwelded_grid(64, 6);
+        for(vec3f& pt : m.positions) {
+            pt[2] = std::sin(pt[0] * 0.2f) * std::cos(pt[1] * 0.2f);
+        }
+        obvi::weld_vertices(m);
+        obvi::partition_mesh(m, chunks, 8192);
+        obvi::simplify_chunks(m, chunks, lod_indices, 3);
+
+        REQUIRE(chunks.size() == 1);
+        const obvi::mesh_chunk& chunk = chunks[0];
+        REQUIRE(chunk.num_lods == 3);
+        float prev_error = 0.0f;
+        for(uint32_t i=0; i<chunk.num_lods; ++i) {
+            CHECK(chunk.lods[i].error > prev_error);
+            prev_error = chunk.lods[i].error;
+        }
+        CHECK(chunk.lods[2].error < 0.5f);
+        CHECK(chunk.lods[2].num_indices * 6 <= chunk.num_indices);
+    }
+
+    SECTION( "empty" ) {
+        mesh m;
+        obvi::partition_mesh(m, chunks);
+        obvi::simplify_chunks(m, chunks, lod_indices);
+        CHECK(lod_indices.empty());
+    }
+}
@@ -0,0 +1,256 @@
+/* Unit tests for mesh cache files (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <catch2/catch.hpp>
+#include <obvi/util/hash.hpp>
+#include <obvi/util/mesh_cache.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::mesh;
+using obvi::prepared_mesh;
+using obvi::vec3f;
+
+namespace {
+    // Cache file path that's deleted when this object goes out of scope.
+    struct temp_path {
+        std::string path;
+
+        explicit temp_path(const std::string& name) : path("obvi_test_" + name) {}
+        ~temp_path() {
+            std::remove(path.c_str());
+        }
+    };
+
+    // Welded, chunked and simplified n x n grid of quads, with a bumpy surface so every level of
+    // detail has some error.
+    prepared_mesh make_prepared_grid(size_t n) {
+        prepared_mesh pm;
+        for(size_t y=0; y<=n; ++y) {
+            for(size_t x=0; x<=n; ++x) {
+                float z = float((x * 7 + y * 3) % 5) * 0.1f;
+                pm.geom.positions.push_back(vec3f((float)x, (float)y, z));
+                pm.geom.colors.push_back(uint32_t(x * 0x010203u + y) | 0xFF000000u);
+            }
+        }
+        for(uint32_t y=0; y<n; ++y) {
+            for(uint32_t x=0; x<n; ++x) {
+                uint32_t i00 = y * uint32_t(n + 1) + x, i10 = i00 + 1;
+                uint32_t i01 = i00 + uint32_t(n + 1),   i11 = i01 + 1;
+                pm.geom.indices.insert(pm.geom.indices.end(), {i00, i10, i11, i00, i11, i01});
+            }
+        }
+        obvi::partition_mesh(pm.geom, pm.chunks, 256);
+        obvi::optimize_vertex_fetch(pm.geom);
+        obvi::simplify_chunks(pm.geom, pm.chunks, pm.lod_indices);
+        pm.generate_chunk_bvh();
+        return pm;
+    }
+
+    std::string read_file(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<size_t> run_query(const bvh& tree, const bboxf& box) {
+        std::vector<size_t> res;
+        auto query = tree.make_query(bvh::intersect_box(box));
+        size_t idx;
+        while(query.next(&idx)) {
+            res.push_back(idx);
+        }
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    void write_file(const std::string& path, const std::string& contents) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), (std::streamsize)contents.size());
+    }
+}
+
+TEST_CASE("mesh cache name", "[mesh_cache]") {
+    CHECK(obvi::mesh_cache_name(0x0123456789ABCDEFull) == "0123456789abcdef.obvicache");
+    CHECK(obvi::mesh_cache_name(1) == "0000000000000001.obvicache");
+}
+
+TEST_CASE("mesh cache hash file", "[mesh_cache]") {
+    temp_path tmp("hash_file.bin");
+    write_file(tmp.path, "abc");
+    uint64_t h = 0;
+    REQUIRE(obvi::hash_file(tmp.path, &h));
+    CHECK(h == obvi::hash64("abc", 3));
+
+    std::string err;
+    CHECK_FALSE(obvi::hash_file("obvi_test_no_such_file.bin", &h, &err));
+    CHECK_FALSE(err.empty());
+}
+
+TEST_CASE("mesh cache round trip", "[mesh_cache]") {
+    const prepared_mesh pm   = make_prepared_grid(48);
+    const uint64_t      hash = 0x1234;
+    REQUIRE(pm.chunks.size() > 4);
+    REQUIRE_FALSE(pm.lod_indices.empty());
+
+    temp_path tmp("round_trip.obvicache");
+    std::string err;
+    REQUIRE(obvi::save_mesh_cache(tmp.path, hash, pm, &err));
+
+    prepared_mesh loaded;
+    REQUIRE(obvi::load_mesh_cache(tmp.path, hash, loaded, &err));
+    CHECK(loaded.cache_file.is_open());
+
+    REQUIRE(loaded.geom.positions.size() == pm.geom.positions.size());
+    for(size_t i=0; i<pm.geom.positions.size(); ++i) {
+        CHECK((loaded.geom.positions[i] - pm.geom.positions[i]).normsqd() == 0.0f);
+    }
+    CHECK(loaded.geom.colors == pm.geom.colors);
+    CHECK(loaded.geom.indices == pm.geom.indices);
+    CHECK(loaded.lod_indices == pm.lod_indices);
+    REQUIRE(loaded.chunks.size() == pm.chunks.size());
+    CHECK(memcmp(loaded.chunks.data(), pm.chunks.data(),
+                 pm.chunks.size() * sizeof(obvi::mesh_chunk)) == 0);
+
+    // Nodes are used in place, straight from the mapped file.
+    bvh::node_list nodes = loaded.chunk_bvh.nodes();
+    const char    *ptr   = reinterpret_cast<const char*>(nodes.data());
+    CHECK(ptr >= loaded.cache_file.data());
+    CHECK(ptr + nodes.size() * sizeof(bvh::node)
+          <= loaded.cache_file.data() + loaded.cache_file.size());
+    CHECK(loaded.chunk_bvh.size() == pm.chunks.size());
+    REQUIRE(nodes.size() == pm.chunk_bvh.nodes().size());
+    CHECK(memcmp(nodes.data(), pm.chunk_bvh.nodes().data(), nodes.size() * sizeof(bvh::node)) == 0);
+
+    // Queries on the borrowed tree find the same chunks, even after moving the prepared mesh.
+    prepared_mesh moved = std::move(loaded);
+    bboxf box(vec3f(10,10,-1));
+    box.expand(vec3f(20,20,1));
+    CHECK(run_query(moved.chunk_bvh, box) == run_query(pm.chunk_bvh, box));
+    CHECK_FALSE(run_query(pm.chunk_bvh, box).empty());
+}
+
+TEST_CASE("mesh cache rejects bad files", "[mesh_cache]") {
+    const prepared_mesh pm = make_prepared_grid(16);
+    temp_path tmp("bad.obvicache");
+    REQUIRE(obvi::save_mesh_cache(tmp.path, 7, pm));
+    const std::string good = read_file(tmp.path);
+
+    prepared_mesh loaded;
+    std::string   err;
+
+    SECTION("missing") {
+        CHECK_FALSE(obvi::load_mesh_cache("obvi_test_no_such_file.obvicache", 7, loaded, &err));
+    }
+    SECTION("different source hash") {
+        CHECK_FALSE(obvi::load_mesh_cache(tmp.path, 8, loaded, &err));
+    }
+    SECTION("truncated") {
+        write_file(tmp.path, good.substr(0, good.size() - 100));
+        CHECK_FALSE(obvi::load_mesh_cache(tmp.path, 7, loaded, &err));
+        write_file(tmp.path, good.substr(0, 20));
+        CHECK_FALSE(obvi::load_mesh_cache(tmp.path, 7, loaded, &err));
+    }
+    SECTION("bad magic") {
+        std::string bad = good;
+        bad[0] = 'X';
+        write_file(tmp.path, bad);
+        CHECK_FALSE(obvi::load_mesh_cache(tmp.path, 7, loaded, &err));
+    }
+    SECTION("index out of range") {
+        // Indices section follows positions and colors (header is 168 bytes, padded to 192).
+        std::string bad = good;
+        uint64_t offset;
+        memcpy(&offset, bad.data() + 24 + 2 * 24, sizeof(offset));
+        uint32_t idx = uint32_t(pm.geom.num_vertices());
+        memcpy(&bad[size_t(offset)], &idx, sizeof(idx));
+        write_file(tmp.path, bad);
+        CHECK_FALSE(obvi::load_mesh_cache(tmp.path, 7, loaded, &err));
+    }
+    SECTION("corrupt bvh") {
+        // Point the root's subtree size past the end of the node array.
+        std::string bad = good;
+        uint64_t offset;
+        memcpy(&offset, bad.data() + 24 + 5 * 24, sizeof(offset));
+        uint32_t num;
+        memcpy(&num, &bad[size_t(offset) + sizeof(bboxf)], sizeof(num));
+        num += 2;
+        memcpy(&bad[size_t(offset) + sizeof(bboxf)], &num, sizeof(num));
+        write_file(tmp.path, bad);
+        CHECK_FALSE(obvi::load_mesh_cache(tmp.path, 7, loaded, &err));
+    }
+
+    CHECK_FALSE(err.empty());
+    CHECK(loaded.geom.positions.empty());
+    CHECK(loaded.chunks.empty());
+    CHECK(loaded.chunk_bvh.nodes().empty());
+    CHECK_FALSE(loaded.cache_file.is_open());
+}
+
+TEST_CASE("bvh borrow", "[mesh_cache]") {
+    const prepared_mesh pm    = make_prepared_grid(32);
+    bvh::node_list      nodes = pm.chunk_bvh.nodes();
+    std::vector<bvh::node> copy(nodes.begin(), nodes.end());
+
+    bvh b;
+    REQUIRE(b.borrow(copy.data(), copy.size(), pm.chunks.size()));
+    CHECK(b.nodes().data() == copy.data());
+    CHECK(b.size() == pm.chunks.size());
+
+    // Wrong sizes, or an object index past the end, are rejected.
+    CHECK_FALSE(b.borrow(copy.data(), copy.size(), pm.chunks.size() + 1));
+    CHECK(b.nodes().empty());
+    CHECK_FALSE(b.borrow(copy.data(), copy.size() - 1, pm.chunks.size()));
+    CHECK_FALSE(b.borrow(nullptr, copy.size(), pm.chunks.size()));
+    CHECK(b.borrow(nullptr, 0, 0));
+
+    std::vector<bvh::node> bad = copy;
+    bad.back().num = 0x80000000u | uint32_t(pm.chunks.size());
+    CHECK_FALSE(b.borrow(bad.data(), bad.size(), pm.chunks.size()));
+    bad = copy;
+    bad[1].num = uint32_t(copy.size());
+    CHECK_FALSE(b.borrow(bad.data(), bad.size(), pm.chunks.size()));
+
+    // Refit copies the nodes first, the borrowed array is never written.
+    REQUIRE(b.borrow(copy.data(), copy.size(), pm.chunks.size()));
+    std::vector<bboxf> boxes;
+    for(const obvi::mesh_chunk& chunk : pm.chunks) {
+        bboxf box(chunk.bounds.min_pt - vec3f(1,1,1));
+        box.expand(chunk.bounds.max_pt + vec3f(1,1,1));
+        boxes.push_back(box);
+    }
+    REQUIRE(b.refit(boxes));
+    CHECK(b.nodes().data() != copy.data());
+    CHECK(memcmp(copy.data(), nodes.data(), copy.size() * sizeof(bvh::node)) == 0);
+    CHECK(b.bounds().min_pt.x() == Approx(pm.chunk_bvh.bounds().min_pt.x() - 1.0f));
+}
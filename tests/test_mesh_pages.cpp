@@ -0,0 +1,189 @@
+/* Unit tests for splitting meshes into pages (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <catch2/catch.hpp>
+#include <obvi/util/mesh_pages.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using obvi::bboxf;
+using obvi::mesh;
+using obvi::mesh_cache_info;
+using obvi::mesh_chunk;
+using obvi::prepared_mesh;
+using obvi::vec3f;
+
+namespace {
+    // Chunked and simplified n x n grid of quads, with a colored, bumpy surface.
+    prepared_mesh make_prepared_grid(size_t n) {
+        prepared_mesh pm;
+        for(size_t y=0; y<=n; ++y) {
+            for(size_t x=0; x<=n; ++x) {
+                float z = float((x * 7 + y * 3) % 5) * 0.1f;
+                pm.geom.positions.push_back(vec3f((float)x, (float)y, z));
+                pm.geom.colors.push_back(uint32_t(x * 0x010203u + y) | 0xFF000000u);
+            }
+        }
+        for(uint32_t y=0; y<n; ++y) {
+            for(uint32_t x=0; x<n; ++x) {
+                uint32_t i00 = y * uint32_t(n + 1) + x, i10 = i00 + 1;
+                uint32_t i01 = i00 + uint32_t(n + 1),   i11 = i01 + 1;
+                pm.geom.indices.insert(pm.geom.indices.end(), {i00, i10, i11, i00, i11, i01});
+            }
+        }
+        obvi::partition_mesh(pm.geom, pm.chunks, 128);
+        obvi::optimize_vertex_fetch(pm.geom);
+        obvi::simplify_chunks(pm.geom, pm.chunks, pm.lod_indices);
+        pm.generate_chunk_bvh();
+        return pm;
+    }
+
+    // Sorted corner positions and colors of a range of triangles.
+    using corner_list = std::vector<std::array<float,4>>;
+    void add_corners(const mesh& m, const uint32_t *indices, size_t count, corner_list& out) {
+        for(size_t i=0; i<count; ++i) {
+            const vec3f& p = m.positions[indices[i]];
+            out.push_back({{p[0], p[1], p[2], float(m.colors[indices[i]] & 0xFFFFFF)}});
+        }
+    }
+}
+
+TEST_CASE("mesh pages split", "[mesh_pages]") {
+    const prepared_mesh pm = make_prepared_grid(64); // 8192 triangles
+    REQUIRE(pm.chunks.size() > 16);
+
+    std::vector<prepared_mesh> pages;
+    prepared_mesh              proxy;
+    obvi::split_mesh_pages(pm, 1000, pages, proxy);
+    REQUIRE(pages.size() >= 9);
+    REQUIRE(proxy.chunks.size() == pages.size());
+    CHECK(proxy.chunk_bvh.size() == pages.size());
+
+    // Every chunk ends up in exactly one page, with the same triangles.
+    corner_list src_corners, page_corners;
+    add_corners(pm.geom, pm.geom.indices.data(), pm.geom.indices.size(), src_corners);
+    size_t num_chunks = 0;
+    for(size_t p=0; p<pages.size(); ++p) {
+        const prepared_mesh& page = pages[p];
+        CHECK(page.geom.num_triangles() <= 1000);
+        CHECK(page.chunk_bvh.size() == page.chunks.size());
+        CHECK(page.geom.colors.size() == page.geom.num_vertices());
+        num_chunks += page.chunks.size();
+        add_corners(page.geom, page.geom.indices.data(), page.geom.indices.size(), page_corners);
+
+        bboxf bounds;
+        for(const mesh_chunk& chunk : page.chunks) {
+            REQUIRE(size_t(chunk.first_index) + chunk.num_indices <= page.geom.indices.size());
+            for(uint32_t j=0; j<chunk.num_lods; ++j) {
+                REQUIRE(size_t(chunk.lods[j].first_index) + chunk.lods[j].num_indices
+                        <= page.lod_indices.size());
+            }
+            bounds.expand(chunk.bounds);
+        }
+        for(uint32_t idx : page.lod_indices) {
+            REQUIRE(idx < page.geom.num_vertices());
+        }
+
+        // Proxy chunk p stands in for page p, with the coarsest levels of its chunks.
+        const mesh_chunk& stand_in = proxy.chunks[p];
+        CHECK(stand_in.bounds.min_pt.x() == bounds.min_pt.x());
+        CHECK(stand_in.bounds.max_pt.y() == bounds.max_pt.y());
+        CHECK(stand_in.num_lods == 0);
+        CHECK(stand_in.num_indices > 0);
+        CHECK(stand_in.num_indices < page.geom.indices.size());
+    }
+    CHECK(num_chunks == pm.chunks.size());
+    std::sort(src_corners.begin(), src_corners.end());
+    std::sort(page_corners.begin(), page_corners.end());
+    CHECK(page_corners == src_corners);
+    for(uint32_t idx : proxy.geom.indices) {
+        REQUIRE(idx < proxy.geom.num_vertices());
+    }
+
+    // One page if the limit is big enough.
+    obvi::split_mesh_pages(pm, 1u << 20, pages, proxy);
+    CHECK(pages.size() == 1);
+    CHECK(pages[0].geom.num_triangles() == pm.geom.num_triangles());
+
+    // Chunks bigger than the limit get a page of their own.
+    obvi::split_mesh_pages(pm, 1, pages, proxy);
+    CHECK(pages.size() == pm.chunks.size());
+}
+
+TEST_CASE("mesh pages save and load", "[mesh_pages]") {
+    const prepared_mesh pm = make_prepared_grid(32);
+    std::vector<prepared_mesh> pages;
+    prepared_mesh              proxy;
+    obvi::split_mesh_pages(pm, 500, pages, proxy);
+    REQUIRE(pages.size() > 1);
+
+    const uint64_t key = obvi::mesh_page_key(99, 500);
+    CHECK(key != obvi::mesh_page_key(99, 501));
+    CHECK(obvi::mesh_page_name(key, 3) != obvi::mesh_page_name(key, 4));
+    CHECK(obvi::mesh_proxy_name(key) != obvi::mesh_cache_name(key));
+
+    struct cleanup {
+        uint64_t key;
+        size_t   num;
+        ~cleanup() {
+            std::remove(("./" + obvi::mesh_proxy_name(key)).c_str());
+            for(size_t i=0; i<num; ++i) {
+                std::remove(("./" + obvi::mesh_page_name(key, i)).c_str());
+            }
+        }
+    } files{key, pages.size()};
+
+    // Nothing there yet.
+    prepared_mesh                loaded;
+    std::vector<mesh_cache_info> infos;
+    CHECK_FALSE(obvi::load_mesh_proxy(".", key, loaded, infos));
+
+    REQUIRE(obvi::save_mesh_pages(".", key, pages, proxy));
+    REQUIRE(obvi::load_mesh_proxy(".", key, loaded, infos));
+    CHECK(loaded.geom.indices == proxy.geom.indices);
+    REQUIRE(infos.size() == pages.size());
+    for(size_t i=0; i<pages.size(); ++i) {
+        CHECK(infos[i].num_vertices == pages[i].geom.num_vertices());
+        CHECK(infos[i].num_indices == pages[i].geom.indices.size());
+        CHECK(infos[i].num_lod_indices == pages[i].lod_indices.size());
+        CHECK(infos[i].num_chunks == pages[i].chunks.size());
+        CHECK(infos[i].has_colors);
+    }
+
+    prepared_mesh page;
+    REQUIRE(obvi::load_mesh_page(".", key, 1, page));
+    CHECK(page.geom.indices == pages[1].geom.indices);
+    CHECK(page.chunk_bvh.size() == pages[1].chunks.size());
+
+    // A missing page makes the whole mesh unusable (so it gets split again).
+    std::remove(("./" + obvi::mesh_page_name(key, 0)).c_str());
+    CHECK_FALSE(obvi::load_mesh_proxy(".", key, loaded, infos));
+    CHECK(infos.empty());
+}
@@ -0,0 +1,126 @@
+/* Unit tests for range_allocator (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <catch2/catch.hpp>
+#include <obvi/util/range_allocator.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using obvi::range_allocator;
+
+TEST_CASE("range_allocator basics", "[range_allocator]") {
+    range_allocator alloc(100);
+    size_t a, b, c;
+    REQUIRE(alloc.allocate(30, &a));
+    REQUIRE(alloc.allocate(30, &b));
+    REQUIRE(alloc.allocate(40, &c));
+    CHECK(a == 0);
+    CHECK(b == 30);
+    CHECK(c == 60);
+    CHECK(alloc.used() == 100);
+    CHECK(alloc.largest_free() == 0);
+
+    size_t d;
+    CHECK_FALSE(alloc.allocate(1, &d));
+    REQUIRE(alloc.allocate(0, &d)); // empty ranges always fit
+    CHECK(d == 0);
+
+    // Free ranges merge with their neighbors.
+    alloc.free(a, 30);
+    alloc.free(c, 40);
+    CHECK(alloc.largest_free() == 40);
+    alloc.free(b, 30);
+    CHECK(alloc.used() == 0);
+    CHECK(alloc.largest_free() == 100);
+}
+
+TEST_CASE("range_allocator best fit and grow", "[range_allocator]") {
+    range_allocator alloc(100);
+    size_t a, b, c, d;
+    REQUIRE(alloc.allocate(20, &a));
+    REQUIRE(alloc.allocate(10, &b));
+    REQUIRE(alloc.allocate(50, &c));
+    REQUIRE(alloc.allocate(10, &d));
+    alloc.free(a, 20); // free: [0,20), [30,80) and [90,100)
+    alloc.free(c, 50);
+
+    // Smallest range that fits is picked.
+    size_t e;
+    REQUIRE(alloc.allocate(10, &e));
+    CHECK(e == 90);
+    REQUIRE(alloc.allocate(15, &e));
+    CHECK(e == 0);
+
+    // Growing adds space at the end, merged with a free range that ends there.
+    size_t f;
+    CHECK_FALSE(alloc.allocate(60, &f));
+    alloc.free(d, 10);
+    alloc.free(90, 10); // first allocation of e, now [30,100) is free
+    alloc.grow(150);
+    CHECK(alloc.capacity() == 150);
+    CHECK(alloc.largest_free() == 120);
+    REQUIRE(alloc.allocate(120, &f));
+    CHECK(f == 30);
+}
+
+TEST_CASE("range_allocator random", "[range_allocator]") {
+    // Random allocations and frees never overlap, and freeing everything leaves one free range.
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> size_dist(1, 50);
+    range_allocator alloc(1000);
+    struct range { size_t offset, size; };
+    std::vector<range> live;
+    for(int i=0; i<2000; ++i) {
+        if(live.empty() || gen() % 3 != 0) {
+            size_t size = size_dist(gen), offset;
+            if(alloc.allocate(size, &offset)) {
+                REQUIRE(offset + size <= alloc.capacity());
+                for(const range& r : live) {
+                    REQUIRE((offset + size <= r.offset || r.offset + r.size <= offset));
+                }
+                live.push_back({offset, size});
+            } else {
+                REQUIRE(alloc.largest_free() < size);
+            }
+        } else {
+            size_t idx = gen() % live.size();
+            alloc.free(live[idx].offset, live[idx].size);
+            live.erase(live.begin() + long(idx));
+        }
+        size_t used = 0;
+        for(const range& r : live) {
+            used += r.size;
+        }
+        REQUIRE(alloc.used() == used);
+    }
+    for(const range& r : live) {
+        alloc.free(r.offset, r.size);
+    }
+    CHECK(alloc.used() == 0);
+    CHECK(alloc.largest_free() == 1000);
+}
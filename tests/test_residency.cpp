@@ -0,0 +1,176 @@
+/* Unit tests for the page residency manager (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <catch2/catch.hpp>
+#include <obvi/util/math.hpp>
+#include <obvi/util/residency.hpp>
+
+#include <algorithm>
+#include <vector>
+
+using obvi::affine3f;
+using obvi::bboxf;
+using obvi::camera3f;
+using obvi::residency;
+using obvi::residency_manager;
+using obvi::vec3f;
+
+namespace {
+    bool contains(const std::vector<size_t>& list, size_t val) {
+        return std::find(list.begin(), list.end(), val) != list.end();
+    }
+
+    // Unit cube pages in a row along +x (page i at x = 2*i), camera looking down -z at them.
+    void add_row(residency_manager& res, size_t num, size_t host_size, size_t gpu_size) {
+        for(size_t i=0; i<num; ++i) {
+            size_t page = res.add_page(host_size, gpu_size);
+            bboxf  box(vec3f(0,0,0));
+            box.expand(vec3f(1,1,1));
+            res.add_instance(page, box, affine3f(vec3f(2.0f * float(i), 0, 0)));
+        }
+    }
+
+    camera3f camera_at(float x, float dist) {
+        camera3f cam;
+        cam.set_perspective(obvi::deg2rad(60.0f), 1.0f, 0.1f, 1000.0f);
+        cam.look_at(vec3f(x, 0.5f, dist), vec3f(x, 0.5f, 0), vec3f(0,1,0));
+        return cam;
+    }
+
+    // Do everything the manager asked for, finishing loads right away.
+    void apply(residency_manager& res, const residency_manager::actions& act) {
+        for(size_t page : act.load) {
+            res.loaded(page, true);
+        }
+    }
+}
+
+TEST_CASE("residency loads nearest pages first", "[residency]") {
+    residency_manager res;
+    res.host_budget = 300;
+    res.gpu_budget  = 200;
+    res.max_loads   = 2;
+    add_row(res, 10, 100, 100);
+
+    residency_manager::actions act;
+    res.update(camera_at(0, 4), 500, act);
+
+    // Closest pages are loaded (two at a time), nothing can be uploaded until they're done.
+    REQUIRE(act.load.size() == 2);
+    CHECK(act.load[0] == 0);
+    CHECK(act.load[1] == 1);
+    CHECK(act.upload.empty());
+    CHECK(res.state(0) == residency::LOADING);
+    CHECK(res.host_used() == 200);
+    CHECK(res.priority(0) > res.priority(1));
+    CHECK(res.priority(1) > res.priority(5));
+
+    apply(res, act);
+    res.update(camera_at(0, 4), 500, act);
+    CHECK(act.load.size() == 1); // only room for one more in the host budget
+    CHECK(act.load[0] == 2);
+    REQUIRE(act.upload.size() == 2);
+    CHECK(contains(act.upload, 0));
+    CHECK(contains(act.upload, 1));
+
+    apply(res, act);
+    res.update(camera_at(0, 4), 500, act);
+    CHECK(act.load.empty());
+    CHECK(act.upload.empty());
+    CHECK(res.count(residency::GPU) == 2);
+    CHECK(res.count(residency::HOST) == 1);
+    CHECK(res.host_used() <= res.host_budget);
+    CHECK(res.gpu_used() <= res.gpu_budget);
+}
+
+TEST_CASE("residency evicts least recently wanted", "[residency]") {
+    residency_manager res;
+    res.host_budget = 300;
+    res.gpu_budget  = 100;
+    res.max_loads   = 10;
+    add_row(res, 10, 100, 100);
+
+    residency_manager::actions act;
+    for(int i=0; i<3; ++i) {
+        res.update(camera_at(0, 3), 500, act);
+        apply(res, act);
+    }
+    CHECK(res.state(0) == residency::GPU);
+
+    // Move over to the far end of the row: pages that aren't wanted anymore make room.
+    for(int i=0; i<3; ++i) {
+        res.update(camera_at(18, 3), 500, act);
+        for(size_t page : act.evict_host) {
+            CHECK(page < 5);
+        }
+        apply(res, act);
+    }
+    CHECK(res.state(9) == residency::GPU);
+    CHECK(res.state(0) == residency::DISK);
+    CHECK(res.count(residency::GPU) == 1);
+    CHECK(res.host_used() <= res.host_budget);
+
+    // Pages that are no longer wanted stay loaded while nothing needs their memory.
+    residency_manager cache;
+    cache.host_budget = 1000;
+    cache.gpu_budget  = 1000;
+    add_row(cache, 2, 100, 100);
+    for(int i=0; i<2; ++i) {
+        cache.update(camera_at(0, 2), 500, act);
+        apply(cache, act);
+    }
+    CHECK(cache.state(0) == residency::GPU);
+    cache.update(camera_at(0, -1000), 500, act); // far away, pages are too small to want
+    CHECK(act.evict_gpu.empty());
+    CHECK(act.evict_host.empty());
+    CHECK(cache.priority(0) == 0.0f);
+    CHECK(cache.state(0) == residency::GPU);
+}
+
+TEST_CASE("residency failed loads and big pages", "[residency]") {
+    residency_manager res;
+    res.host_budget = 250;
+    res.gpu_budget  = 250;
+    add_row(res, 3, 100, 100);
+    size_t big = res.add_page(1000, 1000); // never fits
+    bboxf  box(vec3f(0,0,0));
+    box.expand(vec3f(1,1,1));
+    res.add_instance(big, box, affine3f());
+
+    residency_manager::actions act;
+    res.update(camera_at(0, 4), 500, act);
+    CHECK_FALSE(contains(act.load, big));
+    REQUIRE(contains(act.load, 0));
+    res.loaded(0, false);
+    CHECK(res.state(0) == residency::DISK);
+    for(size_t page : act.load) {
+        res.loaded(page, true); // loaded() ignores pages that aren't loading
+    }
+    res.update(camera_at(0, 4), 500, act);
+    CHECK_FALSE(contains(act.load, 0)); // failed pages aren't tried again
+    CHECK(res.state(0) == residency::DISK);
+    CHECK(res.host_used() == 200);
+}
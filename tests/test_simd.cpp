@@ -0,0 +1,116 @@
+/* Unit tests for SIMD float vectors (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/simd.hpp>
+
+#include <limits>
+
+using obvi::floatv;
+
+TEMPLATE_TEST_CASE_SIG("floatv", "[simd]", ((size_t N), N), 4, 8) {
+    using vec = floatv<N>;
+
+    float a[N], b[N], res[N];
+    for(size_t i=0; i<N; ++i) {
+        a[i] = float(i);
+        b[i] = float(N - i);
+    }
+    vec va = vec::load(a);
+    vec vb = vec::load(b);
+
+    SECTION( "load and store" ) {
+        va.store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == a[i] );
+        }
+        vec(2.5f).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == 2.5f );
+        }
+    }
+
+    SECTION( "load bytes" ) {
+        uint8_t bytes[N];
+        for(size_t i=0; i<N; ++i) {
+            bytes[i] = uint8_t(248 + i);
+        }
+        vec::load_u8(bytes).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == float(248 + i) );
+        }
+    }
+
+    SECTION( "arithmetic" ) {
+        (va + vb).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == a[i] + b[i] );
+        }
+        (va - vb).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == a[i] - b[i] );
+        }
+        (va * vb).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == a[i] * b[i] );
+        }
+    }
+
+    SECTION( "min and max" ) {
+        min(va, vb).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == std::min(a[i], b[i]) );
+        }
+        max(va, vb).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == std::max(a[i], b[i]) );
+        }
+    }
+
+    SECTION( "replace NaN" ) {
+        a[1] = std::numeric_limits<float>::quiet_NaN();
+        replace_nan(vec::load(a), vec(-1.0f)).store(res);
+        for(size_t i=0; i<N; ++i) {
+            REQUIRE( res[i] == ((i == 1)? -1.0f : a[i]) );
+        }
+    }
+
+    SECTION( "compare" ) {
+        uint32_t expected = 0;
+        for(size_t i=0; i<N; ++i) {
+            if(a[i] <= b[i]) {
+                expected |= 1u << i;
+            }
+        }
+        REQUIRE( cmple_mask(va, vb) == expected );
+        REQUIRE( cmple_mask(va, va) == (1u << N) - 1 );
+
+        // Comparisons with NaN are always false.
+        a[0] = std::numeric_limits<float>::quiet_NaN();
+        REQUIRE( (cmple_mask(vec::load(a), vb) & 1u) == 0 );
+    }
+}
@@ -0,0 +1,96 @@
+/* Unit tests for spsc_queue (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/spsc_queue.hpp>
+
+#include <stdint.h>
+#include <thread>
+
+using obvi::spsc_queue;
+
+TEST_CASE("spsc_queue", "[spsc_queue]") {
+    SECTION( "capacity is rounded up to a power of two" ) {
+        CHECK( spsc_queue<int>(1).capacity() == 1 );
+        CHECK( spsc_queue<int>(5).capacity() == 8 );
+        CHECK( spsc_queue<int>(64).capacity() == 64 );
+    }
+
+    SECTION( "first in, first out" ) {
+        spsc_queue<int> queue(4);
+        int             value = -1;
+        CHECK( queue.empty() );
+        CHECK_FALSE( queue.pop(value) );
+
+        for(int i=0; i<4; ++i) {
+            REQUIRE( queue.push(i) );
+        }
+        CHECK_FALSE( queue.push(4) ); // full
+        CHECK_FALSE( queue.empty() );
+
+        REQUIRE( queue.pop(value) );
+        CHECK( value == 0 );
+        REQUIRE( queue.push(4) ); // room again, wraps around
+        for(int i=1; i<5; ++i) {
+            REQUIRE( queue.pop(value) );
+            CHECK( value == i );
+        }
+        CHECK_FALSE( queue.pop(value) );
+        CHECK( queue.empty() );
+    }
+
+    SECTION( "two threads" ) {
+        // Producer pushes a sequence faster than the consumer can keep up with, through a small
+        // queue, so it wraps around and fills up many times. Every item must arrive once, in order.
+        const uint32_t       count = 200000;
+        spsc_queue<uint32_t> queue(16);
+        std::thread          producer([&]() {
+            for(uint32_t i=0; i<count; ) {
+                if(queue.push(i)) {
+                    ++i;
+                } else {
+                    std::this_thread::yield(); // let the consumer run, even on a single core
+                }
+            }
+        });
+
+        uint32_t expected = 0;
+        bool     in_order = true;
+        while(expected < count) {
+            uint32_t value;
+            if(queue.pop(value)) {
+                in_order = in_order && (value == expected);
+                ++expected;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        producer.join();
+        CHECK( in_order );
+        CHECK( queue.empty() );
+    }
+}
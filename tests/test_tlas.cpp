@@ -0,0 +1,270 @@
+/* Unit tests for tlas (util library).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+
+#include <catch2/catch.hpp>
+#include <obvi/util/affine3.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/frustum.hpp>
+#include <obvi/util/tlas.hpp>
+#include "test_helpers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+using obvi::affine3f;
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::frustumf;
+using obvi::mat3f;
+using obvi::tlas;
+using obvi::vec3f;
+using obvi_test::make_boxes;
+
+namespace {
+    using match = std::pair<size_t, size_t>; // (instance index, object index)
+
+    std::vector<tlas::instance> make_instances(const std::vector<const bvh*>& blases, size_t count,
+                                               unsigned seed) {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<float> pos(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> angle(-3.0f, 3.0f);
+        std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+
+        std::vector<tlas::instance> instances;
+        for(size_t i=0; i<count; ++i) {
+            mat3f rot = mat3f::zrot(angle(gen)) * mat3f::yrot(angle(gen)) * mat3f::xrot(angle(gen));
+            tlas::instance inst;
+            inst.blas      = blases[i % blases.size()];
+            inst.transform = affine3f(rot, vec3f(pos(gen), pos(gen), pos(gen)), scale(gen));
+            instances.push_back(inst);
+        }
+        return instances;
+    }
+
+    // Run query to completion, return sorted list of matches.
+    template<typename intersect_func>
+    std::vector<match> run_query(const tlas& scene, intersect_func ifunc) {
+        std::vector<match> res;
+        auto query = scene.make_query(ifunc);
+        size_t inst_idx, obj_idx;
+        while(query.next(&inst_idx, &obj_idx)) {
+            res.push_back({inst_idx, obj_idx});
+        }
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    // Test every object of every instance individually (in instance space).
+    template<typename intersect_func>
+    std::vector<match> brute_force(const tlas& scene,
+                                   const std::vector<std::vector<bboxf>>& blas_boxes,
+                                   const std::vector<const bvh*>& blases, intersect_func ifunc) {
+        std::vector<match> res;
+        for(size_t i=0; i<scene.size(); ++i) {
+            size_t b = (size_t)(std::find(blases.begin(), blases.end(), scene.get_blas(i))
+                                - blases.begin());
+            auto local = ifunc.local(scene.get_inv_transform(i));
+            for(size_t j=0; j<blas_boxes[b].size(); ++j) {
+                if(local(blas_boxes[b][j])) {
+                    res.push_back({i, j});
+                }
+            }
+        }
+        return res;
+    }
+}
+
+TEST_CASE("tlas generate", "[tlas]") {
+    tlas scene;
+
+    SECTION( "empty" ) {
+        REQUIRE( scene.generate(std::vector<tlas::instance>()) );
+        REQUIRE( scene.size() == 0 );
+        REQUIRE( run_query(scene, tlas::intersect_point(vec3f(0,0,0))).empty() );
+    }
+
+    SECTION( "instances share one bvh" ) {
+        bvh blas;
+        blas.generate({bboxf(0,0,0, 1,1,1), bboxf(2,0,0, 3,1,1)});
+
+        std::vector<tlas::instance> instances(3);
+        for(size_t i=0; i<instances.size(); ++i) {
+            instances[i].blas      = &blas;
+            instances[i].transform = affine3f(vec3f(0, 10.0f * float(i), 0));
+        }
+        // Last instance is scaled up and rotated 90 degrees about Z.
+        instances[2].transform = affine3f(mat3f::zrot(1.5707963f), vec3f(0,20,0), 2.0f);
+
+        REQUIRE( scene.generate(instances) );
+        REQUIRE( scene.size() == 3 );
+        REQUIRE( scene.get_blas(1) == &blas );
+
+        REQUIRE( run_query(scene, tlas::intersect_point(vec3f(0.5f, 10.5f, 0.5f)))
+                 == (std::vector<match>{{1, 0}}) );
+        REQUIRE( run_query(scene, tlas::intersect_point(vec3f(2.5f, 0.5f, 0.5f)))
+                 == (std::vector<match>{{0, 1}}) );
+        // Second box of last instance now covers x=[-2,0], y=[24,26], z=[0,2].
+        REQUIRE( run_query(scene, tlas::intersect_point(vec3f(-1, 25, 1)))
+                 == (std::vector<match>{{2, 1}}) );
+        REQUIRE( run_query(scene, tlas::intersect_point(vec3f(5, 5, 5))).empty() );
+        // Rays along Y: one hits both boxes of the rotated instance, the other hits the first box
+        // of the two unrotated instances.
+        REQUIRE( run_query(scene, tlas::intersect_ray(vec3f(-0.5f, -5, 0.5f), vec3f(0,1,0)))
+                 == (std::vector<match>{{2, 0}, {2, 1}}) );
+        REQUIRE( run_query(scene, tlas::intersect_ray(vec3f(0.5f, -5, 0.5f), vec3f(0,1,0)))
+                 == (std::vector<match>{{0, 0}, {1, 0}}) );
+    }
+
+    SECTION( "instance without bvh" ) {
+        bvh blas;
+        blas.generate({bboxf(0,0,0, 1,1,1)});
+        std::vector<tlas::instance> instances(2);
+        instances[0].blas = &blas;
+        REQUIRE( scene.generate(instances) );
+        REQUIRE( run_query(scene, tlas::intersect_point(vec3f(0.5f, 0.5f, 0.5f)))
+                 == (std::vector<match>{{0, 0}}) );
+    }
+}
+
+TEST_CASE("tlas query", "[tlas]") {
+    std::vector<std::vector<bboxf>> blas_boxes = {make_boxes(300, 1, 5.0f, 1.0f),
+                                                   make_boxes(50, 2, 5.0f, 1.0f)};
+    std::vector<bvh>                blas_trees(blas_boxes.size());
+    std::vector<const bvh*>         blases;
+    for(size_t i=0; i<blas_boxes.size(); ++i) {
+        REQUIRE( blas_trees[i].generate(blas_boxes[i]) );
+        blases.push_back(&blas_trees[i]);
+    }
+
+    std::vector<tlas::instance> instances = make_instances(blases, 500, 11);
+    tlas scene;
+    REQUIRE( scene.generate(instances) );
+    REQUIRE( scene.size() == instances.size() );
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> pos(-110.0f, 110.0f);
+
+    auto check_queries = [&]() {
+        for(int i=0; i<50; ++i) {
+            tlas::intersect_point ifunc(vec3f(pos(gen), pos(gen), pos(gen)));
+            REQUIRE( run_query(scene, ifunc) == brute_force(scene, blas_boxes, blases, ifunc) );
+        }
+        for(int i=0; i<50; ++i) {
+            vec3f pt(pos(gen), pos(gen), pos(gen));
+            bboxf qbox(pt);
+            qbox.expand(pt + vec3f(5,5,5));
+            tlas::intersect_box ifunc(qbox);
+            REQUIRE( run_query(scene, ifunc) == brute_force(scene, blas_boxes, blases, ifunc) );
+        }
+        for(int i=0; i<50; ++i) {
+            tlas::intersect_segment ifunc(vec3f(pos(gen), pos(gen), pos(gen)),
+                                          vec3f(pos(gen), pos(gen), pos(gen)));
+            REQUIRE( run_query(scene, ifunc) == brute_force(scene, blas_boxes, blases, ifunc) );
+        }
+        for(int i=0; i<50; ++i) {
+            vec3f origin(pos(gen), pos(gen), pos(gen));
+            vec3f dir = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+            tlas::intersect_ray ifunc(origin, dir);
+            REQUIRE( run_query(scene, ifunc) == brute_force(scene, blas_boxes, blases, ifunc) );
+        }
+        for(int i=0; i<50; ++i) {
+            tlas::intersect_sphere ifunc(vec3f(pos(gen), pos(gen), pos(gen)), 8.0f);
+            REQUIRE( run_query(scene, ifunc) == brute_force(scene, blas_boxes, blases, ifunc) );
+        }
+        for(int i=0; i<50; ++i) {
+            // Box-shaped frustum, with one slanted side.
+            vec3f    lo(pos(gen), pos(gen), pos(gen));
+            frustumf fr;
+            fr.set_plane(frustumf::LEFT,       1, 0, 0, -lo[0]);
+            fr.set_plane(frustumf::RIGHT,     -1, 0, 0,  lo[0] + 40.0f);
+            fr.set_plane(frustumf::BOTTOM,     0, 1, 0, -lo[1]);
+            fr.set_plane(frustumf::TOP,        0,-1, 0,  lo[1] + 40.0f);
+            fr.set_plane(frustumf::NEAR_PLANE, 0, 0, 1, -lo[2]);
+            fr.set_plane(frustumf::FAR_PLANE, -1, 0,-1,  lo[2] + lo[0] + 50.0f);
+            tlas::intersect_frustum ifunc(fr);
+            REQUIRE( run_query(scene, ifunc) == brute_force(scene, blas_boxes, blases, ifunc) );
+        }
+    };
+
+    // Closest-first ray query, where an object's bounding box counts as its exact shape: the
+    // closest hit should match the closest box entry found by testing everything.
+    auto check_ray_queries = [&]() {
+        for(int i=0; i<100; ++i) {
+            vec3f origin(pos(gen), pos(gen), pos(gen));
+            vec3f dir = vec3f(pos(gen), pos(gen), pos(gen)).normalized();
+
+            float best_t = std::numeric_limits<float>::infinity();
+            for(size_t j=0; j<scene.size(); ++j) {
+                size_t b = (size_t)(std::find(blases.begin(), blases.end(), scene.get_blas(j))
+                                    - blases.begin());
+                const affine3f& inv = scene.get_inv_transform(j);
+                vec3f local_origin = inv * origin;
+                vec3f local_dir    = inv.rotate(dir) * inv.scale();
+                for(const bboxf& box : blas_boxes[b]) {
+                    float t;
+                    if(box.intersects_ray(local_origin, local_dir.inv(), best_t, &t)) {
+                        best_t = std::min(best_t, t);
+                    }
+                }
+            }
+
+            auto   query  = scene.make_ray_query(origin, dir);
+            float  hit_t  = std::numeric_limits<float>::infinity();
+            size_t inst_idx, obj_idx;
+            float  entry_t;
+            while(query.next(&inst_idx, &obj_idx, &entry_t)) {
+                REQUIRE( entry_t <= query.max_t() );
+                hit_t = std::min(hit_t, entry_t);
+                query.shrink(entry_t);
+            }
+            if(std::isinf(best_t)) {
+                CHECK( std::isinf(hit_t) );
+            } else {
+                CHECK( hit_t == Approx(best_t).epsilon(1e-4) );
+            }
+        }
+    };
+
+    SECTION( "generate" ) {
+        check_queries();
+        check_ray_queries();
+    }
+
+    SECTION( "update" ) {
+        instances = make_instances(blases, 500, 12);
+        REQUIRE( scene.update(instances) );
+        check_queries();
+        check_ray_queries();
+
+        instances.pop_back();
+        REQUIRE_FALSE( scene.update(instances) );
+    }
+}
@@ -0,0 +1,555 @@
+/* Implementation of batch geometry kernels: scalar, SSE2 and NEON versions, and runtime dispatch.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/batch.hpp>
+#include <obvi/util/math.hpp>
+#include <obvi/util/simd.hpp> // for OBVI_SIMD_SSE/NEON, and their intrinsics headers
+
+#include "batch_kernels.hpp"
+
+#include <atomic>
+#include <type_traits>
+
+#if defined(OBVI_BATCH_AVX2) && defined(_MSC_VER)
+#   include <intrin.h> // for __cpuid(), __cpuidex() and _xgetbv()
+#endif
+
+using obvi::batch_detail::kernels;
+using obvi::bboxf;
+using obvi::simd_isa;
+using obvi::vec3f;
+
+static_assert(sizeof(vec3f) == 3 * sizeof(float) && std::is_standard_layout<vec3f>::value,
+              "batch kernels read vec3f arrays as plain floats");
+static_assert(sizeof(bboxf) == 6 * sizeof(float) && std::is_standard_layout<bboxf>::value,
+              "batch kernels write bboxf arrays as plain floats");
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    const float morton_30_max_val = float(obvi::morton_30_max - 1);
+    const float morton_63_max_val = float(obvi::morton_63_max - 1);
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Scalar kernels. The vector versions do exactly the same operations in the same order.
+    inline float min3(float a, float b, float c) {
+        float m = (b < a)? b : a;
+        return (c < m)? c : m;
+    }
+    inline float max3(float a, float b, float c) {
+        float m = (a < b)? b : a;
+        return (m < c)? c : m;
+    }
+
+    inline uint32_t scaled_int(float v, float offset, float scale, float max_val) {
+        v = (v - offset) * scale;
+        v = (v > 0.0f)? v : 0.0f; // also maps NaN to 0
+        v = (v < max_val)? v : max_val;
+        return uint32_t(v);
+    }
+
+    void transform_points_scalar(const float m[12], const float *x, const float *y,
+                                 const float *z, size_t n, float *out_x, float *out_y,
+                                 float *out_z) {
+        for(size_t i=0; i<n; ++i) {
+            const float vx = x[i], vy = y[i], vz = z[i];
+            out_x[i] = m[0] * vx + m[1] * vy + m[2]  * vz + m[3];
+            out_y[i] = m[4] * vx + m[5] * vy + m[6]  * vz + m[7];
+            out_z[i] = m[8] * vx + m[9] * vy + m[10] * vz + m[11];
+        }
+    }
+
+    void triangle_bounds_scalar(const float *xyz, const uint32_t *indices, size_t num_tris,
+                                float *out_boxes) {
+        for(size_t t=0; t<num_tris; ++t) {
+            const float *a = xyz + 3 * size_t(indices[3 * t]);
+            const float *b = xyz + 3 * size_t(indices[3 * t + 1]);
+            const float *c = xyz + 3 * size_t(indices[3 * t + 2]);
+            float       *o = out_boxes + 6 * t;
+            for(size_t k=0; k<3; ++k) {
+                o[k]     = min3(a[k], b[k], c[k]);
+                o[k + 3] = max3(a[k], b[k], c[k]);
+            }
+        }
+    }
+
+    void morton_codes_30_scalar(const float *x, const float *y, const float *z, size_t n,
+                                const float offset[3], const float scale[3], uint32_t *out) {
+        for(size_t i=0; i<n; ++i) {
+            uint32_t xx = obvi::expand_bits_30(scaled_int(x[i], offset[0], scale[0], morton_30_max_val));
+            uint32_t yy = obvi::expand_bits_30(scaled_int(y[i], offset[1], scale[1], morton_30_max_val));
+            uint32_t zz = obvi::expand_bits_30(scaled_int(z[i], offset[2], scale[2], morton_30_max_val));
+            out[i] = (xx << 2) | (yy << 1) | zz;
+        }
+    }
+
+    void morton_codes_63_scalar(const float *x, const float *y, const float *z, size_t n,
+                                const float offset[3], const float scale[3], uint64_t *out) {
+        for(size_t i=0; i<n; ++i) {
+            uint64_t xx = obvi::expand_bits_63(scaled_int(x[i], offset[0], scale[0], morton_63_max_val));
+            uint64_t yy = obvi::expand_bits_63(scaled_int(y[i], offset[1], scale[1], morton_63_max_val));
+            uint64_t zz = obvi::expand_bits_63(scaled_int(z[i], offset[2], scale[2], morton_63_max_val));
+            out[i] = (xx << 2) | (yy << 1) | zz;
+        }
+    }
+
+    const kernels scalar_kernels = {
+        transform_points_scalar,
+        triangle_bounds_scalar,
+        morton_codes_30_scalar,
+        morton_codes_63_scalar
+    };
+
+#if defined(OBVI_SIMD_SSE)
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // SSE2 kernels (always available on x86-64).
+    inline __m128i scaled_int(__m128 v, __m128 offset, __m128 scale, __m128 max_val) {
+        v = _mm_mul_ps(_mm_sub_ps(v, offset), scale);
+        v = _mm_max_ps(v, _mm_setzero_ps()); // returns 2nd operand (0) if v is NaN
+        v = _mm_min_ps(v, max_val);
+        return _mm_cvttps_epi32(v);
+    }
+
+    inline __m128i expand_30(__m128i v) {
+        v = _mm_and_si128(v, _mm_set1_epi32(0x3FF));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 16)), _mm_set1_epi32(0x030000FF));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v,  8)), _mm_set1_epi32(0x0300F00F));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v,  4)), _mm_set1_epi32(0x030C30C3));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v,  2)), _mm_set1_epi32(0x09249249));
+        return v;
+    }
+
+    inline __m128i expand_63(__m128i v) {
+        v = _mm_and_si128(v, _mm_set1_epi64x(0x1FFFFFll));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v, 32)),
+                          _mm_set1_epi64x(0x001F00000000FFFFll));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v, 16)),
+                          _mm_set1_epi64x(0x001F0000FF0000FFll));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v,  8)),
+                          _mm_set1_epi64x(0x100F00F00F00F00Fll));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v,  4)),
+                          _mm_set1_epi64x(0x10C30C30C30C30C3ll));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v,  2)),
+                          _mm_set1_epi64x(0x1249249249249249ll));
+        return v;
+    }
+
+    // Load 3 floats without reading past the end (last element is 0).
+    inline __m128 load3(const float *p) {
+        return _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+    }
+
+    void transform_points_sse2(const float m[12], const float *x, const float *y, const float *z,
+                               size_t n, float *out_x, float *out_y, float *out_z) {
+        __m128 mv[12];
+        for(size_t i=0; i<12; ++i) {
+            mv[i] = _mm_set1_ps(m[i]);
+        }
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            const __m128 vx = _mm_loadu_ps(x + i);
+            const __m128 vy = _mm_loadu_ps(y + i);
+            const __m128 vz = _mm_loadu_ps(z + i);
+            __m128 res[3];
+            for(size_t r=0; r<3; ++r) {
+                const __m128 *row = mv + 4 * r;
+                res[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(row[0], vx),
+                    _mm_mul_ps(row[1], vy)), _mm_mul_ps(row[2], vz)), row[3]);
+            }
+            _mm_storeu_ps(out_x + i, res[0]);
+            _mm_storeu_ps(out_y + i, res[1]);
+            _mm_storeu_ps(out_z + i, res[2]);
+        }
+        transform_points_scalar(m, x + i, y + i, z + i, n - i, out_x + i, out_y + i, out_z + i);
+    }
+
+    void triangle_bounds_sse2(const float *xyz, const uint32_t *indices, size_t num_tris,
+                              float *out_boxes) {
+        // SSE2 has no gathers, so do one triangle at a time with its x,y,z in one register.
+        for(size_t t=0; t<num_tris; ++t) {
+            const __m128 a  = load3(xyz + 3 * size_t(indices[3 * t]));
+            const __m128 b  = load3(xyz + 3 * size_t(indices[3 * t + 1]));
+            const __m128 c  = load3(xyz + 3 * size_t(indices[3 * t + 2]));
+            // Same comparison order as min3() and max3().
+            const __m128 lo = _mm_min_ps(c, _mm_min_ps(b, a));
+            const __m128 hi = _mm_max_ps(c, _mm_max_ps(b, a));
+            // 4-wide stores: the extra float of each is overwritten by the next store, except
+            // after the last triangle's max, which would land past the end of the output.
+            float *o = out_boxes + 6 * t;
+            _mm_storeu_ps(o, lo);
+            if(t + 1 < num_tris) {
+                _mm_storeu_ps(o + 3, hi);
+            } else {
+                alignas(16) float tmp[4];
+                _mm_store_ps(tmp, hi);
+                o[3] = tmp[0];
+                o[4] = tmp[1];
+                o[5] = tmp[2];
+            }
+        }
+    }
+
+    void morton_codes_30_sse2(const float *x, const float *y, const float *z, size_t n,
+                              const float offset[3], const float scale[3], uint32_t *out) {
+        __m128 voff[3], vscale[3];
+        for(int d=0; d<3; ++d) {
+            voff[d]   = _mm_set1_ps(offset[d]);
+            vscale[d] = _mm_set1_ps(scale[d]);
+        }
+        const __m128 vmax = _mm_set1_ps(morton_30_max_val);
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            __m128i xx = expand_30(scaled_int(_mm_loadu_ps(x + i), voff[0], vscale[0], vmax));
+            __m128i yy = expand_30(scaled_int(_mm_loadu_ps(y + i), voff[1], vscale[1], vmax));
+            __m128i zz = expand_30(scaled_int(_mm_loadu_ps(z + i), voff[2], vscale[2], vmax));
+            __m128i code = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(xx, 2), _mm_slli_epi32(yy, 1)), zz);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), code);
+        }
+        morton_codes_30_scalar(x + i, y + i, z + i, n - i, offset, scale, out + i);
+    }
+
+    void morton_codes_63_sse2(const float *x, const float *y, const float *z, size_t n,
+                              const float offset[3], const float scale[3], uint64_t *out) {
+        __m128 voff[3], vscale[3];
+        for(int d=0; d<3; ++d) {
+            voff[d]   = _mm_set1_ps(offset[d]);
+            vscale[d] = _mm_set1_ps(scale[d]);
+        }
+        const __m128  vmax = _mm_set1_ps(morton_63_max_val);
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            // Convert to 4 32-bit ints, then widen each half to 2 64-bit ints.
+            __m128i ints[3];
+            ints[0] = scaled_int(_mm_loadu_ps(x + i), voff[0], vscale[0], vmax);
+            ints[1] = scaled_int(_mm_loadu_ps(y + i), voff[1], vscale[1], vmax);
+            ints[2] = scaled_int(_mm_loadu_ps(z + i), voff[2], vscale[2], vmax);
+            for(int half=0; half<2; ++half) {
+                __m128i wide[3];
+                for(int d=0; d<3; ++d) {
+                    wide[d] = expand_63((half == 0)? _mm_unpacklo_epi32(ints[d], zero)
+                                                   : _mm_unpackhi_epi32(ints[d], zero));
+                }
+                __m128i code = _mm_or_si128(_mm_or_si128(_mm_slli_epi64(wide[0], 2),
+                                                         _mm_slli_epi64(wide[1], 1)), wide[2]);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 2 * size_t(half)), code);
+            }
+        }
+        morton_codes_63_scalar(x + i, y + i, z + i, n - i, offset, scale, out + i);
+    }
+
+    const kernels sse2_kernels = {
+        transform_points_sse2,
+        triangle_bounds_sse2,
+        morton_codes_30_sse2,
+        morton_codes_63_sse2
+    };
+#endif // OBVI_SIMD_SSE
+
+#if defined(OBVI_SIMD_NEON)
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // NEON kernels (always available on 64-bit ARM).
+    inline uint32x4_t scaled_int(float32x4_t v, float32x4_t offset, float32x4_t scale,
+                                 float32x4_t max_val) {
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        v = vmulq_f32(vsubq_f32(v, offset), scale);
+        v = vbslq_f32(vcgtq_f32(v, zero), v, zero); // also maps NaN to 0
+        v = vminq_f32(v, max_val);
+        return vcvtq_u32_f32(v);
+    }
+
+    inline uint32x4_t expand_30(uint32x4_t v) {
+        v = vandq_u32(v, vdupq_n_u32(0x3FFu));
+        v = vandq_u32(vorrq_u32(v, vshlq_n_u32(v, 16)), vdupq_n_u32(0x030000FFu));
+        v = vandq_u32(vorrq_u32(v, vshlq_n_u32(v,  8)), vdupq_n_u32(0x0300F00Fu));
+        v = vandq_u32(vorrq_u32(v, vshlq_n_u32(v,  4)), vdupq_n_u32(0x030C30C3u));
+        v = vandq_u32(vorrq_u32(v, vshlq_n_u32(v,  2)), vdupq_n_u32(0x09249249u));
+        return v;
+    }
+
+    inline uint64x2_t expand_63(uint64x2_t v) {
+        v = vandq_u64(v, vdupq_n_u64(0x1FFFFFull));
+        v = vandq_u64(vorrq_u64(v, vshlq_n_u64(v, 32)), vdupq_n_u64(0x001F00000000FFFFull));
+        v = vandq_u64(vorrq_u64(v, vshlq_n_u64(v, 16)), vdupq_n_u64(0x001F0000FF0000FFull));
+        v = vandq_u64(vorrq_u64(v, vshlq_n_u64(v,  8)), vdupq_n_u64(0x100F00F00F00F00Full));
+        v = vandq_u64(vorrq_u64(v, vshlq_n_u64(v,  4)), vdupq_n_u64(0x10C30C30C30C30C3ull));
+        v = vandq_u64(vorrq_u64(v, vshlq_n_u64(v,  2)), vdupq_n_u64(0x1249249249249249ull));
+        return v;
+    }
+
+    // Load 3 floats without reading past the end (last element is 0).
+    inline float32x4_t load3(const float *p) {
+        return vcombine_f32(vld1_f32(p), vld1_lane_f32(p + 2, vdup_n_f32(0.0f), 0));
+    }
+
+    void transform_points_neon(const float m[12], const float *x, const float *y, const float *z,
+                               size_t n, float *out_x, float *out_y, float *out_z) {
+        float32x4_t mv[12];
+        for(size_t i=0; i<12; ++i) {
+            mv[i] = vdupq_n_f32(m[i]);
+        }
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            const float32x4_t vx = vld1q_f32(x + i);
+            const float32x4_t vy = vld1q_f32(y + i);
+            const float32x4_t vz = vld1q_f32(z + i);
+            float32x4_t res[3];
+            for(size_t r=0; r<3; ++r) {
+                // Separate multiplies and adds (not vmlaq/vfmaq), to round like the scalar code.
+                const float32x4_t *row = mv + 4 * r;
+                res[r] = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(row[0], vx),
+                    vmulq_f32(row[1], vy)), vmulq_f32(row[2], vz)), row[3]);
+            }
+            vst1q_f32(out_x + i, res[0]);
+            vst1q_f32(out_y + i, res[1]);
+            vst1q_f32(out_z + i, res[2]);
+        }
+        transform_points_scalar(m, x + i, y + i, z + i, n - i, out_x + i, out_y + i, out_z + i);
+    }
+
+    void triangle_bounds_neon(const float *xyz, const uint32_t *indices, size_t num_tris,
+                              float *out_boxes) {
+        for(size_t t=0; t<num_tris; ++t) {
+            const float32x4_t a = load3(xyz + 3 * size_t(indices[3 * t]));
+            const float32x4_t b = load3(xyz + 3 * size_t(indices[3 * t + 1]));
+            const float32x4_t c = load3(xyz + 3 * size_t(indices[3 * t + 2]));
+            float lo[4], hi[4];
+            vst1q_f32(lo, vminq_f32(vminq_f32(a, b), c));
+            vst1q_f32(hi, vmaxq_f32(vmaxq_f32(a, b), c));
+            float *o = out_boxes + 6 * t;
+            for(size_t k=0; k<3; ++k) {
+                o[k]     = lo[k];
+                o[k + 3] = hi[k];
+            }
+        }
+    }
+
+    void morton_codes_30_neon(const float *x, const float *y, const float *z, size_t n,
+                              const float offset[3], const float scale[3], uint32_t *out) {
+        float32x4_t voff[3], vscale[3];
+        for(int d=0; d<3; ++d) {
+            voff[d]   = vdupq_n_f32(offset[d]);
+            vscale[d] = vdupq_n_f32(scale[d]);
+        }
+        const float32x4_t vmax = vdupq_n_f32(morton_30_max_val);
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            uint32x4_t xx = expand_30(scaled_int(vld1q_f32(x + i), voff[0], vscale[0], vmax));
+            uint32x4_t yy = expand_30(scaled_int(vld1q_f32(y + i), voff[1], vscale[1], vmax));
+            uint32x4_t zz = expand_30(scaled_int(vld1q_f32(z + i), voff[2], vscale[2], vmax));
+            vst1q_u32(out + i, vorrq_u32(vorrq_u32(vshlq_n_u32(xx, 2), vshlq_n_u32(yy, 1)), zz));
+        }
+        morton_codes_30_scalar(x + i, y + i, z + i, n - i, offset, scale, out + i);
+    }
+
+    void morton_codes_63_neon(const float *x, const float *y, const float *z, size_t n,
+                              const float offset[3], const float scale[3], uint64_t *out) {
+        float32x4_t voff[3], vscale[3];
+        for(int d=0; d<3; ++d) {
+            voff[d]   = vdupq_n_f32(offset[d]);
+            vscale[d] = vdupq_n_f32(scale[d]);
+        }
+        const float32x4_t vmax = vdupq_n_f32(morton_63_max_val);
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            uint32x4_t ints[3];
+            ints[0] = scaled_int(vld1q_f32(x + i), voff[0], vscale[0], vmax);
+            ints[1] = scaled_int(vld1q_f32(y + i), voff[1], vscale[1], vmax);
+            ints[2] = scaled_int(vld1q_f32(z + i), voff[2], vscale[2], vmax);
+            for(int half=0; half<2; ++half) {
+                uint64x2_t wide[3];
+                for(int d=0; d<3; ++d) {
+                    wide[d] = expand_63(vmovl_u32((half == 0)? vget_low_u32(ints[d])
+                                                             : vget_high_u32(ints[d])));
+                }
+                vst1q_u64(out + i + 2 * size_t(half),
+                          vorrq_u64(vorrq_u64(vshlq_n_u64(wide[0], 2), vshlq_n_u64(wide[1], 1)),
+                                    wide[2]));
+            }
+        }
+        morton_codes_63_scalar(x + i, y + i, z + i, n - i, offset, scale, out + i);
+    }
+
+    const kernels neon_kernels = {
+        transform_points_neon,
+        triangle_bounds_neon,
+        morton_codes_30_neon,
+        morton_codes_63_neon
+    };
+#endif // OBVI_SIMD_NEON
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Runtime dispatch.
+    bool cpu_has_avx2() {
+#if !defined(OBVI_BATCH_AVX2)
+        return false;
+#elif defined(_MSC_VER)
+        // Need the AVX2 CPUID bit, and the OS has to save the upper halves of the ymm registers.
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx     = (info[2] & (1 << 28)) != 0;
+        if(!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        // GCC or Clang (checks the OS support bits too).
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+
+    bool isa_available(simd_isa isa) {
+        switch(isa) {
+            case simd_isa::SCALAR: return true;
+#if defined(OBVI_SIMD_SSE)
+            case simd_isa::SSE2:   return true;
+#endif
+#if defined(OBVI_SIMD_NEON)
+            case simd_isa::NEON:   return true;
+#endif
+            case simd_isa::AVX2:   return cpu_has_avx2();
+            default:               return false;
+        }
+    }
+
+    const kernels *kernels_for(simd_isa isa) {
+        switch(isa) {
+#if defined(OBVI_SIMD_SSE)
+            case simd_isa::SSE2: return &sse2_kernels;
+#endif
+#if defined(OBVI_SIMD_NEON)
+            case simd_isa::NEON: return &neon_kernels;
+#endif
+#if defined(OBVI_BATCH_AVX2)
+            case simd_isa::AVX2: return &obvi::batch_detail::avx2_kernels;
+#endif
+            default:             return &scalar_kernels;
+        }
+    }
+
+    struct dispatch {
+        simd_isa       isa;
+        const kernels *impl;
+    };
+
+    // One immutable entry per instruction set (indexed by simd_isa), so that switching is a single
+    // pointer store.
+    const dispatch *dispatch_for(simd_isa isa) {
+        static const dispatch table[] = {
+            {simd_isa::SCALAR, kernels_for(simd_isa::SCALAR)},
+            {simd_isa::SSE2,   kernels_for(simd_isa::SSE2)},
+            {simd_isa::NEON,   kernels_for(simd_isa::NEON)},
+            {simd_isa::AVX2,   kernels_for(simd_isa::AVX2)}
+        };
+        return &table[size_t(isa)];
+    }
+
+    // Pick the widest instruction set this CPU supports.
+    simd_isa best_isa() {
+        const simd_isa order[] = {simd_isa::AVX2, simd_isa::SSE2, simd_isa::NEON};
+        for(simd_isa candidate : order) {
+            if(isa_available(candidate)) {
+                return candidate;
+            }
+        }
+        return simd_isa::SCALAR;
+    }
+
+    std::atomic<const dispatch*>& current() {
+        // initialized on first use (thread-safe)
+        static std::atomic<const dispatch*> d(dispatch_for(best_isa()));
+        return d;
+    }
+
+    const kernels *current_impl() {
+        return current().load(std::memory_order_acquire)->impl;
+    }
+} // END anonymous namespace
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public functions.
+const char *obvi::to_string(simd_isa isa) {
+    switch(isa) {
+        case simd_isa::SCALAR: return "scalar";
+        case simd_isa::SSE2:   return "sse2";
+        case simd_isa::NEON:   return "neon";
+        case simd_isa::AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+simd_isa obvi::batch_isa() {
+    return current().load(std::memory_order_acquire)->isa;
+}
+
+bool obvi::set_batch_isa(simd_isa isa) {
+    if(!isa_available(isa)) {
+        return false;
+    }
+    current().store(dispatch_for(isa), std::memory_order_release);
+    return true;
+}
+
+void obvi::transform_points(const affine3f& tf, const float *x, const float *y, const float *z,
+                            size_t n, float *out_x, float *out_y, float *out_z) {
+    // Fold the scale into the rotation: y = (rot * scale) * x + tr.
+    float m[12];
+    for(size_t row=0; row<3; ++row) {
+        for(size_t col=0; col<3; ++col) {
+            m[4 * row + col] = tf.rotation()(row, col) * tf.scale();
+        }
+        m[4 * row + 3] = tf.translation()[row];
+    }
+    current_impl()->transform_points(m, x, y, z, n, out_x, out_y, out_z);
+}
+
+void obvi::triangle_bounds(const vec3f *positions, const uint32_t *indices, size_t num_tris,
+                           bboxf *out_boxes) {
+    current_impl()->triangle_bounds(reinterpret_cast<const float*>(positions), indices, num_tris,
+                                    reinterpret_cast<float*>(out_boxes));
+}
+
+void obvi::morton_codes_30(const float *x, const float *y, const float *z, size_t n,
+                           const vec3f& offset, const vec3f& scale, uint32_t *out) {
+    const float off[3] = {offset.x(), offset.y(), offset.z()};
+    const float mul[3] = {scale.x(), scale.y(), scale.z()};
+    current_impl()->morton_codes_30(x, y, z, n, off, mul, out);
+}
+
+void obvi::morton_codes_63(const float *x, const float *y, const float *z, size_t n,
+                           const vec3f& offset, const vec3f& scale, uint64_t *out) {
+    const float off[3] = {offset.x(), offset.y(), offset.z()};
+    const float mul[3] = {scale.x(), scale.y(), scale.z()};
+    current_impl()->morton_codes_63(x, y, z, n, off, mul, out);
+}
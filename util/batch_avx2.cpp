@@ -0,0 +1,270 @@
+/* AVX2 versions of the batch kernels (compiled with AVX2 enabled, only called if the CPU has it).
+ *
+ * Don't include anything from the library here except batch_kernels.hpp (see the note there).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include "batch_kernels.hpp"
+
+#include <immintrin.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    // Scalar versions, for the last few elements of each array. Same operation order as the
+    // vector code, so every element gets the same result.
+    inline float min3(float a, float b, float c) {
+        float m = (b < a)? b : a;
+        return (c < m)? c : m;
+    }
+    inline float max3(float a, float b, float c) {
+        float m = (a < b)? b : a;
+        return (m < c)? c : m;
+    }
+
+    inline uint32_t scaled_int(float v, float offset, float scale, float max_val) {
+        v = (v - offset) * scale;
+        v = (v > 0.0f)? v : 0.0f; // also maps NaN to 0
+        v = (v < max_val)? v : max_val;
+        return uint32_t(v);
+    }
+
+    inline uint32_t expand_30(uint32_t v) {
+        v = v & 0x3FFu;
+        v = (v | (v << 16)) & 0x030000FFu;
+        v = (v | (v <<  8)) & 0x0300F00Fu;
+        v = (v | (v <<  4)) & 0x030C30C3u;
+        v = (v | (v <<  2)) & 0x09249249u;
+        return v;
+    }
+
+    inline uint64_t expand_63(uint64_t v) {
+        v = v & 0x1FFFFFu;
+        v = (v | (v << 32)) & 0x001F00000000FFFFull;
+        v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+        v = (v | (v <<  8)) & 0x100F00F00F00F00Full;
+        v = (v | (v <<  4)) & 0x10C30C30C30C30C3ull;
+        v = (v | (v <<  2)) & 0x1249249249249249ull;
+        return v;
+    }
+
+    void triangle_bounds_scalar(const float *xyz, const uint32_t *indices, size_t num_tris,
+                                float *out_boxes) {
+        for(size_t t=0; t<num_tris; ++t) {
+            const float *a = xyz + 3 * size_t(indices[3 * t]);
+            const float *b = xyz + 3 * size_t(indices[3 * t + 1]);
+            const float *c = xyz + 3 * size_t(indices[3 * t + 2]);
+            float       *o = out_boxes + 6 * t;
+            for(size_t k=0; k<3; ++k) {
+                o[k]     = min3(a[k], b[k], c[k]);
+                o[k + 3] = max3(a[k], b[k], c[k]);
+            }
+        }
+    }
+
+    // Vector versions.
+    inline __m256i scaled_int(__m256 v, __m256 offset, __m256 scale, __m256 max_val) {
+        v = _mm256_mul_ps(_mm256_sub_ps(v, offset), scale);
+        v = _mm256_max_ps(v, _mm256_setzero_ps()); // returns 2nd operand (0) if v is NaN
+        v = _mm256_min_ps(v, max_val);
+        return _mm256_cvttps_epi32(v);
+    }
+
+    inline __m256i expand_30(__m256i v) {
+        v = _mm256_and_si256(v, _mm256_set1_epi32(0x3FF));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 16)),
+                             _mm256_set1_epi32(0x030000FF));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)),
+                             _mm256_set1_epi32(0x0300F00F));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)),
+                             _mm256_set1_epi32(0x030C30C3));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)),
+                             _mm256_set1_epi32(0x09249249));
+        return v;
+    }
+
+    inline __m256i expand_63(__m256i v) {
+        v = _mm256_and_si256(v, _mm256_set1_epi64x(0x1FFFFFll));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 32)),
+                             _mm256_set1_epi64x(0x001F00000000FFFFll));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 16)),
+                             _mm256_set1_epi64x(0x001F0000FF0000FFll));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 8)),
+                             _mm256_set1_epi64x(0x100F00F00F00F00Fll));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 4)),
+                             _mm256_set1_epi64x(0x10C30C30C30C30C3ll));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 2)),
+                             _mm256_set1_epi64x(0x1249249249249249ll));
+        return v;
+    }
+
+    // Interleave the expanded bits of x, y and z (x highest).
+    inline __m256i interleave_30(__m256i x, __m256i y, __m256i z) {
+        return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(x, 2), _mm256_slli_epi32(y, 1)), z);
+    }
+    inline __m256i interleave_63(__m256i x, __m256i y, __m256i z) {
+        return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi64(x, 2), _mm256_slli_epi64(y, 1)), z);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Kernels.
+    void transform_points(const float m[12], const float *x, const float *y, const float *z,
+                          size_t n, float *out_x, float *out_y, float *out_z) {
+        __m256 mv[12];
+        for(size_t i=0; i<12; ++i) {
+            mv[i] = _mm256_set1_ps(m[i]);
+        }
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            const __m256 vx = _mm256_loadu_ps(x + i);
+            const __m256 vy = _mm256_loadu_ps(y + i);
+            const __m256 vz = _mm256_loadu_ps(z + i);
+            __m256 res[3];
+            for(size_t r=0; r<3; ++r) {
+                const __m256 *row = mv + 4 * r;
+                res[r] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(row[0], vx),
+                    _mm256_mul_ps(row[1], vy)), _mm256_mul_ps(row[2], vz)), row[3]);
+            }
+            _mm256_storeu_ps(out_x + i, res[0]);
+            _mm256_storeu_ps(out_y + i, res[1]);
+            _mm256_storeu_ps(out_z + i, res[2]);
+        }
+        for(; i<n; ++i) {
+            const float vx = x[i], vy = y[i], vz = z[i];
+            out_x[i] = m[0] * vx + m[1] * vy + m[2]  * vz + m[3];
+            out_y[i] = m[4] * vx + m[5] * vy + m[6]  * vz + m[7];
+            out_z[i] = m[8] * vx + m[9] * vy + m[10] * vz + m[11];
+        }
+    }
+
+    // Load 3 floats without reading past the end (last element is 0).
+    inline __m128 load3(const float *p) {
+        return _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+    }
+
+    // Corner k of triangles t (low half) and t + 1 (high half).
+    inline __m256 load_corners(const float *xyz, const uint32_t *indices, size_t t, size_t k) {
+        const __m128 first  = load3(xyz + 3 * size_t(indices[3 * t + k]));
+        const __m128 second = load3(xyz + 3 * size_t(indices[3 * t + 3 + k]));
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(first), second, 1);
+    }
+
+    void triangle_bounds(const float *xyz, const uint32_t *indices, size_t num_tris,
+                         float *out_boxes) {
+        // Two triangles at a time, each with its x,y,z in one half of the register. (Gathering
+        // 8 triangles in SoA form is slower: the gathers and the transpose back to boxes cost
+        // more than they save.)
+        size_t t = 0;
+        for(; t + 2 <= num_tris; t += 2) {
+            const __m256 a  = load_corners(xyz, indices, t, 0);
+            const __m256 b  = load_corners(xyz, indices, t, 1);
+            const __m256 c  = load_corners(xyz, indices, t, 2);
+            // Same comparison order as min3() and max3().
+            const __m256 lo = _mm256_min_ps(c, _mm256_min_ps(b, a));
+            const __m256 hi = _mm256_max_ps(c, _mm256_max_ps(b, a));
+            // Boxes are 6 floats: write lo0 hi0 lo1 hi1 with overlapping 4-wide stores, each
+            // one's extra float overwritten by the next (except the last, handled separately).
+            float *o = out_boxes + 6 * t;
+            _mm_storeu_ps(o,     _mm256_castps256_ps128(lo));
+            _mm_storeu_ps(o + 3, _mm256_castps256_ps128(hi));
+            _mm_storeu_ps(o + 6, _mm256_extractf128_ps(lo, 1));
+            const __m128 hi1 = _mm256_extractf128_ps(hi, 1);
+            if(t + 2 < num_tris) {
+                _mm_storeu_ps(o + 9, hi1);
+            } else {
+                _mm_storel_pi(reinterpret_cast<__m64*>(o + 9), hi1);
+                _mm_store_ss(o + 11, _mm_movehl_ps(hi1, hi1));
+            }
+        }
+        triangle_bounds_scalar(xyz, indices + 3 * t, num_tris - t, out_boxes + 6 * t);
+    }
+
+    void morton_codes_30(const float *x, const float *y, const float *z, size_t n,
+                         const float offset[3], const float scale[3], uint32_t *out) {
+        const float max_val = 1023.0f; // morton_30_max - 1
+        __m256 voff[3], vscale[3];
+        for(int d=0; d<3; ++d) {
+            voff[d]   = _mm256_set1_ps(offset[d]);
+            vscale[d] = _mm256_set1_ps(scale[d]);
+        }
+        const __m256 vmax = _mm256_set1_ps(max_val);
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            __m256i xx = expand_30(scaled_int(_mm256_loadu_ps(x + i), voff[0], vscale[0], vmax));
+            __m256i yy = expand_30(scaled_int(_mm256_loadu_ps(y + i), voff[1], vscale[1], vmax));
+            __m256i zz = expand_30(scaled_int(_mm256_loadu_ps(z + i), voff[2], vscale[2], vmax));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), interleave_30(xx, yy, zz));
+        }
+        for(; i<n; ++i) {
+            uint32_t xx = expand_30(scaled_int(x[i], offset[0], scale[0], max_val));
+            uint32_t yy = expand_30(scaled_int(y[i], offset[1], scale[1], max_val));
+            uint32_t zz = expand_30(scaled_int(z[i], offset[2], scale[2], max_val));
+            out[i] = (xx << 2) | (yy << 1) | zz;
+        }
+    }
+
+    void morton_codes_63(const float *x, const float *y, const float *z, size_t n,
+                         const float offset[3], const float scale[3], uint64_t *out) {
+        const float max_val = 2097151.0f; // morton_63_max - 1
+        __m256 voff[3], vscale[3];
+        for(int d=0; d<3; ++d) {
+            voff[d]   = _mm256_set1_ps(offset[d]);
+            vscale[d] = _mm256_set1_ps(scale[d]);
+        }
+        const __m256 vmax = _mm256_set1_ps(max_val);
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            // Convert to 8 32-bit ints, then widen each half to 4 64-bit ints.
+            __m256i ints[3];
+            ints[0] = scaled_int(_mm256_loadu_ps(x + i), voff[0], vscale[0], vmax);
+            ints[1] = scaled_int(_mm256_loadu_ps(y + i), voff[1], vscale[1], vmax);
+            ints[2] = scaled_int(_mm256_loadu_ps(z + i), voff[2], vscale[2], vmax);
+            for(int half=0; half<2; ++half) {
+                __m256i wide[3];
+                for(int d=0; d<3; ++d) {
+                    __m128i part = (half == 0)? _mm256_castsi256_si128(ints[d])
+                                              : _mm256_extracti128_si256(ints[d], 1);
+                    wide[d] = expand_63(_mm256_cvtepu32_epi64(part));
+                }
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 4 * size_t(half)),
+                                    interleave_63(wide[0], wide[1], wide[2]));
+            }
+        }
+        for(; i<n; ++i) {
+            uint64_t xx = expand_63(scaled_int(x[i], offset[0], scale[0], max_val));
+            uint64_t yy = expand_63(scaled_int(y[i], offset[1], scale[1], max_val));
+            uint64_t zz = expand_63(scaled_int(z[i], offset[2], scale[2], max_val));
+            out[i] = (xx << 2) | (yy << 1) | zz;
+        }
+    }
+} // END anonymous namespace
+
+
+const obvi::batch_detail::kernels obvi::batch_detail::avx2_kernels = {
+    transform_points,
+    triangle_bounds,
+    morton_codes_30,
+    morton_codes_63
+};
@@ -0,0 +1,64 @@
+/* Private header shared by the batch kernel implementations (not installed).
+ *
+ * Kernels for instruction sets the whole build can't assume (like AVX2) live in their own source
+ * files, compiled with extra flags. This header is all those files include from the library, so
+ * no inline function gets compiled with instructions the CPU might not have and then picked over
+ * the baseline copy by the linker. That's also why it only uses plain pointers: bboxf is passed
+ * as 6 floats (min x,y,z then max x,y,z), affine3f as a 3x4 row-major matrix.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_BATCH_KERNELS_HPP
+#define OBVI_BATCH_KERNELS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace obvi {
+namespace batch_detail {
+
+// One implementation of every batch function. See batch.hpp for what they do.
+struct kernels {
+    // m is rotation * scale in columns 0-2 and translation in column 3, row-major.
+    void (*transform_points)(const float m[12], const float *x, const float *y, const float *z,
+                             size_t n, float *out_x, float *out_y, float *out_z);
+
+    // xyz is 3 floats per vertex, out_boxes is 6 floats per triangle.
+    void (*triangle_bounds)(const float *xyz, const uint32_t *indices, size_t num_tris,
+                            float *out_boxes);
+
+    void (*morton_codes_30)(const float *x, const float *y, const float *z, size_t n,
+                            const float offset[3], const float scale[3], uint32_t *out);
+
+    void (*morton_codes_63)(const float *x, const float *y, const float *z, size_t n,
+                            const float offset[3], const float scale[3], uint64_t *out);
+};
+
+// AVX2 versions (batch_avx2.cpp). Only exists if OBVI_BATCH_AVX2 is defined.
+extern const kernels avx2_kernels;
+
+} // END namespace batch_detail
+} // END namespace obvi
+#endif // OBVI_BATCH_KERNELS_HPP
@@ -31,10 +31,17 @@
  * THE SOFTWARE.
  * * * * * * * * * * * *
  */
+#include <obvi/util/batch.hpp>
 #include <obvi/util/bvh.hpp>
 #include <obvi/util/compat_omp.hpp>
 #include <obvi/util/math.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <type_traits>
+
 using obvi::bboxf;
 using obvi::vec3f;
 
@@ -42,57 +49,104 @@ using obvi::vec3f;
 // Helper code - only visible inside this file.
 namespace {
     struct obj {
-        uint32_t code = 0;
+        uint64_t code = 0;
         uint32_t idx  = 0;
     };
 
+    // Arrays that are filled and read by parallel loops (see first_touch_allocator.hpp).
+    template<typename T>
+    using scratch_vector = std::vector<T, obvi::first_touch_allocator<T>>;
+    using node_vector    = scratch_vector<obvi::bvh::node>;
+
+    // Time of one phase of a build, for bvh_build_stats.
+    struct phase_timer {
+        using clock = std::chrono::steady_clock;
+        clock::time_point start = clock::now();
+
+        // Seconds since construction or the last call, and restart.
+        double lap() {
+            clock::time_point now = clock::now();
+            double sec = std::chrono::duration<double>(now - start).count();
+            start = now;
+            return sec;
+        }
+    };
+
     // Parallel radix sort code adapted from here:
     //    https://haichuanwang.wordpress.com/2014/05/26/a-faster-openmp-radix-sort-implementation
     //
-    // TODO: generalize the parallel_radix_sort function so we can pass in a comparator, and
-    //       template it to allow use with 64-bit values.
-    uint32_t digits(const uint32_t v, const int shift, const uint32_t mask) {
-        return (v >> shift) & mask;
+    // Sorts 'items' in ascending order of the unsigned integer key returned by 'key(item)'.
+    // The sort is stable. 'buffer' is used as scratch space, its contents are undefined afterwards.
+    //
+    // Passes for digits that have the same value in every key are skipped entirely. So, sorting
+    // 64-bit keys that only use a few of their bits costs about the same as sorting 32-bit keys.
+    template<typename key_t>
+    uint32_t digits(const key_t v, const int shift, const uint32_t mask) {
+        return (uint32_t)(v >> shift) & mask;
     }
-    void parallel_radix_sort(std::vector<obj>& objs) {
+    template<typename vector_t, typename key_func>
+    void parallel_radix_sort(vector_t& items, vector_t& buffer, key_func key) {
+        using key_t = typename std::decay<decltype(key(items[0]))>::type;
+        static_assert(std::is_unsigned<key_t>::value, "radix sort key must be an unsigned integer");
+
         constexpr int      base_bits = 8;
         constexpr int      base      = 1 << base_bits;
         constexpr uint32_t mask      = base - 1;
 
-        std::vector<obj> buffer;
+        int total_digits = (int)sizeof(key_t)*8;
+        int nitems       = (int)items.size();
 
-        int total_digits = (int)sizeof(uint32_t)*8;
-        int nobjs        = (int)objs.size();
-        int i; //loop indices must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        if(nitems < 2) {
+            return;
+        }
+        buffer.resize(items.size());
+
+        // Find out which bits actually differ between the keys, so we can skip constant digits.
+        key_t first_key = key(items[0]);
+        key_t varying   = 0;
+#       pragma omp parallel
+        {
+            key_t local_varying = 0;
+#           pragma omp for schedule(static) nowait
+            for(int i = 0; i < nitems; i++) { //loop indices must be 'int' for old OpenMP (v2.5)
+                local_varying |= key(items[(size_t)i]) ^ first_key;
+            }
+#           pragma omp critical
+            varying |= local_varying;
+        }
 
         //Each thread use local_bucket to move data
         for(int shift = 0; shift < total_digits; shift+=base_bits) {
+            if(digits(varying, shift, mask) == 0) {
+                continue; // every key has the same value for this digit, order wouldn't change.
+            }
+
             size_t bucket[base] = {0};
 
             size_t local_bucket[base] = {0}; // size needed in each bucket/thread
             //1st pass, scan whole and check the count
-#               pragma omp parallel firstprivate(local_bucket)
+#           pragma omp parallel firstprivate(local_bucket)
             {
 #               pragma omp for schedule(static) nowait
-                for(i = 0; i < nobjs; i++){
-                    local_bucket[digits(objs[(size_t)i].code, shift, mask)]++;
+                for(int i = 0; i < nitems; i++){
+                    local_bucket[digits(key(items[(size_t)i]), shift, mask)]++;
                 }
 #               pragma omp critical
-                for(i = 0; i < base; i++) {
-                    bucket[i] += local_bucket[i];
+                for(int b = 0; b < base; b++) {
+                    bucket[b] += local_bucket[b];
                 }
 #               pragma omp barrier
 #               pragma omp single
-                for(i = 1; i < base; i++) {
-                    bucket[i] += bucket[i - 1];
+                for(int b = 1; b < base; b++) {
+                    bucket[b] += bucket[b - 1];
                 }
                 int nthreads = omp_get_num_threads();
                 int tid = omp_get_thread_num();
                 for(int cur_t = nthreads - 1; cur_t >= 0; cur_t--) {
                     if(cur_t == tid) {
-                        for(i = 0; i < base; i++) {
-                            bucket[i] -= local_bucket[i];
-                            local_bucket[i] = bucket[i];
+                        for(int b = 0; b < base; b++) {
+                            bucket[b] -= local_bucket[b];
+                            local_bucket[b] = bucket[b];
                         }
                     } else { //just do barrier
 #                       pragma omp barrier
@@ -100,121 +154,676 @@ namespace {
 
                 }
 #               pragma omp for schedule(static)
-                for(i = 0; i < nobjs; i++) { //note here the end condition
-                    buffer[local_bucket[digits(objs[(size_t)i].code, shift, mask)]++]
-                        = objs[(size_t)i];
+                for(int i = 0; i < nitems; i++) { //note here the end condition
+                    buffer[local_bucket[digits(key(items[(size_t)i]), shift, mask)]++]
+                        = items[(size_t)i];
                 }
             }
             //now move data from buffer back into original vector.
-            std::swap(objs, buffer);
+            std::swap(items, buffer);
         }
     }
 
     // Make list of morton code and index for each bounding box, then sort it.
-    void make_obj_list(std::vector<obj>& objs, const std::vector<bboxf> &boxes, const bboxf& root_box) {
+    void make_obj_list(scratch_vector<obj>& objs, scratch_vector<obj>& buffer,
+                       const std::vector<bboxf> &boxes, const bboxf& root_box,
+                       obvi::bvh_build_stats& stats) {
+        phase_timer timer;
         objs.resize(boxes.size());
 
-        // Multiplier used when converting bbox centroids to lie in range [0,1024) for x, y, and z.
-        vec3f mult = 1024.0f / (root_box.max_pt - root_box.min_pt);
+        // Multiplier used when converting bbox centroids to lie in range [0,2^21) for x, y, and z.
+        // If the scene is flat in some dimension, all the codes get 0 for that dimension.
+        vec3f extent = root_box.max_pt - root_box.min_pt;
+        vec3f mult;
+        for(size_t i=0; i<3; ++i) {
+            mult[i] = (extent[i] > 0.0f)? float(obvi::morton_63_max) / extent[i] : 0.0f;
+        }
 
         // Compute morton codes for center of each box, store in obj list along with object's index
-        // in the boxes array.
+        // in the boxes array. Centers are copied out a block at a time into separate x, y and z
+        // arrays, for the SIMD morton kernel.
+        const size_t block      = 1024;
+        const size_t num_blocks = (boxes.size() + block - 1) / block;
 #       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
-        for(int i=0; i<(int)boxes.size(); ++i) {
-            // Get center of bounding box, transform so that it lies on range [0,1024] for all dims.
-            vec3f center = (boxes[(size_t)i].center() - root_box.min_pt) * mult;
-            // Set morton code of box center and index, in objs array.
-            objs[(size_t)i].code = obvi::morton_encode_30(center.x(), center.y(), center.z());
-            objs[(size_t)i].idx  = (uint32_t)i;
+        for(int b=0; b<(int)num_blocks; ++b) {
+            const size_t first = (size_t)b * block;
+            const size_t count = std::min(block, boxes.size() - first);
+
+            float    cx[block], cy[block], cz[block];
+            uint64_t codes[block];
+            for(size_t i=0; i<count; ++i) {
+                vec3f center = boxes[first + i].center();
+                cx[i] = center.x();
+                cy[i] = center.y();
+                cz[i] = center.z();
+            }
+            // Map centers onto [0,2^21) in all dims, and interleave their bits.
+            obvi::morton_codes_63(cx, cy, cz, count, root_box.min_pt, mult, codes);
+            for(size_t i=0; i<count; ++i) {
+                objs[first + i].code = codes[i];
+                objs[first + i].idx  = (uint32_t)(first + i);
+            }
         }
 
+        stats.morton_sec = timer.lap();
+
         // Sort the objects list in morton-code order.
         //std::sort(objs.begin(), objs.end(), [](const obj& a, const obj& b){ return a.code < b.code; });
-        parallel_radix_sort(objs); //should be faster
+        parallel_radix_sort(objs, buffer, [](const obj& o) { return o.code; }); //should be faster
+        stats.sort_sec = timer.lap();
+    }
+
+    // Number of highest bits shared by the Morton codes of objects i and j, used to decide where
+    // to split ranges of objects. If the codes are identical, the object indices are used to break
+    // the tie, so every object ends up with a unique key.
+    //
+    // Returns -1 if j lies outside the list of objects.
+    int common_prefix(const scratch_vector<obj> &objs, int64_t i, int64_t j) {
+        if(j < 0 || j >= (int64_t)objs.size()) {
+            return -1;
+        }
+        uint64_t code_i = objs[(size_t)i].code;
+        uint64_t code_j = objs[(size_t)j].code;
+        if(code_i == code_j) {
+            return 64 + (int)obvi::count_leading_zeros((uint32_t)i ^ (uint32_t)j);
+        }
+        return (int)obvi::count_leading_zeros_64(code_i ^ code_j);
     }
 
-    // Use binary search to find the index of the object where the highest non-common bit
-    // in the morton code changes from 0 to 1.
+    // Binary radix tree node used during Morton BVH construction.
+    //
+    // There are exactly (num_objs - 1) of these, and the root is always lbvh[0]. Children with the
+    // top bit set are leaves (31 low bits are index into the sorted objs list), otherwise they are
+    // indices of other internal nodes.
+    struct lbvh_node {
+        bboxf    box;
+        uint32_t child[2];
+        uint32_t parent;
+        uint32_t first; // index of first sorted object covered by this node
+        uint32_t last;  // index of last sorted object covered by this node (inclusive)
+    };
+
+    constexpr uint32_t lbvh_leaf_bit  = 1u << 31;
+    constexpr uint32_t lbvh_no_parent = 0xFFFFFFFFu;
+
+    // Build the internal node structure of the tree for the sorted objects, all nodes in parallel.
     //
-    // Returns the index of the last element where that bit is zero. split+1 is the first element
-    // that has 1 in that bit.
-    size_t find_split(const std::vector<obj> &objs, size_t first, size_t last) {
-        uint32_t first_code = objs[first].code;
-        uint32_t last_code = objs[last].code;
+    // Each internal node can find its own range of objects and split point just by searching the
+    // sorted Morton codes, without needing any information from its parent. See:
+    //   T. Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees".
+    //   https://devblogs.nvidia.com/thinking-parallel-part-iii-tree-construction-gpu/
+    void build_radix_tree(scratch_vector<lbvh_node>& lbvh, scratch_vector<uint32_t>& leaf_parent,
+                          const scratch_vector<obj> &objs) {
+        int64_t nobjs = (int64_t)objs.size();
 
-        // Identical Morton codes => split the range in the middle.
-        // Remember, Morton codes are buckets in real space - you can have multiple objects
-        // in the same bucket.
-        if(first_code == last_code) {
-            return (first + last) / 2;
+        lbvh[0].parent = lbvh_no_parent;
+
+#       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int ii=0; ii<(int)(nobjs - 1); ++ii) {
+            int64_t i = ii;
+
+            // Determine direction of the range (+1 or -1).
+            int64_t d = (common_prefix(objs, i, i + 1) > common_prefix(objs, i, i - 1))? 1 : -1;
+
+            // Compute upper bound for the length of the range.
+            int     prefix_min = common_prefix(objs, i, i - d);
+            int64_t lmax       = 2;
+            while(common_prefix(objs, i, i + lmax * d) > prefix_min) {
+                lmax *= 2;
+            }
+
+            // Find the other end of the range using binary search.
+            int64_t l = 0;
+            for(int64_t t = lmax / 2; t >= 1; t /= 2) {
+                if(common_prefix(objs, i, i + (l + t) * d) > prefix_min) {
+                    l += t;
+                }
+            }
+            int64_t j = i + l * d;
+
+            // Find the split position using binary search.
+            int     prefix_node = common_prefix(objs, i, j);
+            int64_t s           = 0;
+            int64_t t           = l;
+            do {
+                t = (t + 1) / 2;
+                if(common_prefix(objs, i, i + (s + t) * d) > prefix_node) {
+                    s += t;
+                }
+            } while(t > 1);
+            int64_t split = i + s * d + std::min(d, (int64_t)0);
+
+            // Output child pointers. The left child covers [first,split], and the right child
+            // covers [split+1,last].
+            int64_t    first = std::min(i, j);
+            int64_t    last  = std::max(i, j);
+            lbvh_node& nd    = lbvh[(size_t)i];
+            nd.first = (uint32_t)first;
+            nd.last  = (uint32_t)last;
+
+            if(first == split) {
+                nd.child[0] = lbvh_leaf_bit | (uint32_t)split;
+                leaf_parent[(size_t)split] = (uint32_t)i;
+            } else {
+                nd.child[0] = (uint32_t)split;
+                lbvh[(size_t)split].parent = (uint32_t)i;
+            }
+
+            if(last == split + 1) {
+                nd.child[1] = lbvh_leaf_bit | (uint32_t)(split + 1);
+                leaf_parent[(size_t)(split + 1)] = (uint32_t)i;
+            } else {
+                nd.child[1] = (uint32_t)(split + 1);
+                lbvh[(size_t)(split + 1)].parent = (uint32_t)i;
+            }
         }
+    }
 
-        // Calculate the number of highest bits that are the same
-        // for all objects, using the count-leading-zeros intrinsic.
+    // Calculate the bounding boxes of all internal nodes in parallel, working up from the leaves.
+    //
+    // One thread is started per leaf. When a thread reaches an internal node, it atomically
+    // increments that node's visit counter. The first thread to arrive stops, and the second one
+    // (which knows both children are complete) computes the node's box and continues upward.
+    void refit_radix_tree(scratch_vector<lbvh_node>& lbvh, const scratch_vector<uint32_t>& leaf_parent,
+                          const std::vector<bboxf>& boxes, const scratch_vector<obj> &objs,
+                          std::atomic<uint32_t> *visits) {
+        size_t nobjs = objs.size();
 
-        uint32_t common_prefix = obvi::count_leading_zeros(first_code ^ last_code);
+#       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)(nobjs - 1); ++i) {
+            visits[(size_t)i].store(0, std::memory_order_relaxed);
+        }
 
-        // Use binary search to find where the next bit differs.
-        // Specifically, we are looking for the highest object that
-        // shares more than common_prefix bits with the first one.
+#       pragma omp parallel for
+        for(int i=0; i<(int)nobjs; ++i) {
+            uint32_t curr = leaf_parent[(size_t)i];
+            while(curr != lbvh_no_parent) {
+                if(visits[curr].fetch_add(1, std::memory_order_acq_rel) == 0) {
+                    break; // first child to arrive, let the sibling's thread finish this node.
+                }
 
-        size_t split = first; // initial guess
-        size_t step = last - first;
+                lbvh_node& nd = lbvh[curr];
+                nd.box.clear();
+                for(uint32_t child : nd.child) {
+                    if(child & lbvh_leaf_bit) {
+                        nd.box.expand(boxes[objs[child & ~lbvh_leaf_bit].idx]);
+                    } else {
+                        nd.box.expand(lbvh[child].box);
+                    }
+                }
+                curr = nd.parent;
+            }
+        }
+    }
 
-        do {
-            step = (step + 1) / 2; // exponential decrease in step size
-            size_t newSplit = split + step; // proposed new position
+    // A subtree of the radix tree that still needs to be copied into the final BVH.
+    struct emit_job {
+        uint32_t ref; // index of internal node, or sorted object index with lbvh_leaf_bit set
+        size_t   pos; // location of the subtree's root in the final tree
+    };
 
-            if(newSplit < last) {
-                uint32_t split_prefix = obvi::count_leading_zeros(first_code ^ objs[newSplit].code);
-                if (split_prefix > common_prefix) {
-                    split = newSplit; // accept proposal
+    // Number of leaves in the radix tree subtree with the given root.
+    size_t subtree_leaves(const scratch_vector<lbvh_node>& lbvh, uint32_t ref) {
+        if(ref & lbvh_leaf_bit) {
+            return 1;
+        }
+        return (size_t)(lbvh[ref].last - lbvh[ref].first) + 1;
+    }
+
+    // Copy a single radix tree node into its place in the final BVH, return jobs for its children.
+    //
+    // Note that we're storing the BVH linearly in memory, in depth-first traversal order. A
+    // subtree with N leaves has (2*N - 1) nodes, so the left child immediately follows its parent,
+    // and the right child immediately follows the entire left subtree.
+    size_t emit_node(node_vector& tree, const scratch_vector<lbvh_node>& lbvh,
+                     const std::vector<bboxf>& boxes, const scratch_vector<obj> &objs,
+                     const emit_job& job, emit_job children[2]) {
+        if(job.ref & lbvh_leaf_bit) {
+            // Single object => leaf node. Need to set top bit to 1 to mark as leaf.
+            uint32_t idx = objs[job.ref & ~lbvh_leaf_bit].idx;
+            tree[job.pos] = {boxes[idx], (1u<<31) | idx};
+            return 0;
+        }
+        // Multiple objects => internal node. Leave top bit set to 0.
+        const lbvh_node& nd = lbvh[job.ref];
+        tree[job.pos] = {nd.box, (uint32_t)(2 * (nd.last - nd.first) + 1)};
+
+        children[0] = {nd.child[0], job.pos + 1};
+        children[1] = {nd.child[1], job.pos + 2 * subtree_leaves(lbvh, nd.child[0])};
+        return 2;
+    }
+
+    // Recursively copy the given radix tree subtree into the final BVH.
+    void emit_subtree(node_vector& tree, const scratch_vector<lbvh_node>& lbvh,
+                      const std::vector<bboxf>& boxes, const scratch_vector<obj> &objs,
+                      const emit_job& job) {
+        emit_job children[2];
+        size_t   nchildren = emit_node(tree, lbvh, boxes, objs, job, children);
+        for(size_t i=0; i<nchildren; ++i) {
+            emit_subtree(tree, lbvh, boxes, objs, children[i]);
+        }
+    }
+
+    // Scratch memory of the Morton builder (see bvh_builder).
+    struct morton_scratch {
+        scratch_vector<obj>                      objs;
+        scratch_vector<obj>                      sort_buffer;
+        scratch_vector<lbvh_node>                lbvh;
+        scratch_vector<uint32_t>                 leaf_parent;
+        std::unique_ptr<std::atomic<uint32_t>[]> visits; // atomics can't live in a vector
+        size_t                                   num_visits = 0;
+        std::vector<emit_job>                    jobs;
+        std::vector<emit_job>                    next_jobs;
+
+        size_t capacity_bytes() const {
+            return (objs.capacity() + sort_buffer.capacity()) * sizeof(obj)
+                 + lbvh.capacity() * sizeof(lbvh_node) + leaf_parent.capacity() * sizeof(uint32_t)
+                 + num_visits * sizeof(std::atomic<uint32_t>)
+                 + (jobs.capacity() + next_jobs.capacity()) * sizeof(emit_job);
+        }
+    };
+
+    // Generate the BVH from the sorted list of objects (in s.objs).
+    //
+    // All three stages (radix tree construction, bounding box calculation, and conversion to the
+    // depth-first layout) run in parallel.
+    void generate_morton(node_vector &tree, const std::vector<bboxf>& boxes, morton_scratch& s) {
+        const scratch_vector<obj>& objs  = s.objs;
+        size_t                     nobjs = objs.size();
+
+        tree.resize(2 * nobjs - 1);
+
+        if(nobjs == 1) {
+            emit_subtree(tree, s.lbvh, boxes, objs, {lbvh_leaf_bit, 0});
+            return;
+        }
+
+        // Sizes only change the first time, or when there are more objects than ever before.
+        if(s.num_visits < nobjs - 1) {
+            s.visits.reset(new std::atomic<uint32_t>[nobjs - 1]);
+            s.num_visits = nobjs - 1;
+        }
+        s.lbvh.resize(nobjs - 1);
+        s.leaf_parent.resize(nobjs);
+        build_radix_tree(s.lbvh, s.leaf_parent, objs);
+        refit_radix_tree(s.lbvh, s.leaf_parent, boxes, objs, s.visits.get());
+
+        // Copy the top few levels of the tree serially, until we have enough independent subtrees
+        // to keep all the threads busy. Then copy the subtrees in parallel.
+        const scratch_vector<lbvh_node>& lbvh      = s.lbvh;
+        const size_t                     min_jobs  = 16 * (size_t)omp_get_max_threads();
+        std::vector<emit_job>&           jobs      = s.jobs;
+        std::vector<emit_job>&           next_jobs = s.next_jobs;
+        jobs.reserve(2 * min_jobs); // they're swapped, so give both room for the biggest list
+        next_jobs.reserve(2 * min_jobs);
+        jobs.assign(1, {0, 0});
+        while(jobs.size() < min_jobs) {
+            bool split_any = false;
+            next_jobs.clear();
+            for(const emit_job& job : jobs) {
+                emit_job children[2];
+                if(job.ref & lbvh_leaf_bit) {
+                    next_jobs.push_back(job);
+                    continue;
+                }
+                emit_node(tree, lbvh, boxes, objs, job, children);
+                next_jobs.push_back(children[0]);
+                next_jobs.push_back(children[1]);
+                split_any = true;
+            }
+            std::swap(jobs, next_jobs);
+            if(!split_any) {
+                break;
+            }
+        }
+
+#       pragma omp parallel for schedule(dynamic)
+        for(int i=0; i<(int)jobs.size(); ++i) {
+            emit_subtree(tree, lbvh, boxes, objs, jobs[(size_t)i]);
+        }
+    }
+
+    // Number of bins per axis used when evaluating the surface area heuristic.
+    constexpr size_t sah_num_bins = 16;
+
+    struct sah_bin {
+        bboxf  box;
+        size_t count = 0;
+    };
+
+    // Range of objects that still needs to be split, and where its subtree goes in the tree.
+    struct sah_job {
+        size_t first; // index of first object in range
+        size_t last;  // index of last object in range (inclusive)
+        size_t pos;   // index of the subtree's root node in the tree
+        bboxf  box;   // bounding box of all objects in range
+    };
+
+    // Partition the given range of objects using a binned surface area heuristic (SAH).
+    //
+    // Objects are sorted into bins along each axis by the centers of their bounding boxes, then
+    // the bin boundary that minimizes (area(left) * count(left) + area(right) * count(right)) is
+    // used as the split plane. Falls back to splitting the range in the middle if all the centers
+    // are identical.
+    //
+    // Returns the index of the last object in the left child. Also returns the bounding boxes of
+    // both children, so we don't have to loop over the objects again to compute them.
+    size_t sah_split(std::vector<uint32_t>& idxs, const std::vector<bboxf>& boxes,
+                     const std::vector<vec3f>& centers, size_t first, size_t last,
+                     bboxf& left_box, bboxf& right_box) {
+        bboxf center_box;
+        for(size_t i=first; i<=last; ++i) {
+            center_box.expand(centers[idxs[i]]);
+        }
+        vec3f extent = center_box.max_pt - center_box.min_pt;
+
+        float  best_cost  = std::numeric_limits<float>::infinity();
+        size_t best_axis  = 0;
+        size_t best_split = 0; // objects in bins [0,best_split) go left
+
+        for(size_t axis=0; axis<3; ++axis) {
+            if(!(extent[axis] > 0.0f)) {
+                continue; // all centers lie on the same plane in this axis, can't split here
+            }
+            float mult = float(sah_num_bins) / extent[axis];
+
+            sah_bin bins[sah_num_bins];
+            for(size_t i=first; i<=last; ++i) {
+                uint32_t idx = idxs[i];
+                size_t   b   = (size_t)((centers[idx][axis] - center_box.min_pt[axis]) * mult);
+                b = std::min(b, sah_num_bins - 1);
+                bins[b].count++;
+                bins[b].box.expand(boxes[idx]);
+            }
+
+            // Sweep from the right to get cost of the right side of each possible split.
+            float  right_cost[sah_num_bins];
+            bboxf  acc_box;
+            size_t acc_count = 0;
+            for(size_t b=sah_num_bins - 1; b>0; --b) {
+                acc_box.expand(bins[b].box);
+                acc_count    += bins[b].count;
+                right_cost[b] = (acc_count > 0)? acc_box.surface_area() * float(acc_count)
+                                               : std::numeric_limits<float>::infinity();
+            }
+
+            // Sweep from the left, combine with right side to get total cost.
+            acc_box.clear();
+            acc_count = 0;
+            for(size_t b=1; b<sah_num_bins; ++b) {
+                acc_box.expand(bins[b-1].box);
+                acc_count += bins[b-1].count;
+                if(acc_count == 0) {
+                    continue;
+                }
+                float cost = acc_box.surface_area() * float(acc_count) + right_cost[b];
+                if(cost < best_cost) {
+                    best_cost  = cost;
+                    best_axis  = axis;
+                    best_split = b;
                 }
             }
-        } while(step > 1);
+        }
+
+        left_box.clear();
+        right_box.clear();
+
+        if(best_split == 0) {
+            // Couldn't find a valid split plane => split the range in the middle.
+            size_t split = (first + last) / 2;
+            for(size_t i=first; i<=split; ++i) {
+                left_box.expand(boxes[idxs[i]]);
+            }
+            for(size_t i=split+1; i<=last; ++i) {
+                right_box.expand(boxes[idxs[i]]);
+            }
+            return split;
+        }
 
+        float mult = float(sah_num_bins) / extent[best_axis];
+        auto  mid  = std::partition(idxs.begin() + (ptrdiff_t)first, idxs.begin() + (ptrdiff_t)last + 1,
+            [&](uint32_t idx) {
+                size_t b = (size_t)((centers[idx][best_axis] - center_box.min_pt[best_axis]) * mult);
+                return std::min(b, sah_num_bins - 1) < best_split;
+            });
+        size_t split = (size_t)(mid - idxs.begin()) - 1;
+
+        for(size_t i=first; i<=split; ++i) {
+            left_box.expand(boxes[idxs[i]]);
+        }
+        for(size_t i=split+1; i<=last; ++i) {
+            right_box.expand(boxes[idxs[i]]);
+        }
         return split;
     }
 
-    // Recursively generate the BVH. Note that we're storing the BVH linearly in memory,
-    // in depth-first traversal order. So, we don't have to keep track of what level we're
-    // on in the tree when constructing it, we just build it in depth-first order too.
-    void generate(std::vector<obvi::bvh::node> &tree,
-                  const std::vector<bboxf>& boxes, const std::vector<obj>& objs,
-                  bboxf& curr_box, size_t first, size_t last) {
-        if(first == last) {
-            // Single object => add a new leaf node. Need to set top bit to 1 to mark as leaf.
-            tree.push_back({curr_box, (1u<<31) | objs[first].idx});
+    // Build a BVH subtree top-down, using the surface area heuristic to pick each split.
+    //
+    // idxs lists the objects that go in the subtree (it gets reordered), pos is the index where
+    // the subtree's root goes in the tree, and box is the bounding box of all the objects. centers
+    // holds the center of every object's box (indexed by object, like boxes).
+    //
+    // Every subtree with N leaves contains exactly (2*N - 1) nodes, so we know where each child's
+    // subtree will start in the depth-first layout as soon as we split a range. That lets us use
+    // an explicit work stack instead of recursion (SAH trees can be quite deep). It also means a
+    // subtree can be rebuilt in place, without touching the rest of the tree.
+    //
+    // jobs is only used as scratch space.
+    void build_sah_subtree(node_vector &tree, const std::vector<bboxf>& boxes,
+                           const std::vector<vec3f>& centers, std::vector<uint32_t>& idxs,
+                           size_t pos, const bboxf& box, std::vector<sah_job>& jobs) {
+        jobs.clear();
+        jobs.push_back({0, idxs.size() - 1, pos, box});
+
+        while(!jobs.empty()) {
+            sah_job job = jobs.back();
+            jobs.pop_back();
+
+            if(job.first == job.last) {
+                // Single object => leaf node. Need to set top bit to 1 to mark as leaf.
+                tree[job.pos] = {job.box, (1u<<31) | idxs[job.first]};
+                continue;
+            }
+            // Multiple objects => internal node. Leave top bit set to 0.
+            tree[job.pos] = {job.box, (uint32_t)(2 * (job.last - job.first) + 1)};
+
+            bboxf  left_box, right_box;
+            size_t split = sah_split(idxs, boxes, centers, job.first, job.last, left_box, right_box);
+
+            // Left child immediately follows parent, right child follows entire left subtree.
+            size_t left_leaves = split - job.first + 1;
+            jobs.push_back({split + 1, job.last, job.pos + 2 * left_leaves, right_box});
+            jobs.push_back({job.first, split,    job.pos + 1,               left_box});
+        }
+    }
+
+    // Scratch memory of the SAH builder (see bvh_builder).
+    struct sah_scratch {
+        std::vector<uint32_t> idxs;
+        std::vector<vec3f>    centers;
+        std::vector<sah_job>  jobs;
+
+        size_t capacity_bytes() const {
+            return idxs.capacity() * sizeof(uint32_t) + centers.capacity() * sizeof(vec3f) +
+                jobs.capacity() * sizeof(sah_job);
+        }
+    };
+
+    // Generate the whole BVH with the surface area heuristic.
+    void generate_sah(node_vector &tree, const std::vector<bboxf>& boxes,
+                      const bboxf& root_box, sah_scratch& s) {
+        size_t nobjs = boxes.size();
+
+        tree.resize(2 * nobjs - 1);
+
+        std::vector<uint32_t>& idxs    = s.idxs;
+        std::vector<vec3f>&    centers = s.centers;
+        idxs.resize(nobjs);
+        centers.resize(nobjs);
+#       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)nobjs; ++i) {
+            idxs[(size_t)i]    = (uint32_t)i;
+            centers[(size_t)i] = boxes[(size_t)i].center();
+        }
+
+        build_sah_subtree(tree, boxes, centers, idxs, 0, root_box, s.jobs);
+    }
+
+    // Recompute the bounding box of a single node from its object (leaf) or its children.
+    inline void refit_node(node_vector &tree, const std::vector<bboxf>& boxes,
+                           size_t idx) {
+        obvi::bvh::node& nd = tree[idx];
+        if(nd.is_leaf()) {
+            nd.box = boxes[nd.num & 0x7FFFFFFFu];
             return;
         }
-        // Multiple objects => add a new internal node. Leave top bit set to 0.
-        tree.push_back({curr_box, (uint32_t)(last - first + 1)});
+        size_t left  = idx + 1;
+        size_t right = left + tree[left].subtree_size();
+        nd.box = tree[left].box;
+        nd.box.expand(tree[right].box);
+    }
+
+    // Recompute all bounding boxes in the tree, without changing its structure.
+    //
+    // Children always come after their parents, so visiting nodes in reverse order guarantees that
+    // both children are updated before their parent. The tree is split into independent subtrees
+    // (contiguous ranges of nodes) that are refit in parallel, then the few nodes above them are
+    // refit serially.
+    void refit_tree(node_vector &tree, const std::vector<bboxf>& boxes) {
+        const size_t        min_jobs = 16 * (size_t)omp_get_max_threads();
+        std::vector<size_t> top;          // nodes above the job subtrees
+        std::vector<size_t> jobs = {0};   // roots of subtrees to refit in parallel
+        std::vector<size_t> next_jobs;
+        while(jobs.size() < min_jobs) {
+            bool split_any = false;
+            next_jobs.clear();
+            for(size_t idx : jobs) {
+                if(tree[idx].is_leaf()) {
+                    next_jobs.push_back(idx);
+                    continue;
+                }
+                top.push_back(idx);
+                next_jobs.push_back(idx + 1);
+                next_jobs.push_back(idx + 1 + tree[idx + 1].subtree_size());
+                split_any = true;
+            }
+            std::swap(jobs, next_jobs);
+            if(!split_any) {
+                break;
+            }
+        }
 
-        // Determine where to split the range.
-        size_t split = find_split(objs, first, last);
+#       pragma omp parallel for schedule(dynamic)
+        for(int i=0; i<(int)jobs.size(); ++i) {
+            size_t root = jobs[(size_t)i];
+            for(size_t idx = root + tree[root].subtree_size(); idx-- > root;) {
+                refit_node(tree, boxes, idx);
+            }
+        }
 
-        // Process left children, add nodes to tree.
-        curr_box.clear();
-        for(size_t i=first; i<=split; ++i) {
-            curr_box.expand(boxes[objs[i].idx]);
+        std::sort(top.begin(), top.end());
+        for(size_t j=top.size(); j-- > 0;) {
+            refit_node(tree, boxes, top[j]);
         }
-        generate(tree, boxes, objs, curr_box, first, split);
+    }
 
-        // Process right children, add nodes to tree.
-        curr_box.clear();
-        for(size_t i=split+1; i<=last; ++i) {
-            curr_box.expand(boxes[objs[i].idx]);
+    // Store the surface area of every node, to compare against after later refits.
+    void record_build_area(const node_vector &tree, std::vector<float>& build_area) {
+        build_area.resize(tree.size());
+#       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)tree.size(); ++i) {
+            build_area[(size_t)i] = tree[(size_t)i].box.surface_area();
+        }
+    }
+
+    // Find the topmost subtrees whose surface area grew by more than the given factor since they
+    // were built. The root of the tree is checked first, so if the whole tree has degraded, the
+    // whole tree is rebuilt.
+    std::vector<size_t> find_degraded(const node_vector &tree,
+                                      const std::vector<float>& build_area, float threshold) {
+        std::vector<size_t> degraded;
+        std::vector<size_t> stack = {0};
+        while(!stack.empty()) {
+            size_t idx = stack.back();
+            stack.pop_back();
+            const obvi::bvh::node& nd = tree[idx];
+            if(nd.is_leaf()) {
+                continue;
+            }
+            if(nd.box.surface_area() > threshold * build_area[idx]) {
+                degraded.push_back(idx);
+                continue;
+            }
+            stack.push_back(idx + 1);
+            stack.push_back(idx + 1 + tree[idx + 1].subtree_size());
+        }
+        return degraded;
+    }
+
+    // Replace the subtree rooted at the given node with a new one built from the same objects.
+    void rebuild_subtree(node_vector &tree, const std::vector<bboxf>& boxes,
+                         const std::vector<vec3f>& centers, std::vector<float>& build_area,
+                         size_t root) {
+        size_t                end = root + tree[root].subtree_size();
+        std::vector<uint32_t> idxs;
+        for(size_t idx=root; idx<end; ++idx) {
+            if(tree[idx].is_leaf()) {
+                idxs.push_back(tree[idx].num & 0x7FFFFFFFu);
+            }
+        }
+
+        bboxf                box = tree[root].box;
+        std::vector<sah_job> jobs;
+        build_sah_subtree(tree, boxes, centers, idxs, root, box, jobs);
+
+        for(size_t idx=root; idx<end; ++idx) {
+            build_area[idx] = tree[idx].box.surface_area();
         }
-        generate(tree, boxes, objs, curr_box, split + 1, last);
     }
 }
 
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // Implementations of public API functions.
-bool obvi::bvh::generate(const std::vector<bboxf>& boxes) {
+struct obvi::bvh_builder::scratch {
+    morton_scratch morton;
+    sah_scratch    sah;
+};
+
+obvi::bvh_builder::bvh_builder() = default;
+obvi::bvh_builder::bvh_builder(const bvh_builder&) {}
+obvi::bvh_builder::bvh_builder(bvh_builder&&) = default;
+obvi::bvh_builder& obvi::bvh_builder::operator=(const bvh_builder&) { return *this; }
+obvi::bvh_builder& obvi::bvh_builder::operator=(bvh_builder&&) = default;
+obvi::bvh_builder::~bvh_builder() = default;
+
+void obvi::bvh_builder::clear() {
+    data.reset();
+}
+
+size_t obvi::bvh_builder::capacity_bytes() const {
+    return data? data->morton.capacity_bytes() + data->sah.capacity_bytes() : 0;
+}
+
+const bboxf obvi::bvh::empty_box;
+constexpr uint32_t obvi::bvh::no_match;
+constexpr size_t   obvi::bvh::max_size;
+
+bool obvi::bvh::generate(const std::vector<bboxf>& boxes, bvh_build_type build_type,
+                         bvh_build_stats *out_stats) {
+    bvh_builder builder;
+    return generate(boxes, builder, build_type, out_stats);
+}
+
+bool obvi::bvh::generate(const std::vector<bboxf>& boxes, bvh_builder& builder,
+                         bvh_build_type build_type, bvh_build_stats *out_stats) {
     clear();
 
+    bvh_build_stats stats;
+    if(out_stats) {
+        *out_stats = stats;
+    }
+
     if(boxes.size() > max_size) {
         return false;
     }
@@ -223,21 +832,251 @@ bool obvi::bvh::generate(const std::vector<bboxf>& boxes) {
         return true;
     }
 
-    // Preallocate memory for BVH. Number of nodes = 2 * (number of leaves) - 1.
-    tree.reserve(2 * boxes.size() - 1);
-
     // Get bounding box that covers all individual boxes in scene.
-    bboxf root_box;
-    for(auto &box : boxes) {
-        root_box.expand(box);
+    phase_timer timer;
+    bboxf       root_box;
+#   pragma omp parallel
+    {
+        bboxf local_box;
+#       pragma omp for nowait // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)boxes.size(); ++i) {
+            local_box.expand(boxes[(size_t)i]);
+        }
+#       pragma omp critical
+        root_box.expand(local_box);
+    }
+
+    num_leaves = boxes.size();
+    stats.bounds_sec = timer.lap();
+
+    if(!builder.data) {
+        builder.data.reset(new bvh_builder::scratch());
     }
+    if(build_type == bvh_build_type::SAH) {
+        generate_sah(tree, boxes, root_box, builder.data->sah);
+    } else {
+        // Get sorted list of morton codes and obj indexes for each bounding box.
+        morton_scratch& s = builder.data->morton;
+        make_obj_list(s.objs, s.sort_buffer, boxes, root_box, stats);
+        timer.lap();
 
-    // Get sorted list of morton codes and obj indexes for each bounding box.
-    std::vector<obj> objs;
-    make_obj_list(objs, boxes, root_box);
+        // Generate BVH.
+        generate_morton(tree, boxes, s);
+    }
+    record_build_area(tree, build_area);
+    stats.tree_sec = timer.lap();
 
-    // Generate BVH.
-    ::generate(tree, boxes, objs, root_box, 0, boxes.size() - 1);
+    if(out_stats) {
+        *out_stats = stats;
+    }
+    return true;
+}
+
+bool obvi::bvh::borrow(const node *tree_nodes, size_t count, size_t num_objects) {
+    clear();
+    if(num_objects > max_size || count != ((num_objects > 0)? 2 * num_objects - 1 : 0)) {
+        return false;
+    }
+    if(count > 0 && !tree_nodes) {
+        return false;
+    }
+
+    // Every subtree must exactly fill the range of nodes its parent expects it to, so that no
+    // traversal can step outside the array. Check every node against the range it should cover.
+    struct range {
+        size_t first;
+        size_t size;
+    };
+    std::vector<range> stack;
+    if(count > 0) {
+        stack.push_back({0, count});
+    }
+    while(!stack.empty()) {
+        range r = stack.back();
+        stack.pop_back();
+        const node& nd = tree_nodes[r.first];
+        if(nd.is_leaf()) {
+            if(r.size != 1 || (nd.num & 0x7FFFFFFFu) >= num_objects) {
+                return false;
+            }
+            continue;
+        }
+        // Internal nodes have two children, so a subtree can't have less than 3 nodes.
+        if(nd.num != r.size || r.size < 3) {
+            return false;
+        }
+        size_t left_size = tree_nodes[r.first + 1].subtree_size();
+        if(left_size >= r.size - 1) {
+            return false;
+        }
+        stack.push_back({r.first + 1, left_size});
+        stack.push_back({r.first + 1 + left_size, r.size - 1 - left_size});
+    }
+
+    borrowed     = tree_nodes;
+    num_borrowed = count;
+    num_leaves   = num_objects;
+    return true;
+}
+
+bool obvi::bvh::assign(const node *tree_nodes, size_t count, size_t num_objects) {
+    if(!borrow(tree_nodes, count, num_objects)) {
+        return false;
+    }
+    tree.assign(tree_nodes, tree_nodes + count);
+    borrowed     = nullptr;
+    num_borrowed = 0;
+    return true;
+}
+
+std::vector<size_t> obvi::bvh::nearest(const vec3f& pt, size_t k, float max_dist2,
+                                       std::vector<float> *out_dist2) const {
+    std::vector<size_t> res;
+    if(out_dist2) {
+        out_dist2->clear();
+    }
+    if(k == 0) {
+        return res;
+    }
+
+    // Objects come out of the query in order of increasing distance, so the first k are the
+    // k nearest. Nothing else in the queue is opened once the kth one is found.
+    nearest_query nq = make_nearest_query(pt, max_dist2);
+    size_t        idx;
+    float         dist2;
+    while(res.size() < k && nq.next(&idx, &dist2)) {
+        res.push_back(idx);
+        if(out_dist2) {
+            out_dist2->push_back(dist2);
+        }
+    }
+    return res;
+}
+
+template<typename intersect_func>
+void obvi::bvh::query_batch(const intersect_func *queries, size_t count, batch_result& out) const {
+    out.offsets.assign(count + 1, 0);
+    out.matches.clear();
+    if(count == 0) {
+        return;
+    }
+
+    // Queries are handed out in blocks. Each block's matches are stored contiguously in the
+    // buffer of the thread that ran it, so we only need to remember where they start.
+    const size_t block_size = 256;
+    const size_t num_blocks = (count + block_size - 1) / block_size;
+
+    std::vector<std::vector<uint32_t>> arenas((size_t)omp_get_max_threads());
+    std::vector<uint32_t>              block_arena(num_blocks);
+    std::vector<size_t>                block_start(num_blocks);
+
+#   pragma omp parallel
+    {
+        std::vector<uint32_t>& arena = arenas[(size_t)omp_get_thread_num()];
+
+#       pragma omp for schedule(dynamic) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int b=0; b<(int)num_blocks; ++b) {
+            size_t first = (size_t)b * block_size;
+            size_t last  = std::min(first + block_size, count);
+
+            block_arena[(size_t)b] = (uint32_t)omp_get_thread_num();
+            block_start[(size_t)b] = arena.size();
+            for(size_t i=first; i<last; ++i) {
+                size_t before = arena.size();
+                auto   q      = make_query(queries[i]);
+                size_t idx;
+                while(q.next(&idx)) {
+                    arena.push_back((uint32_t)idx);
+                }
+                out.offsets[i + 1] = arena.size() - before; // count for now, prefix sum below
+            }
+        }
+    }
+
+    for(size_t i=0; i<count; ++i) {
+        out.offsets[i + 1] += out.offsets[i];
+    }
+    out.matches.resize(out.offsets[count]);
+
+#   pragma omp parallel for schedule(dynamic) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int b=0; b<(int)num_blocks; ++b) {
+        size_t first = (size_t)b * block_size;
+        size_t last  = std::min(first + block_size, count);
+        size_t num   = out.offsets[last] - out.offsets[first];
+        if(num > 0) {
+            const uint32_t *src = arenas[block_arena[(size_t)b]].data() + block_start[(size_t)b];
+            std::copy(src, src + num, out.matches.begin() + (ptrdiff_t)out.offsets[first]);
+        }
+    }
+}
+
+template<typename intersect_func>
+void obvi::bvh::query_batch_first(const intersect_func *queries, size_t count,
+                                  uint32_t *out_first) const {
+#   pragma omp parallel for schedule(dynamic, 64) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int i=0; i<(int)count; ++i) {
+        auto   q = make_query(queries[(size_t)i]);
+        size_t idx;
+        out_first[(size_t)i] = q.next(&idx)? (uint32_t)idx : no_match;
+    }
+}
+
+// Batch queries are only instantiated for the built-in functors, so that OpenMP stays internal
+// to the library.
+#define OBVI_BVH_INSTANTIATE_BATCH(func) \
+    template void obvi::bvh::query_batch<obvi::bvh::func>( \
+        const obvi::bvh::func*, size_t, batch_result&) const; \
+    template void obvi::bvh::query_batch_first<obvi::bvh::func>( \
+        const obvi::bvh::func*, size_t, uint32_t*) const;
+
+OBVI_BVH_INSTANTIATE_BATCH(intersect_point)
+OBVI_BVH_INSTANTIATE_BATCH(intersect_box)
+OBVI_BVH_INSTANTIATE_BATCH(intersect_segment)
+OBVI_BVH_INSTANTIATE_BATCH(intersect_ray)
+OBVI_BVH_INSTANTIATE_BATCH(intersect_sphere)
+
+#undef OBVI_BVH_INSTANTIATE_BATCH
+
+bool obvi::bvh::refit(const std::vector<bboxf>& boxes, float rebuild_threshold) {
+    if(boxes.size() != num_leaves) {
+        return false;
+    }
+    if(borrowed) {
+        // Borrowed nodes are read-only, switch to a copy we own.
+        tree.assign(borrowed, borrowed + num_borrowed);
+        borrowed     = nullptr;
+        num_borrowed = 0;
+    }
+    if(tree.empty()) {
+        return true;
+    }
+
+    // generate() records how big each node was when it was built. Trees that came from borrow()
+    // or assign() don't have that yet, so record it before their first refit (their boxes are
+    // still the ones they were built with).
+    if(build_area.size() != tree.size()) {
+        record_build_area(tree, build_area);
+    }
+
+    refit_tree(tree, boxes);
+
+    if(rebuild_threshold > 0.0f) {
+        std::vector<size_t> degraded = find_degraded(tree, build_area, rebuild_threshold);
+        if(!degraded.empty()) {
+            std::vector<vec3f> centers(boxes.size());
+#           pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+            for(int i=0; i<(int)boxes.size(); ++i) {
+                centers[(size_t)i] = boxes[(size_t)i].center();
+            }
+
+            // Degraded subtrees don't overlap, so they can be rebuilt in parallel. Rebuilding a
+            // subtree doesn't change its root box, so the nodes above it stay valid.
+#           pragma omp parallel for schedule(dynamic)
+            for(int i=0; i<(int)degraded.size(); ++i) {
+                rebuild_subtree(tree, boxes, centers, build_area, degraded[(size_t)i]);
+            }
+        }
+    }
 
     return true;
 }
@@ -0,0 +1,144 @@
+/* Implementation of class that implements a 4-wide bounding-volume hierarchy (BVH4).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/bvh4.hpp>
+
+#include <limits>
+
+using obvi::bboxf;
+using obvi::bvh;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    // Binary node that still needs to be converted into a BVH4 node.
+    struct collapse_job {
+        size_t   bin_idx;    // index of node in binary tree
+        size_t   parent;     // index of parent BVH4 node (only valid if this isn't the root)
+        uint32_t slot;       // which of the parent's child slots this node goes in
+    };
+
+    // Get the indices of the left and right children of the given internal binary node.
+    void binary_children(const bvh::node_list& bin, size_t idx, size_t children[2]) {
+        children[0] = idx + 1;
+        children[1] = idx + 1 + bin[idx + 1].subtree_size();
+    }
+
+    // Collect the (up to four) binary nodes that will become the children of a single BVH4 node.
+    //
+    // Starting from the given binary node, repeatedly replace the internal node with the largest
+    // surface area by its two children. Children with empty bounding boxes are dropped, since no
+    // query can ever intersect them.
+    size_t collect_children(const bvh::node_list& bin, size_t idx, size_t out[4]) {
+        size_t count = 0;
+        if(!bin[idx].box.is_empty()) {
+            out[count++] = idx;
+        }
+
+        while(count < obvi::bvh4::width) {
+            // Find the internal node with the largest surface area.
+            size_t best      = count;
+            float  best_area = -1.0f;
+            for(size_t i=0; i<count; ++i) {
+                const bvh::node& nd = bin[out[i]];
+                if(!nd.is_leaf() && nd.box.surface_area() > best_area) {
+                    best      = i;
+                    best_area = nd.box.surface_area();
+                }
+            }
+            if(best == count) {
+                break; // only leaves left.
+            }
+
+            // Replace it with its children.
+            size_t children[2];
+            binary_children(bin, out[best], children);
+            out[best] = out[--count];
+            for(size_t child : children) {
+                if(!bin[child].box.is_empty()) {
+                    out[count++] = child;
+                }
+            }
+        }
+        return count;
+    }
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Implementations of public API functions.
+void obvi::bvh4::generate(const bvh& binary) {
+    clear();
+
+    const bvh::node_list bin = binary.nodes();
+    if(bin.empty() || bin[0].box.is_empty()) {
+        return;
+    }
+
+    num_leaves = binary.size();
+    root_box   = binary.bounds();
+
+    // Each BVH4 node replaces at least one binary internal node (except for a lone root leaf).
+    tree.reserve(bin.size() / 2 + 1);
+
+    std::vector<collapse_job> jobs;
+    jobs.push_back({0, 0, 0});
+    while(!jobs.empty()) {
+        collapse_job job = jobs.back();
+        jobs.pop_back();
+
+        uint32_t nd_idx = (uint32_t)tree.size();
+        if(nd_idx > 0) {
+            tree[job.parent].child[job.slot] = nd_idx;
+        }
+        tree.emplace_back();
+
+        size_t children[width];
+        size_t count = collect_children(bin, job.bin_idx, children);
+
+        node& nd = tree.back();
+        nd.count = (uint32_t)count;
+        for(size_t i=0; i<width; ++i) {
+            // Unused slots get an empty box that fails every test (and are masked off anyway).
+            const bboxf box = (i < count)? bin[children[i]].box : bboxf();
+            for(size_t axis=0; axis<3; ++axis) {
+                nd.min[axis][i] = (i < count)? box.min_pt[axis] :  std::numeric_limits<float>::infinity();
+                nd.max[axis][i] = (i < count)? box.max_pt[axis] : -std::numeric_limits<float>::infinity();
+            }
+            nd.child[i] = 0xFFFFFFFFu;
+        }
+
+        // Push internal children in reverse order, so the nodes end up in depth-first order.
+        for(size_t i=count; i-- > 0;) {
+            const bvh::node& child = bin[children[i]];
+            if(child.is_leaf()) {
+                nd.child[i] = child.num; // already has leaf bit set, and object index.
+            } else {
+                jobs.push_back({children[i], nd_idx, (uint32_t)i});
+            }
+        }
+    }
+}
@@ -0,0 +1,138 @@
+/* Implementation of compressed 4-wide bounding-volume hierarchy.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/bvh4_compact.hpp>
+#include <obvi/util/compat_omp.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using obvi::bvh4;
+using obvi::bvh4_compact;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    // Return the smallest power of two that covers the given extent in 255 steps (0 if extent is 0).
+    //
+    // Using a power of two means q * scale is always exact, so the only rounding during
+    // dequantization happens when it's added to the origin.
+    float quant_scale(float extent) {
+        if(!(extent > 0.0f)) {
+            return 0.0f;
+        }
+        int   exp;
+        std::frexp(extent / 255.0f, &exp);
+        float scale = std::ldexp(1.0f, exp - 1);
+        while(scale * 255.0f < extent) {
+            scale *= 2.0f;
+        }
+        return scale;
+    }
+
+    // Dequantize a single offset, exactly the way the query functors do it.
+    float dequant(float origin, float scale, uint32_t q) {
+        return origin + float(q) * scale;
+    }
+
+    // Quantize a min corner, rounding down so the dequantized value is never greater than val.
+    uint8_t quant_min(float origin, float scale, float val) {
+        if(scale == 0.0f) {
+            return 0;
+        }
+        float    fq = std::floor((val - origin) / scale);
+        uint32_t q  = (uint32_t)std::min(std::max(fq, 0.0f), 255.0f);
+        while(q > 0 && dequant(origin, scale, q) > val) {
+            --q;
+        }
+        return (uint8_t)q;
+    }
+
+    // Quantize a max corner, rounding up so the dequantized value is never less than val.
+    uint8_t quant_max(float origin, float scale, float val) {
+        if(scale == 0.0f) {
+            return 0;
+        }
+        float    fq = std::ceil((val - origin) / scale);
+        uint32_t q  = (uint32_t)std::min(std::max(fq, 0.0f), 255.0f);
+        while(q < 255 && dequant(origin, scale, q) < val) {
+            ++q;
+        }
+        return (uint8_t)q;
+    }
+
+    void compress_node(const bvh4::node& in, bvh4_compact::node& out) {
+        const size_t width = bvh4_compact::width;
+
+        for(size_t axis=0; axis<3; ++axis) {
+            // Find the box that encloses all the children along this axis.
+            float lo = in.min[axis][0];
+            float hi = in.max[axis][0];
+            for(size_t i=1; i<in.count; ++i) {
+                lo = std::min(lo, in.min[axis][i]);
+                hi = std::max(hi, in.max[axis][i]);
+            }
+
+            out.origin[axis] = lo;
+            out.scale[axis]  = quant_scale(hi - lo);
+
+            for(size_t i=0; i<width; ++i) {
+                if(i < in.count) {
+                    out.qmin[axis][i] = quant_min(lo, out.scale[axis], in.min[axis][i]);
+                    out.qmax[axis][i] = quant_max(lo, out.scale[axis], in.max[axis][i]);
+                } else {
+                    // Unused slot: inverted box, so it can't intersect anything.
+                    out.qmin[axis][i] = 255;
+                    out.qmax[axis][i] = 0;
+                }
+            }
+        }
+
+        for(size_t i=0; i<width; ++i) {
+            out.child[i] = (i < in.count) ? in.child[i] : 0xFFFFFFFFu;
+        }
+    }
+} // END anonymous namespace
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public methods.
+void bvh4_compact::generate(const bvh4& wide) {
+    clear();
+
+    const auto& src = wide.nodes();
+    tree.resize(src.size());
+
+    // Nodes are independent, so they can all be converted in parallel. Output keeps the same
+    // node order as the input, so child indices don't need to be rewritten.
+#   pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int i=0; i<(int)src.size(); ++i) {
+        compress_node(src[(size_t)i], tree[(size_t)i]);
+    }
+
+    num_leaves = wide.size();
+    root_box   = wide.bounds();
+}
@@ -0,0 +1,306 @@
+/* Implementation of the CUDA BVH backend's public interface.
+ *
+ * The CUDA kernels (cuda_detail functions, see bvh_cuda_kernels.hpp) aren't in the tree yet, so
+ * this file provides failing versions of them, and bvh_cuda only ever reports the error.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/bvh_cuda.hpp>
+
+#include "bvh_cuda_kernels.hpp"
+
+#include <utility>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::bvh_cuda;
+
+namespace cd = obvi::cuda_detail;
+
+static_assert(sizeof(cd::node) == sizeof(bvh::node) && sizeof(bboxf) == 6 * sizeof(float),
+              "GPU nodes must have the same layout as bvh::node");
+
+// No CUDA kernels: every kernel entry point fails, so bvh_cuda only ever reports the error.
+namespace obvi {
+namespace cuda_detail {
+
+namespace {
+    const char *const no_cuda_error = "Obvi was built without CUDA support";
+}
+
+struct device_tree {};
+
+bool device_available(std::string& err) {
+    err = no_cuda_error;
+    return false;
+}
+
+device_tree* create_tree(std::string& err) {
+    err = no_cuda_error;
+    return nullptr;
+}
+
+void destroy_tree(device_tree *tree) {
+    delete tree;
+}
+
+size_t num_nodes(const device_tree*) {
+    return 0;
+}
+
+size_t num_objects(const device_tree*) {
+    return 0;
+}
+
+bool build_morton(device_tree*, const float*, size_t, std::string& err) {
+    err = no_cuda_error;
+    return false;
+}
+
+bool upload(device_tree*, const node*, size_t, size_t, std::string& err) {
+    err = no_cuda_error;
+    return false;
+}
+
+bool download(const device_tree*, node*, std::string& err) {
+    err = no_cuda_error;
+    return false;
+}
+
+bool query_all(const device_tree*, query_type, const float*, size_t, std::vector<size_t>&,
+               std::vector<uint32_t>&, std::string& err) {
+    err = no_cuda_error;
+    return false;
+}
+
+bool query_first(const device_tree*, query_type, const float*, size_t, uint32_t*,
+                 std::string& err) {
+    err = no_cuda_error;
+    return false;
+}
+
+} // END namespace cuda_detail
+} // END namespace obvi
+
+namespace {
+    bool fail(std::string *out_error, const std::string& err) {
+        if(out_error) {
+            *out_error = err;
+        }
+        return false;
+    }
+
+    // Copy the queries into the flat float layout the kernels take (see cuda_detail::query_type).
+    void pack(const bvh::intersect_point& q, float *out) {
+        for(size_t i=0; i<3; ++i) {
+            out[i] = q.point[i];
+        }
+    }
+
+    void pack(const bvh::intersect_box& q, float *out) {
+        for(size_t i=0; i<3; ++i) {
+            out[i]     = q.qbox.min_pt[i];
+            out[i + 3] = q.qbox.max_pt[i];
+        }
+    }
+
+    void pack(const bvh::intersect_ray& q, float *out) {
+        for(size_t i=0; i<3; ++i) {
+            out[i]     = q.origin[i];
+            out[i + 3] = q.inv_norm_dir[i];
+        }
+    }
+
+    cd::query_type type_of(const bvh::intersect_point&) { return cd::query_type::POINT; }
+    cd::query_type type_of(const bvh::intersect_box&)   { return cd::query_type::BOX; }
+    cd::query_type type_of(const bvh::intersect_ray&)   { return cd::query_type::RAY; }
+
+    template<typename intersect_func>
+    std::vector<float> pack_all(const std::vector<intersect_func>& queries, cd::query_type type) {
+        const size_t       stride = cd::query_floats[(size_t)type];
+        std::vector<float> packed(queries.size() * stride);
+        for(size_t i=0; i<queries.size(); ++i) {
+            pack(queries[i], packed.data() + i * stride);
+        }
+        return packed;
+    }
+}
+
+struct obvi::bvh_cuda::impl {
+    cd::device_tree *tree = nullptr;
+
+    ~impl() {
+        cd::destroy_tree(tree);
+    }
+
+    // Get the GPU tree, creating an empty one the first time.
+    cd::device_tree* get(std::string& err) {
+        if(!tree) {
+            tree = cd::create_tree(err);
+        }
+        return tree;
+    }
+
+    template<typename intersect_func>
+    bool query_all(const std::vector<intersect_func>& queries, bvh::batch_result& out,
+                   std::string *out_error) {
+        out.offsets.assign(queries.size() + 1, 0);
+        out.matches.clear();
+
+        std::string            err;
+        const cd::device_tree *dev = get(err);
+        if(dev) {
+            cd::query_type     type   = queries.empty()? cd::query_type::POINT : type_of(queries[0]);
+            std::vector<float> packed = pack_all(queries, type);
+            if(cd::query_all(dev, type, packed.data(), queries.size(), out.offsets, out.matches,
+                             err)) {
+                return true;
+            }
+        }
+        out.offsets.assign(queries.size() + 1, 0);
+        out.matches.clear();
+        return fail(out_error, err);
+    }
+
+    template<typename intersect_func>
+    bool query_first(const std::vector<intersect_func>& queries, std::vector<uint32_t>& out_first,
+                     std::string *out_error) {
+        out_first.assign(queries.size(), bvh::no_match);
+
+        std::string            err;
+        const cd::device_tree *dev = get(err);
+        if(dev) {
+            cd::query_type     type   = queries.empty()? cd::query_type::POINT : type_of(queries[0]);
+            std::vector<float> packed = pack_all(queries, type);
+            if(cd::query_first(dev, type, packed.data(), queries.size(), out_first.data(), err)) {
+                return true;
+            }
+        }
+        out_first.assign(queries.size(), bvh::no_match);
+        return fail(out_error, err);
+    }
+};
+
+obvi::bvh_cuda::bvh_cuda() : data(new impl()) {}
+obvi::bvh_cuda::~bvh_cuda() = default;
+obvi::bvh_cuda::bvh_cuda(bvh_cuda&& other) : data(new impl()) { *this = std::move(other); }
+
+obvi::bvh_cuda& obvi::bvh_cuda::operator=(bvh_cuda&& other) {
+    std::swap(data, other.data);
+    return *this;
+}
+
+bool obvi::bvh_cuda::available(std::string *out_error) {
+    std::string err;
+    if(!cd::device_available(err)) {
+        return fail(out_error, err);
+    }
+    return true;
+}
+
+void obvi::bvh_cuda::clear() {
+    cd::destroy_tree(data->tree);
+    data->tree = nullptr;
+}
+
+size_t obvi::bvh_cuda::size() const {
+    return cd::num_objects(data->tree);
+}
+
+bool obvi::bvh_cuda::generate(const std::vector<bboxf>& boxes, std::string *out_error) {
+    if(boxes.size() > bvh::max_size) {
+        clear();
+        return fail(out_error, "too many boxes for one BVH");
+    }
+    std::string      err;
+    cd::device_tree *dev = data->get(err);
+    if(!dev || !cd::build_morton(dev, reinterpret_cast<const float*>(boxes.data()), boxes.size(),
+                                 err)) {
+        return fail(out_error, err);
+    }
+    return true;
+}
+
+bool obvi::bvh_cuda::upload(const bvh& tree, std::string *out_error) {
+    std::string      err;
+    cd::device_tree *dev   = data->get(err);
+    bvh::node_list   nodes = tree.nodes();
+    if(!dev || !cd::upload(dev, reinterpret_cast<const cd::node*>(nodes.data()), nodes.size(),
+                           tree.size(), err)) {
+        return fail(out_error, err);
+    }
+    return true;
+}
+
+bool obvi::bvh_cuda::download(bvh& out_tree, std::string *out_error) const {
+    out_tree.clear();
+
+    std::string      err;
+    cd::device_tree *dev = data->get(err);
+    if(!dev) {
+        return fail(out_error, err);
+    }
+    std::vector<bvh::node> nodes(cd::num_nodes(dev));
+    if(!cd::download(dev, reinterpret_cast<cd::node*>(nodes.data()), err)) {
+        return fail(out_error, err);
+    }
+    if(!out_tree.assign(nodes.data(), nodes.size(), cd::num_objects(dev))) {
+        return fail(out_error, "tree downloaded from the GPU is corrupt");
+    }
+    return true;
+}
+
+bool obvi::bvh_cuda::query_batch(const std::vector<bvh::intersect_point>& queries,
+                                 bvh::batch_result& out, std::string *out_error) const {
+    return data->query_all(queries, out, out_error);
+}
+
+bool obvi::bvh_cuda::query_batch(const std::vector<bvh::intersect_box>& queries,
+                                 bvh::batch_result& out, std::string *out_error) const {
+    return data->query_all(queries, out, out_error);
+}
+
+bool obvi::bvh_cuda::query_batch(const std::vector<bvh::intersect_ray>& queries,
+                                 bvh::batch_result& out, std::string *out_error) const {
+    return data->query_all(queries, out, out_error);
+}
+
+bool obvi::bvh_cuda::query_batch_first(const std::vector<bvh::intersect_point>& queries,
+                                       std::vector<uint32_t>& out_first,
+                                       std::string *out_error) const {
+    return data->query_first(queries, out_first, out_error);
+}
+
+bool obvi::bvh_cuda::query_batch_first(const std::vector<bvh::intersect_box>& queries,
+                                       std::vector<uint32_t>& out_first,
+                                       std::string *out_error) const {
+    return data->query_first(queries, out_first, out_error);
+}
+
+bool obvi::bvh_cuda::query_batch_first(const std::vector<bvh::intersect_ray>& queries,
+                                       std::vector<uint32_t>& out_first,
+                                       std::string *out_error) const {
+    return data->query_first(queries, out_first, out_error);
+}
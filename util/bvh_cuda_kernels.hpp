@@ -0,0 +1,85 @@
+/* Private header between the CUDA BVH backend and the rest of the library (not installed).
+ *
+ * These are the entry points the CUDA kernels have to provide. They'll be compiled by nvcc, so
+ * they shouldn't include any of the library's own headers (nvcc doesn't need to parse the SIMD
+ * code in them). This header is all they share with bvh_cuda.cpp, so it only uses plain types:
+ * a box is 6 floats (min x,y,z then max x,y,z), a node is laid out exactly like bvh::node.
+ *
+ * The kernels aren't in the tree yet. Until they are, bvh_cuda.cpp defines failing versions.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#ifndef OBVI_BVH_CUDA_KERNELS_HPP
+#define OBVI_BVH_CUDA_KERNELS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace obvi {
+namespace cuda_detail {
+
+// Same layout as bvh::node (checked in bvh_cuda.cpp).
+struct node {
+    float    box[6];
+    uint32_t num;
+};
+
+enum class query_type {
+    POINT, // 3 floats per query: the point
+    BOX,   // 6 floats per query: the box
+    RAY    // 6 floats per query: origin, then 1 / normalized direction (like bvh::intersect_ray)
+};
+
+const size_t query_floats[3] = {3, 6, 6};
+
+// A tree in GPU memory (defined by the kernels). Functions return 'false' and set err on failure.
+struct device_tree;
+
+bool          device_available(std::string& err);
+device_tree*  create_tree(std::string& err);
+void          destroy_tree(device_tree *tree);
+size_t        num_nodes(const device_tree *tree);
+size_t        num_objects(const device_tree *tree);
+
+// Build a linear BVH, with exactly the same steps (and results) as bvh_build_type::MORTON.
+bool build_morton(device_tree *tree, const float *boxes, size_t count, std::string& err);
+
+// Copy nodes to and from the GPU (download fills num_nodes() nodes).
+bool upload(device_tree *tree, const node *nodes, size_t count, size_t num_objects,
+            std::string& err);
+bool download(const device_tree *tree, node *out_nodes, std::string& err);
+
+// Same results as bvh::query_batch() and bvh::query_batch_first() (see bvh.hpp).
+bool query_all(const device_tree *tree, query_type type, const float *queries, size_t count,
+               std::vector<size_t>& out_offsets, std::vector<uint32_t>& out_matches,
+               std::string& err);
+bool query_first(const device_tree *tree, query_type type, const float *queries, size_t count,
+                 uint32_t *out_first, std::string& err);
+
+} // END namespace cuda_detail
+} // END namespace obvi
+#endif // OBVI_BVH_CUDA_KERNELS_HPP
@@ -0,0 +1,43 @@
+/* Implementation of first_touch() (see first_touch_allocator.hpp).
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/first_touch_allocator.hpp>
+#include <obvi/util/compat_omp.hpp>
+
+void obvi::first_touch(void *ptr, size_t bytes) {
+    if(!ptr || bytes < first_touch_min_bytes || omp_in_parallel()) {
+        return;
+    }
+
+    // One write per page is enough to place it. Pages are 4 KiB or bigger everywhere we run.
+    const size_t   page_size = 4096;
+    const size_t   npages    = (bytes + page_size - 1) / page_size;
+    volatile char *mem       = static_cast<volatile char*>(ptr);
+#   pragma omp parallel for schedule(static) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int i=0; i<(int)npages; ++i) {
+        mem[(size_t)i * page_size] = 0;
+    }
+}
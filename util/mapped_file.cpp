@@ -0,0 +1,166 @@
+/* Implementation of read-only memory-mapped files.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/mapped_file.hpp>
+
+#include <utility>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+using obvi::mapped_file;
+
+mapped_file& mapped_file::operator=(mapped_file&& other) {
+    if(this != &other) {
+        close();
+        std::swap(ptr, other.ptr);
+        std::swap(len, other.len);
+        std::swap(opened, other.opened);
+#ifdef _WIN32
+        std::swap(file_handle, other.file_handle);
+        std::swap(map_handle, other.map_handle);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const std::string& path) {
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    file_handle = file;
+    len         = (size_t)file_size.QuadPart;
+    opened      = true;
+    if(len == 0) {
+        return true; // Can't map an empty file, but it's not an error.
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping == NULL) {
+        close();
+        return false;
+    }
+    map_handle = mapping;
+
+    ptr = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!ptr) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void mapped_file::close() {
+    if(ptr) {
+        UnmapViewOfFile(ptr);
+    }
+    if(map_handle) {
+        CloseHandle((HANDLE)map_handle);
+    }
+    if(file_handle) {
+        CloseHandle((HANDLE)file_handle);
+    }
+    ptr         = nullptr;
+    len         = 0;
+    opened      = false;
+    file_handle = nullptr;
+    map_handle  = nullptr;
+}
+
+#else // POSIX
+
+bool mapped_file::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    len    = (size_t)st.st_size;
+    opened = true;
+    if(len == 0) {
+        ::close(fd);
+        return true; // Can't map an empty file, but it's not an error.
+    }
+
+    void *addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // mapping stays valid after the descriptor is closed
+    if(addr == MAP_FAILED) {
+        len    = 0;
+        opened = false;
+        return false;
+    }
+
+    // Parsers read the whole file front to back (possibly from several threads at once), so
+    // ask the OS to start reading it in right away.
+    madvise(addr, len, MADV_WILLNEED);
+
+    ptr = (const char*)addr;
+    return true;
+}
+
+void mapped_file::close() {
+    if(ptr) {
+        munmap((void*)ptr, len);
+    }
+    ptr    = nullptr;
+    len    = 0;
+    opened = false;
+}
+
+#endif
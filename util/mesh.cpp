@@ -0,0 +1,1156 @@
+/* Implementation of triangle meshes, and the STL/PLY/OBJ file readers.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/batch.hpp>
+#include <obvi/util/compat_omp.hpp>
+#include <obvi/util/mapped_file.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ctype.h>
+#include <string.h>
+
+using obvi::bboxf;
+using obvi::mat3f;
+using obvi::mesh;
+using obvi::mesh_format;
+using obvi::vec3f;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    bool fail(std::string *out_error, const std::string& msg) {
+        if(out_error) {
+            *out_error = msg;
+        }
+        return false;
+    }
+
+    inline bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    inline const char* skip_space(const char *p, const char *end) {
+        while(p < end && is_space(*p)) {
+            ++p;
+        }
+        return p;
+    }
+
+    inline const char* skip_token(const char *p, const char *end) {
+        while(p < end && !is_space(*p) && *p != '\n') {
+            ++p;
+        }
+        return p;
+    }
+
+    inline const char* next_line(const char *p, const char *end) {
+        const char *nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+        return (nl)? nl + 1 : end;
+    }
+
+    // Return true if the token starting at p matches the given keyword exactly.
+    inline bool token_is(const char *p, const char *end, const char *keyword) {
+        size_t n = strlen(keyword);
+        return (size_t)(end - p) >= n && memcmp(p, keyword, n) == 0
+            && (p + n == end || is_space(p[n]) || p[n] == '\n');
+    }
+
+    /* Parse a decimal integer, starting at p. Returns pointer to the first character after the
+     * number, or null if there isn't a number at p (or it doesn't fit in 64 bits).
+     */
+    const char* parse_int(const char *p, const char *end, int64_t& out) {
+        bool neg = false;
+        if(p < end && (*p == '-' || *p == '+')) {
+            neg = (*p == '-');
+            ++p;
+        }
+        if(p >= end || !is_digit(*p)) {
+            return nullptr;
+        }
+        int64_t val = 0;
+        while(p < end && is_digit(*p)) {
+            int digit = *p - '0';
+            if(val > (std::numeric_limits<int64_t>::max() - digit) / 10) {
+                return nullptr;
+            }
+            val = val * 10 + digit;
+            ++p;
+        }
+        out = (neg)? -val : val;
+        return p;
+    }
+
+    /* Parse a decimal floating-point number (e.g. "-1.25e-3"), starting at p. Returns pointer to
+     * the first character after the number, or null if there isn't a number at p.
+     *
+     * Much faster than strtof (no locale, no dynamic allocation). The digits are accumulated in a
+     * 64-bit integer, then scaled by an exact power of ten in double precision, so the result is
+     * always within one unit in the last place of the correctly-rounded float value.
+     */
+    const char* parse_float(const char *p, const char *end, float& out) {
+        static const double pow10[] = {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        static const uint64_t max_mant = (std::numeric_limits<uint64_t>::max() - 9) / 10;
+
+        bool neg = false;
+        if(p < end && (*p == '-' || *p == '+')) {
+            neg = (*p == '-');
+            ++p;
+        }
+
+        uint64_t mant    = 0;
+        int      exp10   = 0;
+        bool     digits  = false;
+        while(p < end && is_digit(*p)) {
+            if(mant <= max_mant) {
+                mant = mant * 10 + (uint64_t)(*p - '0');
+            } else {
+                exp10++; // too many digits, drop the rest (they can't affect a float)
+            }
+            digits = true;
+            ++p;
+        }
+        if(p < end && *p == '.') {
+            ++p;
+            while(p < end && is_digit(*p)) {
+                if(mant <= max_mant) {
+                    mant = mant * 10 + (uint64_t)(*p - '0');
+                    exp10--;
+                }
+                digits = true;
+                ++p;
+            }
+        }
+        if(!digits) {
+            // Not a regular number - check for inf or nan.
+            if(end - p >= 3 && (p[0] | 0x20) == 'i' && (p[1] | 0x20) == 'n' && (p[2] | 0x20) == 'f') {
+                out = (neg)? -std::numeric_limits<float>::infinity()
+                           : std::numeric_limits<float>::infinity();
+                return skip_token(p, end);
+            }
+            if(end - p >= 3 && (p[0] | 0x20) == 'n' && (p[1] | 0x20) == 'a' && (p[2] | 0x20) == 'n') {
+                out = std::numeric_limits<float>::quiet_NaN();
+                return skip_token(p, end);
+            }
+            return nullptr;
+        }
+        if(p < end && (*p == 'e' || *p == 'E')) {
+            int64_t e;
+            const char *q = parse_int(p + 1, end, e);
+            if(q) {
+                exp10 += (int)std::max<int64_t>(std::min<int64_t>(e, 1000), -1000);
+                p = q;
+            }
+        }
+
+        double val = (double)mant;
+        if(mant != 0 && exp10 != 0) {
+            if(exp10 > 0) {
+                val *= (exp10 <= 22)? pow10[exp10] : std::pow(10.0, exp10);
+            } else {
+                val /= (exp10 >= -22)? pow10[-exp10] : std::pow(10.0, -exp10);
+            }
+        }
+        out = (float)((neg)? -val : val);
+        return p;
+    }
+
+    // Read a little-endian 32-bit value from an unaligned address (works on any host byte order).
+    inline uint32_t read_u32_le(const char *p) {
+        const uint8_t *b = (const uint8_t*)p;
+        return uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) | (uint32_t(b[3]) << 24);
+    }
+
+    inline float read_f32_le(const char *p) {
+        uint32_t bits = read_u32_le(p);
+        float    val;
+        memcpy(&val, &bits, sizeof(val));
+        return val;
+    }
+
+    // Fill indices with 0,1,2,... (for formats that don't share vertices between triangles).
+    void fill_sequential(std::vector<uint32_t>& indices, size_t count) {
+        indices.resize(count);
+#       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)count; ++i) {
+            indices[(size_t)i] = (uint32_t)i;
+        }
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // STL
+    constexpr size_t stl_header_size = 84; // 80 byte comment + 32-bit triangle count
+    constexpr size_t stl_tri_size    = 50; // normal + 3 vertices (12 floats) + 16-bit attribute
+
+    bool parse_stl_binary(const char *data, size_t size, mesh& out, std::string *out_error) {
+        size_t ntris = read_u32_le(data + 80);
+        if(size < stl_header_size + ntris * stl_tri_size) {
+            return fail(out_error, "STL file is truncated");
+        }
+        if(3 * ntris > (size_t)std::numeric_limits<uint32_t>::max()) {
+            return fail(out_error, "STL file has too many triangles");
+        }
+
+        // Each triangle is a fixed-size record, so they can all be parsed independently.
+        out.positions.resize(3 * ntris);
+        const char *tris = data + stl_header_size;
+#       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)ntris; ++i) {
+            const char *rec = tris + (size_t)i * stl_tri_size + 12; // skip facet normal
+            for(size_t v=0; v<3; ++v) {
+                out.positions[3 * (size_t)i + v].set(read_f32_le(rec), read_f32_le(rec + 4),
+                                                     read_f32_le(rec + 8));
+                rec += 12;
+            }
+        }
+        fill_sequential(out.indices, 3 * ntris);
+        return true;
+    }
+
+    bool parse_stl_ascii(const char *data, size_t size, mesh& out, std::string *out_error) {
+        const char *p   = data;
+        const char *end = data + size;
+        while(p < end) {
+            const char *tok = skip_space(p, end);
+            if(token_is(tok, end, "vertex")) {
+                vec3f       pt;
+                const char *q = tok + 6;
+                for(size_t i=0; i<3 && q; ++i) {
+                    q = parse_float(skip_space(q, end), end, pt[i]);
+                }
+                if(!q) {
+                    return fail(out_error, "bad vertex in ASCII STL file");
+                }
+                out.positions.push_back(pt);
+            }
+            p = next_line(tok, end);
+        }
+        if(out.positions.size() % 3 != 0) {
+            return fail(out_error, "ASCII STL file has an incomplete facet");
+        }
+        fill_sequential(out.indices, out.positions.size());
+        return true;
+    }
+
+    bool parse_stl(const char *data, size_t size, mesh& out, std::string *out_error) {
+        // Binary files can also begin with "solid", so check whether the size matches the
+        // triangle count first.
+        if(size >= stl_header_size
+           && size == stl_header_size + (size_t)read_u32_le(data + 80) * stl_tri_size) {
+            return parse_stl_binary(data, size, out, out_error);
+        }
+        const char *p = skip_space(data, data + size);
+        if(token_is(p, data + size, "solid")) {
+            if(parse_stl_ascii(data, size, out, out_error) && !out.positions.empty()) {
+                return true;
+            }
+            // Not valid ASCII - might be a damaged binary file, if so report that instead.
+            out.clear();
+            if(size < stl_header_size) {
+                return fail(out_error, "bad ASCII STL file");
+            }
+        }
+        if(size >= stl_header_size) {
+            return parse_stl_binary(data, size, out, out_error);
+        }
+        return fail(out_error, "not an STL file");
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // PLY
+    enum class ply_type {
+        NONE, INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64
+    };
+
+    ply_type ply_type_from_name(const char *p, const char *end) {
+        struct entry { const char *name; ply_type type; };
+        static const entry types[] = {
+            {"char",  ply_type::INT8},    {"int8",    ply_type::INT8},
+            {"uchar", ply_type::UINT8},   {"uint8",   ply_type::UINT8},
+            {"short", ply_type::INT16},   {"int16",   ply_type::INT16},
+            {"ushort",ply_type::UINT16},  {"uint16",  ply_type::UINT16},
+            {"int",   ply_type::INT32},   {"int32",   ply_type::INT32},
+            {"uint",  ply_type::UINT32},  {"uint32",  ply_type::UINT32},
+            {"float", ply_type::FLOAT32}, {"float32", ply_type::FLOAT32},
+            {"double",ply_type::FLOAT64}, {"float64", ply_type::FLOAT64},
+        };
+        for(const entry& e : types) {
+            if(token_is(p, end, e.name)) {
+                return e.type;
+            }
+        }
+        return ply_type::NONE;
+    }
+
+    size_t ply_type_size(ply_type t) {
+        switch(t) {
+            case ply_type::INT8:    case ply_type::UINT8:  return 1;
+            case ply_type::INT16:   case ply_type::UINT16: return 2;
+            case ply_type::INT32:   case ply_type::UINT32: case ply_type::FLOAT32: return 4;
+            case ply_type::FLOAT64: return 8;
+            default: return 0;
+        }
+    }
+
+    // Read a single binary value of the given type, convert it to double.
+    double ply_read(const char *p, ply_type t, bool big_endian) {
+        uint8_t b[8];
+        size_t  n = ply_type_size(t);
+        for(size_t i=0; i<n; ++i) {
+            b[i] = (uint8_t)p[(big_endian)? n - 1 - i : i];
+        }
+        switch(t) {
+            case ply_type::INT8:   return (double)(int8_t)b[0];
+            case ply_type::UINT8:  return (double)b[0];
+            case ply_type::INT16:  return (double)(int16_t)(uint16_t)(b[0] | (b[1] << 8));
+            case ply_type::UINT16: return (double)(uint16_t)(b[0] | (b[1] << 8));
+            case ply_type::INT32:
+            case ply_type::UINT32:
+            case ply_type::FLOAT32: {
+                uint32_t bits = uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16)
+                              | (uint32_t(b[3]) << 24);
+                if(t == ply_type::INT32) {
+                    return (double)(int32_t)bits;
+                } else if(t == ply_type::UINT32) {
+                    return (double)bits;
+                }
+                float val;
+                memcpy(&val, &bits, sizeof(val));
+                return (double)val;
+            }
+            case ply_type::FLOAT64: {
+                uint64_t bits = 0;
+                for(size_t i=0; i<8; ++i) {
+                    bits |= uint64_t(b[i]) << (8 * i);
+                }
+                double val;
+                memcpy(&val, &bits, sizeof(val));
+                return val;
+            }
+            default: return 0.0;
+        }
+    }
+
+    // Read a single binary integer of the given type. Returns -1 for floating-point types, so
+    // callers that reject negative values reject those too.
+    int64_t ply_read_int(const char *p, ply_type t, bool big_endian) {
+        uint8_t b[4] = {0, 0, 0, 0};
+        size_t  n    = ply_type_size(t);
+        for(size_t i=0; i<n && i<4; ++i) {
+            b[i] = (uint8_t)p[(big_endian)? n - 1 - i : i];
+        }
+        uint32_t bits = uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16)
+                      | (uint32_t(b[3]) << 24);
+        switch(t) {
+            case ply_type::INT8:   return (int8_t)b[0];
+            case ply_type::UINT8:  return b[0];
+            case ply_type::INT16:  return (int16_t)(uint16_t)bits;
+            case ply_type::UINT16: return (uint16_t)bits;
+            case ply_type::INT32:  return (int32_t)bits;
+            case ply_type::UINT32: return bits;
+            default: return -1;
+        }
+    }
+
+    // Parse one vertex index of an ASCII face (a whole non-negative integer that fits in 32 bits).
+    const char* parse_ply_index(const char *p, const char *end, uint32_t& out) {
+        int64_t val;
+        p = parse_int(p, end, val);
+        if(!p || val < 0 || val > (int64_t)std::numeric_limits<uint32_t>::max()
+           || (p < end && !is_space(*p) && *p != '\n')) {
+            return nullptr;
+        }
+        out = (uint32_t)val;
+        return p;
+    }
+
+    struct ply_property {
+        std::string name;
+        ply_type    type       = ply_type::NONE; // type of value (or of list items)
+        ply_type    count_type = ply_type::NONE; // type of list count (NONE if not a list)
+    };
+
+    struct ply_element {
+        std::string               name;
+        size_t                    count = 0;
+        std::vector<ply_property> props;
+
+        // Index of the property with the given name, or -1 if there isn't one.
+        int find(const char *prop_name) const {
+            for(size_t i=0; i<props.size(); ++i) {
+                if(props[i].name == prop_name) {
+                    return (int)i;
+                }
+            }
+            return -1;
+        }
+
+        // Size of each record in bytes, or 0 if it contains lists (so records vary in size).
+        size_t record_size() const {
+            size_t sz = 0;
+            for(const ply_property& prop : props) {
+                if(prop.count_type != ply_type::NONE) {
+                    return 0;
+                }
+                sz += ply_type_size(prop.type);
+            }
+            return sz;
+        }
+    };
+
+    enum class ply_encoding { ASCII, BINARY_LE, BINARY_BE };
+
+    struct ply_header {
+        ply_encoding             encoding = ply_encoding::ASCII;
+        std::vector<ply_element> elements;
+        const char*              body     = nullptr; // first byte after end_header line
+    };
+
+    bool parse_ply_header(const char *data, size_t size, ply_header& hdr, std::string *out_error) {
+        const char *end = data + size;
+        const char *p   = data;
+        if(!token_is(p, end, "ply")) {
+            return fail(out_error, "not a PLY file");
+        }
+        bool have_format = false;
+        for(p = next_line(p, end); p < end; p = next_line(p, end)) {
+            const char *tok = skip_space(p, end);
+            if(token_is(tok, end, "end_header")) {
+                hdr.body = next_line(tok, end);
+                if(!have_format) {
+                    return fail(out_error, "PLY header is missing format line");
+                }
+                return true;
+            }
+            if(token_is(tok, end, "format")) {
+                tok = skip_space(skip_token(tok, end), end);
+                if(token_is(tok, end, "ascii")) {
+                    hdr.encoding = ply_encoding::ASCII;
+                } else if(token_is(tok, end, "binary_little_endian")) {
+                    hdr.encoding = ply_encoding::BINARY_LE;
+                } else if(token_is(tok, end, "binary_big_endian")) {
+                    hdr.encoding = ply_encoding::BINARY_BE;
+                } else {
+                    return fail(out_error, "unknown PLY format");
+                }
+                have_format = true;
+            } else if(token_is(tok, end, "element")) {
+                ply_element elem;
+                tok = skip_space(skip_token(tok, end), end);
+                const char *name_end = skip_token(tok, end);
+                elem.name.assign(tok, name_end);
+                int64_t count;
+                if(!parse_int(skip_space(name_end, end), end, count) || count < 0) {
+                    return fail(out_error, "bad element count in PLY header");
+                }
+                elem.count = (size_t)count;
+                hdr.elements.push_back(elem);
+            } else if(token_is(tok, end, "property")) {
+                if(hdr.elements.empty()) {
+                    return fail(out_error, "PLY property appears before any element");
+                }
+                ply_property prop;
+                tok = skip_space(skip_token(tok, end), end);
+                if(token_is(tok, end, "list")) {
+                    tok             = skip_space(skip_token(tok, end), end);
+                    prop.count_type = ply_type_from_name(tok, end);
+                    tok             = skip_space(skip_token(tok, end), end);
+                    if(prop.count_type == ply_type::NONE || prop.count_type == ply_type::FLOAT32
+                       || prop.count_type == ply_type::FLOAT64) {
+                        return fail(out_error, "bad list count type in PLY header");
+                    }
+                }
+                prop.type = ply_type_from_name(tok, end);
+                if(prop.type == ply_type::NONE) {
+                    return fail(out_error, "unknown property type in PLY header");
+                }
+                tok = skip_space(skip_token(tok, end), end);
+                prop.name.assign(tok, skip_token(tok, end));
+                hdr.elements.back().props.push_back(prop);
+            }
+            // Skip comments, obj_info and anything else we don't understand.
+        }
+        return fail(out_error, "PLY header is missing end_header");
+    }
+
+    // Which vertex properties we care about, and where they are.
+    struct ply_vertex_layout {
+        int    pos[3];
+        int    color[4];
+        bool   has_color;
+        float  color_scale[4]; // converts color property to [0,255]
+        size_t offset[16];     // byte offset of each property in binary record (if fixed size)
+    };
+
+    uint8_t ply_color_byte(double val, float scale) {
+        double c = val * scale;
+        return (uint8_t)std::min(std::max(c + 0.5, 0.0), 255.0);
+    }
+
+    uint32_t pack_color(const double rgba[4], const ply_vertex_layout& layout) {
+        uint32_t packed = 0;
+        for(size_t i=0; i<4; ++i) {
+            uint8_t c = (layout.color[i] >= 0)? ply_color_byte(rgba[i], layout.color_scale[i]) : 255;
+            packed |= uint32_t(c) << (8 * i);
+        }
+        return packed;
+    }
+
+    bool ply_vertex_setup(const ply_element& elem, ply_vertex_layout& layout,
+                          std::string *out_error) {
+        static const char *pos_names[3]   = {"x", "y", "z"};
+        static const char *color_names[4] = {"red", "green", "blue", "alpha"};
+        for(size_t i=0; i<3; ++i) {
+            layout.pos[i] = elem.find(pos_names[i]);
+            if(layout.pos[i] < 0 || elem.props[(size_t)layout.pos[i]].count_type != ply_type::NONE) {
+                return fail(out_error, "PLY vertex is missing x, y or z");
+            }
+        }
+        for(size_t i=0; i<4; ++i) {
+            layout.color[i] = elem.find(color_names[i]);
+            if(layout.color[i] >= 0) {
+                ply_type t = elem.props[(size_t)layout.color[i]].type;
+                // Integer colors are 0-255, floating-point colors are 0-1.
+                layout.color_scale[i] = (t == ply_type::FLOAT32 || t == ply_type::FLOAT64)? 255.0f : 1.0f;
+            }
+        }
+        layout.has_color = layout.color[0] >= 0 && layout.color[1] >= 0 && layout.color[2] >= 0;
+        return true;
+    }
+
+    // Parse all vertices. Returns pointer to first byte after the vertex data on success.
+    const char* parse_ply_vertices(const ply_header& hdr, const ply_element& elem, const char *p,
+                                   const char *end, mesh& out, std::string *out_error) {
+        ply_vertex_layout layout;
+        if(!ply_vertex_setup(elem, layout, out_error)) {
+            return nullptr;
+        }
+
+        // The count comes straight from the header, so check there's enough data for it before
+        // allocating anything. Each ASCII property takes at least two bytes (digit, separator).
+        size_t rec_size = elem.record_size();
+        size_t min_size = (hdr.encoding == ply_encoding::ASCII)? 2 * elem.props.size() : rec_size;
+        if(min_size == 0 || elem.props.size() > 16) {
+            fail(out_error, "PLY vertex format not supported");
+            return nullptr;
+        }
+        if(((size_t)(end - p) + 1) / min_size < elem.count) {
+            fail(out_error, "PLY file is truncated");
+            return nullptr;
+        }
+
+        out.positions.resize(elem.count);
+        if(layout.has_color) {
+            out.colors.resize(elem.count);
+        }
+
+        if(hdr.encoding == ply_encoding::ASCII) {
+            std::vector<double> vals(elem.props.size());
+            for(size_t v=0; v<elem.count; ++v) {
+                const char *q = p;
+                for(size_t i=0; i<vals.size(); ++i) {
+                    float f = 0.0f;
+                    q = (q)? parse_float(skip_space(q, end), end, f) : nullptr;
+                    vals[i] = f;
+                }
+                if(!q) {
+                    fail(out_error, "bad vertex in ASCII PLY file");
+                    return nullptr;
+                }
+                out.positions[v].set((float)vals[(size_t)layout.pos[0]], (float)vals[(size_t)layout.pos[1]],
+                                     (float)vals[(size_t)layout.pos[2]]);
+                if(layout.has_color) {
+                    double rgba[4];
+                    for(size_t i=0; i<4; ++i) {
+                        rgba[i] = (layout.color[i] >= 0)? vals[(size_t)layout.color[i]] : 0.0;
+                    }
+                    out.colors[v] = pack_color(rgba, layout);
+                }
+                p = next_line(q, end);
+            }
+            return p;
+        }
+
+        // Binary: every vertex record is the same size, so parse them all in parallel.
+        if((size_t)(end - p) / rec_size < elem.count) {
+            fail(out_error, "PLY file is truncated");
+            return nullptr;
+        }
+        size_t off = 0;
+        for(size_t i=0; i<elem.props.size(); ++i) {
+            layout.offset[i] = off;
+            off += ply_type_size(elem.props[i].type);
+        }
+
+        bool big_endian = hdr.encoding == ply_encoding::BINARY_BE;
+#       pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int v=0; v<(int)elem.count; ++v) {
+            const char *rec = p + (size_t)v * rec_size;
+            vec3f       pt;
+            for(size_t i=0; i<3; ++i) {
+                size_t prop = (size_t)layout.pos[i];
+                pt[i] = (float)ply_read(rec + layout.offset[prop], elem.props[prop].type, big_endian);
+            }
+            out.positions[(size_t)v] = pt;
+            if(layout.has_color) {
+                double rgba[4] = {0.0, 0.0, 0.0, 0.0};
+                for(size_t i=0; i<4; ++i) {
+                    if(layout.color[i] >= 0) {
+                        size_t prop = (size_t)layout.color[i];
+                        rgba[i] = ply_read(rec + layout.offset[prop], elem.props[prop].type, big_endian);
+                    }
+                }
+                out.colors[(size_t)v] = pack_color(rgba, layout);
+            }
+        }
+        return p + elem.count * rec_size;
+    }
+
+    // Add a polygon to the index list, as a fan of triangles.
+    inline void add_polygon(std::vector<uint32_t>& indices, const uint32_t *verts, size_t count) {
+        for(size_t i=2; i<count; ++i) {
+            indices.push_back(verts[0]);
+            indices.push_back(verts[i-1]);
+            indices.push_back(verts[i]);
+        }
+    }
+
+    // Parse all faces. Returns pointer to first byte after the face data on success.
+    const char* parse_ply_faces(const ply_header& hdr, const ply_element& elem, const char *p,
+                                const char *end, mesh& out, std::string *out_error) {
+        int list = elem.find("vertex_indices");
+        if(list < 0) {
+            list = elem.find("vertex_index");
+        }
+        if(list < 0 || elem.props[(size_t)list].count_type == ply_type::NONE) {
+            fail(out_error, "PLY face is missing vertex_indices list");
+            return nullptr;
+        }
+
+        std::vector<uint32_t> verts;
+        if(hdr.encoding == ply_encoding::ASCII) {
+            for(size_t f=0; f<elem.count; ++f) {
+                const char *q = p;
+                for(size_t i=0; i<elem.props.size() && q; ++i) {
+                    int64_t n = 1;
+                    if(elem.props[i].count_type != ply_type::NONE) {
+                        q = parse_int(skip_space(q, end), end, n);
+                        q = (n >= 0)? q : nullptr;
+                    }
+                    if((int)i == list) {
+                        // Indices are parsed as integers, floats would round anything past 2^24.
+                        verts.clear();
+                        for(int64_t j=0; j<n && q; ++j) {
+                            uint32_t idx = 0;
+                            q = parse_ply_index(skip_space(q, end), end, idx);
+                            verts.push_back(idx);
+                        }
+                        if(q) {
+                            add_polygon(out.indices, verts.data(), verts.size());
+                        }
+                    } else {
+                        for(int64_t j=0; j<n && q; ++j) {
+                            float val;
+                            q = parse_float(skip_space(q, end), end, val);
+                        }
+                    }
+                }
+                if(!q) {
+                    fail(out_error, "bad face in ASCII PLY file");
+                    return nullptr;
+                }
+                p = next_line(q, end);
+            }
+            return p;
+        }
+
+        bool   big_endian = hdr.encoding == ply_encoding::BINARY_BE;
+        size_t count_size = ply_type_size(elem.props[(size_t)list].count_type);
+        size_t idx_size   = ply_type_size(elem.props[(size_t)list].type);
+        ply_type idx_type = elem.props[(size_t)list].type;
+        if(idx_type == ply_type::FLOAT32 || idx_type == ply_type::FLOAT64) {
+            fail(out_error, "PLY vertex indices must be integers");
+            return nullptr;
+        }
+
+        // Most files only contain triangles, and only the vertex list. If so, every record is the
+        // same size, and the faces can be parsed in parallel.
+        if(elem.props.size() == 1 && elem.count > 0 && (size_t)(end - p) >= count_size) {
+            size_t rec_size = count_size + 3 * idx_size;
+            if((size_t)(end - p) / rec_size >= elem.count) {
+                ply_type ctype    = elem.props[0].count_type;
+                ply_type itype    = elem.props[0].type;
+                int      all_tris = 1;
+#               pragma omp parallel for reduction(&&:all_tris) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+                for(int f=0; f<(int)elem.count; ++f) {
+                    all_tris = all_tris && ply_read_int(p + (size_t)f * rec_size, ctype, big_endian) == 3;
+                }
+                if(all_tris) {
+                    out.indices.resize(3 * elem.count);
+                    int all_valid = 1;
+#                   pragma omp parallel for reduction(&&:all_valid) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+                    for(int f=0; f<(int)elem.count; ++f) {
+                        const char *rec = p + (size_t)f * rec_size + count_size;
+                        for(size_t j=0; j<3; ++j) {
+                            int64_t idx = ply_read_int(rec + j * idx_size, itype, big_endian);
+                            all_valid   = all_valid && idx >= 0;
+                            out.indices[3 * (size_t)f + j] = (idx >= 0)? (uint32_t)idx : 0u;
+                        }
+                    }
+                    if(!all_valid) {
+                        fail(out_error, "negative vertex index in PLY file");
+                        return nullptr;
+                    }
+                    return p + elem.count * rec_size;
+                }
+            }
+        }
+
+        // General case: polygons of any size, and possibly other properties mixed in.
+        for(size_t f=0; f<elem.count; ++f) {
+            for(size_t i=0; i<elem.props.size(); ++i) {
+                const ply_property& prop = elem.props[i];
+                size_t n = 1;
+                if(prop.count_type != ply_type::NONE) {
+                    if((size_t)(end - p) < ply_type_size(prop.count_type)) {
+                        fail(out_error, "PLY file is truncated");
+                        return nullptr;
+                    }
+                    int64_t count = ply_read_int(p, prop.count_type, big_endian);
+                    if(count < 0) {
+                        fail(out_error, "negative list size in PLY file");
+                        return nullptr;
+                    }
+                    n  = (size_t)count;
+                    p += ply_type_size(prop.count_type);
+                }
+                size_t item_size = ply_type_size(prop.type);
+                if((size_t)(end - p) / item_size < n) {
+                    fail(out_error, "PLY file is truncated");
+                    return nullptr;
+                }
+                if((int)i == list) {
+                    verts.resize(n);
+                    for(size_t j=0; j<n; ++j) {
+                        int64_t idx = ply_read_int(p + j * item_size, prop.type, big_endian);
+                        if(idx < 0) {
+                            fail(out_error, "negative vertex index in PLY file");
+                            return nullptr;
+                        }
+                        verts[j] = (uint32_t)idx;
+                    }
+                    add_polygon(out.indices, verts.data(), n);
+                }
+                p += n * item_size;
+            }
+        }
+        return p;
+    }
+
+    // Skip over an element we don't care about. Returns pointer to first byte after it.
+    const char* skip_ply_element(const ply_header& hdr, const ply_element& elem, const char *p,
+                                 const char *end, std::string *out_error) {
+        if(hdr.encoding == ply_encoding::ASCII) {
+            for(size_t i=0; i<elem.count; ++i) {
+                if(p >= end) {
+                    fail(out_error, "PLY file is truncated");
+                    return nullptr;
+                }
+                p = next_line(p, end);
+            }
+            return p;
+        }
+        size_t rec_size = elem.record_size();
+        if(rec_size > 0) {
+            if((size_t)(end - p) / rec_size < elem.count) {
+                fail(out_error, "PLY file is truncated");
+                return nullptr;
+            }
+            return p + elem.count * rec_size;
+        }
+        bool big_endian = hdr.encoding == ply_encoding::BINARY_BE;
+        for(size_t f=0; f<elem.count; ++f) {
+            for(const ply_property& prop : elem.props) {
+                size_t n = 1;
+                if(prop.count_type != ply_type::NONE) {
+                    if((size_t)(end - p) < ply_type_size(prop.count_type)) {
+                        fail(out_error, "PLY file is truncated");
+                        return nullptr;
+                    }
+                    int64_t count = ply_read_int(p, prop.count_type, big_endian);
+                    if(count < 0) {
+                        fail(out_error, "negative list size in PLY file");
+                        return nullptr;
+                    }
+                    n  = (size_t)count;
+                    p += ply_type_size(prop.count_type);
+                }
+                if((size_t)(end - p) / ply_type_size(prop.type) < n) {
+                    fail(out_error, "PLY file is truncated");
+                    return nullptr;
+                }
+                p += n * ply_type_size(prop.type);
+            }
+        }
+        return p;
+    }
+
+    bool parse_ply(const char *data, size_t size, mesh& out, std::string *out_error) {
+        ply_header hdr;
+        if(!parse_ply_header(data, size, hdr, out_error)) {
+            return false;
+        }
+        const char *p   = hdr.body;
+        const char *end = data + size;
+        bool have_verts = false;
+        for(const ply_element& elem : hdr.elements) {
+            if(elem.name == "vertex") {
+                p          = parse_ply_vertices(hdr, elem, p, end, out, out_error);
+                have_verts = true;
+            } else if(elem.name == "face") {
+                p = parse_ply_faces(hdr, elem, p, end, out, out_error);
+            } else {
+                p = skip_ply_element(hdr, elem, p, end, out_error);
+            }
+            if(!p) {
+                return false;
+            }
+        }
+        if(!have_verts) {
+            return fail(out_error, "PLY file has no vertex element");
+        }
+        return true;
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // OBJ
+    struct obj_chunk {
+        const char *begin;
+        const char *end;
+        size_t      num_verts = 0; // number of "v" lines in chunk
+        size_t      num_tris  = 0; // number of triangles made from "f" lines in chunk
+        size_t      vert_base = 0; // number of vertices in all previous chunks
+        size_t      tri_base  = 0; // number of triangles in all previous chunks
+        bool        error     = false;
+    };
+
+    // Return true if line (starting at first non-space char) begins with the given record type.
+    inline bool obj_record(const char *p, const char *end, char type) {
+        return p + 1 < end && p[0] == type && is_space(p[1]);
+    }
+
+    // Count the vertex references in a face line.
+    size_t obj_face_size(const char *p, const char *end) {
+        size_t n = 0;
+        for(p = skip_space(p, end); p < end && *p != '\n' && *p != '#'; p = skip_space(p, end)) {
+            p = skip_token(p, end);
+            n++;
+        }
+        return n;
+    }
+
+    // First pass over a chunk: count vertices and triangles, so we know where the chunk's data
+    // goes in the output arrays.
+    void obj_count(obj_chunk& chunk) {
+        for(const char *p = chunk.begin; p < chunk.end; p = next_line(p, chunk.end)) {
+            p = skip_space(p, chunk.end);
+            if(obj_record(p, chunk.end, 'v')) {
+                chunk.num_verts++;
+            } else if(obj_record(p, chunk.end, 'f')) {
+                size_t n = obj_face_size(p + 1, chunk.end);
+                chunk.num_tris += (n >= 3)? n - 2 : 0;
+            }
+        }
+    }
+
+    // Second pass over a chunk: parse vertices and faces directly into the output arrays.
+    void obj_parse(obj_chunk& chunk, size_t total_verts, mesh& out) {
+        vec3f    *pos  = out.positions.data() + chunk.vert_base;
+        uint32_t *idx  = out.indices.data() + 3 * chunk.tri_base;
+        size_t    nv   = chunk.vert_base; // vertices seen so far (for relative indices)
+
+        for(const char *p = chunk.begin; p < chunk.end; p = next_line(p, chunk.end)) {
+            p = skip_space(p, chunk.end);
+            if(obj_record(p, chunk.end, 'v')) {
+                const char *q = p + 1;
+                vec3f       pt;
+                for(size_t i=0; i<3 && q; ++i) {
+                    q = parse_float(skip_space(q, chunk.end), chunk.end, pt[i]);
+                }
+                if(!q) {
+                    chunk.error = true;
+                    return;
+                }
+                *pos++ = pt;
+                nv++;
+            } else if(obj_record(p, chunk.end, 'f')) {
+                // Each reference is "v", "v/vt", "v//vn" or "v/vt/vn", we only need v.
+                uint32_t    first = 0, prev = 0;
+                size_t      n     = 0;
+                const char *q     = skip_space(p + 1, chunk.end);
+                while(q < chunk.end && *q != '\n' && *q != '#') {
+                    int64_t ref;
+                    const char *r = parse_int(q, chunk.end, ref);
+                    if(!r || ref == 0) {
+                        chunk.error = true;
+                        return;
+                    }
+                    int64_t v = (ref > 0)? ref - 1 : (int64_t)nv + ref;
+                    if(v < 0 || (size_t)v >= total_verts) {
+                        chunk.error = true;
+                        return;
+                    }
+                    uint32_t cur = (uint32_t)v;
+                    if(n == 0) {
+                        first = cur;
+                    } else if(n >= 2) {
+                        *idx++ = first;
+                        *idx++ = prev;
+                        *idx++ = cur;
+                    }
+                    prev = cur;
+                    n++;
+                    q = skip_space(skip_token(r, chunk.end), chunk.end);
+                }
+            }
+        }
+    }
+
+    bool parse_obj(const char *data, size_t size, mesh& out, std::string *out_error) {
+        const char *end = data + size;
+
+        // Split the file into chunks that end on line boundaries. Use a few chunks per thread,
+        // so that one slow chunk (e.g., lots of faces) doesn't hold everything up.
+        const size_t min_chunk  = 1u << 20;
+        size_t       num_chunks = std::max<size_t>(1, std::min(4 * (size_t)omp_get_max_threads(),
+                                                               size / min_chunk));
+        std::vector<obj_chunk> chunks;
+        const char *p = data;
+        for(size_t i=0; i<num_chunks && p < end; ++i) {
+            obj_chunk chunk;
+            chunk.begin = p;
+            chunk.end   = (i + 1 == num_chunks)? end : next_line(data + (i + 1) * (size / num_chunks), end);
+            chunk.end   = std::max(chunk.end, p);
+            chunks.push_back(chunk);
+            p = chunk.end;
+        }
+
+#       pragma omp parallel for schedule(dynamic) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)chunks.size(); ++i) {
+            obj_count(chunks[(size_t)i]);
+        }
+
+        size_t total_verts = 0;
+        size_t total_tris  = 0;
+        for(obj_chunk& chunk : chunks) {
+            chunk.vert_base = total_verts;
+            chunk.tri_base  = total_tris;
+            total_verts    += chunk.num_verts;
+            total_tris     += chunk.num_tris;
+        }
+        if(total_verts > (size_t)std::numeric_limits<uint32_t>::max()
+           || 3 * total_tris > (size_t)std::numeric_limits<uint32_t>::max()) {
+            return fail(out_error, "OBJ file is too large");
+        }
+
+        out.positions.resize(total_verts);
+        out.indices.resize(3 * total_tris);
+
+#       pragma omp parallel for schedule(dynamic) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)chunks.size(); ++i) {
+            obj_parse(chunks[(size_t)i], total_verts, out);
+        }
+
+        for(const obj_chunk& chunk : chunks) {
+            if(chunk.error) {
+                out.clear();
+                return fail(out_error, "bad vertex or face in OBJ file");
+            }
+        }
+        return true;
+    }
+
+    mesh_format format_from_path(const std::string& path) {
+        size_t dot = path.find_last_of('.');
+        if(dot == std::string::npos) {
+            return mesh_format::UNKNOWN;
+        }
+        std::string ext = path.substr(dot + 1);
+        for(char& c : ext) {
+            c = (char)tolower((unsigned char)c);
+        }
+        if(ext == "stl") {
+            return mesh_format::STL;
+        } else if(ext == "ply") {
+            return mesh_format::PLY;
+        } else if(ext == "obj") {
+            return mesh_format::OBJ;
+        }
+        return mesh_format::UNKNOWN;
+    }
+} // END anonymous namespace
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public methods.
+bboxf mesh::bounds() const {
+    bboxf box;
+#   pragma omp parallel
+    {
+        bboxf local_box;
+#       pragma omp for nowait // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+        for(int i=0; i<(int)positions.size(); ++i) {
+            local_box.expand(positions[(size_t)i]);
+        }
+#       pragma omp critical
+        box.expand(local_box);
+    }
+    return box;
+}
+
+void mesh::triangle_boxes(std::vector<bboxf>& out_boxes) const {
+    out_boxes.resize(num_triangles());
+
+    // Give each thread long runs of triangles, so the SIMD kernel does most of the work.
+    const size_t block      = 4096;
+    const size_t num_blocks = (out_boxes.size() + block - 1) / block;
+#   pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int b=0; b<(int)num_blocks; ++b) {
+        const size_t first = (size_t)b * block;
+        const size_t count = std::min(block, out_boxes.size() - first);
+        obvi::triangle_bounds(positions.data(), indices.data() + 3 * first, count,
+                              out_boxes.data() + first);
+    }
+}
+
+bool mesh::intersect_ray(const vec3f& origin, const vec3f& dir, size_t first_tri, size_t num_tris,
+                         float max_t, size_t *out_tri, float *out_t) const {
+    bool found = false;
+    for(size_t i=first_tri; i<first_tri + num_tris; ++i) {
+        vec3f a, b, c;
+        triangle(i, a, b, c);
+        float t;
+        if(intersect_ray_triangle(origin, dir, a, b, c, max_t, &t)) {
+            max_t = t; // only look for closer hits from here on
+            found = true;
+            if(out_tri) {
+                *out_tri = i;
+            }
+        }
+    }
+    if(found && out_t) {
+        *out_t = max_t;
+    }
+    return found;
+}
+
+constexpr size_t obvi::quantized_positions::stride;
+
+void obvi::quantize_positions(const mesh& m, quantized_positions& out) {
+    bboxf box   = m.bounds();
+    vec3f lo    = (box.is_empty())? vec3f(0,0,0) : box.min_pt;
+    float scale = (box.is_empty())? 0.0f : (box.max_pt - box.min_pt).max_component();
+    if(!(scale > 0.0f)) {
+        scale = 1.0f; // all vertices at same point (or no vertices), any scale works
+    }
+    out.dequantize.set(mat3f::identity(), lo, scale);
+
+    const float  to_q   = 65535.0f / scale;
+    const size_t stride = quantized_positions::stride;
+    out.values.resize(m.positions.size() * stride);
+#   pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int i=0; i<(int)m.positions.size(); ++i) {
+        vec3f     q   = (m.positions[(size_t)i] - lo) * to_q;
+        uint16_t *dst = out.values.data() + (size_t)i * stride;
+        for(size_t j=0; j<3; ++j) {
+            dst[j] = (uint16_t)std::min(std::max(q[j] + 0.5f, 0.0f), 65535.0f);
+        }
+        dst[3] = 0;
+    }
+}
+
+bool obvi::parse_mesh(const char *data, size_t size, mesh_format format, mesh& out_mesh,
+                      std::string *out_error) {
+    out_mesh.clear();
+
+    bool ok = false;
+    switch(format) {
+        case mesh_format::STL: ok = parse_stl(data, size, out_mesh, out_error); break;
+        case mesh_format::PLY: ok = parse_ply(data, size, out_mesh, out_error); break;
+        case mesh_format::OBJ: ok = parse_obj(data, size, out_mesh, out_error); break;
+        default: return fail(out_error, "unknown mesh file format");
+    }
+    if(!ok) {
+        out_mesh.clear();
+        return false;
+    }
+
+    // Make sure every index refers to a real vertex, so nobody downstream has to check.
+    size_t nverts = out_mesh.positions.size();
+    int    bad    = 0;
+#   pragma omp parallel for reduction(||:bad) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int i=0; i<(int)out_mesh.indices.size(); ++i) {
+        bad = bad || out_mesh.indices[(size_t)i] >= nverts;
+    }
+    if(bad) {
+        out_mesh.clear();
+        return fail(out_error, "mesh has a face that refers to a vertex that doesn't exist");
+    }
+    return true;
+}
+
+bool obvi::load_mesh(const std::string& path, mesh& out_mesh, std::string *out_error,
+                     mesh_format format) {
+    out_mesh.clear();
+
+    if(format == mesh_format::UNKNOWN) {
+        format = format_from_path(path);
+        if(format == mesh_format::UNKNOWN) {
+            return fail(out_error, "unrecognized mesh file extension: " + path);
+        }
+    }
+
+    mapped_file file;
+    if(!file.open(path)) {
+        return fail(out_error, "couldn't open file: " + path);
+    }
+    if(file.size() == 0) {
+        return fail(out_error, "file is empty: " + path);
+    }
+    return parse_mesh(file.data(), file.size(), format, out_mesh, out_error);
+}
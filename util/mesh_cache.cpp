@@ -0,0 +1,336 @@
+/* Implementation of mesh cache files.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/mesh_cache.hpp>
+#include <obvi/util/hash.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <type_traits>
+#include <utility>
+#include <string.h>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::mesh_chunk;
+using obvi::prepared_mesh;
+using obvi::vec3f;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    const char     file_magic[8] = {'O','B','V','I','C','A','C','H'};
+    const uint32_t file_version  = 1;    // bump whenever the layout or the meaning of any field changes
+    const uint64_t alignment     = 64;   // of every section (a cache line)
+
+    enum section_id {
+        POSITIONS,
+        COLORS,
+        INDICES,
+        CHUNKS,
+        LOD_INDICES,
+        BVH_NODES,
+        NUM_SECTIONS
+    };
+
+    struct section {
+        uint64_t offset;    // from start of file, multiple of alignment
+        uint64_t count;     // number of elements
+        uint32_t elem_size; // bytes per element
+        uint32_t reserved;  // always zero
+    };
+
+    struct file_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t header_size; // sizeof(file_header)
+        uint64_t source_hash;
+        section  sections[NUM_SECTIONS];
+    };
+
+    // Sections are raw copies of these types, so their layout is part of the file format.
+    static_assert(sizeof(section) == 24 && sizeof(file_header) == 168, "bad header layout");
+    static_assert(sizeof(vec3f) == 12, "vec3f must be three packed floats");
+    static_assert(sizeof(mesh_chunk) == 84, "mesh_chunk layout changed, bump file_version");
+    static_assert(sizeof(bvh::node) == 28, "bvh::node layout changed, bump file_version");
+    static_assert(std::is_trivially_copyable<vec3f>::value &&
+                  std::is_trivially_copyable<mesh_chunk>::value &&
+                  std::is_trivially_copyable<bvh::node>::value, "section types must be PODs");
+
+    const uint32_t elem_sizes[NUM_SECTIONS] = {
+        sizeof(vec3f), sizeof(uint32_t), sizeof(uint32_t), sizeof(mesh_chunk), sizeof(uint32_t),
+        sizeof(bvh::node)
+    };
+
+    bool fail(std::string *out_error, const std::string& msg) {
+        if(out_error) {
+            *out_error = msg;
+        }
+        return false;
+    }
+
+    // Sections are written in the host's byte order, so only little-endian hosts can use them.
+    bool is_little_endian() {
+        const uint32_t one = 1;
+        unsigned char  first;
+        memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    uint64_t align_up(uint64_t val) {
+        return (val + alignment - 1) / alignment * alignment;
+    }
+
+    /* Check the header of a mapped cache file, and copy it to hdr.
+     *
+     * Every section must be aligned and inside the file (checks are written so nothing can
+     * overflow), so the arrays can be read without any more bounds checks.
+     */
+    bool read_header(const obvi::mapped_file& file, uint64_t source_hash, file_header& hdr,
+                     std::string *out_error) {
+        if(file.size() < sizeof(file_header)) {
+            return fail(out_error, "cache file is truncated");
+        }
+        memcpy(&hdr, file.data(), sizeof(hdr));
+        if(memcmp(hdr.magic, file_magic, sizeof(file_magic)) != 0) {
+            return fail(out_error, "not a mesh cache file");
+        }
+        if(hdr.version != file_version || hdr.header_size != sizeof(file_header)) {
+            return fail(out_error, "cache file is from a different version");
+        }
+        if(hdr.source_hash != source_hash) {
+            return fail(out_error, "cache file was made from a different source file");
+        }
+        for(size_t i=0; i<NUM_SECTIONS; ++i) {
+            const section& s = hdr.sections[i];
+            if(s.elem_size != elem_sizes[i] || s.offset % alignment != 0 ||
+               s.offset > file.size() || s.count > (file.size() - s.offset) / s.elem_size) {
+                return fail(out_error, "cache file is corrupt");
+            }
+        }
+        return true;
+    }
+
+    template<typename T>
+    void copy_section(const obvi::mapped_file& file, const section& s, std::vector<T>& out) {
+        const T *ptr = reinterpret_cast<const T*>(file.data() + s.offset);
+        out.assign(ptr, ptr + s.count);
+    }
+
+    // True if every index is less than num_vertices.
+    bool indices_in_range(const std::vector<uint32_t>& indices, size_t num_vertices) {
+        for(uint32_t idx : indices) {
+            if(idx >= num_vertices) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // True if [first, first + count) fits in an array of the given size, and holds whole triangles.
+    bool range_in(uint64_t first, uint64_t count, size_t size) {
+        return count % 3 == 0 && first <= size && count <= size - first;
+    }
+
+    bool check_chunks(const prepared_mesh& pm) {
+        for(const mesh_chunk& chunk : pm.chunks) {
+            if(!range_in(chunk.first_index, chunk.num_indices, pm.geom.indices.size()) ||
+               chunk.num_lods > mesh_chunk::max_lods) {
+                return false;
+            }
+            for(size_t i=0; i<chunk.num_lods; ++i) {
+                const obvi::mesh_lod& lod = chunk.lods[i];
+                if(!range_in(lod.first_index, lod.num_indices, pm.lod_indices.size())) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+} // END anonymous namespace
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public functions.
+const char *const obvi::mesh_cache_extension = ".obvicache";
+
+void obvi::prepared_mesh::generate_chunk_bvh() {
+    std::vector<bboxf> boxes;
+    boxes.reserve(chunks.size());
+    for(const mesh_chunk& chunk : chunks) {
+        boxes.push_back(chunk.bounds);
+    }
+    chunk_bvh.generate(boxes);
+    cache_file.close(); // nodes aren't borrowed anymore
+}
+
+std::string obvi::mesh_cache_name(uint64_t source_hash) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)source_hash);
+    return std::string(buf) + mesh_cache_extension;
+}
+
+bool obvi::hash_file(const std::string& path, uint64_t *out_hash, std::string *out_error) {
+    mapped_file file;
+    if(!file.open(path)) {
+        return fail(out_error, "can't open file");
+    }
+    if(out_hash) {
+        *out_hash = hash64(file.data(), file.size());
+    }
+    return true;
+}
+
+bool obvi::save_mesh_cache(const std::string& path, uint64_t source_hash, const prepared_mesh& pm,
+                           std::string *out_error) {
+    if(!is_little_endian()) {
+        return fail(out_error, "mesh cache files are only supported on little-endian machines");
+    }
+    if(pm.chunk_bvh.size() != pm.chunks.size()) {
+        return fail(out_error, "chunk bvh doesn't match the chunks");
+    }
+
+    const bvh::node_list nodes = pm.chunk_bvh.nodes();
+    const void *data[NUM_SECTIONS] = {
+        pm.geom.positions.data(), pm.geom.colors.data(), pm.geom.indices.data(),
+        pm.chunks.data(), pm.lod_indices.data(), nodes.data()
+    };
+    const size_t counts[NUM_SECTIONS] = {
+        pm.geom.positions.size(), pm.geom.colors.size(), pm.geom.indices.size(),
+        pm.chunks.size(), pm.lod_indices.size(), nodes.size()
+    };
+
+    file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, file_magic, sizeof(file_magic));
+    hdr.version     = file_version;
+    hdr.header_size = sizeof(file_header);
+    hdr.source_hash = source_hash;
+    uint64_t offset = align_up(sizeof(file_header));
+    for(size_t i=0; i<NUM_SECTIONS; ++i) {
+        hdr.sections[i].offset    = offset;
+        hdr.sections[i].count     = counts[i];
+        hdr.sections[i].elem_size = elem_sizes[i];
+        offset = align_up(offset + counts[i] * elem_sizes[i]);
+    }
+
+    // Write to a temporary file, then move it into place, so a crash (or another process reading
+    // the cache) never sees a half-written file.
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if(!out) {
+            return fail(out_error, "can't create cache file");
+        }
+        static const char zeros[alignment] = {};
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        uint64_t written = sizeof(hdr);
+        for(size_t i=0; i<NUM_SECTIONS; ++i) {
+            out.write(zeros, std::streamsize(hdr.sections[i].offset - written));
+            out.write(static_cast<const char*>(data[i]),
+                      std::streamsize(counts[i] * elem_sizes[i]));
+            written = hdr.sections[i].offset + counts[i] * elem_sizes[i];
+        }
+        out.close();
+        if(!out) {
+            std::remove(tmp_path.c_str());
+            return fail(out_error, "error writing cache file");
+        }
+    }
+    std::remove(path.c_str()); // rename() won't replace an existing file on Windows
+    if(std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return fail(out_error, "can't rename cache file");
+    }
+    return true;
+}
+
+bool obvi::read_mesh_cache_info(const std::string& path, uint64_t source_hash,
+                               mesh_cache_info& out, std::string *out_error) {
+    out = mesh_cache_info();
+    if(!is_little_endian()) {
+        return fail(out_error, "mesh cache files are only supported on little-endian machines");
+    }
+    mapped_file file;
+    if(!file.open(path)) {
+        return fail(out_error, "can't open cache file");
+    }
+    file_header hdr;
+    if(!read_header(file, source_hash, hdr, out_error)) {
+        return false;
+    }
+    out.num_vertices    = size_t(hdr.sections[POSITIONS].count);
+    out.num_indices     = size_t(hdr.sections[INDICES].count);
+    out.num_chunks      = size_t(hdr.sections[CHUNKS].count);
+    out.num_lod_indices = size_t(hdr.sections[LOD_INDICES].count);
+    out.has_colors      = hdr.sections[COLORS].count > 0;
+    out.file_size       = file.size();
+    return true;
+}
+
+bool obvi::load_mesh_cache(const std::string& path, uint64_t source_hash, prepared_mesh& out,
+                           std::string *out_error) {
+    out = prepared_mesh();
+    if(!is_little_endian()) {
+        return fail(out_error, "mesh cache files are only supported on little-endian machines");
+    }
+
+    prepared_mesh pm;
+    if(!pm.cache_file.open(path)) {
+        return fail(out_error, "can't open cache file");
+    }
+    const mapped_file& file = pm.cache_file;
+    file_header hdr;
+    if(!read_header(file, source_hash, hdr, out_error)) {
+        return false;
+    }
+
+    copy_section(file, hdr.sections[POSITIONS], pm.geom.positions);
+    copy_section(file, hdr.sections[COLORS], pm.geom.colors);
+    copy_section(file, hdr.sections[INDICES], pm.geom.indices);
+    copy_section(file, hdr.sections[CHUNKS], pm.chunks);
+    copy_section(file, hdr.sections[LOD_INDICES], pm.lod_indices);
+
+    // Check everything the renderer indexes with, so a bad file can't make it read out of bounds.
+    const size_t num_verts = pm.geom.num_vertices();
+    if((!pm.geom.colors.empty() && pm.geom.colors.size() != num_verts) ||
+       pm.geom.indices.size() % 3 != 0 || pm.lod_indices.size() % 3 != 0 ||
+       !indices_in_range(pm.geom.indices, num_verts) ||
+       !indices_in_range(pm.lod_indices, num_verts) || !check_chunks(pm)) {
+        return fail(out_error, "cache file is corrupt");
+    }
+
+    // The chunk bvh uses the nodes right where they are in the mapped file (no copy). Sections
+    // are aligned, and mappings start on a page boundary, so the nodes are properly aligned.
+    const section& ns = hdr.sections[BVH_NODES];
+    if(!pm.chunk_bvh.borrow(reinterpret_cast<const bvh::node*>(file.data() + ns.offset),
+                            size_t(ns.count), pm.chunks.size())) {
+        return fail(out_error, "cache file has a corrupt bvh");
+    }
+
+    out = std::move(pm);
+    return true;
+}
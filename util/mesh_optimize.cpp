@@ -0,0 +1,448 @@
+/* Implementation of mesh optimizations: vertex welding, and vertex cache/fetch reordering.
+ *
+ * The vertex cache optimization is based on:
+ *   Tom Forsyth, "Linear-Speed Vertex Cache Optimisation", 2006.
+ *   https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/bvh.hpp>
+#include <obvi/util/compat_omp.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::mesh;
+using obvi::mesh_chunk;
+using obvi::vec3f;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    constexpr uint32_t no_vertex = std::numeric_limits<uint32_t>::max();
+
+    // Bit pattern of the float, with -0 and +0 treated as the same value.
+    inline uint32_t float_bits(float val) {
+        val += 0.0f;
+        uint32_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        return bits;
+    }
+
+    inline uint32_t hash_vertex(const vec3f& pt, uint32_t color) {
+        // Mix each word in with a multiply-rotate, then finish with the murmur3 finalizer.
+        uint32_t h = 0;
+        const uint32_t words[4] = {float_bits(pt[0]), float_bits(pt[1]), float_bits(pt[2]), color};
+        for(uint32_t w : words) {
+            h ^= w * 0xcc9e2d51u;
+            h  = (h << 13) | (h >> 19);
+            h  = h * 5u + 0xe6546b64u;
+        }
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    inline bool same_vertex(const vec3f& a, const vec3f& b) {
+        return float_bits(a[0]) == float_bits(b[0]) && float_bits(a[1]) == float_bits(b[1])
+            && float_bits(a[2]) == float_bits(b[2]);
+    }
+
+    // Move vertex data to new positions, given by remap (no_vertex means drop the vertex).
+    void remap_vertices(mesh& m, const std::vector<uint32_t>& remap, size_t new_count) {
+        std::vector<vec3f> positions(new_count);
+        for(size_t i=0; i<remap.size(); ++i) {
+            if(remap[i] != no_vertex) {
+                positions[remap[i]] = m.positions[i];
+            }
+        }
+        m.positions.swap(positions);
+
+        if(m.has_colors()) {
+            std::vector<uint32_t> colors(new_count);
+            for(size_t i=0; i<remap.size(); ++i) {
+                if(remap[i] != no_vertex) {
+                    colors[remap[i]] = m.colors[i];
+                }
+            }
+            m.colors.swap(colors);
+        }
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Forsyth vertex cache optimization.
+    constexpr int   sim_cache_size      = 32;   // size of simulated LRU cache
+    constexpr float cache_decay_power   = 1.5f;
+    constexpr float last_tri_score      = 0.75f;
+    constexpr float valence_boost_scale = 2.0f;
+    constexpr float valence_boost_power = 0.5f;
+    constexpr int   max_valence_table   = 32;
+
+    struct vertex_scorer {
+        float cache_score[sim_cache_size];
+        float valence_score[max_valence_table];
+
+        vertex_scorer() {
+            for(int i=0; i<sim_cache_size; ++i) {
+                if(i < 3) {
+                    // Vertices used by the last triangle get a fixed score, so it doesn't matter
+                    // which order its corners went into the cache.
+                    cache_score[i] = last_tri_score;
+                } else {
+                    float scale    = 1.0f / float(sim_cache_size - 3);
+                    cache_score[i] = std::pow(1.0f - float(i - 3) * scale, cache_decay_power);
+                }
+            }
+            for(int i=0; i<max_valence_table; ++i) {
+                valence_score[i] = valence(uint32_t(i));
+            }
+        }
+
+        static float valence(uint32_t remaining) {
+            return valence_boost_scale * std::pow(float(remaining), -valence_boost_power);
+        }
+
+        // Score of a vertex, given its position in the cache (-1 if not in cache), and the number
+        // of triangles that haven't been emitted yet that use it.
+        float operator()(int cache_pos, uint32_t remaining) const {
+            if(remaining == 0) {
+                return -1.0f; // no triangles need this vertex anymore
+            }
+            float score = (cache_pos >= 0)? cache_score[cache_pos] : 0.0f;
+            score += (remaining < (uint32_t)max_valence_table)? valence_score[remaining] : valence(remaining);
+            return score;
+        }
+    };
+
+    /* Write triangles to out, in the order picked by Forsyth's algorithm. All vertex indices
+     * must be less than nverts.
+     */
+    void forsyth_order(const uint32_t *indices, size_t ntris, size_t nverts, uint32_t *out) {
+        const vertex_scorer score;
+
+        // Build list of triangles that use each vertex (compressed sparse row).
+        std::vector<uint32_t> adj_count(nverts, 0);   // number of triangles not emitted yet
+        for(size_t i=0; i<3*ntris; ++i) {
+            adj_count[indices[i]]++;
+        }
+        std::vector<size_t> adj_offset(nverts + 1, 0);
+        for(size_t v=0; v<nverts; ++v) {
+            adj_offset[v+1] = adj_offset[v] + adj_count[v];
+        }
+        std::vector<uint32_t> adj_tris(3 * ntris);
+        {
+            std::vector<size_t> fill(adj_offset.begin(), adj_offset.end() - 1);
+            for(size_t t=0; t<ntris; ++t) {
+                for(size_t j=0; j<3; ++j) {
+                    adj_tris[fill[indices[3*t+j]]++] = (uint32_t)t;
+                }
+            }
+        }
+
+        // Initial scores.
+        std::vector<int>   cache_pos(nverts, -1);
+        std::vector<float> vert_score(nverts);
+        for(size_t v=0; v<nverts; ++v) {
+            vert_score[v] = score(-1, adj_count[v]);
+        }
+        std::vector<float> tri_score(ntris);
+        std::vector<char>  emitted(ntris, 0);
+        size_t best = 0;
+        for(size_t t=0; t<ntris; ++t) {
+            const uint32_t *idx = indices + 3*t;
+            tri_score[t] = vert_score[idx[0]] + vert_score[idx[1]] + vert_score[idx[2]];
+            if(tri_score[t] > tri_score[best]) {
+                best = t;
+            }
+        }
+
+        uint32_t cache[sim_cache_size + 3];
+        int      cache_count = 0;
+        size_t   cursor      = 0; // every triangle before this has been emitted
+
+        for(size_t n=0; n<ntris; ++n) {
+            if(best == ntris) {
+                // No candidates left in cache, fall back to the first triangle not emitted yet.
+                while(emitted[cursor]) {
+                    cursor++;
+                }
+                best = cursor;
+            }
+
+            // Emit triangle.
+            const uint32_t *tri = indices + 3*best;
+            memcpy(out + 3*n, tri, 3 * sizeof(uint32_t));
+            emitted[best] = 1;
+
+            // Remove it from the adjacency lists of its vertices.
+            for(size_t j=0; j<3; ++j) {
+                uint32_t  v    = tri[j];
+                uint32_t *list = adj_tris.data() + adj_offset[v];
+                for(uint32_t k=0; k<adj_count[v]; ++k) {
+                    if(list[k] == best) {
+                        list[k] = list[adj_count[v] - 1];
+                        adj_count[v]--;
+                        break;
+                    }
+                }
+            }
+
+            // Move triangle's vertices to the front of the cache (LRU).
+            uint32_t new_cache[sim_cache_size + 3];
+            int      new_count = 0;
+            for(size_t j=0; j<3; ++j) {
+                new_cache[new_count++] = tri[j];
+            }
+            for(int i=0; i<cache_count; ++i) {
+                uint32_t v = cache[i];
+                if(v != tri[0] && v != tri[1] && v != tri[2]) {
+                    new_cache[new_count++] = v;
+                }
+            }
+
+            // Update scores of everything that was in the cache (including vertices that just fell
+            // out of it), and pick the best triangle among their neighbors for next time.
+            best = ntris;
+            float best_score = -std::numeric_limits<float>::infinity();
+            for(int i=0; i<new_count; ++i) {
+                uint32_t v   = new_cache[i];
+                int      pos = (i < sim_cache_size)? i : -1;
+                cache_pos[v] = pos;
+
+                float new_score = score(pos, adj_count[v]);
+                float delta     = new_score - vert_score[v];
+                vert_score[v]   = new_score;
+
+                const uint32_t *list = adj_tris.data() + adj_offset[v];
+                for(uint32_t k=0; k<adj_count[v]; ++k) {
+                    uint32_t t = list[k];
+                    tri_score[t] += delta;
+                    if(tri_score[t] > best_score) {
+                        best_score = tri_score[t];
+                        best       = t;
+                    }
+                }
+            }
+            cache_count = (new_count < sim_cache_size)? new_count : sim_cache_size;
+            memcpy(cache, new_cache, (size_t)cache_count * sizeof(uint32_t));
+        }
+    }
+
+} // END anonymous namespace
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public methods.
+void obvi::weld_vertices(mesh& m) {
+    size_t nverts     = m.positions.size();
+    bool   has_colors = m.has_colors();
+    if(nverts == 0) {
+        return;
+    }
+
+    // Open-addressing hash table of unique vertices (stores index into compacted vertex arrays).
+    size_t table_size = 16;
+    while(table_size < 2 * nverts) {
+        table_size *= 2;
+    }
+    const size_t          mask = table_size - 1;
+    std::vector<uint32_t> table(table_size, no_vertex);
+    std::vector<uint32_t> remap(nverts);
+
+    // Compact unique vertices to the front of the arrays, in order of first appearance. This can
+    // be done in place, since a vertex is never moved to a higher index.
+    uint32_t num_unique = 0;
+    for(size_t v=0; v<nverts; ++v) {
+        const vec3f& pt    = m.positions[v];
+        uint32_t     color = (has_colors)? m.colors[v] : 0;
+        size_t       slot  = hash_vertex(pt, color) & mask;
+        while(table[slot] != no_vertex) {
+            uint32_t other = table[slot];
+            if(same_vertex(pt, m.positions[other]) && (!has_colors || m.colors[other] == color)) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if(table[slot] == no_vertex) {
+            table[slot]                 = num_unique;
+            m.positions[num_unique]     = pt;
+            if(has_colors) {
+                m.colors[num_unique]    = color;
+            }
+            num_unique++;
+        }
+        remap[v] = table[slot];
+    }
+    m.positions.resize(num_unique);
+    if(has_colors) {
+        m.colors.resize(num_unique);
+    }
+
+#   pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int i=0; i<(int)m.indices.size(); ++i) {
+        m.indices[(size_t)i] = remap[m.indices[(size_t)i]];
+    }
+
+    // Drop triangles that have collapsed to a line or point.
+    size_t ntris = 0;
+    for(size_t t=0; t<m.num_triangles(); ++t) {
+        uint32_t a = m.indices[3*t], b = m.indices[3*t+1], c = m.indices[3*t+2];
+        if(a != b && b != c && a != c) {
+            m.indices[3*ntris]   = a;
+            m.indices[3*ntris+1] = b;
+            m.indices[3*ntris+2] = c;
+            ntris++;
+        }
+    }
+    m.indices.resize(3 * ntris);
+}
+
+void obvi::optimize_vertex_cache(mesh& m) {
+    std::vector<uint32_t> out(m.indices.size());
+    forsyth_order(m.indices.data(), m.num_triangles(), m.positions.size(), out.data());
+    m.indices.swap(out);
+}
+
+void obvi::partition_mesh(mesh& m, std::vector<mesh_chunk>& out_chunks, size_t max_tris) {
+    out_chunks.clear();
+    const size_t ntris = m.num_triangles();
+    if(ntris == 0) {
+        return;
+    }
+    max_tris = std::max<size_t>(max_tris, 1);
+
+    std::vector<bboxf> boxes;
+    m.triangle_boxes(boxes);
+    bvh tree;
+    tree.generate(boxes);
+    const bvh::node_list nodes = tree.nodes();
+
+    // Nodes are stored depth-first, so the leaves of every subtree are contiguous when listed in
+    // node order. This is the new triangle order.
+    std::vector<uint32_t> order;
+    order.reserve(ntris);
+    for(const bvh::node& nd : nodes) {
+        if(nd.is_leaf()) {
+            order.push_back(nd.num & 0x7FFFFFFF);
+        }
+    }
+
+    // Cut the tree into the biggest subtrees that fit in a chunk, merging small neighbors.
+    std::vector<size_t> stack(1, 0);
+    size_t              leaf_pos = 0;
+    while(!stack.empty()) {
+        size_t idx = stack.back();
+        stack.pop_back();
+        size_t num_leaves = (nodes[idx].subtree_size() + 1) / 2;
+        if(num_leaves > max_tris) {
+            size_t left = idx + 1;
+            stack.push_back(left + nodes[left].subtree_size()); // right child
+            stack.push_back(left);                              // left child (visited first)
+            continue;
+        }
+        if(!out_chunks.empty() && out_chunks.back().num_indices / 3 + num_leaves <= max_tris) {
+            out_chunks.back().num_indices += uint32_t(3 * num_leaves);
+        } else {
+            out_chunks.emplace_back();
+            out_chunks.back().first_index = uint32_t(3 * leaf_pos);
+            out_chunks.back().num_indices = uint32_t(3 * num_leaves);
+        }
+        leaf_pos += num_leaves;
+    }
+
+    // Copy each chunk's triangles into place, and order them for the vertex cache.
+    std::vector<uint32_t> new_indices(m.indices.size());
+#   pragma omp parallel for schedule(dynamic) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int c=0; c<(int)out_chunks.size(); ++c) {
+        mesh_chunk&  chunk     = out_chunks[(size_t)c];
+        const size_t first_tri = chunk.first_index / 3;
+        const size_t num_tris  = chunk.num_indices / 3;
+
+        // Renumber vertices locally, so the cache optimizer's arrays are sized to the chunk.
+        std::vector<uint32_t> local(chunk.num_indices);
+        for(size_t t=0; t<num_tris; ++t) {
+            uint32_t tri = order[first_tri + t];
+            memcpy(local.data() + 3*t, m.indices.data() + 3*tri, 3 * sizeof(uint32_t));
+            chunk.bounds.expand(boxes[tri]);
+        }
+        std::vector<uint32_t> verts(local);
+        std::sort(verts.begin(), verts.end());
+        verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+        for(uint32_t& v : local) {
+            v = uint32_t(std::lower_bound(verts.begin(), verts.end(), v) - verts.begin());
+        }
+
+        uint32_t *dst = new_indices.data() + chunk.first_index;
+        forsyth_order(local.data(), num_tris, verts.size(), dst);
+        for(size_t i=0; i<chunk.num_indices; ++i) {
+            dst[i] = verts[dst[i]];
+        }
+    }
+    m.indices.swap(new_indices);
+}
+
+void obvi::optimize_vertex_fetch(mesh& m) {
+    std::vector<uint32_t> remap(m.positions.size(), no_vertex);
+    uint32_t              next = 0;
+    for(uint32_t& idx : m.indices) {
+        if(remap[idx] == no_vertex) {
+            remap[idx] = next++;
+        }
+        idx = remap[idx];
+    }
+    remap_vertices(m, remap, next);
+}
+
+void obvi::optimize_mesh(mesh& m) {
+    weld_vertices(m);
+    optimize_vertex_cache(m);
+    optimize_vertex_fetch(m);
+}
+
+float obvi::vertex_cache_miss_ratio(const mesh& m, size_t cache_size) {
+    if(m.num_triangles() == 0 || cache_size == 0) {
+        return 0.0f;
+    }
+
+    // A vertex is in the FIFO cache if fewer than cache_size misses happened since it was added.
+    std::vector<size_t> added_at(m.positions.size(), std::numeric_limits<size_t>::max());
+    size_t              misses = 0;
+    for(uint32_t v : m.indices) {
+        if(added_at[v] == std::numeric_limits<size_t>::max() || misses - added_at[v] >= cache_size) {
+            added_at[v] = misses;
+            misses++;
+        }
+    }
+    return float(misses) / float(m.num_triangles());
+}
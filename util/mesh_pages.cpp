@@ -0,0 +1,240 @@
+/* Implementation of splitting prepared meshes into pages.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/mesh_pages.hpp>
+#include <obvi/util/hash.hpp>
+
+#include <cstdio>
+#include <limits>
+
+using obvi::bboxf;
+using obvi::bvh;
+using obvi::mesh_chunk;
+using obvi::prepared_mesh;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    const uint32_t no_vertex = std::numeric_limits<uint32_t>::max();
+
+    bool fail(std::string *out_error, const std::string& msg) {
+        if(out_error) {
+            *out_error = msg;
+        }
+        return false;
+    }
+
+    // Copies vertices from a source mesh into a smaller one, the first time each one is used.
+    struct vertex_remap {
+        const obvi::mesh&     src;
+        obvi::mesh           *dst;
+        std::vector<uint32_t> local; // index in dst of each src vertex
+        std::vector<uint32_t> owner; // dst that local[] is for (so it doesn't need clearing)
+        uint32_t              cur_owner = 0;
+
+        vertex_remap(const obvi::mesh& source, obvi::mesh& dest)
+            : src(source), dst(&dest), local(source.num_vertices()),
+              owner(source.num_vertices(), no_vertex) {}
+
+        // Start filling a different mesh (vertices are never shared between meshes).
+        void restart(obvi::mesh& dest) {
+            dst = &dest;
+            cur_owner++;
+        }
+
+        void copy(const uint32_t *indices, size_t count, std::vector<uint32_t>& out) {
+            for(size_t i=0; i<count; ++i) {
+                const uint32_t v = indices[i];
+                if(owner[v] != cur_owner) {
+                    owner[v] = cur_owner;
+                    local[v] = uint32_t(dst->positions.size());
+                    dst->positions.push_back(src.positions[v]);
+                    if(src.has_colors()) {
+                        dst->colors.push_back(src.colors[v]);
+                    }
+                }
+                out.push_back(local[v]);
+            }
+        }
+    };
+
+    // Number of full-detail triangles under every node of the chunk bvh.
+    std::vector<size_t> subtree_tris(const bvh& tree, const std::vector<mesh_chunk>& chunks) {
+        bvh::node_list      nodes = tree.nodes();
+        std::vector<size_t> tris(nodes.size(), 0);
+        // Children always come after their parent, so walk the nodes backwards.
+        for(size_t i=nodes.size(); i>0; --i) {
+            const bvh::node& nd = nodes[i-1];
+            if(nd.is_leaf()) {
+                tris[i-1] = chunks[nd.num & 0x7FFFFFFFu].num_indices / 3;
+            } else {
+                tris[i-1] = tris[i] + tris[i + nodes[i].subtree_size()];
+            }
+        }
+        return tris;
+    }
+} // END anonymous namespace
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public functions.
+void obvi::split_mesh_pages(const prepared_mesh& pm, size_t max_tris,
+                            std::vector<prepared_mesh>& out_pages, prepared_mesh& out_proxy) {
+    out_pages.clear();
+    out_proxy = prepared_mesh();
+    if(pm.chunks.empty()) {
+        return;
+    }
+
+    // Rebuild the chunk bvh if it's out of date (can't change pm, so use a copy).
+    bvh rebuilt;
+    const bvh *tree = &pm.chunk_bvh;
+    if(pm.chunk_bvh.size() != pm.chunks.size()) {
+        std::vector<bboxf> boxes;
+        for(const mesh_chunk& chunk : pm.chunks) {
+            boxes.push_back(chunk.bounds);
+        }
+        rebuilt.generate(boxes);
+        tree = &rebuilt;
+    }
+
+    // Pages are the biggest subtrees under the triangle limit, in depth-first order (so pages
+    // next to each other in the list are usually close in space, too).
+    const bvh::node_list      nodes = tree->nodes();
+    const std::vector<size_t> tris  = subtree_tris(*tree, pm.chunks);
+    std::vector<size_t>       stack(1, 0);
+    std::vector<size_t>       page_roots;
+    while(!stack.empty()) {
+        size_t idx = stack.back();
+        stack.pop_back();
+        if(nodes[idx].is_leaf() || tris[idx] <= max_tris) {
+            page_roots.push_back(idx);
+        } else {
+            stack.push_back(idx + 1 + nodes[idx + 1].subtree_size()); // right child, after left
+            stack.push_back(idx + 1);
+        }
+    }
+
+    out_pages.resize(page_roots.size());
+    vertex_remap page_verts(pm.geom, out_pages[0].geom);
+    vertex_remap proxy_verts(pm.geom, out_proxy.geom);
+    for(size_t p=0; p<page_roots.size(); ++p) {
+        prepared_mesh& page = out_pages[p];
+        page_verts.restart(page.geom);
+
+        mesh_chunk stand_in;
+        stand_in.first_index = uint32_t(out_proxy.geom.indices.size());
+
+        const size_t root = page_roots[p];
+        const size_t end  = root + nodes[root].subtree_size();
+        for(size_t i=root; i<end; ++i) {
+            if(!nodes[i].is_leaf()) {
+                continue;
+            }
+            const mesh_chunk& src = pm.chunks[nodes[i].num & 0x7FFFFFFFu];
+            mesh_chunk        dst = src;
+            dst.first_index = uint32_t(page.geom.indices.size());
+            page_verts.copy(pm.geom.indices.data() + src.first_index, src.num_indices,
+                            page.geom.indices);
+            for(uint32_t j=0; j<src.num_lods; ++j) {
+                dst.lods[j].first_index = uint32_t(page.lod_indices.size());
+                page_verts.copy(pm.lod_indices.data() + src.lods[j].first_index,
+                                src.lods[j].num_indices, page.lod_indices);
+            }
+            page.chunks.push_back(dst);
+            stand_in.bounds.expand(src.bounds);
+
+            // The proxy gets the coarsest level of every chunk.
+            if(src.num_lods > 0) {
+                const obvi::mesh_lod& lod = src.lods[src.num_lods - 1];
+                proxy_verts.copy(pm.lod_indices.data() + lod.first_index, lod.num_indices,
+                                 out_proxy.geom.indices);
+            } else {
+                proxy_verts.copy(pm.geom.indices.data() + src.first_index, src.num_indices,
+                                 out_proxy.geom.indices);
+            }
+        }
+        page.generate_chunk_bvh();
+
+        stand_in.num_indices = uint32_t(out_proxy.geom.indices.size()) - stand_in.first_index;
+        out_proxy.chunks.push_back(stand_in);
+    }
+    out_proxy.generate_chunk_bvh();
+}
+
+uint64_t obvi::mesh_page_key(uint64_t source_hash, size_t max_tris) {
+    return hash64(&source_hash, sizeof(source_hash), uint64_t(max_tris));
+}
+
+std::string obvi::mesh_proxy_name(uint64_t key) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%016llx.proxy%s", (unsigned long long)key, mesh_cache_extension);
+    return buf;
+}
+
+std::string obvi::mesh_page_name(uint64_t key, size_t page_idx) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%016llx.p%llu%s", (unsigned long long)key,
+             (unsigned long long)page_idx, mesh_cache_extension);
+    return buf;
+}
+
+bool obvi::save_mesh_pages(const std::string& dir, uint64_t key,
+                           const std::vector<prepared_mesh>& pages, const prepared_mesh& proxy,
+                           std::string *out_error) {
+    if(pages.size() != proxy.chunks.size()) {
+        return fail(out_error, "proxy doesn't match the pages");
+    }
+    for(size_t i=0; i<pages.size(); ++i) {
+        if(!save_mesh_cache(dir + "/" + mesh_page_name(key, i), key, pages[i], out_error)) {
+            return false;
+        }
+    }
+    return save_mesh_cache(dir + "/" + mesh_proxy_name(key), key, proxy, out_error);
+}
+
+bool obvi::load_mesh_proxy(const std::string& dir, uint64_t key, prepared_mesh& out_proxy,
+                           std::vector<mesh_cache_info>& out_pages, std::string *out_error) {
+    out_pages.clear();
+    if(!load_mesh_cache(dir + "/" + mesh_proxy_name(key), key, out_proxy, out_error)) {
+        return false;
+    }
+    out_pages.resize(out_proxy.chunks.size());
+    for(size_t i=0; i<out_pages.size(); ++i) {
+        if(!read_mesh_cache_info(dir + "/" + mesh_page_name(key, i), key, out_pages[i],
+                                 out_error)) {
+            out_proxy = prepared_mesh();
+            out_pages.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool obvi::load_mesh_page(const std::string& dir, uint64_t key, size_t page_idx,
+                          prepared_mesh& out, std::string *out_error) {
+    return load_mesh_cache(dir + "/" + mesh_page_name(key, page_idx), key, out, out_error);
+}
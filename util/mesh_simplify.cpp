@@ -0,0 +1,334 @@
+/* Implementation of level-of-detail mesh simplification (quadric error edge collapse).
+ *
+ * See: Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics", SIGGRAPH 1997.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/mesh.hpp>
+#include <obvi/util/compat_omp.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <utility>
+
+using obvi::mesh;
+using obvi::mesh_chunk;
+using obvi::mesh_lod;
+using obvi::vec3f;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Helper code - only visible inside this file.
+namespace {
+    // Sum of squared distances to a set of planes, weighted by triangle area. Stored as the upper
+    // triangle of a symmetric 4x4 matrix (a2 ab ac ad b2 bc bd c2 cd d2), plus the total weight.
+    struct quadric {
+        double q[10] = {};
+        double weight = 0;
+
+        void add_plane(double a, double b, double c, double d, double w) {
+            q[0] += w*a*a; q[1] += w*a*b; q[2] += w*a*c; q[3] += w*a*d;
+            q[4] += w*b*b; q[5] += w*b*c; q[6] += w*b*d;
+            q[7] += w*c*c; q[8] += w*c*d;
+            q[9] += w*d*d;
+            weight += w;
+        }
+
+        quadric& operator+=(const quadric& other) {
+            for(size_t i=0; i<10; ++i) {
+                q[i] += other.q[i];
+            }
+            weight += other.weight;
+            return *this;
+        }
+
+        // Area-weighted RMS distance of pt from the planes.
+        float error(const vec3f& pt) const {
+            double x = pt[0], y = pt[1], z = pt[2];
+            double e = q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+                     + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+                     + q[7]*z*z + 2*q[8]*z
+                     + q[9];
+            return (weight > 0)? float(std::sqrt(std::max(e, 0.0) / weight)) : 0.0f;
+        }
+    };
+
+    // Candidate collapse of vertex 'from' onto vertex 'to' (local vertex ids).
+    struct collapse {
+        float    cost;
+        uint32_t from;
+        uint32_t to;
+        uint32_t stamp; // sum of both vertices' versions when queued, to detect stale entries
+
+        bool operator<(const collapse& other) const {
+            return cost > other.cost; // std::priority_queue puts the largest first, we want smallest
+        }
+    };
+
+    vec3f tri_normal(const vec3f& a, const vec3f& b, const vec3f& c) {
+        return (b - a).cross(c - a);
+    }
+
+    /* Simplify one chunk, appending each level's triangles (global vertex ids) to out_indices.
+     * Returns the number of levels built.
+     */
+    size_t simplify_chunk(const mesh& m, const mesh_chunk& chunk, size_t max_lods,
+                          std::vector<uint32_t>& out_indices, mesh_lod* out_lods) {
+        const uint32_t* idx     = m.indices.data() + chunk.first_index;
+        const size_t    ntris   = chunk.num_indices / 3;
+        if(ntris == 0 || max_lods == 0) {
+            return 0;
+        }
+
+        // Switch to local vertex ids, so per-vertex data is sized to the chunk.
+        std::vector<uint32_t> verts(idx, idx + chunk.num_indices);
+        std::sort(verts.begin(), verts.end());
+        verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+        const size_t nverts = verts.size();
+
+        std::vector<uint32_t> tris(chunk.num_indices);
+        for(size_t i=0; i<tris.size(); ++i) {
+            tris[i] = uint32_t(std::lower_bound(verts.begin(), verts.end(), idx[i]) - verts.begin());
+        }
+        std::vector<vec3f> pos(nverts);
+        for(size_t v=0; v<nverts; ++v) {
+            pos[v] = m.positions[verts[v]];
+        }
+
+        // Lock vertices on edges that only one triangle uses (chunk borders and open edges).
+        std::vector<uint8_t> locked(nverts, 0);
+        {
+            std::vector<std::pair<uint32_t, uint32_t>> edges;
+            edges.reserve(tris.size());
+            for(size_t t=0; t<ntris; ++t) {
+                for(size_t k=0; k<3; ++k) {
+                    uint32_t a = tris[3*t + k], b = tris[3*t + (k + 1) % 3];
+                    edges.push_back({std::min(a, b), std::max(a, b)});
+                }
+            }
+            std::sort(edges.begin(), edges.end());
+            for(size_t i=0; i<edges.size();) {
+                size_t j = i + 1;
+                while(j < edges.size() && edges[j] == edges[i]) {
+                    ++j;
+                }
+                if(j - i == 1) {
+                    locked[edges[i].first] = locked[edges[i].second] = 1;
+                }
+                i = j;
+            }
+        }
+
+        // Quadrics from the planes of each vertex's triangles, and vertex -> triangle lists.
+        std::vector<quadric>               quads(nverts);
+        std::vector<std::vector<uint32_t>> vtris(nverts);
+        for(size_t t=0; t<ntris; ++t) {
+            const uint32_t* tv = &tris[3*t];
+            vec3f  n   = tri_normal(pos[tv[0]], pos[tv[1]], pos[tv[2]]);
+            double len = std::sqrt(double(n.normsqd()));
+            if(len > 0) {
+                double a = n[0] / len, b = n[1] / len, c = n[2] / len;
+                double d = -(a * pos[tv[0]][0] + b * pos[tv[0]][1] + c * pos[tv[0]][2]);
+                for(size_t k=0; k<3; ++k) {
+                    quads[tv[k]].add_plane(a, b, c, d, 0.5 * len);
+                }
+            }
+            for(size_t k=0; k<3; ++k) {
+                vtris[tv[k]].push_back(uint32_t(t));
+            }
+        }
+
+        std::vector<uint8_t>  tri_alive(ntris, 1);
+        std::vector<uint8_t>  vert_alive(nverts, 1);
+        std::vector<uint32_t> version(nverts, 0);
+
+        std::priority_queue<collapse> heap;
+        auto push = [&](uint32_t from, uint32_t to) {
+            if(locked[from]) {
+                return;
+            }
+            quadric q = quads[from];
+            q += quads[to];
+            heap.push({q.error(pos[to]), from, to, version[from] + version[to]});
+        };
+        for(size_t t=0; t<ntris; ++t) {
+            for(size_t k=0; k<3; ++k) {
+                uint32_t a = tris[3*t + k], b = tris[3*t + (k + 1) % 3];
+                push(a, b);
+                push(b, a);
+            }
+        }
+
+        size_t num_levels = 0;
+        size_t live_tris  = ntris;
+        size_t prev_tris  = ntris;
+        size_t target     = ntris / 2;
+        float  max_error  = 0.0f;
+
+        auto save_level = [&]() {
+            mesh_lod& lod   = out_lods[num_levels++];
+            lod.first_index = uint32_t(out_indices.size());
+            lod.error       = max_error;
+            for(size_t t=0; t<ntris; ++t) {
+                if(tri_alive[t]) {
+                    for(size_t k=0; k<3; ++k) {
+                        out_indices.push_back(verts[tris[3*t + k]]);
+                    }
+                }
+            }
+            lod.num_indices = uint32_t(out_indices.size() - lod.first_index);
+            prev_tris = live_tris;
+            target    = live_tris / 2;
+        };
+
+        while(num_levels < max_lods) {
+            if(live_tris <= target) {
+                save_level();
+                continue;
+            }
+            if(heap.empty()) {
+                // Can't reach the target, keep what we have if it's a big enough reduction.
+                if(4 * live_tris <= 3 * prev_tris) {
+                    save_level();
+                }
+                break;
+            }
+
+            collapse c = heap.top();
+            heap.pop();
+            if(!vert_alive[c.from] || !vert_alive[c.to]
+               || c.stamp != version[c.from] + version[c.to]) {
+                continue; // stale
+            }
+
+            // Reject if 'to' isn't a neighbor anymore, or if any triangle would flip over.
+            bool adjacent = false, flips = false;
+            for(uint32_t t : vtris[c.from]) {
+                if(!tri_alive[t]) {
+                    continue;
+                }
+                const uint32_t* tv = &tris[3*t];
+                if(tv[0] == c.to || tv[1] == c.to || tv[2] == c.to) {
+                    adjacent = true;
+                    continue;
+                }
+                vec3f p[3];
+                for(size_t k=0; k<3; ++k) {
+                    p[k] = pos[tv[k]];
+                }
+                vec3f  n_old = tri_normal(p[0], p[1], p[2]);
+                for(size_t k=0; k<3; ++k) {
+                    if(tv[k] == c.from) {
+                        p[k] = pos[c.to];
+                    }
+                }
+                if(n_old.dot(tri_normal(p[0], p[1], p[2])) <= 0.0f) {
+                    flips = true;
+                    break;
+                }
+            }
+            if(!adjacent || flips) {
+                continue;
+            }
+
+            // Collapse: triangles with both vertices disappear, the rest move over to 'to'.
+            for(uint32_t t : vtris[c.from]) {
+                if(!tri_alive[t]) {
+                    continue;
+                }
+                uint32_t* tv = &tris[3*t];
+                if(tv[0] == c.to || tv[1] == c.to || tv[2] == c.to) {
+                    tri_alive[t] = 0;
+                    live_tris--;
+                } else {
+                    for(size_t k=0; k<3; ++k) {
+                        if(tv[k] == c.from) {
+                            tv[k] = c.to;
+                        }
+                    }
+                    vtris[c.to].push_back(t);
+                }
+            }
+            vert_alive[c.from] = 0;
+            vtris[c.from].clear();
+            quads[c.to] += quads[c.from];
+            max_error = std::max(max_error, c.cost);
+
+            // Queue new collapses around 'to' (old entries that involve it are now stale).
+            version[c.to]++;
+            std::vector<uint32_t>& around = vtris[c.to];
+            around.erase(std::remove_if(around.begin(), around.end(),
+                                        [&](uint32_t t) { return !tri_alive[t]; }), around.end());
+            for(uint32_t t : around) {
+                for(size_t k=0; k<3; ++k) {
+                    uint32_t w = tris[3*t + k];
+                    if(w != c.to) {
+                        push(w, c.to);
+                        push(c.to, w);
+                    }
+                }
+            }
+        }
+        return num_levels;
+    }
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public functions.
+constexpr size_t obvi::mesh_chunk::max_lods;
+
+void obvi::simplify_chunks(const mesh& m, std::vector<mesh_chunk>& chunks,
+                           std::vector<uint32_t>& out_lod_indices, size_t max_lods) {
+    out_lod_indices.clear();
+    max_lods = std::min(max_lods, mesh_chunk::max_lods);
+
+    // Chunks are independent, so simplify them in parallel.
+    std::vector<std::vector<uint32_t>> chunk_indices(chunks.size());
+    const int nchunks = (int)chunks.size();
+#   pragma omp parallel for schedule(dynamic) // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int c=0; c<nchunks; ++c) {
+        mesh_chunk& chunk = chunks[(size_t)c];
+        chunk.num_lods = uint32_t(simplify_chunk(m, chunk, max_lods, chunk_indices[(size_t)c],
+                                                 chunk.lods));
+    }
+
+    // Concatenate levels into one list.
+    size_t total = 0;
+    for(const std::vector<uint32_t>& list : chunk_indices) {
+        total += list.size();
+    }
+    out_lod_indices.reserve(total);
+    for(size_t c=0; c<chunks.size(); ++c) {
+        mesh_chunk& chunk  = chunks[c];
+        uint32_t    offset = uint32_t(out_lod_indices.size());
+        for(uint32_t i=0; i<chunk.num_lods; ++i) {
+            chunk.lods[i].first_index += offset;
+        }
+        out_lod_indices.insert(out_lod_indices.end(), chunk_indices[c].begin(),
+                               chunk_indices[c].end());
+        std::vector<uint32_t>().swap(chunk_indices[c]);
+    }
+}
@@ -0,0 +1,109 @@
+/* Implementation of the range allocator.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/range_allocator.hpp>
+
+#include <iterator>
+
+using obvi::range_allocator;
+
+void range_allocator::reset(size_t capacity) {
+    free_ranges.clear();
+    if(capacity > 0) {
+        free_ranges[0] = capacity;
+    }
+    cap      = capacity;
+    num_used = 0;
+}
+
+void range_allocator::grow(size_t new_capacity) {
+    if(new_capacity <= cap) {
+        return;
+    }
+    // Add the new space as a used range, then free it (merges it with a free range at the end).
+    size_t old_cap = cap;
+    cap       = new_capacity;
+    num_used += new_capacity - old_cap;
+    free(old_cap, new_capacity - old_cap);
+}
+
+bool range_allocator::allocate(size_t size, size_t *out_offset) {
+    if(size == 0) {
+        *out_offset = 0;
+        return true;
+    }
+    auto best = free_ranges.end();
+    for(auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        if(it->second >= size && (best == free_ranges.end() || it->second < best->second)) {
+            best = it;
+            if(it->second == size) {
+                break; // can't do better than an exact fit
+            }
+        }
+    }
+    if(best == free_ranges.end()) {
+        return false;
+    }
+
+    *out_offset = best->first;
+    if(best->second > size) {
+        free_ranges[best->first + size] = best->second - size;
+    }
+    free_ranges.erase(best);
+    num_used += size;
+    return true;
+}
+
+void range_allocator::free(size_t offset, size_t size) {
+    if(size == 0) {
+        return;
+    }
+    num_used -= size;
+
+    // Merge with the free ranges right before and right after, if they touch this one.
+    auto next = free_ranges.lower_bound(offset);
+    if(next != free_ranges.begin()) {
+        auto prev = std::prev(next);
+        if(prev->first + prev->second == offset) {
+            offset = prev->first;
+            size  += prev->second;
+            free_ranges.erase(prev);
+        }
+    }
+    if(next != free_ranges.end() && offset + size == next->first) {
+        size += next->second;
+        free_ranges.erase(next);
+    }
+    free_ranges[offset] = size;
+}
+
+size_t range_allocator::largest_free() const {
+    size_t largest = 0;
+    for(const auto& range : free_ranges) {
+        largest = (range.second > largest)? range.second : largest;
+    }
+    return largest;
+}
@@ -0,0 +1,202 @@
+/* Implementation of the page residency manager.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/residency.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using obvi::residency;
+using obvi::residency_manager;
+
+void residency_manager::clear() {
+    pages.clear();
+    instances.clear();
+    order.clear();
+    host_bytes = gpu_bytes = num_loading = 0;
+}
+
+size_t residency_manager::add_page(size_t host_size, size_t gpu_size) {
+    page p;
+    p.host_size = host_size;
+    p.gpu_size  = gpu_size;
+    pages.push_back(p);
+    return pages.size() - 1;
+}
+
+size_t residency_manager::add_instance(size_t page_idx, const bboxf& bounds,
+                                       const affine3f& model) {
+    instances.push_back({page_idx, bounds, model * bounds});
+    return instances.size() - 1;
+}
+
+void residency_manager::set_transform(size_t instance_idx, const affine3f& model) {
+    instance& inst = instances[instance_idx];
+    inst.world_bounds = model * inst.bounds;
+}
+
+void residency_manager::update(const camera3f& camera, float viewport_height, actions& out) {
+    out.evict_gpu.clear();
+    out.evict_host.clear();
+    out.load.clear();
+    out.upload.clear();
+    ++frame;
+
+    // Rate pages by the size on screen of their biggest copy, measured at its nearest point.
+    const frustumf fr  = camera.get_frustum();
+    const vec3f    eye = camera.get_position();
+    for(page& p : pages) {
+        p.priority = 0.0f;
+    }
+    for(const instance& inst : instances) {
+        const bboxf& box = inst.world_bounds;
+        if(box.is_empty()) {
+            continue;
+        }
+        float size = std::sqrt((box.max_pt - box.min_pt).normsqd());
+        float dist = std::sqrt(box.distance_squared(eye));
+        float px   = camera.screen_fraction(size, dist) * viewport_height;
+        if(!fr.intersects_box(box)) {
+            px *= outside_weight;
+        }
+        page& p = pages[inst.page_idx];
+        p.priority = std::max(p.priority, px);
+    }
+    order.clear();
+    for(size_t i = 0; i < pages.size(); ++i) {
+        page& p = pages[i];
+        if(p.priority < min_pixels || p.failed) {
+            p.priority = 0.0f;
+        } else {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        const float pa = pages[a].priority, pb = pages[b].priority;
+        return pa > pb || (pa == pb && a < b);
+    });
+
+    // Best pages that fit in each budget. Pages that don't fit are skipped, so smaller ones
+    // further down the list can still use the rest of the budget.
+    size_t host_left = host_budget;
+    size_t gpu_left  = gpu_budget;
+    for(size_t idx : order) {
+        page& p = pages[idx];
+        if(p.host_size > host_left) {
+            continue;
+        }
+        host_left    -= p.host_size;
+        p.host_wanted = frame;
+        if(p.gpu_size <= gpu_left) {
+            gpu_left    -= p.gpu_size;
+            p.gpu_wanted = frame;
+        }
+    }
+
+    // Send loaded pages to the GPU, then start loading the rest, best first. Everything wanted
+    // fits in the budgets, so making room never has to evict a page that's wanted.
+    for(size_t idx : order) {
+        page& p = pages[idx];
+        if(p.gpu_wanted == frame && p.state == residency::HOST &&
+           make_room(true, p.gpu_size, out)) {
+            p.state    = residency::GPU;
+            gpu_bytes += p.gpu_size;
+            out.upload.push_back(idx);
+        }
+    }
+    for(size_t idx : order) {
+        if(num_loading >= max_loads) {
+            break;
+        }
+        page& p = pages[idx];
+        if(p.host_wanted == frame && p.state == residency::DISK &&
+           make_room(false, p.host_size, out)) {
+            p.state     = residency::LOADING;
+            host_bytes += p.host_size;
+            num_loading++;
+            out.load.push_back(idx);
+        }
+    }
+}
+
+bool residency_manager::make_room(bool gpu, size_t bytes, actions& out) {
+    size_t&      used   = gpu ? gpu_bytes : host_bytes;
+    const size_t budget = gpu ? gpu_budget : host_budget;
+    while(used + bytes > budget) {
+        // Evict the page that was wanted longest ago (and isn't wanted now).
+        size_t   victim = pages.size();
+        uint64_t oldest = frame;
+        for(size_t i = 0; i < pages.size(); ++i) {
+            const page& p = pages[i];
+            const bool  resident = gpu ? p.state == residency::GPU
+                                       : p.state == residency::HOST || p.state == residency::GPU;
+            const uint64_t wanted = gpu ? p.gpu_wanted : p.host_wanted;
+            if(resident && wanted < oldest) {
+                victim = i;
+                oldest = wanted;
+            }
+        }
+        if(victim == pages.size()) {
+            return false;
+        }
+
+        page& v = pages[victim];
+        if(v.state == residency::GPU) {
+            v.state    = residency::HOST;
+            gpu_bytes -= v.gpu_size;
+            out.evict_gpu.push_back(victim);
+        }
+        if(!gpu) {
+            v.state     = residency::DISK;
+            host_bytes -= v.host_size;
+            out.evict_host.push_back(victim);
+        }
+    }
+    return true;
+}
+
+void residency_manager::loaded(size_t page_idx, bool ok) {
+    page& p = pages[page_idx];
+    if(p.state != residency::LOADING) {
+        return;
+    }
+    num_loading--;
+    if(ok) {
+        p.state = residency::HOST;
+    } else {
+        p.state     = residency::DISK;
+        p.failed    = true;
+        host_bytes -= p.host_size;
+    }
+}
+
+size_t residency_manager::count(residency state) const {
+    size_t num = 0;
+    for(const page& p : pages) {
+        num += (p.state == state)? 1 : 0;
+    }
+    return num;
+}
@@ -0,0 +1,74 @@
+/* Implementation of two-level bounding-volume hierarchy.
+ *
+ * * * * * * * * * * * *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Stephen Sorley
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * * * * * * * * * * * *
+ */
+#include <obvi/util/tlas.hpp>
+#include <obvi/util/compat_omp.hpp>
+
+using obvi::bboxf;
+using obvi::tlas;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Private methods.
+void tlas::set_instances(const std::vector<instance>& instances) {
+    insts.resize(instances.size());
+    world_boxes.resize(instances.size());
+
+#   pragma omp parallel for // loop idx must be 'int' for old OpenMP (v2.5) in Visual Studio.
+    for(int i=0; i<(int)instances.size(); ++i) {
+        const instance& src = instances[(size_t)i];
+        instance_data&  dst = insts[(size_t)i];
+
+        dst.blas          = src.blas;
+        dst.transform     = src.transform;
+        dst.inv_transform = src.transform.inv();
+
+        // Box of bottom-level tree, moved into world space. Empty if there's nothing in it.
+        world_boxes[(size_t)i] = (src.blas)? src.transform * src.blas->bounds() : bboxf();
+    }
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Public methods.
+bool tlas::generate(const std::vector<instance>& instances, bvh_build_type build_type) {
+    clear();
+
+    if(instances.size() > bvh::max_size) {
+        return false;
+    }
+
+    set_instances(instances);
+    return top.generate(world_boxes, builder, build_type);
+}
+
+bool tlas::update(const std::vector<instance>& instances, float rebuild_threshold) {
+    if(instances.size() != insts.size()) {
+        return false;
+    }
+
+    set_instances(instances);
+    return top.refit(world_boxes, rebuild_threshold);
+}